@@ -0,0 +1,43 @@
+#!/usr/bin/env bash
+# Build the relay and the peer image for nrf52_bsim and run the benchmark:
+# three sensors and one consumer around the relay, 80 s of simulated time.
+#
+# Needs ZEPHYR_BASE, BSIM_OUT_PATH and BSIM_COMPONENTS_PATH (see the Zephyr
+# BabbleSim setup guide). The report is printed by the "zwift" device.
+set -ue
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set}"
+: "${BSIM_COMPONENTS_PATH:?BSIM_COMPONENTS_PATH must be set}"
+
+bench_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+dongle_dir="$(cd "${bench_dir}/../.." && pwd)"
+build_dir="${BUILD_DIR:-${bench_dir}/build}"
+bin_dir="${BSIM_OUT_PATH}/bin"
+sim_id="relay_bench"
+board=nrf52_bsim
+
+west build -p auto -b "${board}" -d "${build_dir}/relay" "${dongle_dir}" -- \
+	-DEXTRA_CONF_FILE="${bench_dir}/relay.conf"
+west build -p auto -b "${board}" -d "${build_dir}/peer" "${bench_dir}"
+
+cp "${build_dir}/relay/zephyr/zephyr.exe" "${bin_dir}/bs_${board}_relay_bench_relay"
+cp "${build_dir}/peer/zephyr/zephyr.exe" "${bin_dir}/bs_${board}_relay_bench_peer"
+
+cd "${bin_dir}"
+
+./bs_${board}_relay_bench_relay -s=${sim_id} -d=0 -rs=1 &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=1 -rs=2 -testid=hr &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=2 -rs=3 -testid=cp &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=3 -rs=4 -testid=ftms &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=4 -rs=5 -testid=zwift &
+
+# Simulation length matches BENCH_SIM_LENGTH_US in src/bench.h
+./bs_2G4_phy_v1 -s=${sim_id} -D=5 -sim_length=80e6 &
+
+status=0
+for job in $(jobs -p); do
+	wait "${job}" || status=1
+done
+
+exit ${status}
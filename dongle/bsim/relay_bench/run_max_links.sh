@@ -0,0 +1,51 @@
+#!/usr/bin/env bash
+# Run the benchmark at full occupancy: the relay built with
+# overlay-max-links.conf, six sensors (HR, four power meters, trainer) and
+# two consumers, 80 s of simulated time.
+#
+# Needs ZEPHYR_BASE, BSIM_OUT_PATH and BSIM_COMPONENTS_PATH, as run_bench.sh.
+# Both "zwift_max" devices print a report and fail the run if a stream
+# falls below its offered rate or the HR ramp drops notifications.
+set -ue
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set}"
+: "${BSIM_COMPONENTS_PATH:?BSIM_COMPONENTS_PATH must be set}"
+
+bench_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+dongle_dir="$(cd "${bench_dir}/../.." && pwd)"
+build_dir="${BUILD_DIR:-${bench_dir}/build}"
+bin_dir="${BSIM_OUT_PATH}/bin"
+sim_id="relay_max_links"
+board=nrf52_bsim
+
+west build -p auto -b "${board}" -d "${build_dir}/relay_max_links" "${dongle_dir}" -- \
+	-DEXTRA_CONF_FILE="${bench_dir}/relay.conf;${dongle_dir}/overlay-max-links.conf"
+west build -p auto -b "${board}" -d "${build_dir}/peer" "${bench_dir}"
+
+cp "${build_dir}/relay_max_links/zephyr/zephyr.exe" "${bin_dir}/bs_${board}_relay_max_links_relay"
+cp "${build_dir}/peer/zephyr/zephyr.exe" "${bin_dir}/bs_${board}_relay_bench_peer"
+
+cd "${bin_dir}"
+
+# The sensor count per stream matches max_links_peers in src/zwift_central.c.
+# Only one HR strap, its sequence byte is how the consumers count drops.
+./bs_${board}_relay_max_links_relay -s=${sim_id} -d=0 -rs=21 &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=1 -rs=22 -testid=hr &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=2 -rs=23 -testid=cp &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=3 -rs=24 -testid=cp &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=4 -rs=25 -testid=cp &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=5 -rs=26 -testid=cp &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=6 -rs=27 -testid=ftms &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=7 -rs=28 -testid=zwift_max &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=8 -rs=29 -testid=zwift_max &
+
+# Simulation length matches BENCH_SIM_LENGTH_US in src/bench.h
+./bs_2G4_phy_v1 -s=${sim_id} -D=9 -sim_length=80e6 &
+
+status=0
+for job in $(jobs -p); do
+	wait "${job}" || status=1
+done
+
+exit ${status}
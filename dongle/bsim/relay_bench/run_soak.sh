@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+# Soak the relay firmware on nrf52_bsim: four hours of simulated sensor
+# dropouts, consumer reconnects and button presses, which takes minutes
+# of wall time. soak_check.py then judges the relay's audit records.
+#
+# Needs ZEPHYR_BASE, BSIM_OUT_PATH and BSIM_COMPONENTS_PATH, as run_bench.sh.
+set -ue
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set}"
+: "${BSIM_COMPONENTS_PATH:?BSIM_COMPONENTS_PATH must be set}"
+
+bench_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+dongle_dir="$(cd "${bench_dir}/../.." && pwd)"
+build_dir="${BUILD_DIR:-${bench_dir}/build}"
+bin_dir="${BSIM_OUT_PATH}/bin"
+sim_id="relay_soak"
+board=nrf52_bsim
+# Simulated length, BENCH_SOAK_SIM_LENGTH_US in src/bench.h
+sim_length_us=14410000000
+# sw0 of the nrf52_bsim board, active low
+button_pin=11
+
+west build -p auto -b "${board}" -d "${build_dir}/relay_soak" "${dongle_dir}" -- \
+	-DEXTRA_CONF_FILE="${bench_dir}/soak.conf"
+west build -p auto -b "${board}" -d "${build_dir}/peer" "${bench_dir}"
+
+cp "${build_dir}/relay_soak/zephyr/zephyr.exe" "${bin_dir}/bs_${board}_relay_soak_relay"
+cp "${build_dir}/peer/zephyr/zephyr.exe" "${bin_dir}/bs_${board}_relay_bench_peer"
+
+# Button script for the GPIO model, "<time us> <port> <pin> <level>": a
+# short press every 10 minutes (device list, flight recorder save) and a
+# long press every 70 minutes (disconnect all, forget devices, re-pair)
+gpio_in="${build_dir}/soak_button.txt"
+awk -v end="${sim_length_us}" -v pin="${button_pin}" 'BEGIN {
+	print 0, 0, pin, 1
+	for (min = 10; min * 60e6 < end - 600e6; min += 10) {
+		t = min * 60e6
+		hold = (min % 70 == 0) ? 3e6 : 0.2e6
+		printf "%.0f 0 %d 0\n%.0f 0 %d 1\n", t, pin, t + hold, pin
+	}
+}' > "${gpio_in}"
+
+relay_log="${build_dir}/soak_relay.log"
+
+cd "${bin_dir}"
+
+./bs_${board}_relay_soak_relay -s=${sim_id} -d=0 -rs=11 -gpio_in_file="${gpio_in}" \
+	> "${relay_log}" &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=1 -rs=12 -testid=hr_soak &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=2 -rs=13 -testid=cp_soak &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=3 -rs=14 -testid=ftms_soak &
+./bs_${board}_relay_bench_peer -s=${sim_id} -d=4 -rs=15 -testid=zwift_soak &
+
+./bs_2G4_phy_v1 -s=${sim_id} -D=5 -sim_length=${sim_length_us} &
+
+status=0
+for job in $(jobs -p); do
+	wait "${job}" || status=1
+done
+
+python3 "${bench_dir}/soak_check.py" "${relay_log}" --csv "${build_dir}/soak_audit.csv" || status=1
+
+exit ${status}
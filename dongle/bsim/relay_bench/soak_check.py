@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""
+Judge a relay soak run from its audit records.
+
+Reads the relay's console output (BabbleSim stdout or a serial capture),
+collects the "audit" JSON records and fails when:
+
+  - any slot or device table check failed (violations, stale_slots),
+  - connection objects leaked (conn_leaks), or the final audit has more
+    stack connection objects than sensor and consumer links,
+  - heap usage drifted upwards: the lowest usage over the last quarter of
+    the run exceeds the lowest over the second quarter by more than
+    --heap-slack bytes. Lows are compared because highs depend on what
+    happened to be connected at the moment of the audit,
+  - the final audit does not show every sensor and consumer linked again.
+"""
+import argparse
+import csv
+import json
+import sys
+
+FIELDS = ['ts', 'audits', 'violations', 'conn_leaks', 'stale_slots', 'bt_conns',
+          'sensors', 'consumers', 'devices', 'heap_used', 'heap_max']
+
+
+def load_audits(path):
+    audits = []
+    with open(path, encoding='utf-8', errors='replace') as f:
+        for line in f:
+            start = line.find('{"type":"audit"')
+            if start < 0:
+                continue
+            try:
+                audits.append(json.loads(line[start:]))
+            except ValueError:
+                continue
+    return audits
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('log', help='relay console output')
+    parser.add_argument('--sensors', type=int, default=3, help='sensors expected at the end')
+    parser.add_argument('--consumers', type=int, default=1, help='consumers expected at the end')
+    parser.add_argument('--heap-slack', type=int, default=64,
+                        help='allowed growth of the heap usage low (bytes)')
+    parser.add_argument('--csv', help='write the audit series to this file')
+    args = parser.parse_args()
+
+    audits = load_audits(args.log)
+    if len(audits) < 8:
+        print(f'FAIL: only {len(audits)} audit records in {args.log}')
+        return 1
+
+    if args.csv:
+        with open(args.csv, 'w', newline='') as f:
+            writer = csv.DictWriter(f, fieldnames=FIELDS, extrasaction='ignore')
+            writer.writeheader()
+            writer.writerows(audits)
+
+    last = audits[-1]
+    quarter = len(audits) // 4
+    early_low = min(a['heap_used'] for a in audits[quarter:2 * quarter])
+    late_low = min(a['heap_used'] for a in audits[-quarter:])
+    failures = []
+
+    for key in ('violations', 'conn_leaks', 'stale_slots'):
+        if last[key]:
+            failures.append(f'{key} = {last[key]}')
+    if last['bt_conns'] > last['sensors'] + last['consumers']:
+        failures.append(f"{last['bt_conns']} connection objects for "
+                        f"{last['sensors'] + last['consumers']} links")
+    if late_low > early_low + args.heap_slack:
+        failures.append(f'heap low grew {early_low} -> {late_low} bytes')
+    if last['sensors'] < args.sensors or last['consumers'] < args.consumers:
+        failures.append(f"final links {last['sensors']} sensors, "
+                        f"{last['consumers']} consumers")
+
+    hours = (last['ts'] - audits[0]['ts']) / 3600000
+    print(f"{len(audits)} audits over {hours:.1f} h: sensors "
+          f"{min(a['sensors'] for a in audits)}-{max(a['sensors'] for a in audits)}, "
+          f"devices up to {max(a['devices'] for a in audits)}, heap low "
+          f"{early_low} -> {late_low}, heap max {last['heap_max']} bytes")
+
+    for failure in failures:
+        print(f'FAIL: {failure}')
+    if not failures:
+        print('PASS')
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
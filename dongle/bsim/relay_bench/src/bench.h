@@ -0,0 +1,95 @@
+/* bench.h - Shared definitions for the BabbleSim relay benchmark peers */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/random/random.h>
+
+/* All simulated devices boot at simulated time 0 and the phy has no clock
+ * drift configured, so every device's uptime is the same clock. Sensors
+ * stamp their payloads with it and the consumer subtracts. */
+static inline uint32_t bench_now_us(void)
+{
+	return (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+/* Benchmark phases, simulated time */
+#define BENCH_SETUP_END_MS    30000  /* Relay paired with all sensors, consumer subscribed */
+#define BENCH_LATENCY_END_MS  50000  /* Steady 4 Hz from every sensor, control point round trips */
+#define BENCH_RAMP_STEP_MS     4000  /* HR rate steps, see bench_ramp_rates */
+#define BENCH_RAMP_STEPS          6
+#define BENCH_RAMP_END_MS     (BENCH_LATENCY_END_MS + BENCH_RAMP_STEPS * BENCH_RAMP_STEP_MS)
+#define BENCH_REPORT_MS       (BENCH_RAMP_END_MS + 2000)
+#define BENCH_SIM_LENGTH_US   ((BENCH_REPORT_MS + 4000) * 1000ULL)
+
+/* Soak run: hours of connection churn, then a quiet period in which
+ * everything must come back. Simulated time, see run_soak.sh. */
+#define BENCH_SOAK_MS             (4 * 3600 * 1000U)
+#define BENCH_SOAK_SETTLE_MS      (3 * 60 * 1000U)
+#define BENCH_SOAK_CHURN_END_MS   (BENCH_SOAK_MS - BENCH_SOAK_SETTLE_MS)
+#define BENCH_SOAK_CHECK_MS       30000  /* Final window in which every stream must flow */
+#define BENCH_SOAK_SIM_LENGTH_US  ((BENCH_SOAK_MS + 10000) * 1000ULL)
+
+#define BENCH_STEADY_HZ 4
+#define BENCH_CP_CMD_INTERVAL_MS 500
+
+/* Uniformly distributed duration for soak churn; bsim seeds the
+ * entropy source from -rs, so runs are repeatable */
+static inline uint32_t bench_rand_ms(uint32_t min_ms, uint32_t max_ms)
+{
+	return min_ms + sys_rand32_get() % (max_ms - min_ms + 1);
+}
+
+/* HR notification rate of each ramp step */
+static const uint16_t bench_ramp_rates[BENCH_RAMP_STEPS] = { 10, 20, 50, 100, 200, 400 };
+
+/* Ramp step at uptime ms, -1 outside the ramp */
+static inline int bench_ramp_step(uint32_t ms)
+{
+	if (ms < BENCH_LATENCY_END_MS || ms >= BENCH_RAMP_END_MS) {
+		return -1;
+	}
+	return (ms - BENCH_LATENCY_END_MS) / BENCH_RAMP_STEP_MS;
+}
+
+/* Payload layouts. The relay forwards HR and CP unchanged and rewrites
+ * only the power field of Indoor Bike Data, so the send timestamp travels
+ * in fields it does not touch.
+ *
+ * HR (6 bytes):   flags 0x10 (RR present) | seq u8 as bpm | ts as two RR u16
+ * CP (14 bytes):  flags 0x0030 | power | wheel revs u32 = ts | wheel time |
+ *                 crank revs | crank time
+ * IBD (12 bytes): flags 0x004e | speed | avg speed = ts low | cadence |
+ *                 avg cadence = ts high | power
+ */
+#define BENCH_HR_LEN  6
+#define BENCH_CP_LEN  14
+#define BENCH_IBD_LEN 12
+
+#define BENCH_CP_FLAGS  0x0030
+#define BENCH_IBD_FLAGS 0x004e
+
+static inline uint32_t bench_hr_ts(const uint8_t *p)
+{
+	return sys_get_le16(&p[2]) | ((uint32_t)sys_get_le16(&p[4]) << 16);
+}
+
+static inline uint32_t bench_cp_ts(const uint8_t *p)
+{
+	return sys_get_le32(&p[4]);
+}
+
+static inline uint32_t bench_ibd_ts(const uint8_t *p)
+{
+	return sys_get_le16(&p[4]) | ((uint32_t)sys_get_le16(&p[8]) << 16);
+}
+
+/* FTMS control point */
+#define BENCH_CP_REQUEST_CONTROL 0x00
+#define BENCH_CP_SET_SIM         0x11
+#define BENCH_CP_RESPONSE        0x80
+#define BENCH_CP_SUCCESS         0x01
+
+#endif /* BENCH_H_ */
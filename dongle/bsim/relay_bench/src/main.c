@@ -0,0 +1,19 @@
+/* main.c - BabbleSim relay benchmark peer image */
+
+#include "bstests.h"
+
+extern struct bst_test_list *sensor_peer_install(struct bst_test_list *tests);
+extern struct bst_test_list *zwift_central_install(struct bst_test_list *tests);
+
+/* Every simulated device except the relay runs this image; -testid picks the role */
+bst_test_install_t test_installers[] = {
+	sensor_peer_install,
+	zwift_central_install,
+	NULL
+};
+
+int main(void)
+{
+	bst_main();
+	return 0;
+}
@@ -0,0 +1,331 @@
+/* sensor_peer.c - Simulated HR strap, power pedal and FTMS trainer */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/byteorder.h>
+#include "bstests.h"
+#include "bs_tracing.h"
+#include "bench.h"
+
+enum peer_role {
+	PEER_HR,
+	PEER_CP,
+	PEER_FTMS,
+};
+
+static enum peer_role role;
+static struct bt_conn *peer_conn;
+static bool notify_enabled;
+static bool advertising;
+
+/* Soak churn: when the link drops next, and when advertising resumes */
+static uint32_t drop_at_ms = UINT32_MAX;
+static uint32_t readvertise_at_ms;
+static uint32_t dropouts;
+static bool cp_indicate_enabled;
+
+/* Notifications the stack accepted / refused for lack of buffers */
+static uint32_t sent;
+static uint32_t refused;
+/* Carried in the HR bpm byte so the central can count relay drops */
+static uint8_t hr_seq;
+
+static void ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
+{
+	notify_enabled = value == BT_GATT_CCC_NOTIFY;
+}
+
+static void cp_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
+{
+	cp_indicate_enabled = value == BT_GATT_CCC_INDICATE;
+}
+
+static struct bt_gatt_indicate_params cp_ind_params;
+static uint8_t cp_rsp[3];
+
+static ssize_t cp_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			const void *buf, uint16_t len, uint16_t offset, uint8_t flags);
+
+/* Only the role's service is registered, the relay discovers all three */
+static struct bt_gatt_attr hr_attrs[] = {
+	BT_GATT_PRIMARY_SERVICE(BT_UUID_HRS),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HRS_MEASUREMENT, BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+};
+
+static struct bt_gatt_attr cp_attrs[] = {
+	BT_GATT_PRIMARY_SERVICE(BT_UUID_CPS),
+	BT_GATT_CHARACTERISTIC(BT_UUID_CPS_CPM, BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+};
+
+static struct bt_gatt_attr ftms_attrs[] = {
+	BT_GATT_PRIMARY_SERVICE(BT_UUID_FMS),
+	BT_GATT_CHARACTERISTIC(BT_UUID_GATT_IBD, BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(BT_UUID_GATT_FMCP, BT_GATT_CHRC_WRITE | BT_GATT_CHRC_INDICATE,
+			       BT_GATT_PERM_WRITE, NULL, cp_write, NULL),
+	BT_GATT_CCC(cp_ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+};
+
+static struct bt_gatt_service hr_svc = BT_GATT_SERVICE(hr_attrs);
+static struct bt_gatt_service cp_svc = BT_GATT_SERVICE(cp_attrs);
+static struct bt_gatt_service ftms_svc = BT_GATT_SERVICE(ftms_attrs);
+
+static ssize_t cp_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+	const uint8_t *cmd = buf;
+
+	if (len < 1 || !cp_indicate_enabled) {
+		return BT_GATT_ERR(BT_ATT_ERR_CCC_IMPROPER_CONF);
+	}
+
+	/* Every command succeeds; the response goes out right after the write response */
+	cp_rsp[0] = BENCH_CP_RESPONSE;
+	cp_rsp[1] = cmd[0];
+	cp_rsp[2] = BENCH_CP_SUCCESS;
+
+	cp_ind_params.attr = &ftms_attrs[4];
+	cp_ind_params.data = cp_rsp;
+	cp_ind_params.len = sizeof(cp_rsp);
+	if (bt_gatt_indicate(conn, &cp_ind_params)) {
+		bs_trace_warning_time_line("FTMS peer: indication failed\n");
+	}
+
+	return len;
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	advertising = false;
+	if (!err) {
+		peer_conn = bt_conn_ref(conn);
+		drop_at_ms = k_uptime_get_32() + bench_rand_ms(20000, 180000);
+	}
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	if (conn == peer_conn) {
+		bt_conn_unref(peer_conn);
+		peer_conn = NULL;
+		notify_enabled = false;
+		if (reason != BT_HCI_ERR_LOCALHOST_TERM_CONN) {
+			bs_trace_warning_time_line("Peer disconnected (0x%02x)\n", reason);
+		}
+	}
+}
+
+BT_CONN_CB_DEFINE(peer_conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+static void notify(const struct bt_gatt_attr *attr, const void *data, uint16_t len)
+{
+	if (bt_gatt_notify(peer_conn, attr, data, len) == 0) {
+		sent++;
+		if (role == PEER_HR) {
+			hr_seq++;
+		}
+	} else {
+		refused++;
+	}
+}
+
+static void send_sample(void)
+{
+	uint32_t ts = bench_now_us();
+
+	switch (role) {
+	case PEER_HR: {
+		uint8_t p[BENCH_HR_LEN] = { 0x10, hr_seq };
+
+		sys_put_le16(ts & 0xffff, &p[2]);
+		sys_put_le16(ts >> 16, &p[4]);
+		notify(&hr_attrs[2], p, sizeof(p));
+		break;
+	}
+	case PEER_CP: {
+		uint8_t p[BENCH_CP_LEN];
+
+		sys_put_le16(BENCH_CP_FLAGS, &p[0]);
+		sys_put_le16(200, &p[2]);
+		sys_put_le32(ts, &p[4]);
+		sys_put_le16(0, &p[8]);
+		sys_put_le16(sent, &p[10]);            /* One crank revolution per sample */
+		sys_put_le16(sent * 256, &p[12]);      /* 250 ms in 1/1024 s */
+		notify(&cp_attrs[2], p, sizeof(p));
+		break;
+	}
+	case PEER_FTMS: {
+		uint8_t p[BENCH_IBD_LEN];
+
+		sys_put_le16(BENCH_IBD_FLAGS, &p[0]);
+		sys_put_le16(3000, &p[2]);             /* 30 km/h */
+		sys_put_le16(ts & 0xffff, &p[4]);
+		sys_put_le16(180, &p[6]);              /* 90 rpm */
+		sys_put_le16(ts >> 16, &p[8]);
+		sys_put_le16(180, &p[10]);
+		notify(&ftms_attrs[2], p, sizeof(p));
+		break;
+	}
+	}
+}
+
+static void advertise(const char *name, const struct bt_uuid_16 *uuid)
+{
+	uint8_t uuid_le[2];
+	int err;
+
+	sys_put_le16(uuid->val, uuid_le);
+
+	const struct bt_data ad[] = {
+		BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+		BT_DATA(BT_DATA_UUID16_ALL, uuid_le, sizeof(uuid_le)),
+		BT_DATA(BT_DATA_NAME_COMPLETE, name, strlen(name)),
+	};
+
+	err = bt_le_adv_start(BT_LE_ADV_CONN_FAST_1, ad, ARRAY_SIZE(ad), NULL, 0);
+	if (err) {
+		bs_trace_error_time_line("Advertising failed (err %d)\n", err);
+	}
+	advertising = true;
+}
+
+/* Soak: drop the link after a random connected time, stay away a random
+ * while (sensor out of range or asleep), then advertise again */
+static void soak_churn(const char *name, const struct bt_uuid_16 *uuid, uint32_t now)
+{
+	if (now < BENCH_SOAK_CHURN_END_MS && peer_conn && now >= drop_at_ms) {
+		bt_conn_disconnect(peer_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		drop_at_ms = UINT32_MAX;
+		readvertise_at_ms = now + bench_rand_ms(2000, 30000);
+		dropouts++;
+	}
+
+	if (!peer_conn && !advertising && now >= readvertise_at_ms) {
+		advertise(name, uuid);
+	}
+}
+
+static void peer_main(enum peer_role r, bool soak)
+{
+	static const char *const names[] = { "Bench HR", "Bench CP", "Bench Trainer" };
+	struct bt_gatt_service *svcs[] = { &hr_svc, &cp_svc, &ftms_svc };
+	const struct bt_uuid_16 *uuids[] = {
+		(const struct bt_uuid_16 *)BT_UUID_HRS,
+		(const struct bt_uuid_16 *)BT_UUID_CPS,
+		(const struct bt_uuid_16 *)BT_UUID_FMS,
+	};
+	int err;
+
+	role = r;
+
+	err = bt_enable(NULL);
+	if (err) {
+		bs_trace_error_time_line("Bluetooth init failed (err %d)\n", err);
+		return;
+	}
+
+	bt_gatt_service_register(svcs[role]);
+	advertise(names[role], uuids[role]);
+
+	while (k_uptime_get_32() < (soak ? BENCH_SOAK_MS : BENCH_REPORT_MS)) {
+		uint32_t now = k_uptime_get_32();
+		int step = bench_ramp_step(now);
+		uint32_t hz = BENCH_STEADY_HZ;
+
+		if (soak) {
+			soak_churn(names[role], uuids[role], now);
+		} else if (role == PEER_HR && step >= 0) {
+			hz = bench_ramp_rates[step];
+		}
+
+		if (peer_conn && notify_enabled) {
+			send_sample();
+		}
+
+		k_sleep(K_USEC(USEC_PER_SEC / hz));
+	}
+
+	bs_trace_raw_time(2, "%s: sent %u, refused %u, dropouts %u\n",
+			  names[role], sent, refused, dropouts);
+}
+
+static void hr_main(void)
+{
+	peer_main(PEER_HR, false);
+}
+
+static void cp_main(void)
+{
+	peer_main(PEER_CP, false);
+}
+
+static void ftms_main(void)
+{
+	peer_main(PEER_FTMS, false);
+}
+
+static void hr_soak_main(void)
+{
+	peer_main(PEER_HR, true);
+}
+
+static void cp_soak_main(void)
+{
+	peer_main(PEER_CP, true);
+}
+
+static void ftms_soak_main(void)
+{
+	peer_main(PEER_FTMS, true);
+}
+
+static const struct bst_test_instance sensor_peer_tests[] = {
+	{
+		.test_id = "hr",
+		.test_descr = "Heart rate strap, 4 Hz then the notification rate ramp",
+		.test_main_f = hr_main,
+	},
+	{
+		.test_id = "cp",
+		.test_descr = "Power meter, 4 Hz",
+		.test_main_f = cp_main,
+	},
+	{
+		.test_id = "ftms",
+		.test_descr = "FTMS trainer, 4 Hz, answers control point writes",
+		.test_main_f = ftms_main,
+	},
+	{
+		.test_id = "hr_soak",
+		.test_descr = "Heart rate strap, 4 Hz, random dropouts",
+		.test_main_f = hr_soak_main,
+	},
+	{
+		.test_id = "cp_soak",
+		.test_descr = "Power meter, 4 Hz, random dropouts",
+		.test_main_f = cp_soak_main,
+	},
+	{
+		.test_id = "ftms_soak",
+		.test_descr = "FTMS trainer, 4 Hz, random dropouts",
+		.test_main_f = ftms_soak_main,
+	},
+	BSTEST_END_MARKER
+};
+
+struct bst_test_list *sensor_peer_install(struct bst_test_list *tests)
+{
+	return bst_add_tests(tests, sensor_peer_tests);
+}
@@ -0,0 +1,579 @@
+/* zwift_central.c - Simulated consumer measuring relay latency and throughput */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/byteorder.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bstests.h"
+#include "bs_tracing.h"
+#include "bs_types.h"
+#include "bench.h"
+
+#define RELAY_NAME_PREFIX "Z-Relay"
+
+/* Latency samples kept per stream, 20 s at 4 Hz from four power meters
+ * (max-links run) plus slack */
+#define LAT_SAMPLES 384
+/* Forwarding budget for a 4 Hz stream; above this the run fails */
+#define LAT_P99_LIMIT_US 100000
+
+/* Max-links run: share of the offered steady rate every stream must
+ * deliver, HR ramp steps up to this rate must be forwarded, and the
+ * drops allowed in them */
+#define MAX_LINKS_MIN_RX_PCT   95
+#define MAX_LINKS_RAMP_HZ      100
+#define MAX_LINKS_MAX_DROP_PCT 1
+
+enum stream {
+	STREAM_HR,
+	STREAM_CP,
+	STREAM_IBD,
+	STREAM_CP_RTT,
+	STREAM_COUNT,
+};
+
+static const char *const stream_names[STREAM_COUNT] = { "hr", "cp", "ibd", "cp_rtt" };
+
+struct latency {
+	uint32_t us[LAT_SAMPLES];
+	uint16_t count;
+};
+
+struct ramp_step {
+	uint32_t rx;
+	uint32_t drops;
+};
+
+static struct latency lat[STREAM_COUNT];
+static struct ramp_step ramp[BENCH_RAMP_STEPS];
+static uint8_t hr_last_seq;
+static bool hr_seq_valid;
+
+/* Notifications received per stream, any phase */
+static uint32_t rx_count[STREAM_CP_RTT];
+/* Notifications received per stream in the steady phase */
+static uint32_t steady_rx[STREAM_CP_RTT];
+
+/* Sensors behind each stream in the max-links run, see run_max_links.sh */
+static const uint8_t max_links_peers[STREAM_CP_RTT] = { 1, 4, 1 };
+static bool max_links;
+
+static struct bt_conn *relay_conn;
+static bool soak;
+static K_SEM_DEFINE(connected_sem, 0, 1);
+static K_SEM_DEFINE(disconnected_sem, 0, 1);
+static K_SEM_DEFINE(discovered_sem, 0, 1);
+
+/* Characteristics the relay exposes that the benchmark uses */
+static const uint16_t chrc_uuids[] = { 0x2A37, 0x2A63, 0x2AD2, 0x2AD9 };
+static uint16_t chrc_handles[ARRAY_SIZE(chrc_uuids)];
+
+static struct bt_gatt_discover_params discover_params;
+static struct bt_gatt_subscribe_params sub_params[ARRAY_SIZE(chrc_uuids)];
+static struct bt_gatt_write_params cp_write_params;
+static uint8_t cp_cmd[7];
+static uint32_t cp_sent_us;
+static bool cp_pending;
+
+static void lat_add(enum stream s, uint32_t sent_us)
+{
+	struct latency *l = &lat[s];
+
+	if (l->count < LAT_SAMPLES) {
+		l->us[l->count++] = bench_now_us() - sent_us;
+	}
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t pct(const struct latency *l, int p)
+{
+	return l->us[MIN(l->count - 1, l->count * p / 100)];
+}
+
+static void on_hr(const uint8_t *data, uint16_t len, uint32_t ms)
+{
+	int step = bench_ramp_step(ms);
+
+	if (len < BENCH_HR_LEN) {
+		return;
+	}
+
+	if (ms >= BENCH_SETUP_END_MS && ms < BENCH_LATENCY_END_MS) {
+		lat_add(STREAM_HR, bench_hr_ts(data));
+	}
+
+	/* The sensor increments the bpm byte per notification it queued */
+	if (step >= 0) {
+		ramp[step].rx++;
+		if (hr_seq_valid) {
+			ramp[step].drops += (uint8_t)(data[1] - hr_last_seq - 1);
+		}
+	}
+	hr_last_seq = data[1];
+	hr_seq_valid = true;
+}
+
+static uint8_t notify_func(struct bt_conn *conn, struct bt_gatt_subscribe_params *params,
+			   const void *data, uint16_t length)
+{
+	uint32_t ms = k_uptime_get_32();
+	bool steady = ms >= BENCH_SETUP_END_MS && ms < BENCH_LATENCY_END_MS;
+	const uint8_t *p = data;
+
+	if (!data) {
+		params->value_handle = 0;
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (params == &sub_params[0]) {
+		rx_count[STREAM_HR]++;
+		steady_rx[STREAM_HR] += steady;
+		on_hr(p, length, ms);
+	} else if (params == &sub_params[1]) {
+		rx_count[STREAM_CP]++;
+		steady_rx[STREAM_CP] += steady;
+		if (steady && length >= BENCH_CP_LEN) {
+			lat_add(STREAM_CP, bench_cp_ts(p));
+		}
+	} else if (params == &sub_params[2]) {
+		rx_count[STREAM_IBD]++;
+		steady_rx[STREAM_IBD] += steady;
+		if (steady && length >= BENCH_IBD_LEN) {
+			lat_add(STREAM_IBD, bench_ibd_ts(p));
+		}
+	} else if (params == &sub_params[3]) {
+		if (cp_pending && length >= 3 && p[0] == BENCH_CP_RESPONSE) {
+			cp_pending = false;
+			lat_add(STREAM_CP_RTT, cp_sent_us);
+		}
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+static uint8_t discover_func(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			     struct bt_gatt_discover_params *params)
+{
+	const struct bt_gatt_chrc *chrc;
+
+	if (!attr) {
+		k_sem_give(&discovered_sem);
+		return BT_GATT_ITER_STOP;
+	}
+
+	chrc = attr->user_data;
+	if (chrc->uuid->type != BT_UUID_TYPE_16) {
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(chrc_uuids); i++) {
+		if (BT_UUID_16(chrc->uuid)->val == chrc_uuids[i] && !chrc_handles[i]) {
+			chrc_handles[i] = chrc->value_handle;
+		}
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+static int subscribe_all(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(chrc_uuids); i++) {
+		int err;
+
+		if (!chrc_handles[i]) {
+			bs_trace_error_time_line("Relay does not expose 0x%04x\n", chrc_uuids[i]);
+			return -ENOENT;
+		}
+
+		/* The relay's CCC descriptor directly follows each value */
+		sub_params[i].notify = notify_func;
+		sub_params[i].value_handle = chrc_handles[i];
+		sub_params[i].ccc_handle = chrc_handles[i] + 1;
+		sub_params[i].value = chrc_uuids[i] == 0x2AD9 ? BT_GATT_CCC_INDICATE
+							      : BT_GATT_CCC_NOTIFY;
+		err = bt_gatt_subscribe(relay_conn, &sub_params[i]);
+		if (err) {
+			bs_trace_error_time_line("Subscribe 0x%04x failed (err %d)\n",
+						 chrc_uuids[i], err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static void cp_write_cb(struct bt_conn *conn, uint8_t err, struct bt_gatt_write_params *params)
+{
+	if (err) {
+		cp_pending = false;
+		bs_trace_warning_time_line("Control point write failed (0x%02x)\n", err);
+	}
+}
+
+static void send_cp_command(uint16_t grade)
+{
+	/* Set Indoor Bike Simulation: wind, grade, crr, cw */
+	cp_cmd[0] = BENCH_CP_SET_SIM;
+	sys_put_le16(0, &cp_cmd[1]);
+	sys_put_le16(grade, &cp_cmd[3]);
+	cp_cmd[5] = 40;
+	cp_cmd[6] = 51;
+
+	cp_write_params.func = cp_write_cb;
+	cp_write_params.handle = chrc_handles[3];
+	cp_write_params.data = cp_cmd;
+	cp_write_params.length = sizeof(cp_cmd);
+
+	cp_sent_us = bench_now_us();
+	cp_pending = bt_gatt_write(relay_conn, &cp_write_params) == 0;
+}
+
+static bool name_matches(struct bt_data *data, void *user_data)
+{
+	bool *match = user_data;
+
+	if ((data->type == BT_DATA_NAME_COMPLETE || data->type == BT_DATA_NAME_SHORTENED) &&
+	    data->data_len >= strlen(RELAY_NAME_PREFIX) &&
+	    memcmp(data->data, RELAY_NAME_PREFIX, strlen(RELAY_NAME_PREFIX)) == 0) {
+		*match = true;
+		return false;
+	}
+	return true;
+}
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
+			 struct net_buf_simple *ad)
+{
+	bool match = false;
+	int err;
+
+	if (relay_conn || type != BT_GAP_ADV_TYPE_ADV_IND) {
+		return;
+	}
+
+	bt_data_parse(ad, name_matches, &match);
+	if (!match) {
+		return;
+	}
+
+	bt_le_scan_stop();
+	err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT,
+				&relay_conn);
+	if (err) {
+		bs_trace_error_time_line("Connecting to relay failed (err %d)\n", err);
+	}
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	if (conn != relay_conn) {
+		return;
+	}
+	if (err) {
+		bt_conn_unref(relay_conn);
+		relay_conn = NULL;
+		if (!soak) {
+			bs_trace_error_time_line("Relay connection failed (0x%02x)\n", err);
+		}
+		return;
+	}
+	k_sem_give(&connected_sem);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	if (conn != relay_conn) {
+		return;
+	}
+	if (!soak) {
+		bs_trace_error_time_line("Relay disconnected (0x%02x)\n", reason);
+	}
+	bt_conn_unref(relay_conn);
+	relay_conn = NULL;
+	k_sem_give(&disconnected_sem);
+}
+
+BT_CONN_CB_DEFINE(zwift_conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+/* Scan for the relay, connect, discover and subscribe */
+static int connect_relay(k_timeout_t timeout)
+{
+	int err;
+
+	k_sem_reset(&connected_sem);
+	k_sem_reset(&disconnected_sem);
+	k_sem_reset(&discovered_sem);
+	memset(chrc_handles, 0, sizeof(chrc_handles));
+
+	err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+	if (err) {
+		bs_trace_error_time_line("Scanning failed (err %d)\n", err);
+		return err;
+	}
+
+	err = k_sem_take(&connected_sem, timeout);
+	if (err) {
+		bt_le_scan_stop();
+		return err;
+	}
+	bs_trace_raw_time(2, "Connected to relay\n");
+
+	discover_params.func = discover_func;
+	discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+	err = bt_gatt_discover(relay_conn, &discover_params);
+	if (err) {
+		bs_trace_error_time_line("Discovery failed (err %d)\n", err);
+		return err;
+	}
+	if (k_sem_take(&discovered_sem, K_SECONDS(10))) {
+		return -ETIMEDOUT;
+	}
+
+	cp_pending = false;
+	return subscribe_all();
+}
+
+static bool report(void)
+{
+	bool pass = true;
+
+	for (int s = 0; s < STREAM_COUNT; s++) {
+		struct latency *l = &lat[s];
+
+		if (l->count == 0) {
+			bs_trace_raw_time(2, "BENCH latency %-6s no samples\n", stream_names[s]);
+			pass = false;
+			continue;
+		}
+
+		qsort(l->us, l->count, sizeof(l->us[0]), cmp_u32);
+		bs_trace_raw_time(2, "BENCH latency %-6s n=%u p50=%u p90=%u p99=%u max=%u us\n",
+				  stream_names[s], l->count, pct(l, 50), pct(l, 90), pct(l, 99),
+				  l->us[l->count - 1]);
+
+		if (s != STREAM_CP_RTT && pct(l, 99) > LAT_P99_LIMIT_US) {
+			pass = false;
+		}
+	}
+
+	for (int i = 0; i < BENCH_RAMP_STEPS; i++) {
+		bs_trace_raw_time(2, "BENCH ramp %3u Hz rx=%u (%u/s) drops=%u\n",
+				  bench_ramp_rates[i], ramp[i].rx,
+				  ramp[i].rx * 1000 / BENCH_RAMP_STEP_MS, ramp[i].drops);
+	}
+
+	return pass;
+}
+
+/* Full occupancy: every stream keeps its offered rate with all links
+ * busy, and the HR ramp is forwarded without loss up to MAX_LINKS_RAMP_HZ.
+ * Drops are counted from the HR sequence, so notifications the sensor's
+ * own stack refused do not count against the relay. */
+static bool report_max_links(void)
+{
+	uint32_t steady_s = (BENCH_LATENCY_END_MS - BENCH_SETUP_END_MS) / 1000;
+	bool pass = true;
+
+	for (int s = 0; s < ARRAY_SIZE(steady_rx); s++) {
+		uint32_t offered = max_links_peers[s] * BENCH_STEADY_HZ * steady_s;
+
+		bs_trace_raw_time(2, "BENCH steady %-6s rx=%u of %u\n",
+				  stream_names[s], steady_rx[s], offered);
+		if (steady_rx[s] * 100 < offered * MAX_LINKS_MIN_RX_PCT) {
+			pass = false;
+		}
+	}
+
+	for (int i = 0; i < BENCH_RAMP_STEPS && bench_ramp_rates[i] <= MAX_LINKS_RAMP_HZ; i++) {
+		if (ramp[i].rx == 0 || ramp[i].drops * 100 > ramp[i].rx * MAX_LINKS_MAX_DROP_PCT) {
+			bs_trace_raw_time(2, "BENCH ramp %3u Hz over the drop limit\n",
+					  bench_ramp_rates[i]);
+			pass = false;
+		}
+	}
+
+	return pass;
+}
+
+static void zwift_central_main(void)
+{
+	int err;
+
+	err = bt_enable(NULL);
+	if (err) {
+		bs_trace_error_time_line("Bluetooth init failed (err %d)\n", err);
+		return;
+	}
+
+	err = connect_relay(K_FOREVER);
+	if (err) {
+		return;
+	}
+
+	/* Let the relay finish pairing with the sensors */
+	k_sleep(K_TIMEOUT_ABS_MS(BENCH_SETUP_END_MS));
+
+	for (uint16_t grade = 0; k_uptime_get_32() < BENCH_LATENCY_END_MS; grade += 10) {
+		if (!cp_pending) {
+			send_cp_command(grade % 1000);
+		}
+		k_sleep(K_MSEC(BENCH_CP_CMD_INTERVAL_MS));
+	}
+
+	k_sleep(K_TIMEOUT_ABS_MS(BENCH_REPORT_MS));
+
+	bool pass = report();
+
+	if (max_links) {
+		pass = report_max_links() && pass;
+	}
+
+	if (pass) {
+		bst_result = Passed;
+		bs_trace_raw_time(2, "BENCH PASSED\n");
+	} else {
+		bst_result = Failed;
+		bs_trace_raw_time(2, "BENCH FAILED\n");
+	}
+}
+
+/* Same run as "zwift", sharing the relay with a second consumer while
+ * all six sensor links are up */
+static void zwift_max_links_main(void)
+{
+	max_links = true;
+	zwift_central_main();
+}
+
+/* Connect for a random while, send control point commands, leave and
+ * come back, until the churn period ends. Then stay and check that the
+ * relay still forwards every stream. */
+static void zwift_soak_main(void)
+{
+	uint32_t sessions = 0;
+	uint32_t failed = 0;
+	int err;
+
+	soak = true;
+
+	err = bt_enable(NULL);
+	if (err) {
+		bs_trace_error_time_line("Bluetooth init failed (err %d)\n", err);
+		return;
+	}
+
+	while (k_uptime_get_32() < BENCH_SOAK_CHURN_END_MS) {
+		if (connect_relay(K_SECONDS(30))) {
+			failed++;
+			if (relay_conn) {
+				bt_conn_disconnect(relay_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+				k_sem_take(&disconnected_sem, K_SECONDS(10));
+			}
+			continue;
+		}
+		sessions++;
+
+		uint32_t leave = MIN(k_uptime_get_32() + bench_rand_ms(30000, 600000),
+				     BENCH_SOAK_CHURN_END_MS);
+
+		for (uint16_t grade = 0; relay_conn && k_uptime_get_32() < leave; grade += 10) {
+			if (!cp_pending) {
+				send_cp_command(grade % 1000);
+			}
+			k_sem_take(&disconnected_sem, K_SECONDS(2));
+		}
+
+		if (relay_conn) {
+			bt_conn_disconnect(relay_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+			k_sem_take(&disconnected_sem, K_SECONDS(10));
+		}
+		k_sleep(K_MSEC(bench_rand_ms(1000, 20000)));
+	}
+
+	bs_trace_raw_time(2, "SOAK %u sessions, %u failed connects\n", sessions, failed);
+
+	while (!relay_conn && k_uptime_get_32() < BENCH_SOAK_MS - BENCH_SOAK_CHECK_MS) {
+		connect_relay(K_SECONDS(30));
+	}
+
+	k_sleep(K_TIMEOUT_ABS_MS(BENCH_SOAK_MS - BENCH_SOAK_CHECK_MS));
+	memset(rx_count, 0, sizeof(rx_count));
+	k_sleep(K_TIMEOUT_ABS_MS(BENCH_SOAK_MS));
+
+	bool pass = relay_conn != NULL;
+
+	for (int s = 0; s < ARRAY_SIZE(rx_count); s++) {
+		bs_trace_raw_time(2, "SOAK final %-3s rx=%u\n", stream_names[s], rx_count[s]);
+		pass = pass && rx_count[s] > 0;
+	}
+
+	bst_result = pass ? Passed : Failed;
+	bs_trace_raw_time(2, "SOAK %s\n", pass ? "PASSED" : "FAILED");
+}
+
+static void zwift_soak_init(void)
+{
+	bst_ticker_set_next_tick_absolute(BENCH_SOAK_SIM_LENGTH_US);
+	bst_result = In_progress;
+}
+
+static void zwift_central_init(void)
+{
+	bst_ticker_set_next_tick_absolute(BENCH_SIM_LENGTH_US);
+	bst_result = In_progress;
+}
+
+static void zwift_central_tick(bs_time_t HW_device_time)
+{
+	if (bst_result != Passed) {
+		bst_result = Failed;
+		bs_trace_error_time_line("Benchmark did not finish\n");
+	}
+}
+
+static const struct bst_test_instance zwift_central_tests[] = {
+	{
+		.test_id = "zwift",
+		.test_descr = "Consumer: subscribes through the relay and measures it",
+		.test_post_init_f = zwift_central_init,
+		.test_tick_f = zwift_central_tick,
+		.test_main_f = zwift_central_main,
+	},
+	{
+		.test_id = "zwift_max",
+		.test_descr = "Consumer: as zwift, plus throughput and drop limits at full occupancy",
+		.test_post_init_f = zwift_central_init,
+		.test_tick_f = zwift_central_tick,
+		.test_main_f = zwift_max_links_main,
+	},
+	{
+		.test_id = "zwift_soak",
+		.test_descr = "Consumer: reconnects for hours, then checks every stream",
+		.test_post_init_f = zwift_soak_init,
+		.test_tick_f = zwift_central_tick,
+		.test_main_f = zwift_soak_main,
+	},
+	BSTEST_END_MARKER
+};
+
+struct bst_test_list *zwift_central_install(struct bst_test_list *tests)
+{
+	return bst_add_tests(tests, zwift_central_tests);
+}
@@ -0,0 +1,353 @@
+/* relay_codec_bench.c - ns/packet for each relay codec on the build host
+ *
+ * Usage: relay_codec_bench [-n iterations] [capture.btsnoop [hr=H] [cp=H] [ibd=H] [status=H] [cp_cmd=H]]
+ *
+ * Without a capture, representative payloads and synthetic worst cases
+ * (every optional field present, maximum length) are timed. A btsnoop file
+ * written by scripts/att_capture.py adds the captured notifications (and
+ * control point writes) for the given attribute handles.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "relay_codec.h"
+
+#define DEFAULT_ITERATIONS 2000000
+#define MAX_PAYLOADS 256
+#define MAX_PAYLOAD_LEN 32
+
+#define ATT_OP_WRITE_REQ 0x12
+#define ATT_OP_NOTIFY    0x1b
+
+struct payload {
+	uint8_t data[MAX_PAYLOAD_LEN];
+	size_t len;
+};
+
+struct payload_set {
+	const char *name;
+	struct payload p[MAX_PAYLOADS];
+	size_t count;
+};
+
+/* Keeps results observable so nothing is optimized away */
+static volatile uint32_t sink;
+
+static const struct rc_grade_map grade_map = { .offset = 120, .divisor = 20, .max = 100 };
+
+static void add(struct payload_set *set, const uint8_t *data, size_t len)
+{
+	if (set->count < MAX_PAYLOADS && len <= MAX_PAYLOAD_LEN) {
+		memcpy(set->p[set->count].data, data, len);
+		set->p[set->count].len = len;
+		set->count++;
+	}
+}
+
+#define ADD(set, ...) \
+	do { \
+		static const uint8_t _d[] = { __VA_ARGS__ }; \
+		add(set, _d, sizeof(_d)); \
+	} while (0)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef void (*bench_fn)(struct payload *p);
+
+static void bench_hr(struct payload *p)
+{
+	struct rc_hr hr;
+
+	if (rc_hr_decode(p->data, p->len, &hr) == 0) {
+		sink += hr.bpm;
+	}
+}
+
+static void bench_cp(struct payload *p)
+{
+	struct rc_cp cp;
+
+	if (rc_cp_decode(p->data, p->len, &cp) == 0) {
+		sink += cp.power + cp.crank_revs;
+	}
+}
+
+/* The relay's CP path: decode, cadence update, CSC encode */
+static void bench_cp_cadence_csc(struct payload *p)
+{
+	static struct rc_cadence cadence;
+	static uint32_t now_ms;
+	uint8_t csc[RC_CSC_CRANK_LEN];
+	struct rc_cp cp;
+
+	now_ms += 250;
+	if (rc_cp_decode(p->data, p->len, &cp) == 0 && cp.has_crank) {
+		rc_cadence_update(&cadence, cp.crank_revs, cp.crank_time, now_ms);
+		sink += rc_csc_crank_encode(csc, cadence.last_revs, cadence.last_time) + csc[1];
+	}
+}
+
+static void bench_ibd(struct payload *p)
+{
+	struct rc_ibd ibd;
+
+	if (rc_ibd_decode(p->data, p->len, &ibd) == 0) {
+		sink += ibd.speed + ibd.power;
+	}
+}
+
+/* The relay's FTMS path: decode, then replace power with the power meter's */
+static void bench_ibd_inject(struct payload *p)
+{
+	uint8_t out[MAX_PAYLOAD_LEN];
+	struct rc_ibd ibd;
+
+	memcpy(out, p->data, p->len);
+	if (rc_ibd_decode(out, p->len, &ibd) == 0) {
+		sink += rc_ibd_set_power(out, p->len, &ibd, 250);
+	}
+}
+
+static void bench_status(struct payload *p)
+{
+	struct rc_status st;
+
+	if (rc_status_decode(p->data, p->len, &st) == 0) {
+		sink += st.field + st.value;
+	}
+}
+
+static void bench_sim(struct payload *p)
+{
+	uint8_t out[RC_SIM_CONVERTED_LEN];
+	struct rc_sim sim;
+
+	if (rc_sim_to_resistance(p->data, p->len, &grade_map, out, &sim) > 0) {
+		sink += out[1];
+	}
+}
+
+/* The CSC path: wheel revolutions from the FTMS speed, then CSC encode */
+static void bench_ibd_wheel_csc(struct payload *p)
+{
+	static struct rc_wheel wheel;
+	uint8_t csc[RC_CSC_MAX_LEN];
+	struct rc_ibd ibd;
+
+	if (rc_ibd_decode(p->data, p->len, &ibd) == 0) {
+		rc_wheel_update(&wheel, ibd.speed, 250, 2105);
+		sink += rc_csc_encode(csc, &wheel, NULL) + csc[1];
+	}
+}
+
+static void bench_rsp_unconvert(struct payload *p)
+{
+	uint8_t rsp[MAX_PAYLOAD_LEN];
+
+	memcpy(rsp, p->data, p->len);
+	sink += rc_cp_response_unconvert(rsp, p->len);
+}
+
+static void run(const char *name, struct payload_set *set, bench_fn fn, long iterations)
+{
+	uint64_t start, elapsed;
+
+	if (set->count == 0) {
+		return;
+	}
+
+	/* Warm up caches and branch predictors */
+	for (size_t i = 0; i < set->count * 16; i++) {
+		fn(&set->p[i % set->count]);
+	}
+
+	start = now_ns();
+	for (long i = 0; i < iterations; i++) {
+		fn(&set->p[i % set->count]);
+	}
+	elapsed = now_ns() - start;
+
+	printf("%-28s %-10s %4zu payloads  %8.2f ns/packet\n", name, set->name, set->count,
+	       (double)elapsed / iterations);
+}
+
+/* Representative payloads, as sent by common sensors */
+static void typical_payloads(struct payload_set *hr, struct payload_set *cp, struct payload_set *ibd,
+			     struct payload_set *status, struct payload_set *cmd, struct payload_set *rsp)
+{
+	ADD(hr, 0x06, 72);                            /* UINT8, contact detected */
+	ADD(hr, 0x16, 148, 0x10, 0x03);               /* UINT8 with one RR interval */
+	ADD(cp, 0x20, 0x00, 0xc8, 0x00, 0x10, 0x00, 0x00, 0x40);  /* power + crank */
+	ADD(cp, 0x21, 0x00, 0xfa, 0x00, 0x64, 0x11, 0x00, 0x80, 0x01);
+	ADD(ibd, 0x44, 0x00, 0xc4, 0x09, 0xb4, 0x00, 0xc8, 0x00); /* speed, cadence, power */
+	ADD(ibd, 0x64, 0x00, 0xc4, 0x09, 0xb4, 0x00, 0x28, 0x00, 0xc8, 0x00);
+	ADD(status, 0x07, 40);                        /* target resistance */
+	ADD(status, 0x08, 0xc8, 0x00);                /* target power */
+	ADD(cmd, 0x11, 0x00, 0x00, 0xf4, 0x01, 0x28, 0x33); /* 5 % grade */
+	ADD(rsp, 0x80, 0x04, 0x01);
+}
+
+/* Every optional field present, maximum lengths */
+static void worst_case_payloads(struct payload_set *hr, struct payload_set *cp, struct payload_set *ibd,
+				struct payload_set *status, struct payload_set *cmd, struct payload_set *rsp)
+{
+	ADD(hr, 0x1f, 0xc8, 0x00, 0xff, 0xff, 0x10, 0x03, 0x10, 0x03, 0x10, 0x03, 0x10, 0x03,
+	    0x10, 0x03, 0x10, 0x03, 0x10, 0x03, 0x10, 0x03);
+	/* Balance, accumulated torque, wheel and crank revolutions */
+	ADD(cp, 0x35, 0x00, 0xe8, 0x03, 0x32, 0x10, 0x27, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+	    0xff, 0xff, 0xff, 0xff);
+	/* Speed, average speed, cadence, average cadence, distance, resistance, power */
+	ADD(ibd, 0x7e, 0x00, 0xc4, 0x09, 0xc4, 0x09, 0xb4, 0x00, 0xb4, 0x00, 0x10, 0x27, 0x00,
+	    0x28, 0x00, 0xe8, 0x03);
+	ADD(status, 0xff, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19);
+	ADD(cmd, 0x11, 0xff, 0x7f, 0xff, 0x7f, 0xff, 0xff);
+	ADD(rsp, 0x80, 0x04, 0x04);
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Collect ATT notifications and writes from a btsnoop (H4) capture */
+static int load_capture(const char *path, uint16_t hr_h, uint16_t cp_h, uint16_t ibd_h,
+			uint16_t status_h, uint16_t cmd_h, struct payload_set *hr,
+			struct payload_set *cp, struct payload_set *ibd,
+			struct payload_set *status, struct payload_set *cmd)
+{
+	uint8_t hdr[24], pkt[256];
+	FILE *f = fopen(path, "rb");
+
+	if (!f) {
+		return -errno;
+	}
+
+	if (fread(hdr, 1, 16, f) != 16 || memcmp(hdr, "btsnoop", 8) != 0) {
+		fclose(f);
+		return -EINVAL;
+	}
+
+	while (fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr)) {
+		uint32_t incl_len = get_be32(&hdr[4]);
+
+		if (incl_len > sizeof(pkt) || fread(pkt, 1, incl_len, f) != incl_len) {
+			break;
+		}
+
+		/* H4 type, ACL header (4), L2CAP header (4), ATT opcode and handle */
+		if (incl_len < 12 || pkt[0] != 0x02 || rc_get_le16(&pkt[7]) != 0x0004) {
+			continue;
+		}
+
+		uint8_t op = pkt[9];
+		uint16_t handle = rc_get_le16(&pkt[10]);
+		const uint8_t *value = &pkt[12];
+		size_t len = incl_len - 12;
+
+		if (op == ATT_OP_NOTIFY) {
+			if (handle == hr_h) {
+				add(hr, value, len);
+			} else if (handle == cp_h) {
+				add(cp, value, len);
+			} else if (handle == ibd_h) {
+				add(ibd, value, len);
+			} else if (handle == status_h) {
+				add(status, value, len);
+			}
+		} else if (op == ATT_OP_WRITE_REQ && handle == cmd_h) {
+			add(cmd, value, len);
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void run_all(struct payload_set *hr, struct payload_set *cp, struct payload_set *ibd,
+		    struct payload_set *status, struct payload_set *cmd, struct payload_set *rsp,
+		    long iterations)
+{
+	run("hr_decode", hr, bench_hr, iterations);
+	run("cp_decode", cp, bench_cp, iterations);
+	run("cp_decode+cadence+csc", cp, bench_cp_cadence_csc, iterations);
+	run("ibd_decode", ibd, bench_ibd, iterations);
+	run("ibd_decode+set_power", ibd, bench_ibd_inject, iterations);
+	run("ibd_decode+wheel+csc", ibd, bench_ibd_wheel_csc, iterations);
+	run("status_decode", status, bench_status, iterations);
+	run("sim_to_resistance", cmd, bench_sim, iterations);
+	run("cp_response_unconvert", rsp, bench_rsp_unconvert, iterations);
+}
+
+static struct payload_set sets[3][6];
+
+int main(int argc, char **argv)
+{
+	static const char *const names[] = { "typical", "worst", "captured" };
+	long iterations = DEFAULT_ITERATIONS;
+	const char *capture = NULL;
+	uint16_t handles[5] = { 0 };  /* hr, cp, ibd, status, cp_cmd */
+	static const char *const keys[] = { "hr=", "cp=", "ibd=", "status=", "cp_cmd=" };
+
+	for (int i = 1; i < argc; i++) {
+		bool matched = false;
+
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = strtol(argv[++i], NULL, 0);
+			continue;
+		}
+		for (int k = 0; k < 5; k++) {
+			if (strncmp(argv[i], keys[k], strlen(keys[k])) == 0) {
+				handles[k] = (uint16_t)strtoul(argv[i] + strlen(keys[k]), NULL, 0);
+				matched = true;
+			}
+		}
+		if (!matched) {
+			capture = argv[i];
+		}
+	}
+
+	if (iterations <= 0) {
+		fprintf(stderr, "iterations must be positive\n");
+		return 1;
+	}
+
+	for (int s = 0; s < 3; s++) {
+		for (int k = 0; k < 6; k++) {
+			sets[s][k].name = names[s];
+		}
+	}
+
+	typical_payloads(&sets[0][0], &sets[0][1], &sets[0][2], &sets[0][3], &sets[0][4], &sets[0][5]);
+	worst_case_payloads(&sets[1][0], &sets[1][1], &sets[1][2], &sets[1][3], &sets[1][4], &sets[1][5]);
+
+	if (capture) {
+		int err = load_capture(capture, handles[0], handles[1], handles[2], handles[3],
+				       handles[4], &sets[2][0], &sets[2][1], &sets[2][2],
+				       &sets[2][3], &sets[2][4]);
+
+		if (err) {
+			fprintf(stderr, "%s: cannot read capture (%s)\n", capture, strerror(-err));
+			return 1;
+		}
+		/* Responses come from the trainer's indications, reuse the typical ones */
+		sets[2][5] = sets[0][5];
+		sets[2][5].name = names[2];
+	}
+
+	printf("%ld iterations per codec\n", iterations);
+	for (int s = 0; s < (capture ? 3 : 2); s++) {
+		run_all(&sets[s][0], &sets[s][1], &sets[s][2], &sets[s][3], &sets[s][4], &sets[s][5],
+			iterations);
+	}
+
+	return sink == 0xdeadbeef;
+}
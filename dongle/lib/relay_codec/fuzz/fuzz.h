@@ -0,0 +1,22 @@
+/* fuzz.h - Shared helpers for the relay codec fuzz harnesses */
+
+#ifndef FUZZ_H_
+#define FUZZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Each harness is one LLVMFuzzerTestOneInput. With clang it links against
+ * libFuzzer, otherwise against fuzz_driver.c. */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/* A decoder broke its own contract: abort so the fuzzer keeps the input */
+#define FUZZ_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			abort(); \
+		} \
+	} while (0)
+
+#endif /* FUZZ_H_ */
@@ -0,0 +1,48 @@
+/* fuzz_cp.c - Cycling Power Measurement decoder, cadence and CSC encoding
+ *
+ * Input: one or more records of [len u8][dt_ms u8][payload], so a single
+ * input drives the cadence state through a sequence of samples.
+ */
+
+#include <string.h>
+#include "fuzz.h"
+#include "relay_codec.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct rc_cadence cadence;
+	uint32_t now_ms = 0;
+
+	memset(&cadence, 0, sizeof(cadence));
+
+	while (size >= 2) {
+		size_t len = data[0];
+		struct rc_cp cp;
+
+		now_ms += data[1] * 16U;
+		data += 2;
+		size -= 2;
+		if (len > size) {
+			len = size;
+		}
+
+		if (rc_cp_decode(data, len, &cp) == 0) {
+			uint8_t csc[RC_CSC_CRANK_LEN];
+
+			FUZZ_CHECK(len >= 4);
+			FUZZ_CHECK(!cp.has_balance || (cp.flags & RC_CP_FLAG_BALANCE));
+			FUZZ_CHECK(!cp.has_crank || len >= 8);
+
+			if (cp.has_crank) {
+				rc_cadence_update(&cadence, cp.crank_revs, cp.crank_time, now_ms);
+				FUZZ_CHECK(rc_csc_crank_encode(csc, cp.crank_revs, cp.crank_time) ==
+					   RC_CSC_CRANK_LEN);
+			}
+		}
+
+		data += len;
+		size -= len;
+	}
+
+	return 0;
+}
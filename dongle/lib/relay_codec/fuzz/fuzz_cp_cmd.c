@@ -0,0 +1,62 @@
+/* fuzz_cp_cmd.c - Consumer control point writes and trainer responses
+ *
+ * Input: [map u8 x3][write len u8][write][trainer response]. The grade map
+ * is drawn from the ranges relay_config accepts.
+ */
+
+#include <string.h>
+#include "fuzz.h"
+#include "relay_codec.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint8_t out[RC_SIM_CONVERTED_LEN];
+	struct rc_grade_map map;
+	struct rc_sim sim;
+	size_t cmd_len;
+	uint8_t *rsp;
+	int len;
+
+	if (size < 4) {
+		return 0;
+	}
+
+	/* grade_offset -2000..2000, grade_divisor 1..1000, resistance_max 0..100 */
+	map.offset = ((int32_t)data[0] - 128) * 16;
+	map.divisor = 1 + data[1] * 4;
+	map.max = data[2] % 101;
+	cmd_len = data[3];
+	data += 4;
+	size -= 4;
+	if (cmd_len > size) {
+		cmd_len = size;
+	}
+
+	len = rc_sim_to_resistance(data, cmd_len, &map, out, &sim);
+	if (len > 0) {
+		FUZZ_CHECK(len == RC_SIM_CONVERTED_LEN);
+		FUZZ_CHECK(sim.resistance >= 0 && sim.resistance <= map.max);
+		FUZZ_CHECK(out[0] == RC_FTMS_CP_SET_TARGET_RESISTANCE && out[1] == sim.resistance);
+	} else {
+		FUZZ_CHECK(cmd_len < 5 || data[0] != RC_FTMS_CP_SET_INDOOR_BIKE_SIM);
+	}
+
+	data += cmd_len;
+	size -= cmd_len;
+
+	rsp = malloc(size ? size : 1);
+	if (!rsp) {
+		return 0;
+	}
+	memcpy(rsp, data, size);
+
+	if (rc_cp_response_unconvert(rsp, size)) {
+		FUZZ_CHECK(rsp[1] == RC_FTMS_CP_SET_INDOOR_BIKE_SIM);
+		FUZZ_CHECK(memcmp(rsp + 2, data + 2, size - 2) == 0);
+	} else {
+		FUZZ_CHECK(memcmp(rsp, data, size) == 0);
+	}
+
+	free(rsp);
+	return 0;
+}
@@ -0,0 +1,223 @@
+/* fuzz_driver.c - Stand-in for libFuzzer when the compiler has none (gcc)
+ *
+ * Usage: fuzz_<target> [-runs=N] [-max_total_time=S] [-seed=N] [corpus_dir | file]...
+ *
+ * Takes the libFuzzer flags the README uses. -runs=0 replays the corpus
+ * once, as a regression run. Otherwise inputs are random mutations of the
+ * corpus (bit flips, byte stores, truncation, extension) with no coverage
+ * feedback. Either way it prints execs/s at the end. On a crash the input
+ * is written to crash-input in the working directory.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "fuzz.h"
+
+#define MAX_SEEDS 4096
+#define MAX_INPUT_LEN 64
+
+struct input {
+	uint8_t data[MAX_INPUT_LEN];
+	size_t len;
+};
+
+static struct input seeds[MAX_SEEDS];
+static size_t seed_count;
+
+/* The input under test, for the crash handler */
+static const uint8_t *current;
+static size_t current_len;
+
+void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+static void dump_current(void)
+{
+	int fd = open("crash-input", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd >= 0) {
+		if (write(fd, current, current_len) < 0) {
+			/* Nothing left to do on the way out */
+		}
+		close(fd);
+	}
+}
+
+static void on_signal(int sig)
+{
+	dump_current();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void add_file(const char *path)
+{
+	FILE *f;
+
+	if (seed_count == MAX_SEEDS) {
+		return;
+	}
+
+	f = fopen(path, "rb");
+	if (!f) {
+		return;
+	}
+	seeds[seed_count].len = fread(seeds[seed_count].data, 1, MAX_INPUT_LEN, f);
+	seed_count++;
+	fclose(f);
+}
+
+static void add_path(const char *path)
+{
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	char file[1024];
+
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "%s: not found\n", path);
+		return;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		add_file(path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (!dir) {
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+		add_file(file);
+	}
+	closedir(dir);
+}
+
+static void mutate(struct input *in)
+{
+	int n = 1 + rand() % 4;
+
+	while (n--) {
+		switch (rand() % 5) {
+		case 0:
+			if (in->len) {
+				in->data[rand() % in->len] ^= 1 << (rand() % 8);
+			}
+			break;
+		case 1:
+			if (in->len) {
+				in->data[rand() % in->len] = rand();
+			}
+			break;
+		case 2:
+			/* Interesting values for flag and length bytes */
+			if (in->len) {
+				static const uint8_t special[] = { 0x00, 0x01, 0x7f, 0x80, 0xff };
+
+				in->data[rand() % in->len] = special[rand() % sizeof(special)];
+			}
+			break;
+		case 3:
+			in->len = in->len ? rand() % in->len : 0;
+			break;
+		default:
+			if (in->len < MAX_INPUT_LEN) {
+				in->data[in->len++] = rand();
+			}
+			break;
+		}
+	}
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_one(const struct input *in)
+{
+	/* Exact-size heap copy so ASan sees any read past len */
+	uint8_t *buf = malloc(in->len ? in->len : 1);
+
+	if (!buf) {
+		return;
+	}
+	memcpy(buf, in->data, in->len);
+	current = buf;
+	current_len = in->len;
+	LLVMFuzzerTestOneInput(buf, in->len);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	long runs = -1;
+	double max_time = 10;
+	unsigned int seed = (unsigned int)time(NULL);
+	unsigned long execs = 0;
+	double start;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "-runs=", 6) == 0) {
+			runs = atol(argv[i] + 6);
+		} else if (strncmp(argv[i], "-max_total_time=", 16) == 0) {
+			max_time = atof(argv[i] + 16);
+		} else if (strncmp(argv[i], "-seed=", 6) == 0) {
+			seed = strtoul(argv[i] + 6, NULL, 0);
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, "Ignoring %s (libFuzzer only)\n", argv[i]);
+		} else {
+			add_path(argv[i]);
+		}
+	}
+
+	signal(SIGABRT, on_signal);
+	signal(SIGSEGV, on_signal);
+	if (__sanitizer_set_death_callback) {
+		__sanitizer_set_death_callback(dump_current);
+	}
+
+	if (seed_count == 0) {
+		/* Start from the empty input */
+		seed_count = 1;
+	}
+
+	start = now_s();
+
+	if (runs == 0) {
+		for (size_t i = 0; i < seed_count; i++) {
+			run_one(&seeds[i]);
+			execs++;
+		}
+	} else {
+		srand(seed);
+		while ((runs < 0 || (long)execs < runs) &&
+		       ((execs & 0xfff) || now_s() - start < max_time)) {
+			struct input in = seeds[rand() % seed_count];
+
+			mutate(&in);
+			run_one(&in);
+			execs++;
+		}
+	}
+
+	double elapsed = now_s() - start;
+
+	printf("%s: %lu execs over %zu seeds in %.1f s, %.0f execs/s (seed %u)\n",
+	       argv[0], execs, seed_count, elapsed, elapsed > 0 ? execs / elapsed : 0.0, seed);
+	return 0;
+}
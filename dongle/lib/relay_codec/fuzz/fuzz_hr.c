@@ -0,0 +1,16 @@
+/* fuzz_hr.c - Heart Rate Measurement decoder */
+
+#include "fuzz.h"
+#include "relay_codec.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct rc_hr hr;
+
+	if (rc_hr_decode(data, size, &hr) == 0) {
+		FUZZ_CHECK(size >= ((hr.flags & 0x01) ? 3 : 2));
+		FUZZ_CHECK((hr.flags & 0x01) || hr.bpm <= UINT8_MAX);
+	}
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+/* fuzz_ibd.c - Indoor Bike Data decoder and in-place power injection */
+
+#include <string.h>
+#include "fuzz.h"
+#include "relay_codec.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct rc_ibd ibd;
+	uint8_t *copy;
+
+	if (rc_ibd_decode(data, size, &ibd) != 0) {
+		return 0;
+	}
+
+	FUZZ_CHECK(size >= 2);
+	FUZZ_CHECK((ibd.power_offset >= 0) == !!(ibd.flags & RC_IBD_FLAG_POWER));
+	FUZZ_CHECK(!(ibd.present & RC_IBD_HAS_POWER) || (size_t)ibd.power_offset + 2 <= size);
+
+	/* Injection writes into the notification buffer, exact size so ASan
+	 * catches a write past the end */
+	copy = malloc(size);
+	if (!copy) {
+		return 0;
+	}
+	memcpy(copy, data, size);
+
+	if (rc_ibd_set_power(copy, size, &ibd, 250)) {
+		struct rc_ibd check;
+
+		FUZZ_CHECK(rc_ibd_decode(copy, size, &check) == 0);
+		FUZZ_CHECK(check.power == 250);
+	} else {
+		FUZZ_CHECK(memcmp(copy, data, size) == 0);
+	}
+
+	free(copy);
+	return 0;
+}
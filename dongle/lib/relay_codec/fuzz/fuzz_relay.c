@@ -0,0 +1,65 @@
+/* fuzz_relay.c - Copy of a notification into its relay buffer
+ *
+ * Input: [characteristic u8][notification]. The notification is copied
+ * into a buffer of that characteristic's relay size, allocated exactly so
+ * ASan catches a copy past the end. Indoor Bike Data then gets the power
+ * injection applied to the copy, as the relay does before notifying.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "fuzz.h"
+#include "relay_codec.h"
+
+static const size_t relay_len[] = {
+	RC_HR_RELAY_LEN,
+	RC_CP_RELAY_LEN,
+	RC_IBD_RELAY_LEN,
+	RC_STATUS_RELAY_LEN,
+};
+
+#define RELAY_IBD 2
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct rc_ibd ibd;
+	size_t kind, buf_size;
+	uint8_t *buf;
+	int len;
+
+	if (size < 1) {
+		return 0;
+	}
+
+	kind = data[0] % (sizeof(relay_len) / sizeof(relay_len[0]));
+	buf_size = relay_len[kind];
+	data++;
+	size--;
+
+	buf = malloc(buf_size);
+	if (!buf) {
+		return 0;
+	}
+
+	len = rc_relay_copy(buf, buf_size, data, size);
+	if (size > buf_size) {
+		FUZZ_CHECK(len == -EMSGSIZE);
+		free(buf);
+		return 0;
+	}
+
+	FUZZ_CHECK(len == (int)size);
+	FUZZ_CHECK(memcmp(buf, data, size) == 0);
+
+	if (kind == RELAY_IBD && rc_ibd_decode(data, size, &ibd) == 0 &&
+	    rc_ibd_set_power(buf, len, &ibd, 250)) {
+		/* Only the power field changes */
+		FUZZ_CHECK(rc_get_le16(&buf[ibd.power_offset]) == 250);
+		FUZZ_CHECK(memcmp(buf, data, ibd.power_offset) == 0);
+		FUZZ_CHECK(memcmp(buf + ibd.power_offset + 2, data + ibd.power_offset + 2,
+				  size - ibd.power_offset - 2) == 0);
+	}
+
+	free(buf);
+	return 0;
+}
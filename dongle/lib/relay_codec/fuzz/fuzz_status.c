@@ -0,0 +1,27 @@
+/* fuzz_status.c - Fitness Machine Status decoder */
+
+#include "fuzz.h"
+#include "relay_codec.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct rc_status st;
+	volatile uint8_t sum = 0;
+
+	if (rc_status_decode(data, size, &st) != 0) {
+		return 0;
+	}
+
+	if (st.field == RC_STATUS_RAW) {
+		FUZZ_CHECK(st.raw == &data[1] && st.raw_len == size - 1);
+		/* The telemetry line hex-dumps raw, touch every byte */
+		for (size_t i = 0; i < st.raw_len; i++) {
+			sum += st.raw[i];
+		}
+	} else {
+		FUZZ_CHECK(st.raw == NULL && st.raw_len == 0);
+		FUZZ_CHECK((st.field == RC_STATUS_NONE) == (rc_status_field_name(st.field) == NULL));
+	}
+
+	return 0;
+}
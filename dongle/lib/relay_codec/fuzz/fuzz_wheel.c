@@ -0,0 +1,46 @@
+/* fuzz_wheel.c - CSC wheel revolutions synthesized from FTMS speed
+ *
+ * Input: a sequence of [circumference_mm le16][speed le16][dt_ms le16]
+ * steps. The circumference is fuzzed as well, since wheel_mm can be
+ * changed at runtime, also while the trainer is stopped.
+ */
+
+#include <string.h>
+#include "fuzz.h"
+#include "relay_codec.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint8_t out[RC_CSC_MAX_LEN];
+	struct rc_wheel wheel;
+	struct rc_cadence crank;
+	size_t len;
+
+	memset(&wheel, 0, sizeof(wheel));
+	memset(&crank, 0, sizeof(crank));
+
+	for (; size >= 6; data += 6, size -= 6) {
+		uint16_t circumference = rc_get_le16(&data[0]);
+		uint16_t speed = rc_get_le16(&data[2]);
+		uint32_t dt_ms = rc_get_le16(&data[4]);
+		uint32_t revs = wheel.revs;
+
+		rc_wheel_update(&wheel, speed, dt_ms, circumference);
+
+		if (circumference != 0) {
+			FUZZ_CHECK(wheel.distance < (uint32_t)circumference * 360);
+		}
+		if (speed == 0) {
+			FUZZ_CHECK(wheel.revs == revs);
+		}
+
+		/* Crank data alternates so both CSC layouts are encoded */
+		crank.valid = (data[4] & 1) != 0;
+		len = rc_csc_encode(out, &wheel, &crank);
+		FUZZ_CHECK(len == (crank.valid ? RC_CSC_MAX_LEN : 7));
+		FUZZ_CHECK(rc_get_le16(&out[1]) == (uint16_t)wheel.revs);
+		FUZZ_CHECK(rc_get_le16(&out[5]) == wheel.event_time);
+	}
+
+	return 0;
+}
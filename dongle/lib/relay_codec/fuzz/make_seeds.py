@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""
+Build fuzz seed corpora from a Z-Relay serial capture.
+
+Re-encodes the hr, cp, ftms and sim JSON records and the control point
+response hex dumps of a capture (default: server/sample.json) into the
+payloads the relay decoded, one file per distinct input, in the layout
+each harness expects. The ftms speeds also drive the wheel harness, and
+the sensor payloads seed the relay buffer copy.
+"""
+import argparse
+import hashlib
+import json
+import os
+import re
+import struct
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_CAPTURE = os.path.join(HERE, '..', '..', '..', '..', 'server', 'sample.json')
+
+# Indoor Bike Data fields after Instantaneous Speed: (flag bit, length, JSON key)
+IBD_FIELDS = [
+    (1, 2, None),           # Average Speed
+    (2, 2, 'cadence'),
+    (3, 2, None),           # Average Cadence
+    (4, 3, None),           # Total Distance
+    (5, 2, 'resistance'),
+    (6, 2, 'power'),
+    (7, 2, None),           # Average Power
+    (8, 5, None),           # Expended Energy
+    (9, 1, None),           # Heart Rate
+    (10, 1, None),          # Metabolic Equivalent
+    (11, 2, None),          # Elapsed Time
+    (12, 2, None),          # Remaining Time
+]
+
+# Grade map bytes of fuzz_cp_cmd, close to the relay_config defaults:
+# offset (135 - 128) * 16 = 112, divisor 1 + 5 * 4 = 21, max 100
+CP_CMD_MAP = bytes([135, 5, 100])
+
+# Characteristic selector of fuzz_relay
+RELAY_HR, RELAY_CP, RELAY_IBD, RELAY_STATUS = range(4)
+
+# Wheel steps of fuzz_wheel: 700x25c circumference, csc_output's tick
+WHEEL_MM = 2105
+WHEEL_TICK_MS = 250
+
+RESPONSE_RE = re.compile(r'Trainer response \[\d+ bytes\]: ((?:[0-9a-f]{2} )+)')
+
+
+def hr_seed(rec):
+    bpm = rec.get('bpm', 0)
+    if bpm > 0xff:
+        return struct.pack('<BH', 0x01, bpm)
+    return struct.pack('<BB', 0x00, bpm)
+
+
+def cp_payload(rec):
+    flags = rec.get('flags', 0)
+    out = struct.pack('<Hh', flags, rec.get('power', 0))
+    if flags & 0x01:
+        out += struct.pack('<B', rec.get('balance', 0))
+    if flags & 0x04:
+        out += bytes(2)
+    if flags & 0x10:
+        out += bytes(6)
+    if flags & 0x20:
+        out += struct.pack('<HH', rec.get('crank_revs', 0), rec.get('crank_time', 0))
+    return out
+
+
+def ibd_seed(rec):
+    flags = rec.get('flags', 0)
+    out = struct.pack('<HH', flags, rec.get('speed', 0))
+    for bit, length, key in IBD_FIELDS:
+        if flags & (1 << bit):
+            value = rec.get(key, 0) if key else 0
+            out += (value & ((1 << (8 * length)) - 1)).to_bytes(length, 'little')
+    return out
+
+
+def wheel_step(speed, wheel_mm=WHEEL_MM):
+    return struct.pack('<HHH', wheel_mm, speed, WHEEL_TICK_MS)
+
+
+def sim_seed(rec, response):
+    cmd = struct.pack('<BhhBB', 0x11, rec.get('wind_speed', 0), rec.get('grade', 0),
+                      rec.get('crr', 40), rec.get('cw', 51))
+    return CP_CMD_MAP + bytes([len(cmd)]) + cmd + response
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', nargs='?', default=DEFAULT_CAPTURE,
+                        help='serial capture (default: server/sample.json)')
+    parser.add_argument('-o', '--out', default='corpus',
+                        help='output directory, one subdirectory per harness')
+    args = parser.parse_args()
+
+    corpora = {name: set() for name in ('hr', 'cp', 'ibd', 'status', 'cp_cmd', 'wheel',
+                                        'relay')}
+    cp_sequence = b''
+    wheel_sequence = b''
+
+    with open(args.capture, encoding='utf-8', errors='replace') as f:
+        for line in f:
+            m = RESPONSE_RE.search(line)
+            if m:
+                rsp = bytes.fromhex(m.group(1))
+                corpora['cp_cmd'].add(CP_CMD_MAP + b'\x00' + rsp)
+                # 0x80 responses double as unknown status op codes
+                corpora['status'].add(rsp)
+                corpora['relay'].add(bytes([RELAY_STATUS]) + rsp)
+                continue
+
+            if not line.startswith('{'):
+                continue
+            try:
+                rec = json.loads(line)
+            except ValueError:
+                continue
+
+            kind = rec.get('type')
+            if kind == 'hr':
+                corpora['hr'].add(hr_seed(rec))
+                corpora['relay'].add(bytes([RELAY_HR]) + hr_seed(rec))
+            elif kind == 'cp':
+                payload = cp_payload(rec)
+                corpora['cp'].add(bytes([len(payload), 62]) + payload)
+                corpora['relay'].add(bytes([RELAY_CP]) + payload)
+                # Consecutive samples exercise the cadence state
+                if len(cp_sequence) < 48:
+                    cp_sequence += bytes([len(payload), 62]) + payload
+            elif kind == 'ftms':
+                corpora['ibd'].add(ibd_seed(rec))
+                corpora['relay'].add(bytes([RELAY_IBD]) + ibd_seed(rec))
+                if len(wheel_sequence) < 96:
+                    wheel_sequence += wheel_step(rec.get('speed', 0))
+            elif kind == 'sim':
+                corpora['cp_cmd'].add(sim_seed(rec, bytes([0x80, 0x04, 0x01])))
+
+    if cp_sequence:
+        corpora['cp'].add(cp_sequence)
+    if wheel_sequence:
+        corpora['wheel'].add(wheel_sequence)
+    # Stop, shrink the wheel while stopped, then ride on
+    corpora['wheel'].add(wheel_step(3000) * 4 + wheel_step(0) + wheel_step(0, 100) +
+                         wheel_step(3000, 100))
+
+    # Status op codes the decoder knows, none appear in the sample capture
+    for op, params in ((0x05, b'\xe8\x03'), (0x06, b'\x64\x00'), (0x07, b'\x14'),
+                       (0x08, b'\xc8\x00'), (0x09, b'\x8c'), (0x83, b'\x02'),
+                       (0x04, b''), (0xff, b'\x01\x02\x03')):
+        corpora['status'].add(bytes([op]) + params)
+
+    for name, inputs in corpora.items():
+        path = os.path.join(args.out, name)
+        os.makedirs(path, exist_ok=True)
+        for data in inputs:
+            with open(os.path.join(path, hashlib.sha1(data).hexdigest()), 'wb') as out:
+                out.write(data)
+        print(f'{name}: {len(inputs)} seeds', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,186 @@
+/* relay_codec.h - Sensor payload decoders and FTMS rewriting, independent of Zephyr */
+
+#ifndef RELAY_CODEC_H_
+#define RELAY_CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Plain C so the same code runs in the firmware and in host benchmarks.
+ * Decoders return 0 or a negative errno and never read past len. */
+
+static inline uint16_t rc_get_le16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline void rc_put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+/* Heart Rate Measurement (0x2A37) */
+struct rc_hr {
+	uint8_t flags;
+	uint16_t bpm;
+};
+
+int rc_hr_decode(const uint8_t *data, size_t len, struct rc_hr *hr);
+
+/* Cycling Power Measurement (0x2A63) */
+#define RC_CP_FLAG_BALANCE 0x0001
+#define RC_CP_FLAG_CRANK   0x0020
+
+struct rc_cp {
+	uint16_t flags;
+	int16_t power;
+	bool has_balance;
+	bool has_crank;
+	uint8_t balance;
+	uint16_t crank_revs;
+	uint16_t crank_time;  /* 1/1024 s */
+};
+
+int rc_cp_decode(const uint8_t *data, size_t len, struct rc_cp *cp);
+
+/* Cadence from cumulative crank revolutions and sensor event time */
+#define RC_CADENCE_TIMEOUT_MS 4000
+
+struct rc_cadence {
+	uint16_t cadence;        /* 0.5 rpm, as in FTMS */
+	uint16_t last_revs;
+	uint16_t last_time;      /* 1/1024 s */
+	uint32_t last_change_ms; /* Local time of the last revolution */
+	bool valid;
+};
+
+/* Feed one crank sample; cadence drops to 0 after RC_CADENCE_TIMEOUT_MS
+ * without a revolution */
+void rc_cadence_update(struct rc_cadence *c, uint16_t revs, uint16_t time, uint32_t now_ms);
+
+/* CSC Measurement (0x2A5B) with crank data only, returns its length */
+#define RC_CSC_CRANK_LEN 5
+
+size_t rc_csc_crank_encode(uint8_t out[RC_CSC_CRANK_LEN], uint16_t revs, uint16_t time);
+
+/* Cumulative wheel revolutions synthesized from a speed, for CSC */
+struct rc_wheel {
+	uint32_t revs;
+	uint16_t event_time;  /* 1/1024 s, time of the last revolution */
+	uint32_t elapsed_ms;  /* Time integrated so far */
+	uint32_t distance;    /* Since the last revolution, 1/360 mm */
+};
+
+/* Advance by dt_ms at speed (0.01 km/h) on a wheel of circumference_mm.
+ * The event time is interpolated to when the last revolution completed.
+ * The circumference may change between calls, also while stopped. */
+void rc_wheel_update(struct rc_wheel *w, uint16_t speed, uint32_t dt_ms,
+		     uint16_t circumference_mm);
+
+/* CSC Measurement (0x2A5B) with wheel and/or crank data, either may be
+ * NULL; crank data is left out unless crank->valid. Returns its length. */
+#define RC_CSC_MAX_LEN 11
+
+size_t rc_csc_encode(uint8_t out[RC_CSC_MAX_LEN], const struct rc_wheel *wheel,
+		     const struct rc_cadence *crank);
+
+/* FTMS Indoor Bike Data (0x2AD2) */
+#define RC_IBD_FLAG_AVG_SPEED   0x0002
+#define RC_IBD_FLAG_CADENCE     0x0004
+#define RC_IBD_FLAG_AVG_CADENCE 0x0008
+#define RC_IBD_FLAG_DISTANCE    0x0010
+#define RC_IBD_FLAG_RESISTANCE  0x0020
+#define RC_IBD_FLAG_POWER       0x0040
+
+/* Fields present and complete in the payload */
+#define RC_IBD_HAS_SPEED      0x01
+#define RC_IBD_HAS_CADENCE    0x02
+#define RC_IBD_HAS_RESISTANCE 0x04
+#define RC_IBD_HAS_POWER      0x08
+
+struct rc_ibd {
+	uint16_t flags;
+	uint8_t present;
+	uint16_t speed;       /* 0.01 km/h */
+	uint16_t cadence;     /* 0.5 rpm */
+	int16_t resistance;
+	int16_t power;        /* W */
+	int8_t power_offset;  /* -1 when the flags announce no power field */
+};
+
+int rc_ibd_decode(const uint8_t *data, size_t len, struct rc_ibd *ibd);
+
+/* Overwrite the power field in place; false when the payload has none */
+bool rc_ibd_set_power(uint8_t *data, size_t len, const struct rc_ibd *ibd, int16_t power);
+
+/* FTMS Fitness Machine Status (0x2ADA) */
+enum rc_status_field {
+	RC_STATUS_NONE = 0,
+	RC_STATUS_SPEED,
+	RC_STATUS_INCLINE,
+	RC_STATUS_RESISTANCE,
+	RC_STATUS_TARGET_POWER,
+	RC_STATUS_TARGET_HR,
+	RC_STATUS_TEMP,
+	RC_STATUS_RAW,  /* Unknown op code, parameters in raw/raw_len */
+};
+
+struct rc_status {
+	uint8_t op_code;
+	uint8_t field;  /* enum rc_status_field */
+	int32_t value;
+	const uint8_t *raw;
+	size_t raw_len;
+};
+
+int rc_status_decode(const uint8_t *data, size_t len, struct rc_status *st);
+
+/* JSON key of a status field, NULL for NONE and RAW */
+const char *rc_status_field_name(enum rc_status_field field);
+
+/* FTMS Control Point op codes used by the rewrite */
+#define RC_FTMS_CP_SET_TARGET_RESISTANCE 0x04
+#define RC_FTMS_CP_SET_INDOOR_BIKE_SIM   0x11
+#define RC_FTMS_CP_RESPONSE_CODE         0x80
+
+/* Grade (0.01 %) to resistance: (grade + offset) / divisor, clamped to 0..max.
+ * offset must stay far from the int32 limits; relay_config allows +-2000. */
+struct rc_grade_map {
+	int32_t offset;
+	int32_t divisor;
+	int32_t max;
+};
+
+int16_t rc_grade_resistance(int16_t grade, const struct rc_grade_map *map);
+
+struct rc_sim {
+	int16_t wind_speed;  /* 0.001 m/s */
+	int16_t grade;       /* 0.01 % */
+	int16_t resistance;
+};
+
+/* Rewrite Set Indoor Bike Simulation (0x11) as Set Target Resistance (0x04).
+ * Returns the length of the command in out, or -EINVAL when cmd is not a
+ * complete simulation command. */
+#define RC_SIM_CONVERTED_LEN 2
+
+int rc_sim_to_resistance(const uint8_t *cmd, size_t len, const struct rc_grade_map *map,
+			 uint8_t out[RC_SIM_CONVERTED_LEN], struct rc_sim *sim);
+
+/* Turn the trainer's response to 0x04 back into a response to 0x11.
+ * Returns true if the response was rewritten. */
+bool rc_cp_response_unconvert(uint8_t *rsp, size_t len);
+
+/* Relayed notifications are copied into one fixed buffer per characteristic,
+ * with a length chosen by the sensor. Returns the length copied, or
+ * -EMSGSIZE without copying when the payload does not fit. */
+#define RC_HR_RELAY_LEN     20
+#define RC_CP_RELAY_LEN     34
+#define RC_IBD_RELAY_LEN    64
+#define RC_STATUS_RELAY_LEN 20  /* Training and Machine Status */
+
+int rc_relay_copy(uint8_t *dst, size_t dst_size, const uint8_t *data, size_t len);
+
+#endif /* RELAY_CODEC_H_ */
@@ -0,0 +1,363 @@
+/* relay_codec.c - Sensor payload decoders and FTMS rewriting, independent of Zephyr */
+
+#include <errno.h>
+#include <string.h>
+#include "relay_codec.h"
+
+/* Cycling Power fields ahead of the crank revolution data */
+#define CP_FLAG_ACC_TORQUE 0x0004
+#define CP_FLAG_WHEEL      0x0010
+#define CP_ACC_TORQUE_LEN  2
+#define CP_WHEEL_LEN       6
+
+/* rpm = revs / (time / 1024) * 60, cadence in 0.5 rpm: revs * 122880 / time */
+#define CADENCE_SCALE 122880UL
+
+int rc_hr_decode(const uint8_t *data, size_t len, struct rc_hr *hr)
+{
+	if (len < 2) {
+		return -EINVAL;
+	}
+
+	hr->flags = data[0];
+	if (hr->flags & 0x01) {
+		/* UINT16 format */
+		if (len < 3) {
+			return -EINVAL;
+		}
+		hr->bpm = rc_get_le16(&data[1]);
+	} else {
+		hr->bpm = data[1];
+	}
+
+	return 0;
+}
+
+int rc_cp_decode(const uint8_t *data, size_t len, struct rc_cp *cp)
+{
+	size_t offset = 4;
+
+	if (len < 4) {
+		return -EINVAL;
+	}
+
+	cp->flags = rc_get_le16(&data[0]);
+	cp->power = (int16_t)rc_get_le16(&data[2]);
+	cp->has_balance = false;
+	cp->has_crank = false;
+
+	if (cp->flags & RC_CP_FLAG_BALANCE) {
+		if (len > offset) {
+			cp->balance = data[offset];
+			cp->has_balance = true;
+		}
+		offset++;
+	}
+
+	if (cp->flags & CP_FLAG_ACC_TORQUE) {
+		offset += CP_ACC_TORQUE_LEN;
+	}
+
+	if (cp->flags & CP_FLAG_WHEEL) {
+		offset += CP_WHEEL_LEN;
+	}
+
+	if ((cp->flags & RC_CP_FLAG_CRANK) && len >= offset + 4) {
+		cp->crank_revs = rc_get_le16(&data[offset]);
+		cp->crank_time = rc_get_le16(&data[offset + 2]);
+		cp->has_crank = true;
+	}
+
+	return 0;
+}
+
+void rc_cadence_update(struct rc_cadence *c, uint16_t revs, uint16_t time, uint32_t now_ms)
+{
+	if (!c->valid) {
+		/* First crank sample, nothing to compare against */
+		c->last_change_ms = now_ms;
+	} else {
+		/* Both counters wrap at 16 bits */
+		uint16_t rev_delta = (uint16_t)(revs - c->last_revs);
+		uint16_t time_delta = (uint16_t)(time - c->last_time);
+
+		if (rev_delta > 0) {
+			if (time_delta > 0) {
+				uint32_t cadence = (rev_delta * CADENCE_SCALE) / time_delta;
+
+				c->cadence = (uint16_t)(cadence > UINT16_MAX ? UINT16_MAX : cadence);
+			}
+			c->last_change_ms = now_ms;
+		} else if (now_ms - c->last_change_ms >= RC_CADENCE_TIMEOUT_MS) {
+			c->cadence = 0;
+		}
+	}
+
+	c->last_revs = revs;
+	c->last_time = time;
+	c->valid = true;
+}
+
+size_t rc_csc_crank_encode(uint8_t out[RC_CSC_CRANK_LEN], uint16_t revs, uint16_t time)
+{
+	out[0] = 0x02;  /* Crank Revolution Data Present */
+	rc_put_le16(&out[1], revs);
+	rc_put_le16(&out[3], time);
+
+	return RC_CSC_CRANK_LEN;
+}
+
+void rc_wheel_update(struct rc_wheel *w, uint16_t speed, uint32_t dt_ms,
+		     uint16_t circumference_mm)
+{
+	/* 0.01 km/h for 1 ms is 1/360 mm, so distance stays exact */
+	uint64_t distance = w->distance + (uint64_t)speed * dt_ms;
+	uint32_t per_rev = (uint32_t)circumference_mm * 360;
+
+	w->elapsed_ms += dt_ms;
+
+	if (per_rev == 0 || distance < per_rev) {
+		w->distance = (uint32_t)distance;
+		return;
+	}
+
+	if (speed == 0) {
+		/* The circumference shrank while stopped: there is no time to
+		 * place a revolution at, so complete it once the wheel turns */
+		w->distance = per_rev - 1;
+		return;
+	}
+
+	w->revs += (uint32_t)(distance / per_rev);
+	w->distance = (uint32_t)(distance % per_rev);
+
+	/* The remainder is what was covered since the revolution */
+	uint32_t event_ms = w->elapsed_ms - w->distance / speed;
+
+	w->event_time = (uint16_t)((uint64_t)event_ms * 1024 / 1000);
+}
+
+size_t rc_csc_encode(uint8_t out[RC_CSC_MAX_LEN], const struct rc_wheel *wheel,
+		     const struct rc_cadence *crank)
+{
+	size_t len = 1;
+
+	out[0] = 0;
+
+	if (wheel) {
+		out[0] |= 0x01;  /* Wheel Revolution Data Present */
+		rc_put_le16(&out[len], (uint16_t)wheel->revs);
+		rc_put_le16(&out[len + 2], (uint16_t)(wheel->revs >> 16));
+		rc_put_le16(&out[len + 4], wheel->event_time);
+		len += 6;
+	}
+
+	if (crank && crank->valid) {
+		out[0] |= 0x02;  /* Crank Revolution Data Present */
+		rc_put_le16(&out[len], crank->last_revs);
+		rc_put_le16(&out[len + 2], crank->last_time);
+		len += 4;
+	}
+
+	return len;
+}
+
+int rc_ibd_decode(const uint8_t *data, size_t len, struct rc_ibd *ibd)
+{
+	size_t offset = 2;
+
+	if (len < 2) {
+		return -EINVAL;
+	}
+
+	memset(ibd, 0, sizeof(*ibd));
+	ibd->flags = rc_get_le16(&data[0]);
+	ibd->power_offset = -1;
+
+	/* Instantaneous Speed */
+	if (len >= offset + 2) {
+		ibd->speed = rc_get_le16(&data[offset]);
+		ibd->present |= RC_IBD_HAS_SPEED;
+	}
+	offset += 2;
+
+	if (ibd->flags & RC_IBD_FLAG_AVG_SPEED) {
+		offset += 2;
+	}
+
+	if (ibd->flags & RC_IBD_FLAG_CADENCE) {
+		if (len >= offset + 2) {
+			ibd->cadence = rc_get_le16(&data[offset]);
+			ibd->present |= RC_IBD_HAS_CADENCE;
+		}
+		offset += 2;
+	}
+
+	if (ibd->flags & RC_IBD_FLAG_AVG_CADENCE) {
+		offset += 2;
+	}
+
+	if (ibd->flags & RC_IBD_FLAG_DISTANCE) {
+		offset += 3;
+	}
+
+	if (ibd->flags & RC_IBD_FLAG_RESISTANCE) {
+		if (len >= offset + 2) {
+			ibd->resistance = (int16_t)rc_get_le16(&data[offset]);
+			ibd->present |= RC_IBD_HAS_RESISTANCE;
+		}
+		offset += 2;
+	}
+
+	if (ibd->flags & RC_IBD_FLAG_POWER) {
+		ibd->power_offset = (int8_t)offset;
+		if (len >= offset + 2) {
+			ibd->power = (int16_t)rc_get_le16(&data[offset]);
+			ibd->present |= RC_IBD_HAS_POWER;
+		}
+	}
+
+	return 0;
+}
+
+bool rc_ibd_set_power(uint8_t *data, size_t len, const struct rc_ibd *ibd, int16_t power)
+{
+	/* Only an existing field is replaced, inserting one would shift the rest */
+	if (ibd->power_offset < 0 || (size_t)ibd->power_offset + 2 > len) {
+		return false;
+	}
+
+	rc_put_le16(&data[ibd->power_offset], (uint16_t)power);
+	return true;
+}
+
+int rc_status_decode(const uint8_t *data, size_t len, struct rc_status *st)
+{
+	if (len < 1) {
+		return -EINVAL;
+	}
+
+	st->op_code = data[0];
+	st->field = RC_STATUS_NONE;
+	st->value = 0;
+	st->raw = NULL;
+	st->raw_len = 0;
+
+	switch (st->op_code) {
+	case 0x05:
+		if (len >= 3) {
+			st->field = RC_STATUS_SPEED;
+			st->value = rc_get_le16(&data[1]);
+		}
+		break;
+	case 0x06:
+		if (len >= 3) {
+			st->field = RC_STATUS_INCLINE;
+			st->value = (int16_t)rc_get_le16(&data[1]);
+		}
+		break;
+	case 0x07:
+		if (len >= 2) {
+			st->field = RC_STATUS_RESISTANCE;
+			st->value = (int8_t)data[1];
+		}
+		break;
+	case 0x08:
+		if (len >= 3) {
+			st->field = RC_STATUS_TARGET_POWER;
+			st->value = (int16_t)rc_get_le16(&data[1]);
+		}
+		break;
+	case 0x09:
+		if (len >= 2) {
+			st->field = RC_STATUS_TARGET_HR;
+			st->value = data[1];
+		}
+		break;
+	case 0x83:
+	case 0x84:
+		if (len >= 2) {
+			st->field = RC_STATUS_TEMP;
+			st->value = data[1];
+		}
+		break;
+	default:
+		if (len > 1) {
+			st->field = RC_STATUS_RAW;
+			st->raw = &data[1];
+			st->raw_len = len - 1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+const char *rc_status_field_name(enum rc_status_field field)
+{
+	switch (field) {
+	case RC_STATUS_SPEED:        return "speed";
+	case RC_STATUS_INCLINE:      return "incline";
+	case RC_STATUS_RESISTANCE:   return "resistance";
+	case RC_STATUS_TARGET_POWER: return "target_power";
+	case RC_STATUS_TARGET_HR:    return "target_hr";
+	case RC_STATUS_TEMP:         return "temp";
+	default:                     return NULL;
+	}
+}
+
+int16_t rc_grade_resistance(int16_t grade, const struct rc_grade_map *map)
+{
+	int32_t resistance;
+
+	if (map->divisor <= 0) {
+		return 0;
+	}
+
+	resistance = ((int32_t)grade + map->offset) / map->divisor;
+	if (resistance < 0) {
+		resistance = 0;
+	} else if (resistance > map->max) {
+		resistance = map->max;
+	}
+
+	return (int16_t)resistance;
+}
+
+int rc_sim_to_resistance(const uint8_t *cmd, size_t len, const struct rc_grade_map *map,
+			 uint8_t out[RC_SIM_CONVERTED_LEN], struct rc_sim *sim)
+{
+	if (len < 5 || cmd[0] != RC_FTMS_CP_SET_INDOOR_BIKE_SIM) {
+		return -EINVAL;
+	}
+
+	sim->wind_speed = (int16_t)rc_get_le16(&cmd[1]);
+	sim->grade = (int16_t)rc_get_le16(&cmd[3]);
+	sim->resistance = rc_grade_resistance(sim->grade, map);
+
+	out[0] = RC_FTMS_CP_SET_TARGET_RESISTANCE;
+	out[1] = (uint8_t)sim->resistance;
+
+	return RC_SIM_CONVERTED_LEN;
+}
+
+bool rc_cp_response_unconvert(uint8_t *rsp, size_t len)
+{
+	if (len < 3 || rsp[0] != RC_FTMS_CP_RESPONSE_CODE ||
+	    rsp[1] != RC_FTMS_CP_SET_TARGET_RESISTANCE) {
+		return false;
+	}
+
+	rsp[1] = RC_FTMS_CP_SET_INDOOR_BIKE_SIM;
+	return true;
+}
+
+int rc_relay_copy(uint8_t *dst, size_t dst_size, const uint8_t *data, size_t len)
+{
+	if (len > dst_size) {
+		return -EMSGSIZE;
+	}
+
+	memcpy(dst, data, len);
+	return (int)len;
+}
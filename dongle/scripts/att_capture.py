@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""
+Convert a Z-Relay ATT capture to pcap or btsnoop for Wireshark.
+
+Reads telemetry lines containing att_begin / att / att_end JSON records
+(a saved log, or '-' to follow stdin) and writes every btsnoop record
+they carry. pcap output uses LINKTYPE_BLUETOOTH_HCI_H4_WITH_PHDR.
+"""
+import argparse
+import base64
+import json
+import struct
+import sys
+
+BTSNOOP_HDR = struct.Struct('>IIIIq')
+BTSNOOP_EPOCH_DELTA_US = 0x00dcddb30f2f8000
+BTSNOOP_DATALINK_H4 = 1002
+LINKTYPE_BLUETOOTH_HCI_H4_WITH_PHDR = 201
+
+
+class PcapWriter:
+    def __init__(self, out):
+        self.out = out
+        # Magic, version 2.4, GMT offset, accuracy, snaplen, link type
+        out.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535,
+                              LINKTYPE_BLUETOOTH_HCI_H4_WITH_PHDR))
+
+    def write(self, ts_us, orig_len, flags, packet):
+        # Pseudo header: direction, 0 sent / 1 received, like the btsnoop flag
+        phdr = struct.pack('>I', flags & 1)
+        secs, usecs = divmod(ts_us, 1000000)
+        self.out.write(struct.pack('<IIII', secs, usecs, len(phdr) + len(packet),
+                                   len(phdr) + orig_len))
+        self.out.write(phdr + packet)
+
+
+class BtsnoopWriter:
+    def __init__(self, out):
+        self.out = out
+        out.write(b'btsnoop\0' + struct.pack('>II', 1, BTSNOOP_DATALINK_H4))
+
+    def write(self, ts_us, orig_len, flags, packet, drops=0):
+        self.out.write(BTSNOOP_HDR.pack(orig_len, len(packet), flags, drops,
+                                        ts_us + BTSNOOP_EPOCH_DELTA_US))
+        self.out.write(packet)
+
+
+def split_records(blob):
+    """Yield (orig_len, flags, drops, ts_us since boot, packet) from a btsnoop record blob."""
+    pos = 0
+    while pos + BTSNOOP_HDR.size <= len(blob):
+        orig_len, incl_len, flags, drops, ts = BTSNOOP_HDR.unpack_from(blob, pos)
+        pos += BTSNOOP_HDR.size
+        yield orig_len, flags, drops, ts - BTSNOOP_EPOCH_DELTA_US, blob[pos:pos + incl_len]
+        pos += incl_len
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('capture', type=argparse.FileType('r'),
+                        help="telemetry log, '-' for stdin")
+    parser.add_argument('output', help='.pcap (default) or .btsnoop file')
+    parser.add_argument('--offset', type=float, default=0.0,
+                        help='seconds added to dongle uptime, e.g. the boot time as a Unix timestamp')
+    args = parser.parse_args()
+
+    offset_us = int(args.offset * 1000000)
+    packets, last_seq, last_drops, missing_lines = 0, None, 0, 0
+
+    with open(args.output, 'wb') as out:
+        if args.output.endswith('.btsnoop'):
+            writer = BtsnoopWriter(out)
+        else:
+            writer = PcapWriter(out)
+
+        for line in args.capture:
+            start, end = line.find('{'), line.rfind('}')
+            if start == -1 or end <= start:
+                continue
+            try:
+                msg = json.loads(line[start:end + 1])
+            except json.JSONDecodeError:
+                continue
+
+            kind = msg.get('type')
+            if kind == 'att_begin':
+                last_seq = None
+            elif kind == 'att':
+                seq = msg.get('seq')
+                if last_seq is not None and seq != last_seq + 1:
+                    missing_lines += seq - last_seq - 1
+                last_seq = seq
+                for orig_len, flags, drops, ts_us, packet in split_records(
+                        base64.b64decode(msg['data'])):
+                    if isinstance(writer, BtsnoopWriter):
+                        writer.write(ts_us + offset_us, orig_len, flags, packet, drops)
+                    else:
+                        writer.write(ts_us + offset_us, orig_len, flags, packet)
+                    last_drops = drops
+                    packets += 1
+                out.flush()
+            elif kind == 'att_end':
+                if args.capture is sys.stdin:
+                    break
+
+    print(f'{packets} packets written to {args.output}, {last_drops} dropped on the dongle, '
+          f'{missing_lines} telemetry lines missing', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
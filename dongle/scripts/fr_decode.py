@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""
+Decode a Z-Relay flight recorder download.
+
+Reads a serial capture containing fr_begin / fr_data / fr_end JSON lines
+and prints the records as CSV, oldest first.
+"""
+import argparse
+import base64
+import csv
+import json
+import struct
+import sys
+
+RECORD = struct.Struct('<IBB5h')
+
+# Must match enum fr_type in src/flight_recorder.h
+TYPES = {
+    1: ('boot', ['reset_cause_lo', 'reset_cause_hi', 'boot_count']),
+    2: ('hr', ['bpm']),
+    3: ('cp', ['power', 'cadence']),
+    4: ('ftms', ['power', 'cadence', 'resistance', 'speed']),
+    5: ('sim', ['grade', 'resistance', 'wind_speed']),
+    6: ('cp_cmd', ['p0', 'p1', 'p2', 'p3']),
+    7: ('cp_rsp', ['result']),
+    8: ('connect', ['role', 'err']),
+    9: ('disconnect', ['reason']),
+    10: ('consumer', ['connected', 'reason']),
+    11: ('trigger', []),
+    12: ('fault', ['reason_lo', 'reason_hi']),
+}
+
+
+def read_download(lines):
+    header, chunks = None, {}
+    for line in lines:
+        start, end = line.find('{'), line.rfind('}')
+        if start == -1 or end <= start:
+            continue
+        try:
+            msg = json.loads(line[start:end + 1])
+        except json.JSONDecodeError:
+            continue
+        kind = msg.get('type')
+        if kind == 'fr_begin':
+            header, chunks = msg, {}
+        elif kind == 'fr_data' and header is not None:
+            chunks[msg['seq']] = base64.b64decode(msg['data'])
+        elif kind == 'fr_end' and header is not None:
+            return header, b''.join(chunks[k] for k in sorted(chunks)), msg
+    raise ValueError('no complete flight recorder download found')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('capture', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    args = parser.parse_args()
+
+    header, blob, end = read_download(args.capture)
+    if not end.get('crc_ok', False):
+        print('warning: dump CRC mismatch', file=sys.stderr)
+    print(f"# source={header['source']} boot={header['boot']} "
+          f"records={header['records']} trigger={header['trigger']}", file=sys.stderr)
+
+    out = csv.writer(sys.stdout)
+    out.writerow(['ts_ms', 'type', 'arg', 'fields'])
+    for offset in range(0, len(blob) - RECORD.size + 1, RECORD.size):
+        ts, rtype, arg, *values = RECORD.unpack_from(blob, offset)
+        name, fields = TYPES.get(rtype, (f'type{rtype}', []))
+        detail = ' '.join(f'{f}={v}' for f, v in zip(fields, values))
+        out.writerow([ts, name, arg, detail])
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""
+Report static RAM used by the Z-Relay application.
+
+Parses the linker map file and sums the .bss, .data and .noinit input
+sections contributed by the application library, grouped per source
+file, and by the Bluetooth libraries (host buffers and connection
+contexts, controller memory), grouped per library. Fails when the total
+exceeds the configured budget.
+"""
+import argparse
+import re
+import sys
+from collections import defaultdict
+
+RAM_SECTIONS = ('.bss', '.data', '.noinit')
+
+# " .bss.connections   0x20001234   0x3a8 app/libapp.a(main.c.obj)"
+# Long section names put address, size and object on the next line.
+SECTION_RE = re.compile(r'^\s(\.\S+)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+))?\s*$')
+CONT_RE = re.compile(r'^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+)\s*$')
+APP_OBJ_RE = re.compile(r'libapp\.a\((\S+?)\.obj\)')
+# zephyr/subsys/bluetooth/host/libsubsys__bluetooth__host.a(buf.c.obj), and
+# the NCS controller and HCI driver libraries
+BT_LIB_RE = re.compile(r'lib([^/\s(]*(?:subsys|drivers)__bluetooth[^/\s(]*)\.a\(')
+
+
+def ram_kind(section):
+    for kind in RAM_SECTIONS:
+        if section == kind or section.startswith(kind + '.'):
+            return kind
+    return None
+
+
+def parse_map(path):
+    usage = defaultdict(lambda: defaultdict(int))
+    pending = None
+
+    with open(path, encoding='utf-8', errors='replace') as f:
+        for line in f:
+            if pending:
+                m = CONT_RE.match(line)
+                section, pending = pending, None
+                if m:
+                    add_entry(usage, section, int(m.group(2), 16), m.group(3))
+                    continue
+
+            m = SECTION_RE.match(line)
+            if not m or not ram_kind(m.group(1)):
+                continue
+            if m.group(2) is None:
+                pending = m.group(1)
+            else:
+                add_entry(usage, m.group(1), int(m.group(3), 16), m.group(4))
+
+    return usage
+
+
+def add_entry(usage, section, size, obj):
+    if not size:
+        return
+    m = APP_OBJ_RE.search(obj) or BT_LIB_RE.search(obj)
+    if m:
+        usage[m.group(1)][ram_kind(section)] += size
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('map_file')
+    parser.add_argument('--budget', type=int, default=0)
+    parser.add_argument('--sensor-conn', type=int, default=0)
+    parser.add_argument('--peripheral-conn', type=int, default=0)
+    parser.add_argument('--bt-max-conn', type=int, default=0)
+    args = parser.parse_args()
+
+    usage = parse_map(args.map_file)
+    total = 0
+
+    print(f'Z-Relay RAM budget: {args.sensor_conn} sensor + '
+          f'{args.peripheral_conn} consumer links (BT_MAX_CONN={args.bt_max_conn})')
+    print(f'  {"module":<44}{".bss":>8}{".data":>8}{".noinit":>9}{"total":>8}')
+    for module in sorted(usage, key=lambda m: -sum(usage[m].values())):
+        sizes = usage[module]
+        module_total = sum(sizes.values())
+        total += module_total
+        print(f'  {module:<44}{sizes[".bss"]:>8}{sizes[".data"]:>8}'
+              f'{sizes[".noinit"]:>9}{module_total:>8}')
+    print(f'  {"total":<44}{total:>33}')
+
+    if args.budget:
+        print(f'  budget {args.budget} bytes, {args.budget - total} bytes left')
+        if total > args.budget:
+            print('error: relay and Bluetooth RAM exceeds CONFIG_ZRELAY_RAM_BUDGET',
+                  file=sys.stderr)
+            return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,178 @@
+/* att_capture.c - Relayed ATT traffic capture as btsnoop records */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/base64.h>
+#include <string.h>
+#include "common.h"
+#include "att_capture.h"
+#include "work_queues.h"
+
+/* ATT bytes kept per PDU, longer PDUs are truncated (orig_len is kept) */
+#define ATT_CAPTURE_MAX_PDU 32
+#define ATT_CAPTURE_DEPTH CONFIG_ZRELAY_ATT_CAPTURE_DEPTH
+/* Records per telemetry line */
+#define ATT_CAPTURE_BATCH 4
+/* Collect a few PDUs before encoding a line */
+#define ATT_CAPTURE_FLUSH_MS 20
+
+/* btsnoop record: 24 byte header, then the H4 packet type, ACL and L2CAP headers */
+#define BTSNOOP_HDR_LEN 24
+#define H4_ACL 0x02
+#define ACL_HDR_LEN 4
+#define L2CAP_HDR_LEN 4
+#define L2CAP_CID_ATT 0x0004
+#define ATT_FRAME_OVERHEAD (1 + ACL_HDR_LEN + L2CAP_HDR_LEN)
+#define BTSNOOP_RECORD_MAX (BTSNOOP_HDR_LEN + ATT_FRAME_OVERHEAD + ATT_CAPTURE_MAX_PDU)
+/* Microseconds from 0000-01-01 to 1970-01-01, btsnoop's epoch */
+#define BTSNOOP_EPOCH_DELTA_US 0x00dcddb30f2f8000ULL
+/* ACL packet boundary flag: first automatically flushable packet */
+#define ACL_PB_FIRST_FLUSHABLE 0x2000
+
+#define ATT_CAPTURE_B64_LEN (4 * DIV_ROUND_UP(ATT_CAPTURE_BATCH * BTSNOOP_RECORD_MAX, 3) + 1)
+
+struct att_capture_entry {
+	int64_t ticks;
+	uint16_t conn_handle;
+	uint16_t orig_len;  /* ATT PDU length before truncation */
+	uint8_t dir;
+	uint8_t len;        /* ATT PDU bytes stored */
+	uint8_t pdu[ATT_CAPTURE_MAX_PDU];
+};
+
+/* Written from BT and work contexts, drained on the low priority queue */
+K_MSGQ_DEFINE(att_capture_q, sizeof(struct att_capture_entry), ATT_CAPTURE_DEPTH, 4);
+
+bool att_capture_enabled;
+
+static struct k_work_delayable drain_work;
+static atomic_t dropped;
+static uint32_t captured;
+static uint32_t truncated;
+static uint32_t lines;
+static bool end_pending;
+
+void att_capture_record(struct bt_conn *conn, enum att_capture_dir dir, uint8_t opcode,
+			uint16_t handle, const void *value, uint16_t len)
+{
+	struct att_capture_entry e = {
+		.ticks = k_uptime_ticks(),
+		.dir = dir,
+	};
+	uint8_t hdr_len = 1;
+
+	if (bt_hci_get_conn_handle(conn, &e.conn_handle) != 0) {
+		return;
+	}
+
+	e.pdu[0] = opcode;
+	if (handle != 0) {
+		sys_put_le16(handle, &e.pdu[1]);
+		hdr_len += 2;
+	}
+
+	e.orig_len = hdr_len + len;
+	e.len = MIN(e.orig_len, ATT_CAPTURE_MAX_PDU);
+	if (e.len > hdr_len) {
+		memcpy(&e.pdu[hdr_len], value, e.len - hdr_len);
+	}
+
+	if (k_msgq_put(&att_capture_q, &e, K_NO_WAIT) != 0) {
+		/* Never wait in the relay path, the drops are reported to Wireshark */
+		atomic_inc(&dropped);
+		return;
+	}
+
+	k_work_schedule_for_queue(&housekeeping_work_q, &drain_work, K_MSEC(ATT_CAPTURE_FLUSH_MS));
+}
+
+/* Append one btsnoop record (big endian header) for entry e, returns its length */
+static size_t encode_record(uint8_t *buf, const struct att_capture_entry *e)
+{
+	uint64_t ts = BTSNOOP_EPOCH_DELTA_US + k_ticks_to_us_floor64(e->ticks);
+	uint8_t *p = buf + BTSNOOP_HDR_LEN;
+
+	sys_put_be32(ATT_FRAME_OVERHEAD + e->orig_len, &buf[0]);
+	sys_put_be32(ATT_FRAME_OVERHEAD + e->len, &buf[4]);
+	sys_put_be32(e->dir, &buf[8]);
+	sys_put_be32(atomic_get(&dropped), &buf[12]);
+	sys_put_be64(ts, &buf[16]);
+
+	*p++ = H4_ACL;
+	sys_put_le16(e->conn_handle | ACL_PB_FIRST_FLUSHABLE, p);
+	sys_put_le16(L2CAP_HDR_LEN + e->orig_len, p + 2);
+	sys_put_le16(e->orig_len, p + 4);
+	sys_put_le16(L2CAP_CID_ATT, p + 6);
+	memcpy(p + 8, e->pdu, e->len);
+
+	if (e->len < e->orig_len) {
+		truncated++;
+	}
+
+	return BTSNOOP_HDR_LEN + ATT_FRAME_OVERHEAD + e->len;
+}
+
+static void drain_work_handler(struct k_work *work)
+{
+	static uint8_t records[ATT_CAPTURE_BATCH * BTSNOOP_RECORD_MAX];
+	static char b64[ATT_CAPTURE_B64_LEN];
+	struct att_capture_entry e;
+	size_t olen;
+
+	while (k_msgq_num_used_get(&att_capture_q) > 0) {
+		size_t len = 0;
+		int n = 0;
+
+		while (n < ATT_CAPTURE_BATCH && k_msgq_get(&att_capture_q, &e, K_NO_WAIT) == 0) {
+			len += encode_record(&records[len], &e);
+			n++;
+		}
+
+		if (base64_encode((uint8_t *)b64, sizeof(b64), &olen, records, len) != 0) {
+			continue;
+		}
+
+		captured += n;
+		json_out("{\"type\":\"att\",\"seq\":%u,\"n\":%d,\"data\":\"%s\"}\n", lines++, n, b64);
+	}
+
+	if (end_pending && !att_capture_enabled) {
+		end_pending = false;
+		json_out("{\"type\":\"att_end\",\"ts\":%u}\n", k_uptime_get_32());
+		att_capture_print_stats();
+	}
+}
+
+void att_capture_set(bool enable)
+{
+	if (enable == att_capture_enabled) {
+		return;
+	}
+
+	if (enable) {
+		json_out("{\"type\":\"att_begin\",\"ts\":%u,\"max_pdu\":%u}\n",
+			 k_uptime_get_32(), ATT_CAPTURE_MAX_PDU);
+		att_capture_enabled = true;
+		return;
+	}
+
+	/* Queued records are still sent, followed by att_end */
+	att_capture_enabled = false;
+	end_pending = true;
+	k_work_reschedule_for_queue(&housekeeping_work_q, &drain_work, K_NO_WAIT);
+}
+
+void att_capture_print_stats(void)
+{
+	json_out("{\"type\":\"att_stats\",\"ts\":%u,\"enabled\":%s,\"captured\":%u,"
+		 "\"dropped\":%u,\"truncated\":%u,\"queued\":%u}\n",
+		 k_uptime_get_32(), att_capture_enabled ? "true" : "false", captured,
+		 (uint32_t)atomic_get(&dropped), truncated, k_msgq_num_used_get(&att_capture_q));
+}
+
+void att_capture_init(void)
+{
+	k_work_init_delayable(&drain_work, drain_work_handler);
+}
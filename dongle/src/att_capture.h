@@ -0,0 +1,62 @@
+/* att_capture.h - Relayed ATT traffic capture as btsnoop records */
+
+#ifndef ATT_CAPTURE_H_
+#define ATT_CAPTURE_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+
+/* ATT opcodes seen by the relay */
+#define ATT_OP_ERROR_RSP  0x01
+#define ATT_OP_READ_REQ   0x0A
+#define ATT_OP_READ_RSP   0x0B
+#define ATT_OP_WRITE_REQ  0x12
+#define ATT_OP_WRITE_RSP  0x13
+#define ATT_OP_WRITE_CMD  0x52
+#define ATT_OP_NOTIFY     0x1B
+#define ATT_OP_INDICATE   0x1D
+#define ATT_OP_CONFIRM    0x1E
+
+/* btsnoop direction flag */
+enum att_capture_dir {
+	ATT_CAPTURE_TX = 0,  /* Sent by the relay */
+	ATT_CAPTURE_RX = 1,  /* Received by the relay */
+};
+
+#if defined(CONFIG_ZRELAY_ATT_CAPTURE)
+
+/* Set by att_capture_set(), tested inline so disabled capture costs one branch */
+extern bool att_capture_enabled;
+
+void att_capture_init(void);
+
+/* Start or stop streaming; stopping flushes queued records */
+void att_capture_set(bool enable);
+
+/* Queue one PDU. handle 0 means the PDU has no handle field
+ * (write response, confirmation, error response). */
+void att_capture_record(struct bt_conn *conn, enum att_capture_dir dir, uint8_t opcode,
+			uint16_t handle, const void *value, uint16_t len);
+
+/* Emit capture counters as JSON */
+void att_capture_print_stats(void);
+
+static inline void att_capture(struct bt_conn *conn, enum att_capture_dir dir, uint8_t opcode,
+			       uint16_t handle, const void *value, uint16_t len)
+{
+	if (unlikely(att_capture_enabled)) {
+		att_capture_record(conn, dir, opcode, handle, value, len);
+	}
+}
+
+#else
+
+static inline void att_capture_init(void) {}
+static inline void att_capture_set(bool enable) {}
+static inline void att_capture_print_stats(void) {}
+static inline void att_capture(struct bt_conn *conn, enum att_capture_dir dir, uint8_t opcode,
+			       uint16_t handle, const void *value, uint16_t len) {}
+
+#endif /* CONFIG_ZRELAY_ATT_CAPTURE */
+
+#endif /* ATT_CAPTURE_H_ */
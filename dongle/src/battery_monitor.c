@@ -0,0 +1,124 @@
+/* battery_monitor.c - Sensor battery levels, subscribed or periodically re-read
+ *
+ * The Battery Level characteristic is found in the main discovery pass.
+ * Sensors that notify it are subscribed like any other stream; the others
+ * are re-read every CONFIG_ZRELAY_BATTERY_POLL_INTERVAL seconds. The level
+ * lives in the connection slot, so relayed measurements carry it without
+ * a device table lookup.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <string.h>
+#include "common.h"
+#include "battery_monitor.h"
+#include "device_manager.h"
+#include "device_table.h"
+#include "work_queues.h"
+
+/* How often slots are checked for a due re-read */
+#define BATTERY_CHECK_MS 30000
+
+static struct k_work_delayable battery_work;
+
+void battery_monitor_update(struct conn_slot *slot, const void *data, uint16_t length)
+{
+	uint8_t level;
+	struct device_info *dev_info;
+
+	if (!data || length < 1) {
+		return;
+	}
+
+	level = ((const uint8_t *)data)[0];
+	if (level > 100) {
+		log_debug(DISC, "[BAS] Ignoring battery level %u\n", level);
+		return;
+	}
+
+	if (slot->battery_level == (int8_t)level) {
+		return;
+	}
+	slot->battery_level = (int8_t)level;
+
+	/* Mirror into the device table for the device list */
+	device_table_lock();
+	dev_info = device_table_find(bt_conn_get_dst(slot->conn));
+	if (dev_info) {
+		dev_info->has_battery_service = true;
+		dev_info->battery_level = (int8_t)level;
+	}
+	device_table_unlock();
+
+	log_info(DISC, "[BAS] Slot %d battery %u%%\n", (int)(slot - connections), level);
+	print_device_list();
+}
+
+static uint8_t battery_read_func(struct bt_conn *conn, uint8_t err,
+				 struct bt_gatt_read_params *params,
+				 const void *data, uint16_t length)
+{
+	struct conn_slot *slot = CONTAINER_OF(params, struct conn_slot, battery_read_params);
+
+	if (err) {
+		log_info(DISC, "[BAS] Battery read failed (err %u)\n", err);
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (slot->conn == conn) {
+		battery_monitor_update(slot, data, length);
+	}
+
+	return BT_GATT_ITER_STOP;
+}
+
+static void battery_read(struct conn_slot *slot)
+{
+	int err;
+
+	(void)memset(&slot->battery_read_params, 0, sizeof(slot->battery_read_params));
+	slot->battery_read_params.func = battery_read_func;
+	slot->battery_read_params.handle_count = 1;
+	slot->battery_read_params.single.handle = slot->battery_handle;
+	slot->battery_read_params.single.offset = 0;
+	slot->battery_read_at = k_uptime_get_32();
+
+	err = bt_gatt_read(slot->conn, &slot->battery_read_params);
+	if (err) {
+		log_info(DISC, "[BAS] Read request failed (err %d)\n", err);
+	}
+}
+
+void battery_monitor_found(struct conn_slot *slot, uint16_t value_handle)
+{
+	slot->battery_handle = value_handle;
+	slot->battery_subscribed = false;
+
+	/* Notifications only report changes, so always start with a read */
+	battery_read(slot);
+}
+
+static void battery_work_handler(struct k_work *work)
+{
+	uint32_t now = k_uptime_get_32();
+
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		struct conn_slot *slot = &connections[i];
+
+		if (!slot->conn || !slot->battery_handle || slot->battery_subscribed) {
+			continue;
+		}
+
+		if (now - slot->battery_read_at >= CONFIG_ZRELAY_BATTERY_POLL_INTERVAL * 1000U) {
+			battery_read(slot);
+		}
+	}
+
+	k_work_reschedule_for_queue(&conn_work_q, &battery_work, K_MSEC(BATTERY_CHECK_MS));
+}
+
+void battery_monitor_init(void)
+{
+	k_work_init_delayable(&battery_work, battery_work_handler);
+	k_work_reschedule_for_queue(&conn_work_q, &battery_work, K_MSEC(BATTERY_CHECK_MS));
+}
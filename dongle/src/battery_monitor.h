@@ -0,0 +1,18 @@
+/* battery_monitor.h - Sensor battery levels, subscribed or periodically re-read */
+
+#ifndef BATTERY_MONITOR_H_
+#define BATTERY_MONITOR_H_
+
+#include <stdint.h>
+#include "common.h"
+
+/* Start the periodic re-read of sensors without battery notifications */
+void battery_monitor_init(void);
+
+/* Battery Level characteristic found during discovery, reads it once */
+void battery_monitor_found(struct conn_slot *slot, uint16_t value_handle);
+
+/* New Battery Level value from a notification or read */
+void battery_monitor_update(struct conn_slot *slot, const void *data, uint16_t length);
+
+#endif /* BATTERY_MONITOR_H_ */
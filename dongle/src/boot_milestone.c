@@ -0,0 +1,28 @@
+/* boot_milestone.c - Boot-to-ride timing */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include "common.h"
+#include "boot_milestone.h"
+
+static ATOMIC_DEFINE(reached, BOOT_MILESTONE_COUNT);
+
+static const char *const milestone_names[BOOT_MILESTONE_COUNT] = {
+	[BOOT_BT_READY] = "bt_ready",
+	[BOOT_ADVERTISING] = "advertising",
+	[BOOT_HOST_ATTACHED] = "host_attached",
+	[BOOT_FIRST_SENSOR] = "first_sensor",
+	[BOOT_FIRST_CONSUMER] = "first_consumer",
+	[BOOT_FIRST_RELAY] = "first_relay",
+};
+
+void boot_milestone(enum boot_milestone milestone)
+{
+	if (atomic_test_and_set_bit(reached, milestone)) {
+		return;
+	}
+
+	/* ts is the time since power-up */
+	json_out("{\"type\":\"boot\",\"ts\":%u,\"milestone\":\"%s\"}\n",
+		 k_uptime_get_32(), milestone_names[milestone]);
+}
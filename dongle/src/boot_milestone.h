@@ -0,0 +1,19 @@
+/* boot_milestone.h - Boot-to-ride timing */
+
+#ifndef BOOT_MILESTONE_H_
+#define BOOT_MILESTONE_H_
+
+enum boot_milestone {
+	BOOT_BT_READY,
+	BOOT_ADVERTISING,
+	BOOT_HOST_ATTACHED,
+	BOOT_FIRST_SENSOR,
+	BOOT_FIRST_CONSUMER,
+	BOOT_FIRST_RELAY,
+	BOOT_MILESTONE_COUNT,
+};
+
+/* Report a milestone the first time it is reached after boot */
+void boot_milestone(enum boot_milestone milestone);
+
+#endif /* BOOT_MILESTONE_H_ */
@@ -0,0 +1,412 @@
+/* command_channel.c - Framed host commands over the console */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <string.h>
+#include "common.h"
+#include "command_channel.h"
+#include "device_manager.h"
+#include "conn_manager.h"
+#include "consumer_manager.h"
+#include "ftms_control_point.h"
+#include "link_monitor.h"
+#include "nvs_storage.h"
+#include "flight_recorder.h"
+#include "relay_config.h"
+#include "att_capture.h"
+#include "timebase.h"
+#include "work_queues.h"
+#include "resource_audit.h"
+#include "sysstats.h"
+#include "gatt_mirror.h"
+
+#define CMD_RX_BUFFER_SIZE 128
+#define CMD_THREAD_STACK_SIZE 2048
+/* A partial frame older than this is discarded */
+#define CMD_FRAME_TIMEOUT_MS 200
+#define CMD_DEFAULT_SCAN_WINDOW_S (5 * 60)
+#define CMD_CONFIG_ALL 0xFF
+
+#if !defined(CONFIG_ZRELAY_TELEMETRY_UART)
+static const struct device *const console_dev = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
+#endif
+
+/* Filled from the UART ISR, drained by the command thread */
+RING_BUF_DECLARE(cmd_rx, CMD_RX_BUFFER_SIZE);
+static K_SEM_DEFINE(cmd_rx_sem, 0, 1);
+
+K_THREAD_STACK_DEFINE(cmd_thread_stack, CMD_THREAD_STACK_SIZE);
+static struct k_thread cmd_thread;
+
+enum parse_state {
+	PARSE_SYNC,
+	PARSE_HEADER,
+	PARSE_PAYLOAD,
+	PARSE_CRC,
+};
+
+struct cmd_frame {
+	uint8_t seq;
+	uint8_t opcode;
+	uint8_t len;
+	uint8_t payload[CMD_MAX_PAYLOAD];
+};
+
+static struct {
+	enum parse_state state;
+	uint8_t buf[3 + CMD_MAX_PAYLOAD + 2];  /* seq, opcode, len, payload, crc */
+	uint8_t pos;
+	uint8_t need;
+} parser;
+
+struct cmd_counters {
+	uint32_t frames;
+	uint32_t crc_errors;
+	uint32_t timeouts;
+	uint32_t oversize;
+	uint32_t rx_overflow;  /* Bytes lost because the thread fell behind */
+};
+
+static struct cmd_counters counters;
+
+/* Arrival time of the most recent RX bytes, for time sync */
+static struct k_spinlock rx_time_lock;
+static uint64_t last_rx_us;
+
+/* Scan window changes run on the connection work queue like the button's */
+static uint32_t scan_window_ms;
+static void scan_start_work_handler(struct k_work *work)
+{
+	start_scan_window(scan_window_ms);
+}
+static void scan_stop_work_handler(struct k_work *work)
+{
+	stop_scan_window();
+}
+static K_WORK_DEFINE(scan_start_work, scan_start_work_handler);
+static K_WORK_DEFINE(scan_stop_work, scan_stop_work_handler);
+
+static void respond(const struct cmd_frame *f, int status)
+{
+	json_out("{\"type\":\"cmd_rsp\",\"ts\":%u,\"seq\":%u,\"op\":%u,\"status\":%d}\n",
+		 k_uptime_get_32(), f->seq, f->opcode, status);
+}
+
+static void print_stats(void)
+{
+	json_out("{\"type\":\"cmd_stats\",\"ts\":%u,\"frames\":%u,\"crc_errors\":%u,"
+		 "\"timeouts\":%u,\"oversize\":%u,\"rx_overflow\":%u}\n",
+		 k_uptime_get_32(), counters.frames, counters.crc_errors,
+		 counters.timeouts, counters.oversize, counters.rx_overflow);
+}
+
+/* The host pairs its send/receive times with rx_us to estimate offset and drift */
+static int cmd_time_sync(const struct cmd_frame *f)
+{
+	char rx_str[TIMEBASE_US_STR_LEN], host_str[TIMEBASE_US_STR_LEN];
+	k_spinlock_key_t key;
+	uint64_t rx_us;
+
+	if (f->len != 8) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&rx_time_lock);
+	rx_us = last_rx_us;
+	k_spin_unlock(&rx_time_lock, key);
+
+	json_out("{\"type\":\"cmd_rsp\",\"ts\":%u,\"seq\":%u,\"op\":%u,\"status\":0,"
+		 "\"boot\":\"%08x\",\"rx_us\":%s,\"host_us\":%s}\n",
+		 k_uptime_get_32(), f->seq, f->opcode, timebase_boot_id(),
+		 timebase_us_str(rx_us, rx_str),
+		 timebase_us_str(sys_get_le64(f->payload), host_str));
+	return 0;
+}
+
+static int cmd_config_get(const struct cmd_frame *f)
+{
+	if (f->len != 1) {
+		return -EINVAL;
+	}
+
+	if (f->payload[0] == CMD_CONFIG_ALL) {
+		relay_config_print();
+		respond(f, 0);
+		return 0;
+	}
+
+	if (!relay_config_name(f->payload[0])) {
+		return -EINVAL;
+	}
+
+	json_out("{\"type\":\"cmd_rsp\",\"ts\":%u,\"seq\":%u,\"op\":%u,\"status\":0,"
+		 "\"key\":\"%s\",\"value\":%d}\n",
+		 k_uptime_get_32(), f->seq, f->opcode, relay_config_name(f->payload[0]),
+		 relay_config_get(f->payload[0]));
+	return 0;
+}
+
+/* Returns 0 once the handler has responded, otherwise the status to report */
+static int dispatch(const struct cmd_frame *f)
+{
+	int err;
+
+	switch (f->opcode) {
+	case CMD_PING:
+		json_out("{\"type\":\"cmd_rsp\",\"ts\":%u,\"seq\":%u,\"op\":%u,\"status\":0,"
+			 "\"version\":\"%s\"}\n", k_uptime_get_32(), f->seq, f->opcode, VERSION);
+		return 0;
+
+	case CMD_STATS:
+		print_device_list();
+		conn_manager_print_stats();
+		consumer_print_stats();
+		ftms_cp_print_stats();
+		gatt_mirror_print_stats();
+		link_monitor_print_stats();
+		nvs_print_stats();
+		serial_output_print_stats();
+		att_capture_print_stats();
+		work_queues_print_stats();
+		resource_audit_run();
+		sysstats_print();
+		print_stats();
+		break;
+
+	case CMD_LOG_LEVEL:
+		if (f->len < 1 || f->len > 2 || f->payload[0] > SERIAL_LOG_DEBUG) {
+			return -EINVAL;
+		}
+		/* Optional category bitmask, all categories without it */
+		serial_log_set(f->payload[0], f->len == 2 ? f->payload[1] : LOG_CAT_ALL);
+		break;
+
+	case CMD_SCAN_START: {
+		if (f->len != 2) {
+			return -EINVAL;
+		}
+		uint16_t seconds = sys_get_le16(f->payload);
+
+		scan_window_ms = (seconds ? seconds : CMD_DEFAULT_SCAN_WINDOW_S) * 1000U;
+		k_work_submit_to_queue(&conn_work_q, &scan_start_work);
+		break;
+	}
+
+	case CMD_SCAN_STOP:
+		k_work_submit_to_queue(&conn_work_q, &scan_stop_work);
+		break;
+
+	case CMD_CONFIG_GET:
+		return cmd_config_get(f);
+
+	case CMD_TIME_SYNC:
+		return cmd_time_sync(f);
+
+	case CMD_CONFIG_SET:
+		if (f->len != 5) {
+			return -EINVAL;
+		}
+		err = relay_config_set(f->payload[0], (int32_t)sys_get_le32(&f->payload[1]));
+		if (err) {
+			return err;
+		}
+		break;
+
+	case CMD_FR_DOWNLOAD:
+		if (f->len != 1 || f->payload[0] > 1) {
+			return -EINVAL;
+		}
+		err = flight_recorder_download(f->payload[0] == 1);
+		if (err) {
+			return err;
+		}
+		break;
+
+	case CMD_FR_SAVE:
+		if (!IS_ENABLED(CONFIG_ZRELAY_FLIGHT_RECORDER)) {
+			return -ENOTSUP;
+		}
+		flight_recorder_freeze(FR_TRIGGER_HOST);
+		break;
+
+	case CMD_RESET_COUNTERS:
+		conn_manager_reset_stats();
+		consumer_reset_stats();
+		ftms_cp_reset_stats();
+		gatt_mirror_reset_stats();
+		link_monitor_reset_stats();
+		work_queues_reset_stats();
+		resource_audit_reset_stats();
+		memset(&counters, 0, sizeof(counters));
+		break;
+
+	case CMD_ATT_CAPTURE:
+		if (f->len != 1 || f->payload[0] > 1) {
+			return -EINVAL;
+		}
+		if (!IS_ENABLED(CONFIG_ZRELAY_ATT_CAPTURE)) {
+			return -ENOTSUP;
+		}
+		att_capture_set(f->payload[0] == 1);
+		break;
+
+	default:
+		return -ENOTSUP;
+	}
+
+	respond(f, 0);
+	return 0;
+}
+
+static void parser_reset(void)
+{
+	parser.state = PARSE_SYNC;
+	parser.pos = 0;
+}
+
+static void frame_complete(void)
+{
+	struct cmd_frame f = {
+		.seq = parser.buf[0],
+		.opcode = parser.buf[1],
+		.len = parser.buf[2],
+	};
+	uint16_t crc = crc16_itu_t(0xFFFF, parser.buf, 3 + f.len);
+
+	parser_reset();
+
+	if (crc != sys_get_le16(&parser.buf[3 + f.len])) {
+		counters.crc_errors++;
+		respond(&f, -EBADMSG);
+		return;
+	}
+
+	counters.frames++;
+	memcpy(f.payload, &parser.buf[3], f.len);
+
+	int err = dispatch(&f);
+
+	if (err) {
+		respond(&f, err);
+	}
+}
+
+static void parse_byte(uint8_t byte)
+{
+	switch (parser.state) {
+	case PARSE_SYNC:
+		if (byte == CMD_FRAME_SYNC) {
+			parser.state = PARSE_HEADER;
+			parser.pos = 0;
+			parser.need = 3;
+		}
+		return;
+
+	case PARSE_HEADER:
+	case PARSE_PAYLOAD:
+	case PARSE_CRC:
+		parser.buf[parser.pos++] = byte;
+		if (--parser.need > 0) {
+			return;
+		}
+		break;
+	}
+
+	if (parser.state == PARSE_HEADER) {
+		uint8_t len = parser.buf[2];
+
+		if (len > CMD_MAX_PAYLOAD) {
+			/* Resynchronise on the next sync byte */
+			counters.oversize++;
+			parser_reset();
+			return;
+		}
+		parser.state = len ? PARSE_PAYLOAD : PARSE_CRC;
+		parser.need = len ? len : 2;
+	} else if (parser.state == PARSE_PAYLOAD) {
+		parser.state = PARSE_CRC;
+		parser.need = 2;
+	} else {
+		frame_complete();
+	}
+}
+
+static void cmd_thread_fn(void *p1, void *p2, void *p3)
+{
+	uint8_t chunk[32];
+
+	while (true) {
+		k_timeout_t timeout = parser.state == PARSE_SYNC ? K_FOREVER :
+								   K_MSEC(CMD_FRAME_TIMEOUT_MS);
+
+		if (k_sem_take(&cmd_rx_sem, timeout) != 0) {
+			/* Sender stalled mid-frame */
+			counters.timeouts++;
+			parser_reset();
+			continue;
+		}
+
+		uint32_t len;
+
+		while ((len = ring_buf_get(&cmd_rx, chunk, sizeof(chunk))) > 0) {
+			for (uint32_t i = 0; i < len; i++) {
+				parse_byte(chunk[i]);
+			}
+		}
+	}
+}
+
+void command_channel_rx(const uint8_t *data, uint32_t len)
+{
+	k_spinlock_key_t key = k_spin_lock(&rx_time_lock);
+	uint32_t put;
+
+	last_rx_us = timebase_now_us();
+	k_spin_unlock(&rx_time_lock, key);
+
+	put = ring_buf_put(&cmd_rx, data, len);
+
+	counters.rx_overflow += len - put;
+	k_sem_give(&cmd_rx_sem);
+}
+
+#if !defined(CONFIG_ZRELAY_TELEMETRY_UART)
+static void console_isr(const struct device *dev, void *user_data)
+{
+	uint8_t rx[32];
+	int n;
+
+	while (uart_irq_update(dev) && uart_irq_rx_ready(dev)) {
+		n = uart_fifo_read(dev, rx, sizeof(rx));
+		if (n <= 0) {
+			break;
+		}
+		command_channel_rx(rx, n);
+	}
+}
+#endif
+
+void command_channel_init(void)
+{
+	parser_reset();
+
+	/* Lowest application priority, commands never preempt the relay */
+	k_thread_create(&cmd_thread, cmd_thread_stack, K_THREAD_STACK_SIZEOF(cmd_thread_stack),
+			cmd_thread_fn, NULL, NULL, NULL,
+			K_LOWEST_APPLICATION_THREAD_PRIO, 0, K_NO_WAIT);
+	k_thread_name_set(&cmd_thread, "cmd");
+
+#if !defined(CONFIG_ZRELAY_TELEMETRY_UART)
+	/* With a telemetry interface, serial_output feeds us its RX data */
+	if (!device_is_ready(console_dev) ||
+	    uart_irq_callback_user_data_set(console_dev, console_isr, NULL) != 0) {
+		log("Command channel: console has no interrupt support\n");
+		return;
+	}
+	uart_irq_rx_enable(console_dev);
+#endif
+}
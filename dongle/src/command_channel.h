@@ -0,0 +1,47 @@
+/* command_channel.h - Framed host commands over the console */
+
+#ifndef COMMAND_CHANNEL_H_
+#define COMMAND_CHANNEL_H_
+
+#include <zephyr/kernel.h>
+
+/*
+ * Request frame, little endian:
+ *
+ *   0xA5 | seq | opcode | len | payload[len] | crc16
+ *
+ * crc16 is CRC-16/CCITT-FALSE (crc16_itu_t, seed 0xFFFF) over seq..payload.
+ * Every request is answered with one JSON line:
+ *
+ *   {"type":"cmd_rsp","ts":..,"seq":..,"op":..,"status":<0 or -errno>,...}
+ *
+ * Commands that produce telemetry (stats, flight recorder download) emit
+ * their records before the response line.
+ */
+#define CMD_FRAME_SYNC 0xA5
+#define CMD_MAX_PAYLOAD 16
+
+/* Opcodes, stable: they are used by server/src/dongle_client.py */
+enum cmd_opcode {
+	CMD_PING = 0x01,           /* -> "version" */
+	CMD_STATS = 0x02,          /* Emit device, connection, consumer, link and NVS records */
+	CMD_LOG_LEVEL = 0x03,      /* u8 enum serial_log_level [, u8 enum log_category bitmask] */
+	CMD_SCAN_START = 0x04,     /* u16 window in seconds, 0 for the default 5 minutes */
+	CMD_SCAN_STOP = 0x05,
+	CMD_CONFIG_GET = 0x06,     /* u8 enum relay_config_key, 0xFF for all */
+	CMD_CONFIG_SET = 0x07,     /* u8 enum relay_config_key, i32 value */
+	CMD_FR_DOWNLOAD = 0x08,    /* u8 source: 0 live RAM ring, 1 last flash dump */
+	CMD_FR_SAVE = 0x09,        /* Write the ring to flash now */
+	CMD_RESET_COUNTERS = 0x0A, /* Zero connection, consumer, link, work queue and channel counters */
+	CMD_ATT_CAPTURE = 0x0B,    /* u8 1 start / 0 stop streaming relayed ATT PDUs */
+	CMD_TIME_SYNC = 0x0C,      /* u64 host time in us, echoed with boot ID and receive time */
+};
+
+/* Start receiving commands on the telemetry interface, or on the console
+ * when there is none */
+void command_channel_init(void);
+
+/* Queue received bytes for parsing, callable from ISR */
+void command_channel_rx(const uint8_t *data, uint32_t len);
+
+#endif /* COMMAND_CHANNEL_H_ */
@@ -7,35 +7,49 @@
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/gatt.h>
-#include <zephyr/sys/slist.h>
 #include <zephyr/kernel.h>
-
-/* Mutex for serial output synchronization */
-extern struct k_mutex serial_output_mutex;
-
-/* Define log macro using printf with timestamps - thread-safe */
-#define log(fmt, ...) \
+#include "serial_output.h"
+#include "timebase.h"
+#include "relay_codec.h"
+
+/* True when a category logs at this level. Below the Kconfig floor it is a
+ * constant false and the call compiles away, format string included;
+ * otherwise it is one load and branch before any formatting. */
+#define log_enabled(cat, level) \
+	(CONFIG_ZRELAY_LOG_LEVEL_##cat >= (level) && \
+	 (serial_log_mask & SERIAL_LOG_BIT(LOG_CAT_##cat, level)))
+
+/* Define log macro with millisecond timestamps - thread-safe, buffered until a host attaches */
+#define log_cat(cat, level, fmt, ...) \
 	do { \
-		uint32_t _ms = k_uptime_get_32(); \
-		k_mutex_lock(&serial_output_mutex, K_FOREVER); \
-		printf("[%u.%u] " fmt, _ms / 1000, (_ms % 1000) / 100, ##__VA_ARGS__); \
-		k_mutex_unlock(&serial_output_mutex); \
+		if (log_enabled(cat, level)) { \
+			uint64_t _us = timebase_now_us(); \
+			serial_out("[%u.%03u] " fmt, (uint32_t)(_us / 1000000U), \
+				   (uint32_t)(_us / 1000U % 1000U), ##__VA_ARGS__); \
+		} \
 	} while(0)
 
-/* Define json_out macro for JSON output - thread-safe */
-#define json_out(fmt, ...) \
-	do { \
-		k_mutex_lock(&serial_output_mutex, K_FOREVER); \
-		printf(fmt, ##__VA_ARGS__); \
-		k_mutex_unlock(&serial_output_mutex); \
-	} while(0)
+#define log(fmt, ...) log_cat(GENERAL, SERIAL_LOG_INFO, fmt, ##__VA_ARGS__)
+#define log_info(cat, fmt, ...) log_cat(cat, SERIAL_LOG_INFO, fmt, ##__VA_ARGS__)
+
+/* Per-packet detail, only printed at SERIAL_LOG_DEBUG */
+#define log_debug(cat, fmt, ...) log_cat(cat, SERIAL_LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+/* Define json_out macro for JSON output - thread-safe, buffered until a host attaches.
+ * Goes to the telemetry interface when there is one. Records starting with
+ * {"type":"name" get a 64-bit "us" timestamp after the type. */
+#define json_out(fmt, ...) telemetry_out(fmt, ##__VA_ARGS__)
 
 #define VERSION "1.15"
 
 #define DEVICE_NAME_PREFIX "Z-Relay"
 
-#define MAX_CONNECTIONS 3  /* HR, Power Meter, Trainer */
-#define MAX_SUBSCRIPTIONS_PER_CONN 5  /* Trainer needs: Indoor Bike Data, Training Status, Machine Status, Control Point */
+#define MAX_CONNECTIONS CONFIG_ZRELAY_MAX_SENSOR_CONN  /* HR, Power Meter(s), Trainer */
+#define MAX_PERIPHERAL_CONNECTIONS CONFIG_ZRELAY_MAX_PERIPHERAL_CONN  /* Zwift and other consumers */
+#define MAX_SUBSCRIPTIONS_PER_CONN CONFIG_ZRELAY_MAX_SUBSCRIPTIONS_PER_CONN  /* Trainer needs: Indoor Bike Data, Training Status, Machine Status, Control Point */
+
+BUILD_ASSERT(CONFIG_BT_MAX_CONN >= MAX_CONNECTIONS + MAX_PERIPHERAL_CONNECTIONS,
+	     "CONFIG_BT_MAX_CONN must cover all sensor and consumer links");
 #define MAX_SAVED_DEVICES 4
 
 /* Saved device structure for NVS persistence */
@@ -48,7 +62,6 @@ struct saved_device {
 
 /* Device info structure for tracking discovered devices */
 struct device_info {
-	sys_snode_t node;
 	bt_addr_le_t addr;
 	char name[32];
 	uint32_t last_seen;
@@ -57,6 +70,20 @@ struct device_info {
 	int8_t battery_level;  /* -1 if unknown, else 0..100 */
 	bool is_saved;  /* true if this device was previously saved */
 	int8_t rssi;    /* Last observed RSSI from scanning */
+	int8_t conn_slot;  /* Index into connections[], -1 if not connected */
+	bool in_use;    /* Device table bucket is occupied */
+};
+
+/* Payload a sensor subscription carries, from its characteristic UUID */
+enum sub_type {
+	SUB_UNKNOWN = -1,
+	SUB_HR = 0,
+	SUB_CP = 1,
+	SUB_IBD = 2,
+	SUB_TRAINING_STATUS = 3,
+	SUB_MACHINE_STATUS = 4,
+	SUB_FTMS_CONTROL_POINT = 5,
+	SUB_BATTERY = 6,
 };
 
 /* Connection slot structure */
@@ -65,28 +92,32 @@ struct conn_slot {
 	struct bt_uuid_16 discover_uuid;
 	struct bt_gatt_discover_params discover_params;
 	struct bt_gatt_subscribe_params subscribe_params[MAX_SUBSCRIPTIONS_PER_CONN];  /* Embedded storage */
-	int service_type[MAX_SUBSCRIPTIONS_PER_CONN]; /* 0=HR, 1=CP, 2=FTMS */
+	int service_type[MAX_SUBSCRIPTIONS_PER_CONN]; /* enum sub_type */
 	int subscribe_count;
 	int discover_service_index;
 	uint16_t ftms_control_point_handle;
 	struct bt_gatt_indicate_params indicate_params;
 	uint16_t temp_value_handle;
-	struct bt_uuid_16 battery_uuid;
-	struct bt_gatt_discover_params battery_discover_params;
+	int temp_service_type;  /* enum sub_type of temp_value_handle */
 	struct bt_gatt_read_params battery_read_params;
+	uint16_t battery_handle;  /* Battery Level value, 0 if the sensor has none */
+	bool battery_subscribed;  /* Notifies changes, otherwise re-read periodically */
+	int8_t battery_level;     /* -1 until read, else 0..100 */
+	uint32_t battery_read_at;
 	int8_t rssi;  /* Last known RSSI */
+	uint8_t role;  /* enum sensor_role of the connected device */
 };
 
 /* Global connection slots */
 extern struct conn_slot connections[MAX_CONNECTIONS];
 
-/* Peripheral (Zwift) connection */
-extern struct bt_conn *peripheral_conn;
-
 /* Services to discover */
 extern const struct bt_uuid *discover_services[];
 extern const int discover_service_count;
 
+/* Index of the Battery Service in discover_services, discovered last */
+#define DISCOVER_INDEX_BAS 3
+
 /* Power meter tracking */
 extern uint32_t last_cp_data_time;
 #define CP_TIMEOUT_MS 5000
@@ -94,12 +125,8 @@ extern uint32_t last_cp_data_time;
 /* Cached CP data for injection into FTMS */
 struct cp_cache {
 	int16_t power;
-	uint16_t cadence;  /* in 0.5 rpm units (same as FTMS) */
 	uint32_t timestamp;
-	uint16_t last_crank_revs;
-	uint16_t last_crank_time;  /* sensor time in 1/1024 second units */
-	uint32_t last_crank_change_time;  /* wall clock timestamp of last crank revolution change */
-	bool valid;
+	struct rc_cadence crank;  /* valid once crank data was seen */
 };
 extern struct cp_cache cached_cp_data;
 
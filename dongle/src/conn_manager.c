@@ -0,0 +1,578 @@
+/* conn_manager.c - Prioritized connection establishment */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/hci.h>
+#include <string.h>
+#include "common.h"
+#include "conn_manager.h"
+#include "device_manager.h"
+#include "device_table.h"
+#include "scan_scheduler.h"
+#include "work_queues.h"
+
+/* Candidates offered by the scanner, picked by priority */
+#define CONN_QUEUE_SIZE 8
+/* A candidate not re-offered within this time is considered gone */
+#define CONN_CANDIDATE_MAX_AGE_MS 5000
+
+#define CONN_TIMEOUT_MS 10000
+
+/* Exponential backoff after failed attempts or flapping links */
+#define CONN_BACKOFF_BASE_MS 1000
+#define CONN_BACKOFF_MAX_MS 60000
+/* A link lost within this time after connecting counts as a failure */
+#define CONN_FLAP_WINDOW_MS 15000
+
+/* Per-device metrics, oldest entry recycled when full */
+#define CONN_STATS_SIZE 8
+
+/* Slots held back for roles that are not connected yet */
+static const uint8_t reserved_slots[SENSOR_ROLE_COUNT] = {
+	[SENSOR_ROLE_TRAINER] = 1,
+	[SENSOR_ROLE_POWER] = 1,
+	[SENSOR_ROLE_HR] = 0,
+};
+
+struct conn_candidate {
+	bt_addr_le_t addr;
+	uint32_t offered_at;
+	uint8_t role;
+	bool saved;
+	bool in_use;
+};
+
+/* Offers come from the scanner on the BT RX thread; they are handed over
+ * by value so that queue[] is only touched on conn_work_q */
+struct conn_offer {
+	bt_addr_le_t addr;
+	uint32_t offered_at;
+	uint8_t role;
+	bool saved;
+};
+
+K_MSGQ_DEFINE(offer_q, sizeof(struct conn_offer), CONN_QUEUE_SIZE, 4);
+
+/* Connection callbacks run on the BT RX thread. They are posted with a
+ * reference so pending_conn and stats[] are only touched on conn_work_q. */
+#define CONN_EVENT_QUEUE_SIZE (2 * CONFIG_BT_MAX_CONN)
+
+enum conn_event_type {
+	CONN_EVENT_CONNECTED,
+	CONN_EVENT_DISCONNECTED,
+};
+
+struct conn_event {
+	struct bt_conn *conn;
+	uint32_t at;
+	uint8_t type;
+	uint8_t err;
+};
+
+K_MSGQ_DEFINE(event_q, sizeof(struct conn_event), CONN_EVENT_QUEUE_SIZE, 4);
+
+struct conn_stats {
+	bt_addr_le_t addr;
+	uint32_t attempt_start;
+	uint32_t connected_at;
+	uint32_t backoff_until;
+	uint32_t last_ttc_ms;
+	uint32_t total_ttc_ms;
+	uint16_t attempts;
+	uint16_t successes;
+	uint16_t failures;
+	uint8_t consecutive_failures;
+	bool in_use;
+};
+
+static struct conn_candidate queue[CONN_QUEUE_SIZE];
+static struct conn_stats stats[CONN_STATS_SIZE];
+
+static struct bt_conn *pending_conn = NULL;
+static struct k_work_delayable conn_timeout_work;
+static struct k_work process_work;
+static struct k_work stats_print_work;
+static struct k_work stats_reset_work;
+
+static void handle_event(const struct conn_event *ev);
+static void print_stats(void);
+
+enum sensor_role sensor_role_from_svc_mask(uint8_t svc_mask)
+{
+	if (svc_mask & 0x04) {
+		return SENSOR_ROLE_TRAINER;
+	}
+	if (svc_mask & 0x02) {
+		return SENSOR_ROLE_POWER;
+	}
+	return SENSOR_ROLE_HR;
+}
+
+const char *sensor_role_str(enum sensor_role role)
+{
+	switch (role) {
+	case SENSOR_ROLE_TRAINER: return "trainer";
+	case SENSOR_ROLE_POWER:   return "power";
+	case SENSOR_ROLE_HR:      return "hr";
+	default:                  return "unknown";
+	}
+}
+
+static struct conn_stats *find_stats(const bt_addr_le_t *addr, bool create)
+{
+	struct conn_stats *victim = NULL;
+
+	for (int i = 0; i < CONN_STATS_SIZE; i++) {
+		struct conn_stats *st = &stats[i];
+
+		if (st->in_use && !bt_addr_le_cmp(&st->addr, addr)) {
+			return st;
+		}
+
+		/* Prefer a free entry, else the one with the oldest attempt */
+		if (!victim || (victim->in_use && !st->in_use) ||
+		    (victim->in_use && st->in_use &&
+		     (int32_t)(st->attempt_start - victim->attempt_start) < 0)) {
+			victim = st;
+		}
+	}
+
+	if (!create) {
+		return NULL;
+	}
+
+	memset(victim, 0, sizeof(*victim));
+	bt_addr_le_copy(&victim->addr, addr);
+	victim->in_use = true;
+	return victim;
+}
+
+static void record_failure(struct conn_stats *st, uint32_t now)
+{
+	st->failures++;
+	if (st->consecutive_failures < 16) {
+		st->consecutive_failures++;
+	}
+
+	uint32_t backoff = CONN_BACKOFF_BASE_MS << (st->consecutive_failures - 1);
+	if (backoff > CONN_BACKOFF_MAX_MS) {
+		backoff = CONN_BACKOFF_MAX_MS;
+	}
+	st->backoff_until = now + backoff;
+
+	char addr[BT_ADDR_LE_STR_LEN];
+	bt_addr_le_to_str(&st->addr, addr, sizeof(addr));
+	log("[CONN] %s failure %u in a row, backing off %u ms\n",
+	       addr, st->consecutive_failures, backoff);
+}
+
+static bool in_backoff(const bt_addr_le_t *addr, uint32_t now)
+{
+	struct conn_stats *st = find_stats(addr, false);
+
+	return st && st->consecutive_failures > 0 &&
+	       (int32_t)(st->backoff_until - now) > 0;
+}
+
+static bool role_may_take_slot(enum sensor_role role)
+{
+	int free_slots = 0;
+	int connected[SENSOR_ROLE_COUNT] = {0};
+
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		if (connections[i].conn) {
+			connected[connections[i].role]++;
+		} else {
+			free_slots++;
+		}
+	}
+
+	if (free_slots == 0) {
+		return false;
+	}
+
+	/* Slots still held back for other roles */
+	int held = 0;
+	for (int r = 0; r < SENSOR_ROLE_COUNT; r++) {
+		if (r != role && connected[r] < reserved_slots[r]) {
+			held += reserved_slots[r] - connected[r];
+		}
+	}
+
+	return free_slots - 1 >= held || connected[role] < reserved_slots[role];
+}
+
+static int candidate_rank(const struct conn_candidate *c)
+{
+	/* Lower is better: role first, saved ahead of new within a role */
+	return c->role * 2 + (c->saved ? 0 : 1);
+}
+
+static struct conn_candidate *pick_candidate(uint32_t now)
+{
+	struct conn_candidate *best = NULL;
+
+	for (int i = 0; i < CONN_QUEUE_SIZE; i++) {
+		struct conn_candidate *c = &queue[i];
+
+		if (!c->in_use) {
+			continue;
+		}
+
+		device_table_lock();
+		struct device_info *dev_info = device_table_find(&c->addr);
+		bool gone = !dev_info || dev_info->conn_slot >= 0;
+		device_table_unlock();
+
+		if (gone || now - c->offered_at > CONN_CANDIDATE_MAX_AGE_MS) {
+			/* Gone, already connected or stale */
+			c->in_use = false;
+			continue;
+		}
+
+		if (in_backoff(&c->addr, now) || !role_may_take_slot(c->role)) {
+			continue;
+		}
+
+		if (!best || candidate_rank(c) < candidate_rank(best) ||
+		    (candidate_rank(c) == candidate_rank(best) &&
+		     (int32_t)(c->offered_at - best->offered_at) > 0)) {
+			best = c;
+		}
+	}
+
+	return best;
+}
+
+static void connect_candidate(struct conn_candidate *c, uint32_t now)
+{
+	struct device_info *dev_info;
+	struct bt_le_conn_param *param = BT_LE_CONN_PARAM_DEFAULT;
+	bt_addr_le_t addr;
+	char name[sizeof(dev_info->name)];
+	int free_slot = -1;
+	int err;
+
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		if (!connections[i].conn) {
+			free_slot = i;
+			break;
+		}
+	}
+
+	if (free_slot < 0) {
+		return;
+	}
+
+	/* Claim the slot for the device and copy what is needed; the entry
+	 * may move once the table is unlocked */
+	bt_addr_le_copy(&addr, &c->addr);
+	device_table_lock();
+	dev_info = device_table_find(&addr);
+	if (!dev_info) {
+		device_table_unlock();
+		return;
+	}
+	memcpy(name, dev_info->name, sizeof(name));
+	dev_info->conn_slot = free_slot;
+	device_table_unlock();
+
+	/* Clear the slot to ensure clean state for new connection */
+	struct conn_slot *slot = &connections[free_slot];
+	memset(&slot->subscribe_params, 0, sizeof(slot->subscribe_params));
+	memset(&slot->service_type, 0, sizeof(slot->service_type));
+	slot->subscribe_count = 0;
+	slot->discover_service_index = 0;
+	slot->ftms_control_point_handle = 0;
+	slot->temp_value_handle = 0;
+	slot->battery_handle = 0;
+	slot->battery_subscribed = false;
+	slot->battery_level = -1;
+	slot->role = c->role;
+
+	struct conn_stats *st = find_stats(&addr, true);
+	st->attempts++;
+	st->attempt_start = now;
+
+	c->in_use = false;
+
+	scan_scheduler_suspend();
+
+	log("Creating connection to %s (slot %d, %s%s)\n", name, free_slot,
+	       sensor_role_str(c->role), c->saved ? ", saved" : "");
+	struct bt_conn_le_create_param create_param = *BT_CONN_LE_CREATE_CONN;
+	create_param.options = 0;
+
+	err = bt_conn_le_create(&addr, &create_param, param, &slot->conn);
+	if (err) {
+		log("Create connection failed (err %d)\n", err);
+		slot->conn = NULL;
+		device_table_lock();
+		dev_info = device_table_find(&addr);
+		if (dev_info && dev_info->conn_slot == free_slot) {
+			dev_info->conn_slot = -1;
+		}
+		device_table_unlock();
+		record_failure(st, now);
+		start_scan();
+		return;
+	}
+
+	pending_conn = bt_conn_ref(slot->conn);
+	k_work_schedule_for_queue(&conn_work_q, &conn_timeout_work, K_MSEC(CONN_TIMEOUT_MS));
+}
+
+static void queue_offer(const struct conn_offer *offer)
+{
+	struct conn_candidate *c = NULL;
+	struct conn_candidate *free_entry = NULL;
+
+	for (int i = 0; i < CONN_QUEUE_SIZE; i++) {
+		if (queue[i].in_use && !bt_addr_le_cmp(&queue[i].addr, &offer->addr)) {
+			c = &queue[i];
+			break;
+		}
+		if (!queue[i].in_use && !free_entry) {
+			free_entry = &queue[i];
+		}
+	}
+
+	if (!c) {
+		if (!free_entry) {
+			/* Queue full; the candidate will be offered again */
+			return;
+		}
+		c = free_entry;
+		bt_addr_le_copy(&c->addr, &offer->addr);
+		c->in_use = true;
+	}
+
+	c->role = offer->role;
+	c->saved = offer->saved;
+	c->offered_at = offer->offered_at;
+}
+
+static void process_work_handler(struct k_work *work)
+{
+	struct conn_offer offer;
+	struct conn_event ev;
+	bool events = false;
+
+	/* Events first: a connect that completed clears pending_conn */
+	while (k_msgq_get(&event_q, &ev, K_NO_WAIT) == 0) {
+		handle_event(&ev);
+		bt_conn_unref(ev.conn);
+		events = true;
+	}
+
+	while (k_msgq_get(&offer_q, &offer, K_NO_WAIT) == 0) {
+		queue_offer(&offer);
+	}
+
+	if (!pending_conn) {
+		uint32_t now = k_uptime_get_32();
+		struct conn_candidate *c = pick_candidate(now);
+
+		if (c) {
+			connect_candidate(c, now);
+		}
+	}
+
+	/* The callbacks' scan restart saw the attempt still pending */
+	if (events && !pending_conn) {
+		scan_scheduler_update();
+	}
+}
+
+void conn_manager_offer(const struct device_info *dev_info)
+{
+	struct conn_offer offer;
+
+	bt_addr_le_copy(&offer.addr, &dev_info->addr);
+	offer.role = sensor_role_from_svc_mask(dev_info->svc_mask);
+	offer.saved = dev_info->is_saved;
+	offer.offered_at = k_uptime_get_32();
+
+	if (k_msgq_put(&offer_q, &offer, K_NO_WAIT) != 0) {
+		/* Backlog full; the candidate will be offered again */
+		return;
+	}
+
+	k_work_submit_to_queue(&conn_work_q, &process_work);
+}
+
+static void conn_timeout_handler(struct k_work *work)
+{
+	if (pending_conn) {
+		char addr[BT_ADDR_LE_STR_LEN];
+		bt_addr_le_to_str(bt_conn_get_dst(pending_conn), addr, sizeof(addr));
+		log("Connection timeout to %s, cancelling...\n", addr);
+
+		int err = bt_conn_disconnect(pending_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		if (err) {
+			log("Failed to cancel connection (err %d)\n", err);
+			bt_conn_unref(pending_conn);
+			pending_conn = NULL;
+			start_scan();
+		}
+	}
+}
+
+static void cancel_pending(struct bt_conn *conn)
+{
+	if (pending_conn && pending_conn == conn) {
+		k_work_cancel_delayable(&conn_timeout_work);
+		bt_conn_unref(pending_conn);
+		pending_conn = NULL;
+	}
+}
+
+static void handle_connected(struct bt_conn *conn, uint8_t err, uint32_t now)
+{
+	struct conn_stats *st = find_stats(bt_conn_get_dst(conn), false);
+
+	cancel_pending(conn);
+
+	if (st) {
+		if (err) {
+			record_failure(st, now);
+		} else {
+			st->successes++;
+			st->connected_at = now;
+			st->last_ttc_ms = now - st->attempt_start;
+			st->total_ttc_ms += st->last_ttc_ms;
+			log("[CONN] Connected after %u ms (attempt %u)\n",
+			       st->last_ttc_ms, st->attempts);
+		}
+		print_stats();
+	}
+}
+
+static void handle_disconnected(struct bt_conn *conn, uint32_t now)
+{
+	struct conn_stats *st = find_stats(bt_conn_get_dst(conn), false);
+
+	cancel_pending(conn);
+
+	if (st && st->connected_at != 0) {
+		if (now - st->connected_at < CONN_FLAP_WINDOW_MS) {
+			/* Flapping link, don't let it monopolise attempts */
+			record_failure(st, now);
+		} else {
+			st->consecutive_failures = 0;
+		}
+		st->connected_at = 0;
+	}
+}
+
+static void handle_event(const struct conn_event *ev)
+{
+	switch (ev->type) {
+	case CONN_EVENT_CONNECTED:
+		handle_connected(ev->conn, ev->err, ev->at);
+		break;
+	case CONN_EVENT_DISCONNECTED:
+		handle_disconnected(ev->conn, ev->at);
+		break;
+	}
+}
+
+static void post_event(struct bt_conn *conn, uint8_t type, uint8_t err)
+{
+	struct conn_event ev = {
+		.conn = bt_conn_ref(conn),
+		.at = k_uptime_get_32(),
+		.type = type,
+		.err = err,
+	};
+
+	if (k_msgq_put(&event_q, &ev, K_NO_WAIT) != 0) {
+		log("[CONN] Event queue full, connection event lost\n");
+		bt_conn_unref(ev.conn);
+		return;
+	}
+
+	/* Also lets the next queued candidate go */
+	k_work_submit_to_queue(&conn_work_q, &process_work);
+}
+
+void conn_manager_on_connected(struct bt_conn *conn, uint8_t err)
+{
+	post_event(conn, CONN_EVENT_CONNECTED, err);
+}
+
+void conn_manager_on_disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	post_event(conn, CONN_EVENT_DISCONNECTED, reason);
+}
+
+bool conn_manager_is_pending(void)
+{
+	return pending_conn != NULL;
+}
+
+static void print_stats(void)
+{
+	uint32_t now = k_uptime_get_32();
+	char addr[BT_ADDR_LE_STR_LEN];
+	bool first = true;
+
+	json_out("{\"type\":\"connstats\",\"ts\":%u,\"list\":[", now);
+	for (int i = 0; i < CONN_STATS_SIZE; i++) {
+		struct conn_stats *st = &stats[i];
+
+		if (!st->in_use) {
+			continue;
+		}
+
+		bt_addr_le_to_str(&st->addr, addr, sizeof(addr));
+		uint32_t success_pct = st->attempts ? (st->successes * 100U) / st->attempts : 0;
+		uint32_t avg_ttc = st->successes ? st->total_ttc_ms / st->successes : 0;
+		int32_t backoff = (int32_t)(st->backoff_until - now);
+
+		json_out("%s{\"addr\":\"%s\",\"attempts\":%u,\"successes\":%u,\"failures\":%u,"
+			 "\"success_pct\":%u,\"last_ttc_ms\":%u,\"avg_ttc_ms\":%u,\"backoff_ms\":%d}",
+			 first ? "" : ",", addr, st->attempts, st->successes, st->failures,
+			 success_pct, st->last_ttc_ms, avg_ttc,
+			 st->consecutive_failures > 0 && backoff > 0 ? backoff : 0);
+		first = false;
+	}
+	json_out("]}\n");
+}
+
+static void stats_print_handler(struct k_work *work)
+{
+	print_stats();
+}
+
+void conn_manager_print_stats(void)
+{
+	k_work_submit_to_queue(&conn_work_q, &stats_print_work);
+}
+
+static void stats_reset_handler(struct k_work *work)
+{
+	for (int i = 0; i < CONN_STATS_SIZE; i++) {
+		struct conn_stats *st = &stats[i];
+
+		st->attempts = 0;
+		st->successes = 0;
+		st->failures = 0;
+		st->last_ttc_ms = 0;
+		st->total_ttc_ms = 0;
+	}
+}
+
+void conn_manager_reset_stats(void)
+{
+	k_work_submit_to_queue(&conn_work_q, &stats_reset_work);
+}
+
+void conn_manager_init(void)
+{
+	k_work_init_delayable(&conn_timeout_work, conn_timeout_handler);
+	k_work_init(&process_work, process_work_handler);
+	k_work_init(&stats_print_work, stats_print_handler);
+	k_work_init(&stats_reset_work, stats_reset_handler);
+}
@@ -0,0 +1,41 @@
+/* conn_manager.h - Prioritized connection establishment */
+
+#ifndef CONN_MANAGER_H_
+#define CONN_MANAGER_H_
+
+#include <zephyr/bluetooth/conn.h>
+#include "common.h"
+
+/* Sensor roles in connection priority order */
+enum sensor_role {
+	SENSOR_ROLE_TRAINER,
+	SENSOR_ROLE_POWER,
+	SENSOR_ROLE_HR,
+	SENSOR_ROLE_COUNT,
+};
+
+void conn_manager_init(void);
+
+/* Offer a device seen while scanning as a connection candidate. Call with
+ * the device table locked; the fields needed are copied. */
+void conn_manager_offer(const struct device_info *dev_info);
+
+/* Connection callbacks, update metrics and backoff. The event is handed
+ * to the connection work queue with a reference held. */
+void conn_manager_on_connected(struct bt_conn *conn, uint8_t err);
+void conn_manager_on_disconnected(struct bt_conn *conn, uint8_t reason);
+
+/* True while a connection attempt is outstanding */
+bool conn_manager_is_pending(void);
+
+enum sensor_role sensor_role_from_svc_mask(uint8_t svc_mask);
+const char *sensor_role_str(enum sensor_role role);
+
+/* Emit per-device connection metrics as JSON, from the connection work queue */
+void conn_manager_print_stats(void);
+
+/* Zero attempt and time-to-connect metrics, backoff state is kept.
+ * Done on the connection work queue. */
+void conn_manager_reset_stats(void);
+
+#endif /* CONN_MANAGER_H_ */
@@ -0,0 +1,572 @@
+/* consumer_manager.c - Peripheral-side consumers (Zwift, apps, head units) */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <string.h>
+#include "common.h"
+#include "consumer_manager.h"
+#include "boot_milestone.h"
+#include "att_capture.h"
+#include "work_queues.h"
+
+/* Characteristics relayed by notification, registered on first use */
+#if defined(CONFIG_ZRELAY_GATT_MIRROR)
+/* Room for notifying trainer characteristics of mirrored services */
+#define CONSUMER_MAX_CHRCS 16
+#else
+#define CONSUMER_MAX_CHRCS 8
+#endif
+#define CONSUMER_NOTIFY_MAX_LEN 64
+/* Notifications per characteristic handed to the stack but not yet sent */
+#define CONSUMER_MAX_IN_FLIGHT 2
+/* Retry delay when a consumer's ATT TX buffers are exhausted */
+#define CONSUMER_RETRY_MS 5
+/* Indications waiting per consumer: a control point response for each
+ * queued trainer command, plus room for mirrored indications */
+#define CONSUMER_INDICATE_QUEUE 6
+
+struct consumer;
+
+/* Latest value of one characteristic for one consumer. A newer value
+ * replaces one that is still waiting, so a slow link skips samples of that
+ * characteristic instead of falling behind on all of them.
+ */
+struct consumer_chrc {
+	struct consumer *owner;
+	uint16_t len;
+	uint8_t data[CONSUMER_NOTIFY_MAX_LEN];
+	bool pending;
+	uint32_t queued_at;
+
+	/* Decremented by the completion callback */
+	atomic_t in_flight;
+	atomic_t completed;
+
+	uint32_t sent;
+	uint32_t superseded;
+	uint32_t retries;
+	uint32_t errors;
+	uint8_t max_in_flight;
+	/* Longest a value waited between consumer_notify and the stack */
+	uint32_t max_age_ms;
+};
+
+/* An indication waiting for its turn. Mirrored trainer indications may be
+ * dropped when the queue is full; control point responses are not. */
+struct consumer_ind {
+	const struct bt_gatt_attr *attr;
+	uint16_t len;
+	bool droppable;
+	uint8_t data[CONSUMER_INDICATE_MAX_LEN];
+};
+
+struct consumer {
+	struct bt_conn *conn;
+	uint32_t connected_at;
+
+	/* Latest values, indexed like chrc_attrs, sent by drain_work */
+	struct consumer_chrc chrcs[CONSUMER_MAX_CHRCS];
+	uint8_t next_chrc;
+	struct k_work_delayable drain_work;
+
+	/* Indications in order, the head is in flight while indicating.
+	 * Sent by indicate_work, the next one once the head is destroyed. */
+	struct consumer_ind ind_queue[CONSUMER_INDICATE_QUEUE];
+	uint8_t ind_head;
+	uint8_t ind_count;
+	bool indicating;
+	uint32_t ind_dropped;
+	struct bt_gatt_indicate_params ind_params;
+	struct k_work indicate_work;
+};
+
+static struct consumer consumers[MAX_PERIPHERAL_CONNECTIONS];
+
+/* Notified characteristic of each chrcs[] index, shared by all consumers */
+static const struct bt_gatt_attr *chrc_attrs[CONSUMER_MAX_CHRCS];
+
+/* Protects the latest values, set from the BT RX thread and sent from work */
+K_MUTEX_DEFINE(consumer_lock);
+
+static struct consumer *find_consumer(struct bt_conn *conn)
+{
+	for (int i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
+		if (consumers[i].conn && consumers[i].conn == conn) {
+			return &consumers[i];
+		}
+	}
+	return NULL;
+}
+
+/* Handle of the value attribute, attr may be the characteristic declaration */
+static uint16_t value_handle(const struct bt_gatt_attr *attr)
+{
+	uint16_t handle = bt_gatt_attr_value_handle(attr);
+
+	return handle ? handle : bt_gatt_attr_get_handle(attr);
+}
+
+/* Index of attr in chrc_attrs, registering it if new. Called with consumer_lock held */
+static int chrc_index(const struct bt_gatt_attr *attr)
+{
+	for (int i = 0; i < CONSUMER_MAX_CHRCS; i++) {
+		if (chrc_attrs[i] == attr) {
+			return i;
+		}
+		if (!chrc_attrs[i]) {
+			chrc_attrs[i] = attr;
+			return i;
+		}
+	}
+	return -ENOMEM;
+}
+
+static void reset_chrc_stats(struct consumer_chrc *ch)
+{
+	atomic_set(&ch->completed, 0);
+	ch->sent = 0;
+	ch->superseded = 0;
+	ch->retries = 0;
+	ch->errors = 0;
+	ch->max_in_flight = atomic_get(&ch->in_flight);
+	ch->max_age_ms = 0;
+}
+
+/* TX completion, called by the stack once the notification went out */
+static void consumer_notify_sent(struct bt_conn *conn, void *user_data)
+{
+	struct consumer_chrc *ch = user_data;
+	struct consumer *c = ch->owner;
+
+	/* Completions from a previous link on this slot were reset on connect */
+	if (c->conn != conn || atomic_get(&ch->in_flight) == 0) {
+		return;
+	}
+
+	atomic_dec(&ch->in_flight);
+	atomic_inc(&ch->completed);
+
+	if (ch->pending) {
+		k_work_schedule_for_queue(&relay_work_q, &c->drain_work, K_NO_WAIT);
+	}
+}
+
+static void drain_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct consumer *c = CONTAINER_OF(dwork, struct consumer, drain_work);
+	uint32_t now = k_uptime_get_32();
+
+	k_mutex_lock(&consumer_lock, K_FOREVER);
+
+	/* Round robin, so one busy characteristic cannot hold back the others */
+	for (int n = 0; c->conn && n < CONSUMER_MAX_CHRCS; n++) {
+		int i = (c->next_chrc + n) % CONSUMER_MAX_CHRCS;
+		struct consumer_chrc *ch = &c->chrcs[i];
+		struct bt_gatt_notify_params params = {
+			.attr = chrc_attrs[i],
+			.data = ch->data,
+			.len = ch->len,
+			.func = consumer_notify_sent,
+			.user_data = ch,
+		};
+		atomic_val_t in_flight;
+		int err;
+
+		/* At the in-flight limit, the completion callback reschedules */
+		if (!ch->pending || atomic_get(&ch->in_flight) >= CONSUMER_MAX_IN_FLIGHT) {
+			continue;
+		}
+
+		in_flight = atomic_inc(&ch->in_flight) + 1;
+		err = bt_gatt_notify_cb(c->conn, &params);
+
+		if (err == -ENOMEM) {
+			/* This consumer is slow, retry later without blocking others */
+			atomic_dec(&ch->in_flight);
+			ch->retries++;
+			c->next_chrc = i;
+			k_work_reschedule_for_queue(&relay_work_q, &c->drain_work, K_MSEC(CONSUMER_RETRY_MS));
+			break;
+		}
+
+		ch->pending = false;
+		c->next_chrc = (i + 1) % CONSUMER_MAX_CHRCS;
+
+		if (err) {
+			atomic_dec(&ch->in_flight);
+			ch->errors++;
+			continue;
+		}
+
+		ch->sent++;
+		if (in_flight > ch->max_in_flight) {
+			ch->max_in_flight = in_flight;
+		}
+		if (now - ch->queued_at > ch->max_age_ms) {
+			ch->max_age_ms = now - ch->queued_at;
+		}
+		boot_milestone(BOOT_FIRST_RELAY);
+		att_capture(c->conn, ATT_CAPTURE_TX, ATT_OP_NOTIFY, value_handle(params.attr),
+			    ch->data, ch->len);
+	}
+
+	k_mutex_unlock(&consumer_lock);
+}
+
+void consumer_notify(const struct bt_gatt_attr *attr, const void *data, uint16_t len)
+{
+	int idx;
+
+	if (len > CONSUMER_NOTIFY_MAX_LEN) {
+		log_info(RELAY, "[Consumer] Notification too long (%u), dropping\n", len);
+		return;
+	}
+
+	k_mutex_lock(&consumer_lock, K_FOREVER);
+
+	idx = chrc_index(attr);
+	if (idx < 0) {
+		k_mutex_unlock(&consumer_lock);
+		log_info(RELAY, "[Consumer] No slot for characteristic 0x%04x, dropping\n",
+			 value_handle(attr));
+		return;
+	}
+
+	for (int i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
+		struct consumer *c = &consumers[i];
+		struct consumer_chrc *ch = &c->chrcs[idx];
+
+		if (!c->conn || !bt_gatt_is_subscribed(c->conn, attr, BT_GATT_CCC_NOTIFY)) {
+			continue;
+		}
+
+		if (ch->pending) {
+			/* Newest wins, the consumer never sees the replaced value */
+			ch->superseded++;
+		} else {
+			ch->queued_at = k_uptime_get_32();
+		}
+		ch->len = len;
+		memcpy(ch->data, data, len);
+		ch->pending = true;
+
+		k_work_schedule_for_queue(&relay_work_q, &c->drain_work, K_NO_WAIT);
+	}
+
+	k_mutex_unlock(&consumer_lock);
+}
+
+static void consumer_indicate_cb(struct bt_conn *conn,
+				 struct bt_gatt_indicate_params *params, uint8_t err)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+	if (err) {
+		log_info(RELAY, "[Consumer] Indication to %s failed (err %d)\n", addr, err);
+	} else {
+		att_capture(conn, ATT_CAPTURE_RX, ATT_OP_CONFIRM, 0, NULL, 0);
+		log_debug(RELAY, "[Consumer] Indication acknowledged by %s\n", addr);
+	}
+}
+
+/* Drop the head once it is done with. Called with consumer_lock held */
+static void ind_pop(struct consumer *c)
+{
+	c->indicating = false;
+	c->ind_head = (c->ind_head + 1) % CONSUMER_INDICATE_QUEUE;
+	c->ind_count--;
+	if (c->ind_count > 0) {
+		k_work_submit_to_queue(&relay_work_q, &c->indicate_work);
+	}
+}
+
+static void consumer_indicate_destroy(struct bt_gatt_indicate_params *params)
+{
+	struct consumer *c = CONTAINER_OF(params, struct consumer, ind_params);
+
+	k_mutex_lock(&consumer_lock, K_FOREVER);
+	/* Not indicating: from a previous link on this slot */
+	if (c->indicating) {
+		ind_pop(c);
+	}
+	k_mutex_unlock(&consumer_lock);
+}
+
+static void indicate_work_handler(struct k_work *work)
+{
+	struct consumer *c = CONTAINER_OF(work, struct consumer, indicate_work);
+	struct consumer_ind *ind;
+	int err;
+
+	k_mutex_lock(&consumer_lock, K_FOREVER);
+	if (!c->conn || c->indicating || c->ind_count == 0) {
+		k_mutex_unlock(&consumer_lock);
+		return;
+	}
+
+	/* The head stays put until destroyed, the stack points at its data */
+	ind = &c->ind_queue[c->ind_head];
+	c->ind_params.attr = ind->attr;
+	c->ind_params.func = consumer_indicate_cb;
+	c->ind_params.destroy = consumer_indicate_destroy;
+	c->ind_params.data = ind->data;
+	c->ind_params.len = ind->len;
+	c->indicating = true;
+
+	err = bt_gatt_indicate(c->conn, &c->ind_params);
+	if (err) {
+		log_info(RELAY, "[Consumer] Failed to send indication (err %d)\n", err);
+		if (c->indicating) {
+			ind_pop(c);
+		}
+	} else {
+		att_capture(c->conn, ATT_CAPTURE_TX, ATT_OP_INDICATE, value_handle(ind->attr),
+			    ind->data, ind->len);
+	}
+	k_mutex_unlock(&consumer_lock);
+}
+
+/* Make room by dropping the oldest droppable entry that is not in flight.
+ * Called with consumer_lock held. */
+static bool ind_evict(struct consumer *c)
+{
+	for (int n = c->indicating ? 1 : 0; n < c->ind_count; n++) {
+		int i = (c->ind_head + n) % CONSUMER_INDICATE_QUEUE;
+
+		if (!c->ind_queue[i].droppable) {
+			continue;
+		}
+
+		/* Close the gap, keeping the order of the rest */
+		for (; n < c->ind_count - 1; n++) {
+			int next = (c->ind_head + n + 1) % CONSUMER_INDICATE_QUEUE;
+
+			c->ind_queue[(c->ind_head + n) % CONSUMER_INDICATE_QUEUE] = c->ind_queue[next];
+		}
+		c->ind_count--;
+		c->ind_dropped++;
+		return true;
+	}
+	return false;
+}
+
+static int ind_queue(struct consumer *c, const struct bt_gatt_attr *attr,
+		     const void *data, uint16_t len, bool droppable)
+{
+	struct consumer_ind *ind;
+	int err = 0;
+
+	if (!bt_gatt_is_subscribed(c->conn, attr, BT_GATT_CCC_INDICATE)) {
+		log_info(RELAY, "[Consumer] Cannot send indication - CCC not configured\n");
+		return -EINVAL;
+	}
+
+	if (len > CONSUMER_INDICATE_MAX_LEN) {
+		log_info(RELAY, "[Consumer] Indication too long (%u), truncating\n", len);
+		len = CONSUMER_INDICATE_MAX_LEN;
+	}
+
+	k_mutex_lock(&consumer_lock, K_FOREVER);
+	if (c->ind_count == CONSUMER_INDICATE_QUEUE && (droppable || !ind_evict(c))) {
+		c->ind_dropped++;
+		err = -ENOMEM;
+	} else {
+		ind = &c->ind_queue[(c->ind_head + c->ind_count) % CONSUMER_INDICATE_QUEUE];
+		ind->attr = attr;
+		ind->len = len;
+		ind->droppable = droppable;
+		memcpy(ind->data, data, len);
+		c->ind_count++;
+		k_work_submit_to_queue(&relay_work_q, &c->indicate_work);
+	}
+	k_mutex_unlock(&consumer_lock);
+
+	if (err) {
+		log_info(RELAY, "[Consumer] Indication queue full, dropping\n");
+	}
+	return err;
+}
+
+int consumer_indicate(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+		      const void *data, uint16_t len)
+{
+	struct consumer *c = find_consumer(conn);
+
+	if (!c) {
+		return -ENOTCONN;
+	}
+
+	return ind_queue(c, attr, data, len, false);
+}
+
+void consumer_indicate_all(const struct bt_gatt_attr *attr, const void *data, uint16_t len)
+{
+	for (int i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
+		struct consumer *c = &consumers[i];
+
+		if (c->conn && bt_gatt_is_subscribed(c->conn, attr, BT_GATT_CCC_INDICATE)) {
+			ind_queue(c, attr, data, len, true);
+		}
+	}
+}
+
+int consumer_connected(struct bt_conn *conn)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+
+	if (find_consumer(conn)) {
+		return 0;
+	}
+
+	for (int i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
+		struct consumer *c = &consumers[i];
+
+		if (c->conn) {
+			continue;
+		}
+
+		k_mutex_lock(&consumer_lock, K_FOREVER);
+		c->conn = bt_conn_ref(conn);
+		c->connected_at = k_uptime_get_32();
+		c->next_chrc = 0;
+		c->indicating = false;
+		c->ind_head = 0;
+		c->ind_count = 0;
+		c->ind_dropped = 0;
+		for (int j = 0; j < CONSUMER_MAX_CHRCS; j++) {
+			struct consumer_chrc *ch = &c->chrcs[j];
+
+			ch->pending = false;
+			atomic_set(&ch->in_flight, 0);
+			reset_chrc_stats(ch);
+		}
+		k_mutex_unlock(&consumer_lock);
+
+		log_info(RELAY, "[Consumer] %s connected as consumer %d\n", addr, i);
+		return 0;
+	}
+
+	log_info(RELAY, "[Consumer] No consumer slot for %s\n", addr);
+	return -ENOMEM;
+}
+
+void consumer_disconnected(struct bt_conn *conn)
+{
+	struct consumer *c = find_consumer(conn);
+	uint32_t sent = 0;
+	uint32_t superseded = 0;
+
+	if (!c) {
+		return;
+	}
+
+	k_work_cancel_delayable(&c->drain_work);
+	k_work_cancel(&c->indicate_work);
+
+	k_mutex_lock(&consumer_lock, K_FOREVER);
+	for (int i = 0; i < CONSUMER_MAX_CHRCS; i++) {
+		sent += c->chrcs[i].sent;
+		superseded += c->chrcs[i].superseded;
+		c->chrcs[i].pending = false;
+	}
+	c->ind_count = 0;
+	c->indicating = false;
+	log_info(RELAY, "[Consumer] Consumer %d disconnected (sent %u, superseded %u)\n",
+	    (int)(c - consumers), sent, superseded);
+	bt_conn_unref(c->conn);
+	c->conn = NULL;
+	k_mutex_unlock(&consumer_lock);
+}
+
+bool consumer_is_connected(struct bt_conn *conn)
+{
+	return find_consumer(conn) != NULL;
+}
+
+int consumer_count(void)
+{
+	int count = 0;
+
+	for (int i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
+		if (consumers[i].conn) {
+			count++;
+		}
+	}
+	return count;
+}
+
+void consumer_print_stats(void)
+{
+	uint32_t now = k_uptime_get_32();
+	char addr[BT_ADDR_LE_STR_LEN];
+	bool first = true;
+
+	k_mutex_lock(&consumer_lock, K_FOREVER);
+	json_out("{\"type\":\"consumers\",\"ts\":%u,\"list\":[", now);
+	for (int i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
+		struct consumer *c = &consumers[i];
+		bool first_chrc = true;
+
+		if (!c->conn) {
+			continue;
+		}
+
+		bt_addr_le_to_str(bt_conn_get_dst(c->conn), addr, sizeof(addr));
+		json_out("%s{\"slot\":%d,\"addr\":\"%s\",\"uptime_ms\":%u,\"ind_queued\":%u,"
+			 "\"ind_dropped\":%u,\"chrcs\":[",
+			 first ? "" : ",", i, addr, now - c->connected_at, c->ind_count,
+			 c->ind_dropped);
+		first = false;
+
+		/* sent - completed - in_flight is what the stack dropped without sending */
+		for (int j = 0; j < CONSUMER_MAX_CHRCS; j++) {
+			struct consumer_chrc *ch = &c->chrcs[j];
+
+			if (!chrc_attrs[j] || (!ch->sent && !ch->superseded && !ch->errors && !ch->pending)) {
+				continue;
+			}
+
+			json_out("%s{\"handle\":%u,\"sent\":%u,\"completed\":%u,\"in_flight\":%u,"
+				 "\"max_in_flight\":%u,\"superseded\":%u,\"retries\":%u,"
+				 "\"errors\":%u,\"pending\":%u,\"max_age_ms\":%u}",
+				 first_chrc ? "" : ",", value_handle(chrc_attrs[j]), ch->sent,
+				 (uint32_t)atomic_get(&ch->completed),
+				 (uint32_t)atomic_get(&ch->in_flight), ch->max_in_flight,
+				 ch->superseded, ch->retries, ch->errors, ch->pending,
+				 ch->max_age_ms);
+			first_chrc = false;
+		}
+		json_out("]}");
+	}
+	json_out("]}\n");
+	k_mutex_unlock(&consumer_lock);
+}
+
+void consumer_reset_stats(void)
+{
+	k_mutex_lock(&consumer_lock, K_FOREVER);
+	for (int i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
+		consumers[i].ind_dropped = 0;
+		for (int j = 0; j < CONSUMER_MAX_CHRCS; j++) {
+			reset_chrc_stats(&consumers[i].chrcs[j]);
+		}
+	}
+	k_mutex_unlock(&consumer_lock);
+}
+
+void consumer_manager_init(void)
+{
+	for (int i = 0; i < MAX_PERIPHERAL_CONNECTIONS; i++) {
+		for (int j = 0; j < CONSUMER_MAX_CHRCS; j++) {
+			consumers[i].chrcs[j].owner = &consumers[i];
+		}
+		k_work_init_delayable(&consumers[i].drain_work, drain_work_handler);
+		k_work_init(&consumers[i].indicate_work, indicate_work_handler);
+	}
+}
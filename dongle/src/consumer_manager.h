@@ -0,0 +1,44 @@
+/* consumer_manager.h - Peripheral-side consumers (Zwift, apps, head units) */
+
+#ifndef CONSUMER_MANAGER_H_
+#define CONSUMER_MANAGER_H_
+
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include "common.h"
+
+/* Largest indication payload, fits the default ATT MTU */
+#define CONSUMER_INDICATE_MAX_LEN 20
+
+void consumer_manager_init(void);
+
+/* Peripheral link callbacks, return 0 or -ENOMEM when all consumer slots are used */
+int consumer_connected(struct bt_conn *conn);
+void consumer_disconnected(struct bt_conn *conn);
+
+/* True if conn is a connected consumer */
+bool consumer_is_connected(struct bt_conn *conn);
+int consumer_count(void);
+
+/* Notify every consumer subscribed to attr. A value of the same
+ * characteristic still waiting for TX buffers is replaced (newest wins) */
+void consumer_notify(const struct bt_gatt_attr *attr, const void *data, uint16_t len);
+
+/* Queue an indication to a single consumer, sent in order once the previous
+ * one is acknowledged. Used for control point responses, which are never
+ * dropped for a mirrored indication; -ENOMEM only with the queue full of
+ * responses. */
+int consumer_indicate(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+		      const void *data, uint16_t len);
+
+/* Indicate to every consumer subscribed to attr. These are dropped first
+ * when a consumer's indication queue is full. */
+void consumer_indicate_all(const struct bt_gatt_attr *attr, const void *data, uint16_t len);
+
+/* Emit per-consumer, per-characteristic TX metrics as JSON */
+void consumer_print_stats(void);
+
+/* Zero the per-consumer counters */
+void consumer_reset_stats(void);
+
+#endif /* CONSUMER_MANAGER_H_ */
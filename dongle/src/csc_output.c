@@ -0,0 +1,66 @@
+/* csc_output.c - CSC Measurements with wheel data synthesized from trainer speed
+ *
+ * Integrates the trainer's instantaneous speed into cumulative wheel
+ * revolutions and sends them, with the power meter's crank data when it is
+ * fresh, every CONFIG_ZRELAY_CSC_INTERVAL_MS. The rate does not follow CP
+ * notifications, so wheel speed keeps updating without a power meter.
+ */
+
+#include <zephyr/kernel.h>
+#include "common.h"
+#include "csc_output.h"
+#include "consumer_manager.h"
+#include "gatt_services.h"
+#include "relay_config.h"
+#include "work_queues.h"
+
+/* A speed older than this counts as stopped, the wheel stops turning */
+#define CSC_SPEED_TIMEOUT_MS 3000
+
+/* Set from the BT RX thread and read from relay work, both cooperative */
+static uint16_t last_speed;
+static uint32_t last_speed_at;
+static bool have_speed;
+
+static struct rc_wheel wheel;
+static uint32_t last_tick;
+static struct k_work_delayable csc_work;
+
+void csc_output_speed(uint16_t speed, uint32_t now)
+{
+	last_speed = speed;
+	last_speed_at = now;
+	have_speed = true;
+}
+
+static void csc_work_handler(struct k_work *work)
+{
+	uint32_t now = k_uptime_get_32();
+	bool crank = cached_cp_data.crank.valid &&
+		     (now - cached_cp_data.timestamp) < CP_TIMEOUT_MS;
+
+	k_work_reschedule_for_queue(&relay_work_q, &csc_work, K_MSEC(CONFIG_ZRELAY_CSC_INTERVAL_MS));
+
+	if (have_speed) {
+		uint16_t speed = (now - last_speed_at) < CSC_SPEED_TIMEOUT_MS ? last_speed : 0;
+
+		rc_wheel_update(&wheel, speed, now - last_tick,
+				relay_config_get(RELAY_CFG_WHEEL_MM));
+	}
+	last_tick = now;
+
+	if (!have_speed && !crank) {
+		return;
+	}
+
+	csc_measurement_len = rc_csc_encode(csc_measurement, have_speed ? &wheel : NULL,
+					    crank ? &cached_cp_data.crank : NULL);
+	consumer_notify(&csc_svc.attrs[1], csc_measurement, csc_measurement_len);
+}
+
+void csc_output_init(void)
+{
+	last_tick = k_uptime_get_32();
+	k_work_init_delayable(&csc_work, csc_work_handler);
+	k_work_schedule_for_queue(&relay_work_q, &csc_work, K_MSEC(CONFIG_ZRELAY_CSC_INTERVAL_MS));
+}
@@ -0,0 +1,14 @@
+/* csc_output.h - CSC Measurements with wheel data synthesized from trainer speed */
+
+#ifndef CSC_OUTPUT_H_
+#define CSC_OUTPUT_H_
+
+#include <stdint.h>
+
+/* Start the fixed rate CSC Measurement generator */
+void csc_output_init(void);
+
+/* Latest FTMS instantaneous speed (0.01 km/h), from the Indoor Bike Data handler */
+void csc_output_speed(uint16_t speed, uint32_t now);
+
+#endif /* CSC_OUTPUT_H_ */
@@ -11,14 +11,18 @@
 #include <stdio.h>
 #include "common.h"
 #include "device_manager.h"
+#include "device_table.h"
 #include "nvs_storage.h"
+#include "boot_milestone.h"
 #include "led_feedback.h"
+#include "scan_scheduler.h"
+#include "conn_manager.h"
+#include "work_queues.h"
 
-sys_slist_t device_list;
-
-/* Connection timeout work */
-static struct k_work_delayable conn_timeout_work;
-static struct bt_conn *pending_conn = NULL;
+/* Devices not seen for this long are dropped from the table */
+#define DEVICE_MAX_AGE_MS 10000
+#define DEVICE_EXPIRE_INTERVAL_MS 1000
+static uint32_t last_expire_time;
 
 /* Scan window control - only scan during active window */
 static bool scan_window_active = false;
@@ -29,27 +33,16 @@ void print_device_list(void)
 	struct device_info *dev_info;
 	char addr[BT_ADDR_LE_STR_LEN];
 	uint32_t now = k_uptime_get_32();
-	int count = 0;
-
-	/* Count devices first */
-	SYS_SLIST_FOR_EACH_CONTAINER(&device_list, dev_info, node) {
-		count++;
-	}
+	int count;
 
+	device_table_lock();
+	count = device_table_count();
 	json_out("{\"type\":\"devices\",\"ts\":%u,\"count\":%d,\"list\":[", now, count);
 	
 	int idx = 0;
-	SYS_SLIST_FOR_EACH_CONTAINER(&device_list, dev_info, node) {
-		bool is_connected = false;
-		for (int i = 0; i < MAX_CONNECTIONS; i++) {
-			if (connections[i].conn) {
-				const bt_addr_le_t *conn_addr = bt_conn_get_dst(connections[i].conn);
-				if (!bt_addr_le_cmp(conn_addr, &dev_info->addr)) {
-					is_connected = true;
-					break;
-				}
-			}
-		}
+	DEVICE_TABLE_FOREACH(dev_info) {
+		bool is_connected = dev_info->conn_slot >= 0 &&
+				    connections[dev_info->conn_slot].conn != NULL;
 		bt_addr_le_to_str(&dev_info->addr, addr, sizeof(addr));
 		json_out("{\"name\":\"%s\",\"addr\":\"%s\",\"connected\":%s,\"saved\":%s,\"battery_level\":",
 		       dev_info->name, addr, is_connected ? "true" : "false", 
@@ -66,32 +59,7 @@ void print_device_list(void)
 		idx++;
 	}
 	json_out("]}\n");
-}
-
-static void conn_timeout_handler(struct k_work *work)
-{
-	if (pending_conn) {
-		char addr[BT_ADDR_LE_STR_LEN];
-		bt_addr_le_to_str(bt_conn_get_dst(pending_conn), addr, sizeof(addr));
-		log("Connection timeout to %s, cancelling...\n", addr);
-		
-		int err = bt_conn_disconnect(pending_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
-		if (err) {
-			log("Failed to cancel connection (err %d)\n", err);
-			bt_conn_unref(pending_conn);
-			pending_conn = NULL;
-			start_scan();
-		}
-	}
-}
-
-void cancel_connection_timeout(struct bt_conn *conn)
-{
-	if (pending_conn && pending_conn == conn) {
-		k_work_cancel_delayable(&conn_timeout_work);
-		bt_conn_unref(pending_conn);
-		pending_conn = NULL;
-	}
+	device_table_unlock();
 }
 
 static bool eir_found(struct bt_data *data, void *user_data)
@@ -169,26 +137,32 @@ static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
 		return;
 	}
 
-	uint32_t now = k_uptime_get_32();
+	/* Passive reconnect scans get no scan response; fall back to what
+	 * was stored for saved devices */
+	if (parse_ctx.name[0] == '\0' || parse_ctx.svc_mask == 0) {
+		char saved_name[sizeof(parse_ctx.name)];
 
-	struct device_info *dev_info = NULL;
-	struct device_info *iter;
-	bool found = false;
-	SYS_SLIST_FOR_EACH_CONTAINER(&device_list, iter, node) {
-		if (!bt_addr_le_cmp(&iter->addr, addr)) {
-			dev_info = iter;
-			found = true;
-			break;
+		if (nvs_get_saved_name(addr, saved_name, sizeof(saved_name))) {
+			if (parse_ctx.name[0] == '\0') {
+				memcpy(parse_ctx.name, saved_name, sizeof(parse_ctx.name));
+			}
+			parse_ctx.svc_mask |= nvs_get_saved_svc_mask(addr);
 		}
 	}
 
-	if (found && dev_info) {
+	uint32_t now = k_uptime_get_32();
+
+	device_table_lock();
+
+	struct device_info *dev_info = device_table_find(addr);
+
+	if (dev_info) {
 		if (parse_ctx.name[0] != '\0' && strcmp(dev_info->name, parse_ctx.name) != 0) {
 			bool was_address = (strcmp(dev_info->name, dev) == 0);
 			strncpy(dev_info->name, parse_ctx.name, sizeof(dev_info->name) - 1);
 			dev_info->name[sizeof(dev_info->name) - 1] = '\0';
 			if (was_address) {
-				log("Captured name for device: %s (%s)\n", dev_info->name, dev);
+				log_debug(SCAN, "Captured name for device: %s (%s)\n", dev_info->name, dev);
 			}
 		}
 		dev_info->last_seen = now;
@@ -197,47 +171,43 @@ static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
 		dev_info->rssi = rssi;  /* Update RSSI from latest advertisement */
 		/* Check if device is saved */
 		dev_info->is_saved = nvs_is_device_saved(&dev_info->addr);
-	} else if (!found) {
+	} else {
 		/* Only track saved devices, or any device during scan window */
 		bool is_saved = nvs_is_device_saved(addr);
 		
 		/* Outside scan window: only track saved devices */
 		if (!scan_window_active && !is_saved) {
+			device_table_unlock();
 			return;
 		}
 		
 		/* During scan window: track devices with relevant services */
 		if (scan_window_active && parse_ctx.svc_mask == 0 && !is_saved) {
 			/* Skip devices without HR/CP/FTMS services */
+			device_table_unlock();
 			return;
 		}
 		
-		dev_info = k_malloc(sizeof(struct device_info));
-		if (dev_info) {
-			memcpy(&dev_info->addr, addr, sizeof(bt_addr_le_t));
-			if (parse_ctx.name[0] != '\0') {
-				strncpy(dev_info->name, parse_ctx.name, sizeof(dev_info->name) - 1);
-				dev_info->name[sizeof(dev_info->name) - 1] = '\0';
-			} else {
-				strncpy(dev_info->name, dev, sizeof(dev_info->name) - 1);
-				dev_info->name[sizeof(dev_info->name) - 1] = '\0';
-			}
-			dev_info->svc_mask = parse_ctx.svc_mask;
-			dev_info->has_battery_service = parse_ctx.has_battery_service;
-			dev_info->battery_level = -1;
-			dev_info->last_seen = now;
-			dev_info->is_saved = is_saved;
-			dev_info->rssi = rssi;  /* Store RSSI from advertisement */
-			sys_slist_append(&device_list, &dev_info->node);
-			log("Added device: %s (svc_mask=%d, saved=%d)\n", dev_info->name, dev_info->svc_mask, is_saved);
-			print_device_list();
-		} else {
-			log("ERROR: Failed to allocate memory for device %s\n", dev);
+		dev_info = device_table_insert(addr);
+		if (!dev_info) {
+			log_info(SCAN, "ERROR: Device table full, dropping %s\n", dev);
+			device_table_unlock();
 			return;
 		}
-	} else {
-		log("ERROR: found=true but dev_info=NULL for %s\n", dev);
-		return;
+
+		if (parse_ctx.name[0] != '\0') {
+			strncpy(dev_info->name, parse_ctx.name, sizeof(dev_info->name) - 1);
+		} else {
+			strncpy(dev_info->name, dev, sizeof(dev_info->name) - 1);
+		}
+		dev_info->name[sizeof(dev_info->name) - 1] = '\0';
+		dev_info->svc_mask = parse_ctx.svc_mask;
+		dev_info->has_battery_service = parse_ctx.has_battery_service;
+		dev_info->last_seen = now;
+		dev_info->is_saved = is_saved;
+		dev_info->rssi = rssi;  /* Store RSSI from advertisement */
+		log_info(SCAN, "Added device: %s (svc_mask=%d, saved=%d)\n", dev_info->name, dev_info->svc_mask, is_saved);
+		print_device_list();
 	}
 
 	/* Attempt connection if device has known services */
@@ -245,134 +215,30 @@ static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
 	    dev_info->name[0] != '\0' && strcmp(dev_info->name, dev) != 0) {
 		
 		/* Check if already connected first to avoid spam */
-		bool already_connected = false;
-		for (int i = 0; i < MAX_CONNECTIONS; i++) {
-			if (connections[i].conn) {
-				const bt_addr_le_t *conn_addr = bt_conn_get_dst(connections[i].conn);
-				if (!bt_addr_le_cmp(conn_addr, addr)) {
-					already_connected = true;
-					break;
-				}
-			}
-		}
+		bool already_connected = dev_info->conn_slot >= 0;
 
 		/* Saved devices can connect anytime; non-saved only during scan window */
-		if (!already_connected && !dev_info->is_saved) {
-			if (!scan_window_active) {
-				/* Skip non-saved devices outside scan window */
-				return;
-			}
-		}
-
-		if (!already_connected) {
-			int free_slot = -1;
-			for (int i = 0; i < MAX_CONNECTIONS; i++) {
-				if (!connections[i].conn) {
-					free_slot = i;
-					break;
-				}
-			}
-
-			if (free_slot >= 0) {
-				struct bt_le_conn_param *param = BT_LE_CONN_PARAM_DEFAULT;
-				int err;
-
-				/* Clear the slot to ensure clean state for new connection */
-				memset(&connections[free_slot].subscribe_params, 0, 
-				       sizeof(connections[free_slot].subscribe_params));
-				memset(&connections[free_slot].service_type, 0,
-				       sizeof(connections[free_slot].service_type));
-				connections[free_slot].subscribe_count = 0;
-				connections[free_slot].discover_service_index = 0;
-				connections[free_slot].ftms_control_point_handle = 0;
-				connections[free_slot].temp_value_handle = 0;
-
-				err = bt_le_scan_stop();
-				if (err) {
-					log("Stop LE scan failed (err %d)\n", err);
-				} else {
-					log("Creating connection to %s (slot %d)\n", dev_info->name, free_slot);
-					struct bt_conn_le_create_param create_param = *BT_CONN_LE_CREATE_CONN;
-					create_param.options = 0;
-					
-					err = bt_conn_le_create(&dev_info->addr, &create_param, param, &connections[free_slot].conn);
-					if (err) {
-						log("Create connection failed (err %d)\n", err);
-						connections[free_slot].conn = NULL;
-						start_scan();
-					} else {
-						pending_conn = bt_conn_ref(connections[free_slot].conn);
-						k_work_schedule(&conn_timeout_work, K_SECONDS(10));
-					}
-				}
-			}
-		}
-	}
-
-	/* Clean up old devices */
-	struct device_info *next;
-	SYS_SLIST_FOR_EACH_CONTAINER_SAFE(&device_list, dev_info, next, node) {
-		bool is_connected = false;
-		for (int i = 0; i < MAX_CONNECTIONS; i++) {
-			if (connections[i].conn) {
-				const bt_addr_le_t *conn_addr = bt_conn_get_dst(connections[i].conn);
-				if (!bt_addr_le_cmp(conn_addr, &dev_info->addr)) {
-					is_connected = true;
-					dev_info->last_seen = now;
-					break;
-				}
-			}
-		}
-		
-		/* Remove devices not seen in 10 seconds, unless connected */
-		if (now - dev_info->last_seen > 10000) {
-			if (!is_connected) {
-				log("Removed device: %s\n", dev_info->name);
-				print_device_list();
-				sys_slist_find_and_remove(&device_list, &dev_info->node);
-				k_free(dev_info);
-			}
+		if (!already_connected && (dev_info->is_saved || scan_window_active)) {
+			conn_manager_offer(dev_info);
 		}
 	}
-}
-
-static void _start_scan_internal(void)
-{
-	int err;
-
-	struct bt_le_scan_param scan_param = {
-		.type       = BT_LE_SCAN_TYPE_ACTIVE,
-		.options    = BT_LE_SCAN_OPT_CODED,
-		.interval   = BT_GAP_SCAN_FAST_INTERVAL,
-		.window     = BT_GAP_SCAN_FAST_WINDOW,
-	};
-
-	err = bt_le_scan_start(&scan_param, device_found);
-	if (err) {
-		if (err == -EALREADY) {
-			return;
-		}
-		log("Scanning with Coded PHY support failed (err %d)\n", err);
 
-		log("Scanning without Coded PHY\n");
-		scan_param.options &= ~BT_LE_SCAN_OPT_CODED;
-		err = bt_le_scan_start(&scan_param, device_found);
-		if (err && err != -EALREADY) {
-			log("Scanning failed to start (err %d)\n", err);
-			return;
+	/* Age out stale devices; connected entries are kept by the table */
+	if (now - last_expire_time >= DEVICE_EXPIRE_INTERVAL_MS) {
+		last_expire_time = now;
+		if (device_table_expire(now, DEVICE_MAX_AGE_MS) > 0) {
+			print_device_list();
 		}
 	}
 
-	if (scan_window_active) {
-		log("Scanning successfully started (window active)\n");
-	} else {
-		log("Scanning successfully started\n");
-	}
+	device_table_unlock();
 }
 
 void start_scan(void)
 {
-	_start_scan_internal();
+	/* Called from the BT RX thread as well; the scan state and
+	 * conn_manager's pending attempt are only consistent on conn_work_q */
+	scan_scheduler_request_update();
 }
 
 void start_advertising(const char *device_name)
@@ -380,10 +246,7 @@ void start_advertising(const char *device_name)
 	int err;
 	
 	/* Stop scanning first to free up resources for advertising */
-	err = bt_le_scan_stop();
-	if (err && err != -EALREADY) {
-		log("Failed to stop scan for advertising (err %d)\n", err);
-	}
+	scan_scheduler_suspend();
 	
 	/* Stop advertising first if it's already running */
 	err = bt_le_adv_stop();
@@ -416,53 +279,51 @@ void start_advertising(const char *device_name)
 	}
 
 	log("Advertising as '%s' started\n", device_name);
+	boot_milestone(BOOT_ADVERTISING);
 	
-	/* Restart scanning so saved devices can reconnect while advertising */
+	/* Resume scanning if saved devices are still missing */
 	start_scan();
 }
 
 static void scan_window_timeout_handler(struct k_work *work)
 {
-	log("Scan window expired - resuming normal scanning\n");
+	log_info(SCAN, "Scan window expired - resuming normal scanning\n");
 	scan_window_active = false;
 	
 	/* Update LED feedback for scan window end */
 	led_feedback_update();
 	
-	/* Restart scanning to allow saved devices to reconnect normally */
+	/* Drop back to reconnect scanning (or none if nothing is missing) */
 	start_scan();
 }
 
 void start_scan_window(uint32_t duration_ms)
 {
 	scan_window_active = true;
-	log("Scan window started for %u ms\n", duration_ms);
+	log_info(SCAN, "Scan window started for %u ms\n", duration_ms);
 	
 	/* Update LED feedback for scan window start */
 	led_feedback_update();
 
 	/* Schedule timeout to close window */
-	k_work_reschedule_for_queue(&k_sys_work_q, &scan_window_timeout,
+	k_work_reschedule_for_queue(&conn_work_q, &scan_window_timeout,
 	                           K_MSEC(duration_ms));
 
-	/* Start scanning immediately */
-	_start_scan_internal();
+	/* Switch to pairing scan immediately */
+	start_scan();
 }
 
 void stop_scan_window(void)
 {
 	if (scan_window_active) {
-		int err = bt_le_scan_stop();
-		if (err && err != -EALREADY) {
-			log("Failed to stop scan (err %d)\n", err);
-		}
 		k_work_cancel_delayable(&scan_window_timeout);
 		scan_window_active = false;
 		
 		/* Update LED feedback for scan window stop */
 		led_feedback_update();
 		
-		log("Scan window stopped\n");
+		log_info(SCAN, "Scan window stopped\n");
+		start_scan();
 	}
 }
 
@@ -485,31 +346,29 @@ void disconnect_all_devices(void)
 
 void save_connected_device(struct bt_conn *conn)
 {
-	/* Find device in list */
-	const bt_addr_le_t *addr = bt_conn_get_dst(conn);
 	struct device_info *dev_info;
-	
-	SYS_SLIST_FOR_EACH_CONTAINER(&device_list, dev_info, node) {
-		if (!bt_addr_le_cmp(&dev_info->addr, addr)) {
-			/* Save device to NVS if not already saved */
-			if (!dev_info->is_saved) {
-				int err = nvs_save_device(&dev_info->addr, dev_info->name, dev_info->svc_mask);
-				if (err == 0) {
-					dev_info->is_saved = true;
-					log("Auto-saved connected device: %s\n", dev_info->name);
-				} else {
-					log("Failed to save device %s (err %d)\n", dev_info->name, err);
-				}
-			}
-			break;
+
+	device_table_lock();
+	dev_info = device_table_find(bt_conn_get_dst(conn));
+
+	/* Save device to NVS if not already saved */
+	if (dev_info && !dev_info->is_saved) {
+		int err = nvs_save_device(&dev_info->addr, dev_info->name, dev_info->svc_mask);
+		if (err == 0) {
+			dev_info->is_saved = true;
+			log("Auto-saved connected device: %s\n", dev_info->name);
+		} else {
+			log("Failed to save device %s (err %d)\n", dev_info->name, err);
 		}
 	}
+	device_table_unlock();
 }
 
 void device_manager_init(void)
 {
-	sys_slist_init(&device_list);
-	k_work_init_delayable(&conn_timeout_work, conn_timeout_handler);
+	device_table_init();
+	scan_scheduler_init(device_found);
+	conn_manager_init();
 	k_work_init_delayable(&scan_window_timeout, scan_window_timeout_handler);
 	
 	/* Initialize NVS storage */
@@ -530,6 +389,6 @@ void device_manager_init(void)
 		}
 	}
 	
-	/* Always start scanning - saved devices can reconnect anytime */
+	/* Scan for saved devices if any are configured */
 	start_scan();
 }
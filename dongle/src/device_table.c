@@ -0,0 +1,202 @@
+/* device_table.c - Fixed-capacity table of discovered devices */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <string.h>
+#include "common.h"
+#include "device_table.h"
+
+/* Linear probing with backward-shift deletion, so there are no tombstones
+ * and lookups stop at the first empty bucket. */
+static struct device_info table[DEVICE_TABLE_SIZE];
+static int device_count;
+
+K_MUTEX_DEFINE(table_lock);
+
+static uint32_t addr_hash(const bt_addr_le_t *addr)
+{
+	/* FNV-1a over address type and value */
+	uint32_t hash = 2166136261U;
+
+	hash = (hash ^ addr->type) * 16777619U;
+	for (int i = 0; i < sizeof(addr->a.val); i++) {
+		hash = (hash ^ addr->a.val[i]) * 16777619U;
+	}
+
+	return hash;
+}
+
+static inline int bucket_of(const bt_addr_le_t *addr)
+{
+	return addr_hash(addr) & (DEVICE_TABLE_SIZE - 1);
+}
+
+static int find_index(const bt_addr_le_t *addr)
+{
+	int idx = bucket_of(addr);
+
+	for (int n = 0; n < DEVICE_TABLE_SIZE; n++) {
+		if (!table[idx].in_use) {
+			return -1;
+		}
+		if (!bt_addr_le_cmp(&table[idx].addr, addr)) {
+			return idx;
+		}
+		idx = (idx + 1) & (DEVICE_TABLE_SIZE - 1);
+	}
+
+	return -1;
+}
+
+static void remove_index(int idx)
+{
+	int hole = idx;
+	int next = (idx + 1) & (DEVICE_TABLE_SIZE - 1);
+
+	/* Shift back every following entry that can legally occupy the hole */
+	while (table[next].in_use) {
+		int home = bucket_of(&table[next].addr);
+		int dist_next = (next - home) & (DEVICE_TABLE_SIZE - 1);
+		int dist_hole = (hole - home) & (DEVICE_TABLE_SIZE - 1);
+
+		if (dist_hole <= dist_next) {
+			table[hole] = table[next];
+			hole = next;
+		}
+		next = (next + 1) & (DEVICE_TABLE_SIZE - 1);
+	}
+
+	memset(&table[hole], 0, sizeof(table[hole]));
+	device_count--;
+}
+
+static int find_lru_index(void)
+{
+	int lru = -1;
+
+	for (int i = 0; i < DEVICE_TABLE_SIZE; i++) {
+		if (!table[i].in_use || table[i].conn_slot >= 0) {
+			continue;
+		}
+		if (lru < 0 || (int32_t)(table[i].last_seen - table[lru].last_seen) < 0) {
+			lru = i;
+		}
+	}
+
+	return lru;
+}
+
+void device_table_init(void)
+{
+	memset(table, 0, sizeof(table));
+	device_count = 0;
+}
+
+void device_table_lock(void)
+{
+	k_mutex_lock(&table_lock, K_FOREVER);
+}
+
+void device_table_unlock(void)
+{
+	k_mutex_unlock(&table_lock);
+}
+
+struct device_info *device_table_find(const bt_addr_le_t *addr)
+{
+	int idx = find_index(addr);
+
+	return idx >= 0 ? &table[idx] : NULL;
+}
+
+struct device_info *device_table_insert(const bt_addr_le_t *addr)
+{
+	int idx = find_index(addr);
+
+	if (idx >= 0) {
+		return &table[idx];
+	}
+
+	if (device_count >= DEVICE_TABLE_MAX_DEVICES) {
+		int lru = find_lru_index();
+
+		if (lru < 0) {
+			return NULL;
+		}
+		log("Device table full, evicting %s\n", table[lru].name);
+		remove_index(lru);
+	}
+
+	idx = bucket_of(addr);
+	while (table[idx].in_use) {
+		idx = (idx + 1) & (DEVICE_TABLE_SIZE - 1);
+	}
+
+	memset(&table[idx], 0, sizeof(table[idx]));
+	bt_addr_le_copy(&table[idx].addr, addr);
+	table[idx].battery_level = -1;
+	table[idx].conn_slot = -1;
+	table[idx].in_use = true;
+	device_count++;
+
+	return &table[idx];
+}
+
+void device_table_remove(struct device_info *dev_info)
+{
+	int idx = dev_info - table;
+
+	if (idx < 0 || idx >= DEVICE_TABLE_SIZE || !table[idx].in_use) {
+		return;
+	}
+
+	remove_index(idx);
+}
+
+int device_table_expire(uint32_t now, uint32_t max_age_ms)
+{
+	int removed = 0;
+	int i = 0;
+
+	while (i < DEVICE_TABLE_SIZE) {
+		struct device_info *dev_info = &table[i];
+
+		if (!dev_info->in_use) {
+			i++;
+			continue;
+		}
+
+		if (dev_info->conn_slot >= 0) {
+			/* Connected devices never age out */
+			dev_info->last_seen = now;
+			i++;
+			continue;
+		}
+
+		if (now - dev_info->last_seen > max_age_ms) {
+			log("Removed device: %s\n", dev_info->name);
+			remove_index(i);
+			removed++;
+			/* An entry may have shifted into this bucket, re-check it */
+			continue;
+		}
+
+		i++;
+	}
+
+	return removed;
+}
+
+struct device_info *device_table_get(int idx)
+{
+	if (idx < 0 || idx >= DEVICE_TABLE_SIZE || !table[idx].in_use) {
+		return NULL;
+	}
+
+	return &table[idx];
+}
+
+int device_table_count(void)
+{
+	return device_count;
+}
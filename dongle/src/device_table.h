@@ -0,0 +1,56 @@
+/* device_table.h - Fixed-capacity table of discovered devices */
+
+#ifndef DEVICE_TABLE_H_
+#define DEVICE_TABLE_H_
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include "common.h"
+
+/* Number of open-addressed buckets (must be a power of two) */
+#define DEVICE_TABLE_SIZE 32
+
+/* Devices tracked before the least recently seen one is evicted.
+ * Keeping the table at most 3/4 full bounds the probe length. */
+#define DEVICE_TABLE_MAX_DEVICES 24
+
+BUILD_ASSERT((DEVICE_TABLE_SIZE & (DEVICE_TABLE_SIZE - 1)) == 0,
+	     "DEVICE_TABLE_SIZE must be a power of two");
+BUILD_ASSERT(DEVICE_TABLE_MAX_DEVICES < DEVICE_TABLE_SIZE,
+	     "DEVICE_TABLE_MAX_DEVICES must leave free buckets");
+
+/* Iterate over all occupied entries, with the table locked.
+ * Do not insert or remove while iterating. */
+#define DEVICE_TABLE_FOREACH(_dev) \
+	for (int _dt_idx = 0; _dt_idx < DEVICE_TABLE_SIZE; _dt_idx++) \
+		if (((_dev) = device_table_get(_dt_idx)) != NULL)
+
+void device_table_init(void);
+
+/* The table is used from the BT RX thread (scan results, link events), the
+ * work queues and the command thread. Entries move on insert and remove,
+ * so a device_info pointer is only valid while the lock is held: lock
+ * around every lookup and use, and copy what is needed past the unlock.
+ * The lock is recursive and may be held across log and json_out calls. */
+void device_table_lock(void);
+void device_table_unlock(void);
+
+/* Look up a device by address (NULL if not tracked) */
+struct device_info *device_table_find(const bt_addr_le_t *addr);
+
+/* Add a device, evicting the least recently seen unconnected entry if the
+ * table is full. Returns NULL only if every entry is connected. */
+struct device_info *device_table_insert(const bt_addr_le_t *addr);
+
+/* Remove an entry. Pointers to other entries may be invalidated. */
+void device_table_remove(struct device_info *dev_info);
+
+/* Remove unconnected entries not seen within max_age_ms.
+ * Returns the number of removed entries. */
+int device_table_expire(uint32_t now, uint32_t max_age_ms);
+
+/* Return the entry at bucket idx, or NULL if the bucket is empty */
+struct device_info *device_table_get(int idx);
+
+int device_table_count(void);
+
+#endif /* DEVICE_TABLE_H_ */
@@ -0,0 +1,382 @@
+/* flight_recorder.c - Retained event ring for post-mortem analysis */
+
+#include <zephyr/kernel.h>
+#include <zephyr/fatal.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/drivers/hwinfo.h>
+#include <zephyr/sys/base64.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/reboot.h>
+#include <string.h>
+#include "common.h"
+#include "flight_recorder.h"
+#include "nvs_storage.h"
+#include "relay_config.h"
+#include "work_queues.h"
+
+#define FR_RECORDS CONFIG_ZRELAY_FLIGHT_RECORDER_RECORDS
+
+#define FR_RING_MAGIC 0x46524e47  /* "FRNG" */
+#define FR_DUMP_MAGIC 0x31445246  /* "FRD1" */
+
+/* Power drop: from at least RELAY_CFG_FR_DROP_POWER to below a third while pedalling */
+#define FR_DROP_MIN_CADENCE 50
+/* Keep recording this long after a drop so the dump shows the recovery */
+#define FR_POST_TRIGGER_MS 10000
+#define FR_TRIGGER_HOLDOFF_MS 60000
+
+/* Records per base64 line when downloading */
+#define FR_DOWNLOAD_CHUNK 16
+#define FR_BASE64_LEN (4 * DIV_ROUND_UP(FR_DOWNLOAD_CHUNK * sizeof(struct fr_record), 3) + 1)
+
+#if FIXED_PARTITION_EXISTS(flight_recorder_partition)
+#define FR_PARTITION_ID FIXED_PARTITION_ID(flight_recorder_partition)
+#define FR_PARTITION_SHARED 0
+#else
+/* No dedicated partition: use the storage partition after the NVS sectors */
+#define FR_PARTITION_ID FIXED_PARTITION_ID(storage_partition)
+#define FR_PARTITION_SHARED 1
+#endif
+
+struct fr_ring {
+	uint32_t magic;
+	uint32_t boot_count;
+	uint32_t head;  /* Next record to write */
+	uint32_t count;
+	uint32_t fault_pending;
+	struct fr_record records[FR_RECORDS];
+};
+
+struct fr_dump_hdr {
+	uint32_t magic;
+	uint16_t record_size;
+	uint16_t count;
+	uint32_t boot_count;
+	uint32_t dumped_at;
+	uint8_t trigger;
+	uint8_t reserved[3];
+	uint32_t crc;  /* CRC-32 of the records */
+};
+
+/* A full ring must fit the flash area, after the NVS sectors when shared */
+#if FR_PARTITION_SHARED
+#define FR_SECTOR_SIZE \
+	DT_PROP(DT_MTD_FROM_FIXED_PARTITION(DT_NODELABEL(storage_partition)), erase_block_size)
+BUILD_ASSERT(NVS_SECTOR_COUNT * FR_SECTOR_SIZE + sizeof(struct fr_dump_hdr) +
+	     FR_RECORDS * sizeof(struct fr_record) <= FIXED_PARTITION_SIZE(storage_partition),
+	     "Flight recorder ring does not fit the storage partition after NVS");
+#else
+BUILD_ASSERT(sizeof(struct fr_dump_hdr) + FR_RECORDS * sizeof(struct fr_record) <=
+	     FIXED_PARTITION_SIZE(flight_recorder_partition),
+	     "Flight recorder ring does not fit flight_recorder_partition");
+#endif
+
+/* Not cleared at boot, so a warm reboot or fault keeps the last minutes */
+static __noinit struct fr_ring ring;
+
+static struct k_spinlock ring_lock;
+static bool frozen;
+static uint32_t dropped_while_frozen;
+static uint8_t pending_trigger;
+static uint32_t last_trigger_time;
+
+/* Decimation and drop detection state */
+static uint32_t last_sample_time[FR_FAULT + 1];
+static int16_t last_ftms_power;
+
+static struct k_work_delayable dump_work;
+
+static uint32_t fr_area_offset(const struct flash_area *fa)
+{
+#if FR_PARTITION_SHARED
+	struct flash_pages_info info;
+
+	if (flash_get_page_info_by_offs(fa->fa_dev, fa->fa_off, &info)) {
+		return UINT32_MAX;
+	}
+	return NVS_SECTOR_COUNT * info.size;
+#else
+	return 0;
+#endif
+}
+
+static void ring_append(const struct fr_record *rec)
+{
+	ring.records[ring.head] = *rec;
+	ring.head = (ring.head + 1) % FR_RECORDS;
+	if (ring.count < FR_RECORDS) {
+		ring.count++;
+	}
+}
+
+/* Copy records in chronological order, starting 'first' records after the oldest */
+static void ring_copy(struct fr_record *dst, uint32_t first, uint32_t n)
+{
+	uint32_t oldest = (ring.head + FR_RECORDS - ring.count) % FR_RECORDS;
+
+	for (uint32_t i = 0; i < n; i++) {
+		dst[i] = ring.records[(oldest + first + i) % FR_RECORDS];
+	}
+}
+
+void flight_recorder_log(enum fr_type type, uint8_t arg,
+			 int16_t v0, int16_t v1, int16_t v2, int16_t v3)
+{
+	uint32_t now = k_uptime_get_32();
+	struct fr_record rec = {
+		.ts = now,
+		.type = type,
+		.arg = arg,
+		.v = { v0, v1, v2, v3, 0 },
+	};
+
+	if (type == FR_FTMS) {
+		if (last_ftms_power >= relay_config_get(RELAY_CFG_FR_DROP_POWER) &&
+		    v0 < last_ftms_power / 3 && v1 >= FR_DROP_MIN_CADENCE) {
+			flight_recorder_freeze(FR_TRIGGER_POWER_DROP);
+		}
+		last_ftms_power = v0;
+	}
+
+	if (type == FR_HR || type == FR_CP || type == FR_FTMS) {
+		if (now - last_sample_time[type] < (uint32_t)relay_config_get(RELAY_CFG_FR_SAMPLE_MS)) {
+			return;
+		}
+		last_sample_time[type] = now;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&ring_lock);
+
+	if (frozen) {
+		dropped_while_frozen++;
+	} else {
+		ring_append(&rec);
+	}
+
+	k_spin_unlock(&ring_lock, key);
+}
+
+static void dump_work_handler(struct k_work *work)
+{
+	const struct flash_area *fa;
+	struct flash_pages_info info;
+	struct fr_dump_hdr hdr = {0};
+	struct fr_record chunk[FR_DOWNLOAD_CHUNK];
+	uint32_t start = k_uptime_get_32();
+	uint32_t offset, len, crc = 0;
+	int err;
+
+	k_spinlock_key_t key = k_spin_lock(&ring_lock);
+	frozen = true;
+	hdr.trigger = pending_trigger;
+	pending_trigger = 0;
+	k_spin_unlock(&ring_lock, key);
+
+	err = flash_area_open(FR_PARTITION_ID, &fa);
+	if (err) {
+		log("[FR] Cannot open flash area (err %d)\n", err);
+		goto out;
+	}
+
+	offset = fr_area_offset(fa);
+	len = sizeof(hdr) + ring.count * sizeof(struct fr_record);
+	if (offset == UINT32_MAX || offset + len > fa->fa_size ||
+	    flash_get_page_info_by_offs(fa->fa_dev, fa->fa_off + offset, &info)) {
+		log("[FR] Dump does not fit the flash area\n");
+		err = -ENOSPC;
+		goto close;
+	}
+
+	err = flash_area_erase(fa, offset, ROUND_UP(len, info.size));
+	if (err) {
+		log("[FR] Flash erase failed (err %d)\n", err);
+		goto close;
+	}
+
+	/* Records first, header last: an interrupted dump has no valid magic */
+	for (uint32_t i = 0; i < ring.count && !err; i += FR_DOWNLOAD_CHUNK) {
+		uint32_t n = MIN(FR_DOWNLOAD_CHUNK, ring.count - i);
+
+		ring_copy(chunk, i, n);
+		crc = crc32_ieee_update(crc, (const uint8_t *)chunk, n * sizeof(chunk[0]));
+		err = flash_area_write(fa, offset + sizeof(hdr) + i * sizeof(chunk[0]),
+				       chunk, n * sizeof(chunk[0]));
+	}
+
+	if (!err) {
+		hdr.magic = FR_DUMP_MAGIC;
+		hdr.record_size = sizeof(struct fr_record);
+		hdr.count = ring.count;
+		hdr.boot_count = ring.boot_count;
+		hdr.dumped_at = k_uptime_get_32();
+		hdr.crc = crc;
+		err = flash_area_write(fa, offset, &hdr, sizeof(hdr));
+	}
+
+	if (err) {
+		log("[FR] Flash write failed (err %d)\n", err);
+	} else {
+		log("[FR] Dumped %u records to flash in %u ms (trigger %u)\n",
+		    ring.count, k_uptime_get_32() - start, hdr.trigger);
+	}
+
+close:
+	flash_area_close(fa);
+out:
+	key = k_spin_lock(&ring_lock);
+	frozen = false;
+	k_spin_unlock(&ring_lock, key);
+}
+
+void flight_recorder_freeze(enum fr_trigger trigger)
+{
+	uint32_t now = k_uptime_get_32();
+
+	if (pending_trigger || (last_trigger_time != 0 &&
+	    now - last_trigger_time < FR_TRIGGER_HOLDOFF_MS && trigger == FR_TRIGGER_POWER_DROP)) {
+		return;
+	}
+
+	last_trigger_time = now;
+	pending_trigger = trigger;
+	flight_recorder_log(FR_TRIGGER, trigger, 0, 0, 0, 0);
+
+	k_work_schedule_for_queue(&housekeeping_work_q, &dump_work,
+				  trigger == FR_TRIGGER_POWER_DROP ? K_MSEC(FR_POST_TRIGGER_MS) :
+								     K_NO_WAIT);
+}
+
+static void download_chunk(uint32_t seq, const struct fr_record *recs, uint32_t n)
+{
+	char b64[FR_BASE64_LEN];
+	size_t olen;
+
+	if (base64_encode((uint8_t *)b64, sizeof(b64), &olen, (const uint8_t *)recs,
+			  n * sizeof(struct fr_record)) == 0) {
+		json_out("{\"type\":\"fr_data\",\"seq\":%u,\"data\":\"%s\"}\n", seq, b64);
+	}
+}
+
+static int download_flash(void)
+{
+	const struct flash_area *fa;
+	struct fr_dump_hdr hdr;
+	struct fr_record chunk[FR_DOWNLOAD_CHUNK];
+	uint32_t offset, crc = 0;
+	int err;
+
+	err = flash_area_open(FR_PARTITION_ID, &fa);
+	if (err) {
+		return err;
+	}
+
+	offset = fr_area_offset(fa);
+	err = flash_area_read(fa, offset, &hdr, sizeof(hdr));
+	if (err || hdr.magic != FR_DUMP_MAGIC || hdr.record_size != sizeof(struct fr_record)) {
+		flash_area_close(fa);
+		return err ? err : -ENOENT;
+	}
+
+	json_out("{\"type\":\"fr_begin\",\"ts\":%u,\"source\":\"flash\",\"records\":%u,"
+		 "\"record_size\":%u,\"boot\":%u,\"trigger\":%u}\n",
+		 k_uptime_get_32(), hdr.count, hdr.record_size, hdr.boot_count, hdr.trigger);
+
+	for (uint32_t i = 0; i < hdr.count && !err; i += FR_DOWNLOAD_CHUNK) {
+		uint32_t n = MIN(FR_DOWNLOAD_CHUNK, hdr.count - i);
+
+		err = flash_area_read(fa, offset + sizeof(hdr) + i * sizeof(chunk[0]),
+				      chunk, n * sizeof(chunk[0]));
+		if (!err) {
+			crc = crc32_ieee_update(crc, (const uint8_t *)chunk, n * sizeof(chunk[0]));
+			download_chunk(i / FR_DOWNLOAD_CHUNK, chunk, n);
+		}
+	}
+
+	flash_area_close(fa);
+	json_out("{\"type\":\"fr_end\",\"crc_ok\":%s}\n", !err && crc == hdr.crc ? "true" : "false");
+	return err;
+}
+
+static int download_ram(void)
+{
+	struct fr_record chunk[FR_DOWNLOAD_CHUNK];
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&ring_lock);
+	if (frozen) {
+		k_spin_unlock(&ring_lock, key);
+		return -EBUSY;
+	}
+	frozen = true;
+	k_spin_unlock(&ring_lock, key);
+
+	json_out("{\"type\":\"fr_begin\",\"ts\":%u,\"source\":\"ram\",\"records\":%u,"
+		 "\"record_size\":%u,\"boot\":%u,\"trigger\":0}\n",
+		 k_uptime_get_32(), ring.count, (unsigned int)sizeof(struct fr_record), ring.boot_count);
+
+	for (uint32_t i = 0; i < ring.count; i += FR_DOWNLOAD_CHUNK) {
+		uint32_t n = MIN(FR_DOWNLOAD_CHUNK, ring.count - i);
+
+		ring_copy(chunk, i, n);
+		download_chunk(i / FR_DOWNLOAD_CHUNK, chunk, n);
+	}
+	json_out("{\"type\":\"fr_end\",\"crc_ok\":true,\"dropped\":%u}\n", dropped_while_frozen);
+
+	key = k_spin_lock(&ring_lock);
+	frozen = false;
+	k_spin_unlock(&ring_lock, key);
+	return 0;
+}
+
+int flight_recorder_download(bool from_flash)
+{
+	return from_flash ? download_flash() : download_ram();
+}
+
+void k_sys_fatal_error_handler(unsigned int reason, const struct arch_esf *esf)
+{
+	struct fr_record rec = {
+		.ts = k_uptime_get_32(),
+		.type = FR_FAULT,
+		.v = { reason & 0xffff, reason >> 16 },
+	};
+
+	ARG_UNUSED(esf);
+
+	/* No locking, nothing else runs any more. The ring survives the
+	 * warm reboot and is dumped to flash on the next boot. */
+	ring_append(&rec);
+	ring.fault_pending = 1;
+	sys_reboot(SYS_REBOOT_WARM);
+}
+
+void flight_recorder_init(void)
+{
+	uint32_t cause = 0;
+	bool retained = ring.magic == FR_RING_MAGIC && ring.head < FR_RECORDS &&
+			ring.count <= FR_RECORDS;
+	bool fault = retained && ring.fault_pending;
+
+	k_work_init_delayable(&dump_work, dump_work_handler);
+
+	if (!retained) {
+		memset(&ring, 0, offsetof(struct fr_ring, records));
+		ring.magic = FR_RING_MAGIC;
+	}
+	ring.fault_pending = 0;
+	ring.boot_count++;
+
+	hwinfo_get_reset_cause(&cause);
+	hwinfo_clear_reset_cause();
+
+	flight_recorder_log(FR_BOOT, retained, cause & 0xffff, cause >> 16,
+			    ring.boot_count, 0);
+	log("[FR] Boot %u, %u records retained, reset cause 0x%08x\n",
+	    ring.boot_count, retained ? ring.count - 1 : 0, cause);
+
+	if (fault || (cause & RESET_WATCHDOG)) {
+		flight_recorder_freeze(FR_TRIGGER_FAULT);
+	}
+}
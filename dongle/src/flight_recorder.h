@@ -0,0 +1,64 @@
+/* flight_recorder.h - Retained event ring for post-mortem analysis */
+
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+#include <zephyr/kernel.h>
+#include "common.h"
+
+/* Record types, stable: they are decoded by scripts/fr_decode.py */
+enum fr_type {
+	FR_BOOT = 1,       /* v0/v1: reset cause low/high, v2: boot count */
+	FR_HR = 2,         /* arg: slot, v0: bpm */
+	FR_CP = 3,         /* arg: slot, v0: power W, v1: cadence rpm */
+	FR_FTMS = 4,       /* arg: slot, v0: power W, v1: cadence rpm, v2: resistance, v3: speed 0.01 km/h */
+	FR_SIM = 5,        /* v0: grade 0.01 %, v1: resistance, v2: wind 0.001 m/s */
+	FR_CP_CMD = 6,     /* arg: opcode, v0..v3: parameter bytes 1-8 */
+	FR_CP_RSP = 7,     /* arg: request opcode, v0: result */
+	FR_CONNECT = 8,    /* arg: slot, v0: role, v1: error */
+	FR_DISCONNECT = 9, /* arg: slot, v0: reason */
+	FR_CONSUMER = 10,  /* arg: consumer count, v0: 1 connected / 0 disconnected, v1: reason */
+	FR_TRIGGER = 11,   /* arg: enum fr_trigger */
+	FR_FAULT = 12,     /* v0/v1: fatal reason low/high */
+};
+
+enum fr_trigger {
+	FR_TRIGGER_BUTTON = 1,
+	FR_TRIGGER_POWER_DROP = 2,
+	FR_TRIGGER_FAULT = 3,
+	FR_TRIGGER_HOST = 4,
+};
+
+/* Fixed-size binary record, 16 bytes */
+struct fr_record {
+	uint32_t ts;  /* ms since boot */
+	uint8_t type;
+	uint8_t arg;
+	int16_t v[5];
+} __packed;
+
+#if defined(CONFIG_ZRELAY_FLIGHT_RECORDER)
+
+void flight_recorder_init(void);
+
+/* Append a record; samples (HR/CP/FTMS) are decimated per type */
+void flight_recorder_log(enum fr_type type, uint8_t arg,
+			 int16_t v0, int16_t v1, int16_t v2, int16_t v3);
+
+/* Freeze the ring and write it to flash, callable from ISR */
+void flight_recorder_freeze(enum fr_trigger trigger);
+
+/* Stream the ring (live RAM or last flash dump) as base64 JSON lines */
+int flight_recorder_download(bool from_flash);
+
+#else
+
+static inline void flight_recorder_init(void) {}
+static inline void flight_recorder_log(enum fr_type type, uint8_t arg,
+				       int16_t v0, int16_t v1, int16_t v2, int16_t v3) {}
+static inline void flight_recorder_freeze(enum fr_trigger trigger) {}
+static inline int flight_recorder_download(bool from_flash) { return -ENOTSUP; }
+
+#endif /* CONFIG_ZRELAY_FLIGHT_RECORDER */
+
+#endif /* FLIGHT_RECORDER_H_ */
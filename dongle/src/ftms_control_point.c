@@ -3,34 +3,103 @@
 #include <zephyr/kernel.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/gatt.h>
-#include <zephyr/sys/byteorder.h>
 #include <string.h>
 #include "common.h"
 #include "ftms_control_point.h"
 #include "gatt_services.h"
+#include "consumer_manager.h"
+#include "flight_recorder.h"
+#include "relay_config.h"
+#include "att_capture.h"
+#include "work_queues.h"
+
+/* Grade to resistance mapping, by default grade -100 -> 0, grade 1900 -> 100 */
+static void grade_map_get(struct rc_grade_map *map)
+{
+	map->offset = relay_config_get(RELAY_CFG_GRADE_OFFSET);
+	map->divisor = relay_config_get(RELAY_CFG_GRADE_DIVISOR);
+	map->max = relay_config_get(RELAY_CFG_RESISTANCE_MAX);
+}
 
-/* Control Point state */
-bool ftms_cp_indicate_enabled = false;
-bool ftms_cp_indicating = false;
-
-/* Grade to resistance conversion: grade -100 -> 0, grade 1900 -> 100 */
-#define GRADE_RESISTANCE(x) MAX(MIN(((x) + 120) / 20, 100), 0)
-
-/* Track if last command was converted from 0x11 to 0x04 */
-static bool last_cmd_was_converted = false;
-
-/* Buffer for Control Point indication responses */
-static uint8_t ftms_cp_response[20];
-static uint16_t ftms_cp_response_len;
-static struct bt_gatt_indicate_params ftms_cp_ind_params;
+/* Consumer granted control through Request Control, NULL if none.
+ * Cleared on disconnect, so no reference is held. */
+static struct bt_conn *control_owner;
+
+/* Commands for the trainer, sent one at a time: the next is written once
+ * the trainer acknowledged the previous write and indicated its response */
+#define CP_QUEUE_DEPTH 4
+#define CP_CMD_MAX_LEN 20
+/* A trainer that has not responded by then is treated as having failed.
+ * The write stays in flight until its write response arrives (ATT bounds
+ * that at 30 s) or the link drops. Nothing bounds the indication, so the
+ * relay stops waiting for it at the timeout. */
+#define CP_RESPONSE_TIMEOUT_MS 2000
+
+struct cp_trainer_cmd {
+	uint8_t data[CP_CMD_MAX_LEN];
+	uint8_t len;
+	uint8_t opcode;            /* As written by the consumer, before conversion */
+	bool converted;            /* 0x11 sent as 0x04, the response is converted back */
+	struct bt_conn *reply_to;  /* NULL for commands the relay issues itself */
+	uint16_t seq;
+};
+
+/* The queue is used from the BT RX thread and the relay work queue (response
+ * timeout). Bluetooth calls and consumer responses happen outside cp_lock. */
+static struct k_spinlock cp_lock;
+static struct cp_trainer_cmd cmd_queue[CP_QUEUE_DEPTH];
+static uint8_t cmd_head;
+static uint8_t cmd_count;
+static uint16_t cmd_seq;
+
+/* The command written to the trainer. The stack owns ftms_cp_write_params
+ * until write_pending clears; the trainer owes an indication while
+ * response_pending is set. Nothing else is written until both clear or the
+ * link drops. A command failed by the timeout leaves the queue and stops
+ * the wait for its indication; a late one is dropped by its opcode. */
+static struct {
+	bool write_pending;
+	bool response_pending;
+	bool timed_out;
+	uint8_t opcode;        /* As written to the trainer */
+	uint8_t late_opcode;   /* Response owed to a timed out command, 0 if none */
+	uint16_t seq;
+	uint32_t sent_at;
+	struct bt_conn *conn;  /* Compared only, no reference held */
+} inflight;
+
+static struct k_work_delayable response_timeout_work;
+
+/* Session state as consumers see it, kept across trainer reconnects */
+enum cp_session {
+	CP_SESSION_IDLE,
+	CP_SESSION_STARTED,
+	CP_SESSION_STOPPED,
+};
+
+static enum cp_session session;
+
+/* Last target command (0x02-0x06, 0x11) as written, replayed on reconnect */
+static uint8_t last_target[CP_CMD_MAX_LEN];
+static uint8_t last_target_len;
+
+/* Trainer state on the current link, from its responses */
+static bool trainer_controlled;
+static bool trainer_started;
+static bool control_refused;  /* Request Control failed, not retried on this link */
+
+static struct {
+	uint32_t local;      /* Answered by the relay without the trainer */
+	uint32_t forwarded;  /* Consumer commands written to the trainer */
+	uint32_t setup;      /* Relay issued commands replaying the session */
+	uint32_t coalesced;  /* Queued targets replaced by a newer one */
+	uint32_t timeouts;
+	uint32_t failed;     /* Writes the trainer or stack rejected */
+} cp_stats;
 
 /* Buffer for forwarding commands to trainer */
-static uint8_t ftms_cp_write_buf[32];
+static uint8_t ftms_cp_write_buf[CP_CMD_MAX_LEN];
 static struct bt_gatt_write_params ftms_cp_write_params;
-static bool ftms_cp_write_busy = false;
-
-/* Work item for sending deferred Control Point responses */
-struct k_work ftms_cp_response_work;
 
 const char *ftms_cp_opcode_str(uint8_t opcode)
 {
@@ -52,64 +121,338 @@ const char *ftms_cp_opcode_str(uint8_t opcode)
 
 void ftms_cp_ccc_cfg_changed(const struct bt_gatt_attr *attr, uint16_t value)
 {
-	ftms_cp_indicate_enabled = (value == BT_GATT_CCC_INDICATE);
-	log("[FTMS CP] CCC changed: indications %s\n", 
-	       ftms_cp_indicate_enabled ? "enabled" : "disabled");
+	/* Aggregate over all consumers, per-consumer state is checked on indicate */
+	log_info(CP, "[FTMS CP] CCC changed: indications %s\n",
+	       value == BT_GATT_CCC_INDICATE ? "enabled" : "disabled");
 }
 
-static void ftms_cp_indicate_cb(struct bt_conn *conn,
-				struct bt_gatt_indicate_params *params, uint8_t err)
+static void ftms_cp_respond_local(struct bt_conn *conn, uint8_t opcode, uint8_t result)
 {
-	if (err) {
-		log("[FTMS CP] Indication failed (err %d)\n", err);
-	} else {
-		log("[FTMS CP] Indication acknowledged by Zwift\n");
+	uint8_t response[3] = { FTMS_CP_RESPONSE_CODE, opcode, result };
+
+	consumer_indicate(conn, &ftms_svc.attrs[FTMS_ATTR_CONTROL_POINT],
+			  response, sizeof(response));
+}
+
+static void ftms_cp_write_cb(struct bt_conn *conn, uint8_t err,
+			     struct bt_gatt_write_params *params);
+
+static struct conn_slot *find_trainer(void)
+{
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		if (connections[i].conn && connections[i].ftms_control_point_handle != 0) {
+			return &connections[i];
+		}
 	}
+	return NULL;
 }
 
-static void ftms_cp_indicate_destroy(struct bt_gatt_indicate_params *params)
+static bool is_target_opcode(uint8_t opcode)
 {
-	log("[FTMS CP] Indication complete\n");
-	ftms_cp_indicating = false;
+	return (opcode >= FTMS_CP_SET_TARGET_SPEED && opcode <= FTMS_CP_SET_TARGET_HEARTRATE) ||
+	       opcode == FTMS_CP_SET_INDOOR_BIKE_SIM;
 }
 
-static void ftms_cp_response_work_handler(struct k_work *work)
+static bool inflight_busy(void)
 {
-	if (peripheral_conn && ftms_cp_indicate_enabled && !ftms_cp_indicating) {
-		/* Use Attribute 11 (Control Point Value) for indication */
-		ftms_cp_ind_params.attr = &ftms_svc.attrs[11];
-		ftms_cp_ind_params.func = ftms_cp_indicate_cb;
-		ftms_cp_ind_params.destroy = ftms_cp_indicate_destroy;
-		ftms_cp_ind_params.data = ftms_cp_response;
-		ftms_cp_ind_params.len = ftms_cp_response_len;
-		
-		int err = bt_gatt_indicate(peripheral_conn, &ftms_cp_ind_params);
+	return inflight.write_pending || inflight.response_pending;
+}
+
+/* Remove the head command into out if it is the one numbered seq.
+ * Called with cp_lock held. */
+static bool cmd_take(uint16_t seq, struct cp_trainer_cmd *out)
+{
+	if (cmd_count == 0 || cmd_queue[cmd_head].seq != seq) {
+		return false;
+	}
+
+	*out = cmd_queue[cmd_head];
+	cmd_head = (cmd_head + 1) % CP_QUEUE_DEPTH;
+	cmd_count--;
+	return true;
+}
+
+/* Answer a command that will not get a trainer response */
+static void cmd_fail(struct cp_trainer_cmd *c)
+{
+	cp_stats.failed++;
+	if (c->reply_to) {
+		ftms_cp_respond_local(c->reply_to, c->opcode, FTMS_CP_RESULT_FAILED);
+	}
+}
+
+static void trainer_send_next(void)
+{
+	struct conn_slot *trainer = find_trainer();
+
+	while (trainer) {
+		struct cp_trainer_cmd c;
+		k_spinlock_key_t key = k_spin_lock(&cp_lock);
+		int err;
+
+		/* Reserve the params before the write, which may block */
+		if (inflight_busy() || cmd_count == 0) {
+			k_spin_unlock(&cp_lock, key);
+			return;
+		}
+		c = cmd_queue[cmd_head];
+		inflight.write_pending = true;
+		inflight.response_pending = true;
+		inflight.timed_out = false;
+		inflight.opcode = c.data[0];
+		inflight.seq = c.seq;
+		inflight.sent_at = k_uptime_get_32();
+		inflight.conn = trainer->conn;
+		k_spin_unlock(&cp_lock, key);
+
+		k_work_reschedule_for_queue(&relay_work_q, &response_timeout_work,
+					    K_MSEC(CP_RESPONSE_TIMEOUT_MS));
+
+		memcpy(ftms_cp_write_buf, c.data, c.len);
+		ftms_cp_write_params.func = ftms_cp_write_cb;
+		ftms_cp_write_params.handle = trainer->ftms_control_point_handle;
+		ftms_cp_write_params.offset = 0;
+		ftms_cp_write_params.data = ftms_cp_write_buf;
+		ftms_cp_write_params.length = c.len;
+
+		err = bt_gatt_write(trainer->conn, &ftms_cp_write_params);
 		if (err) {
-			log("[FTMS CP] Failed to send indication (err %d)\n", err);
-		} else {
-			ftms_cp_indicating = true;
-			log("[FTMS CP] Indication sent, waiting for ACK\n");
+			bool failed;
+
+			log_info(CP, "[FTMS CP] Write to trainer failed (err %d)\n", err);
+			key = k_spin_lock(&cp_lock);
+			inflight.write_pending = false;
+			inflight.response_pending = false;
+			/* Unless the timeout already failed it */
+			failed = cmd_take(c.seq, &c);
+			k_spin_unlock(&cp_lock, key);
+			if (failed) {
+				cmd_fail(&c);
+			}
+			continue;
 		}
+
+		att_capture(trainer->conn, ATT_CAPTURE_TX, ATT_OP_WRITE_REQ,
+			    ftms_cp_write_params.handle, ftms_cp_write_buf, c.len);
+
+		/* Skip the hex formatting entirely unless it will be printed */
+		if (log_enabled(CP, SERIAL_LOG_DEBUG)) {
+			char hex_str[96];
+			int pos = 0;
+			for (int i = 0; i < c.len && pos < sizeof(hex_str) - 3; i++) {
+				pos += snprintf(hex_str + pos, sizeof(hex_str) - pos, "%02x ", c.data[i]);
+			}
+			log_debug(CP, "[FTMS CP] %s to trainer [%u bytes]: %s\n",
+				  c.reply_to ? "Forwarded" : "Setup", c.len, hex_str);
+		}
+		return;
+	}
+}
+
+/* Queue cmd for the trainer, converting 0x11 to 0x04. A target still
+ * waiting in the queue is replaced (newest wins) and answered locally. */
+static int trainer_queue(const uint8_t *cmd, uint16_t len, struct bt_conn *reply_to)
+{
+	uint8_t converted_cmd[RC_SIM_CONVERTED_LEN];
+	struct cp_trainer_cmd *c = NULL;
+	struct cp_trainer_cmd replaced = { .reply_to = NULL };
+	k_spinlock_key_t key;
+	struct rc_grade_map map;
+	struct rc_sim sim;
+	int converted_len;
+
+	if (len > CP_CMD_MAX_LEN) {
+		log_info(CP, "[FTMS CP] Error: Command too long (%u)\n", len);
+		return -EINVAL;
+	}
+
+	grade_map_get(&map);
+	converted_len = rc_sim_to_resistance(cmd, len, &map, converted_cmd, &sim);
+	if (converted_len > 0) {
+		flight_recorder_log(FR_SIM, 0, sim.grade, sim.resistance, sim.wind_speed, 0);
+		json_out("{\"type\":\"sim\",\"ts\":%u,\"wind_speed\":%d,\"grade\":%d,\"resistance\":%d}\n",
+		       k_uptime_get_32(), sim.wind_speed, sim.grade, sim.resistance);
+		log_debug(CP, "[FTMS CP] Converted 0x11 (grade=%d) -> 0x04 (resistance=%d)\n", sim.grade, sim.resistance);
+	}
+
+	key = k_spin_lock(&cp_lock);
+
+	if (is_target_opcode(cmd[0])) {
+		/* The head may already be written, only waiting entries are replaced */
+		bool head_written = inflight_busy() && cmd_count > 0 &&
+				    cmd_queue[cmd_head].seq == inflight.seq;
+
+		for (int i = head_written ? 1 : 0; i < cmd_count; i++) {
+			struct cp_trainer_cmd *q = &cmd_queue[(cmd_head + i) % CP_QUEUE_DEPTH];
+
+			if (is_target_opcode(q->opcode)) {
+				replaced = *q;
+				cp_stats.coalesced++;
+				c = q;
+				break;
+			}
+		}
+	}
+
+	if (!c) {
+		if (cmd_count == CP_QUEUE_DEPTH) {
+			k_spin_unlock(&cp_lock, key);
+			return -ENOMEM;
+		}
+		c = &cmd_queue[(cmd_head + cmd_count) % CP_QUEUE_DEPTH];
+		cmd_count++;
+	}
+
+	if (converted_len > 0) {
+		memcpy(c->data, converted_cmd, converted_len);
+		c->len = converted_len;
+	} else {
+		memcpy(c->data, cmd, len);
+		c->len = len;
+	}
+	c->opcode = cmd[0];
+	c->converted = converted_len > 0;
+	c->reply_to = reply_to;
+	c->seq = ++cmd_seq;
+
+	k_spin_unlock(&cp_lock, key);
+
+	if (replaced.reply_to) {
+		ftms_cp_respond_local(replaced.reply_to, replaced.opcode, FTMS_CP_RESULT_SUCCESS);
+	}
+
+	if (reply_to) {
+		cp_stats.forwarded++;
+	} else {
+		cp_stats.setup++;
+	}
+
+	return 0;
+}
+
+/* Relay issued command without parameters, its response is consumed here */
+static void trainer_queue_setup(uint8_t opcode)
+{
+	if (trainer_queue(&opcode, 1, NULL)) {
+		log_info(CP, "[FTMS CP] No room to queue %s\n", ftms_cp_opcode_str(opcode));
+	}
+}
+
+static bool cmd_queued(uint8_t opcode)
+{
+	k_spinlock_key_t key = k_spin_lock(&cp_lock);
+	bool found = false;
+
+	for (int i = 0; i < cmd_count && !found; i++) {
+		found = cmd_queue[(cmd_head + i) % CP_QUEUE_DEPTH].opcode == opcode;
+	}
+	k_spin_unlock(&cp_lock, key);
+	return found;
+}
+
+/* Request Control ahead of other commands on a link without it,
+ * after a reconnect or a Reset */
+static void trainer_ensure_control(void)
+{
+	if (!trainer_controlled && !control_refused && !cmd_queued(FTMS_CP_REQUEST_CONTROL)) {
+		trainer_queue_setup(FTMS_CP_REQUEST_CONTROL);
+	}
+}
+
+static void response_timeout_handler(struct k_work *work)
+{
+	k_spinlock_key_t key = k_spin_lock(&cp_lock);
+	uint32_t elapsed = k_uptime_get_32() - inflight.sent_at;
+	struct cp_trainer_cmd c;
+	bool failed = false;
+	bool released = false;
+
+	if (inflight_busy() && elapsed < CP_RESPONSE_TIMEOUT_MS) {
+		/* Scheduled for an earlier command that completed */
+		k_work_reschedule_for_queue(&relay_work_q, &response_timeout_work,
+					    K_MSEC(CP_RESPONSE_TIMEOUT_MS - elapsed));
+	} else if (inflight_busy() && !inflight.timed_out) {
+		/* Answer the consumer now */
+		inflight.timed_out = true;
+		failed = cmd_take(inflight.seq, &c);
+		if (!inflight.write_pending) {
+			/* Stop waiting for the indication and let the next
+			 * command go; otherwise the write callback does */
+			inflight.response_pending = false;
+			inflight.late_opcode = inflight.opcode;
+			released = true;
+		}
+	}
+	k_spin_unlock(&cp_lock, key);
+
+	if (failed) {
+		log_info(CP, "[FTMS CP] No response from trainer to %s\n",
+			 ftms_cp_opcode_str(c.opcode));
+		cp_stats.timeouts++;
+		cmd_fail(&c);
+	}
+	if (released) {
+		trainer_send_next();
 	}
 }
 
 static void ftms_cp_write_cb(struct bt_conn *conn, uint8_t err,
 			     struct bt_gatt_write_params *params)
 {
-	ftms_cp_write_busy = false;
-	
+	struct cp_trainer_cmd c;
+	k_spinlock_key_t key;
+	bool failed = false;
+
 	if (err) {
-		log("[FTMS CP] Forwarding to trainer failed (err %u)\n", err);
+		uint8_t rsp[4] = { ATT_OP_WRITE_REQ, params->handle & 0xff, params->handle >> 8, err };
+
+		att_capture(conn, ATT_CAPTURE_RX, ATT_OP_ERROR_RSP, 0, rsp, sizeof(rsp));
+	} else {
+		att_capture(conn, ATT_CAPTURE_RX, ATT_OP_WRITE_RSP, 0, NULL, 0);
+	}
+
+	key = k_spin_lock(&cp_lock);
+	if (!inflight.write_pending || inflight.conn != conn) {
+		/* From a link already dropped */
+		k_spin_unlock(&cp_lock, key);
+		return;
+	}
+	inflight.write_pending = false;
+	if (err) {
+		/* No indication will follow a rejected write */
+		inflight.response_pending = false;
+		failed = cmd_take(inflight.seq, &c);
+	} else if (inflight.timed_out && inflight.response_pending) {
+		/* Already failed by the timeout, do not wait for the indication */
+		inflight.response_pending = false;
+		inflight.late_opcode = inflight.opcode;
+	}
+	k_spin_unlock(&cp_lock, key);
+
+	if (err) {
+		log_info(CP, "[FTMS CP] Forwarding to trainer failed (err %u)\n", err);
+		if (failed) {
+			cmd_fail(&c);
+		}
 	} else {
-		log("[FTMS CP] Forwarding to trainer complete\n");
+		log_debug(CP, "[FTMS CP] Forwarding to trainer complete\n");
 	}
+
+	trainer_send_next();
 }
 
-ssize_t ftms_control_point_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
-				 const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+static void respond_local(struct bt_conn *conn, uint8_t opcode, uint8_t result)
+{
+	cp_stats.local++;
+	ftms_cp_respond_local(conn, opcode, result);
+}
+
+static ssize_t handle_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			    const void *buf, uint16_t len, uint16_t offset)
 {
 	const uint8_t *cmd = buf;
 	char addr[BT_ADDR_LE_STR_LEN];
+	bool have_trainer;
 
 	if (offset != 0) {
 		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
@@ -122,99 +465,107 @@ ssize_t ftms_control_point_write(struct bt_conn *conn, const struct bt_gatt_attr
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
 	/* Keep debug log for all commands */
-	log("[FTMS CP] Zwift (%s) -> %s (0x%02x)\n", 
+	log_info(CP, "[FTMS CP] Consumer (%s) -> %s (0x%02x)\n", 
 	       addr, ftms_cp_opcode_str(cmd[0]), cmd[0]);
 
-	/* Store peripheral connection for sending responses back */
-	if (!peripheral_conn) {
-		peripheral_conn = bt_conn_ref(conn);
-		log("[FTMS CP] Stored peripheral connection\n");
-	}
-
-	/* Convert Set Indoor Bike Simulation (0x11) to Set Target Resistance (0x04) */
-	uint8_t converted_cmd[32];
-	const uint8_t *forward_cmd = cmd;
-	uint16_t forward_len = len;
-	last_cmd_was_converted = false;
-	
-	if (cmd[0] == FTMS_CP_SET_INDOOR_BIKE_SIM && len >= 5) {
-		int16_t wind_speed = sys_le16_to_cpu(*(uint16_t *)&cmd[1]);
-		int16_t grade = sys_le16_to_cpu(*(uint16_t *)&cmd[3]);
-		
-		/* Convert grade (0.01% units) to resistance (unitless 0-100) */
-		int16_t resistance = GRADE_RESISTANCE(grade);
-		
-		/* Build Set Target Resistance command */
-		converted_cmd[0] = FTMS_CP_SET_TARGET_RESISTANCE;
-		converted_cmd[1] = (uint8_t)resistance;
-		forward_cmd = converted_cmd;
-		forward_len = 2;
-		last_cmd_was_converted = true;
-		
-		/* Log conversion */
-		uint32_t now = k_uptime_get_32();
-		json_out("{\"type\":\"sim\",\"ts\":%u,\"wind_speed\":%d,\"grade\":%d,\"resistance\":%d}\n",
-		       now, wind_speed, grade, resistance);
-		log("[FTMS CP] Converted 0x11 (grade=%d) -> 0x04 (resistance=%d)\n", grade, resistance);
+	int16_t params[4] = {0};
+
+	memcpy(params, &cmd[1], MIN(len - 1, sizeof(params)));
+	flight_recorder_log(FR_CP_CMD, cmd[0], params[0], params[1], params[2], params[3]);
+
+	/* Only one consumer may control the trainer at a time */
+	if (control_owner && control_owner != conn) {
+		log_info(CP, "[FTMS CP] Control held by another consumer, rejecting\n");
+		respond_local(conn, cmd[0], FTMS_CP_RESULT_CONTROL_NOT_PERMITTED);
+		return len;
 	}
 
-	/* Find trainer connection with FTMS Control Point */
-	struct conn_slot *trainer_slot = NULL;
-	for (int i = 0; i < MAX_CONNECTIONS; i++) {
-		if (connections[i].conn && connections[i].ftms_control_point_handle != 0) {
-			trainer_slot = &connections[i];
-			log("[FTMS CP] Found trainer at slot %d, handle=%u\n", i, connections[i].ftms_control_point_handle);
-			break;
+	if (!control_owner) {
+		if (cmd[0] != FTMS_CP_REQUEST_CONTROL) {
+			log_info(CP, "[FTMS CP] %s without Request Control, granting control\n", addr);
 		}
+		control_owner = conn;
 	}
 
-	if (!trainer_slot) {
-		char slots_str[64];
-		int pos = 0;
-		for (int i = 0; i < MAX_CONNECTIONS; i++) {
-			if (connections[i].conn) {
-				pos += snprintf(slots_str + pos, sizeof(slots_str) - pos, "%d:handle=%u ", i, connections[i].ftms_control_point_handle);
-			}
+	have_trainer = find_trainer() != NULL;
+
+	switch (cmd[0]) {
+	case FTMS_CP_REQUEST_CONTROL:
+		/* The relay holds control of the trainer itself */
+		respond_local(conn, cmd[0], FTMS_CP_RESULT_SUCCESS);
+		return len;
+
+	case FTMS_CP_START_RESUME:
+		session = CP_SESSION_STARTED;
+		respond_local(conn, cmd[0], FTMS_CP_RESULT_SUCCESS);
+		if (have_trainer && !trainer_started && !cmd_queued(FTMS_CP_START_RESUME)) {
+			trainer_ensure_control();
+			trainer_queue_setup(FTMS_CP_START_RESUME);
+			trainer_send_next();
 		}
-		log("[FTMS CP] ERROR: No trainer connection found (slots: %s)\n", slots_str);
 		return len;
+
+	case FTMS_CP_STOP_PAUSE:
+		session = CP_SESSION_STOPPED;
+		break;
+
+	case FTMS_CP_RESET:
+		/* Reset releases control so another consumer may take over */
+		session = CP_SESSION_IDLE;
+		last_target_len = 0;
+		control_owner = NULL;
+		break;
+
+	default:
+		if (is_target_opcode(cmd[0]) && len <= sizeof(last_target)) {
+			memcpy(last_target, cmd, len);
+			last_target_len = len;
+		}
+		break;
 	}
 
-	/* Forward command to trainer */
-	if (len > sizeof(ftms_cp_write_buf)) {
-		log("[FTMS CP] Error: Command too long (%u)\n", len);
+	if (!have_trainer) {
+		/* Targets and session changes are replayed when the trainer connects */
+		log_info(CP, "[FTMS CP] No trainer connected, answering locally\n");
+		respond_local(conn, cmd[0], is_target_opcode(cmd[0]) ||
+			      cmd[0] == FTMS_CP_STOP_PAUSE || cmd[0] == FTMS_CP_RESET ?
+			      FTMS_CP_RESULT_SUCCESS : FTMS_CP_RESULT_FAILED);
 		return len;
 	}
-	
-	/* Check if a write is already in progress */
-	if (ftms_cp_write_busy) {
-		log("[FTMS CP] Write busy, dropping command\n");
+
+	if (cmd[0] != FTMS_CP_RESET) {
+		trainer_ensure_control();
+	}
+	if (trainer_queue(cmd, len, conn)) {
+		log_info(CP, "[FTMS CP] Cannot queue command for the trainer\n");
+		respond_local(conn, cmd[0], FTMS_CP_RESULT_FAILED);
 		return len;
 	}
+	trainer_send_next();
 
-	memcpy(ftms_cp_write_buf, forward_cmd, forward_len);
-			
-	ftms_cp_write_params.func = ftms_cp_write_cb;
-	ftms_cp_write_params.handle = trainer_slot->ftms_control_point_handle;
-	ftms_cp_write_params.offset = 0;
-	ftms_cp_write_params.data = ftms_cp_write_buf;
-	ftms_cp_write_params.length = forward_len;
+	return len;
+}
 
-	ftms_cp_write_busy = true;
-	int err = bt_gatt_write(trainer_slot->conn, &ftms_cp_write_params);
-	if (err) {
-		ftms_cp_write_busy = false;
-		log("[FTMS CP] Write to trainer failed (err %d)\n", err);
+ssize_t ftms_control_point_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+				 const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+	uint16_t handle = bt_gatt_attr_get_handle(attr);
+	ssize_t ret;
+
+	att_capture(conn, ATT_CAPTURE_RX, ATT_OP_WRITE_REQ, handle, buf, len);
+
+	ret = handle_write(conn, attr, buf, len, offset);
+
+	/* The stack sends the response once we return */
+	if (ret < 0) {
+		uint8_t rsp[4] = { ATT_OP_WRITE_REQ, handle & 0xff, handle >> 8, -ret };
+
+		att_capture(conn, ATT_CAPTURE_TX, ATT_OP_ERROR_RSP, 0, rsp, sizeof(rsp));
 	} else {
-		char hex_str[96];
-		int pos = 0;
-		for (int i = 0; i < forward_len && pos < sizeof(hex_str) - 3; i++) {
-			pos += snprintf(hex_str + pos, sizeof(hex_str) - pos, "%02x ", forward_cmd[i]);
-		}
-		log("[FTMS CP] Forwarded to trainer [%u bytes]: %s\n", forward_len, hex_str);
+		att_capture(conn, ATT_CAPTURE_TX, ATT_OP_WRITE_RSP, 0, NULL, 0);
 	}
 
-	return len;
+	return ret;
 }
 
 uint8_t ftms_cp_indicate_func(struct bt_conn *conn,
@@ -222,58 +573,191 @@ uint8_t ftms_cp_indicate_func(struct bt_conn *conn,
 			      const void *data, uint16_t length)
 {
 	if (!data) {
-		log("[FTMS CP] Indication unsubscribed\n");
+		log_info(CP, "[FTMS CP] Indication unsubscribed\n");
 		params->value_handle = 0U;
 		return BT_GATT_ITER_STOP;
 	}
 
 	const uint8_t *response = data;
 
+	/* The stack confirms the indication after we return */
+	att_capture(conn, ATT_CAPTURE_RX, ATT_OP_INDICATE, params->value_handle, data, length);
+	att_capture(conn, ATT_CAPTURE_TX, ATT_OP_CONFIRM, 0, NULL, 0);
+
 	/* Log trainer response */
-	char hex_str[64];
-	int pos = 0;
-	for (int i = 0; i < length && pos < sizeof(hex_str) - 3; i++) {
-		pos += snprintf(hex_str + pos, sizeof(hex_str) - pos, "%02x ", response[i]);
+	if (log_enabled(CP, SERIAL_LOG_DEBUG)) {
+		char hex_str[64];
+		int pos = 0;
+		for (int i = 0; i < length && pos < sizeof(hex_str) - 3; i++) {
+			pos += snprintf(hex_str + pos, sizeof(hex_str) - pos, "%02x ", response[i]);
+		}
+		log_debug(CP, "[FTMS CP] Trainer response [%u bytes]: %s\n", length, hex_str);
 	}
-	log("[FTMS CP] Trainer response [%u bytes]: %s\n", length, hex_str);
 
 	if (length >= 3 && response[0] == FTMS_CP_RESPONSE_CODE) {
 		uint8_t req_opcode = response[1];
 		uint8_t result = response[2];
-		log("[FTMS CP] Response to %s: %s\n",
+		flight_recorder_log(FR_CP_RSP, req_opcode, result, 0, 0, 0);
+		log_info(CP, "[FTMS CP] Response to %s: %s\n",
 		       ftms_cp_opcode_str(req_opcode),
 		       result == 0x01 ? "Success" : result == 0x02 ? "Not Supported" :
 		       result == 0x03 ? "Invalid Parameter" : result == 0x04 ? "Failed" : "Unknown");
+
+		if (req_opcode == FTMS_CP_REQUEST_CONTROL && result != FTMS_CP_RESULT_SUCCESS) {
+			control_refused = true;
+		} else if (result == FTMS_CP_RESULT_SUCCESS) {
+			switch (req_opcode) {
+			case FTMS_CP_REQUEST_CONTROL:
+				trainer_controlled = true;
+				break;
+			case FTMS_CP_START_RESUME:
+				trainer_started = true;
+				break;
+			case FTMS_CP_STOP_PAUSE:
+				trainer_started = false;
+				break;
+			case FTMS_CP_RESET:
+				trainer_controlled = false;
+				trainer_started = false;
+				break;
+			}
+		}
+	}
+
+	/* Unsolicited responses go to the consumer in control */
+	struct cp_trainer_cmd cmd = { .reply_to = control_owner };
+	k_spinlock_key_t key = k_spin_lock(&cp_lock);
+	bool late = false;
+
+	if (inflight.late_opcode != 0 && inflight.conn == conn && length >= 2 &&
+	    response[0] == FTMS_CP_RESPONSE_CODE && response[1] == inflight.late_opcode) {
+		/* Indications arrive in order, so this answers the timed out
+		 * command, not the one written after it */
+		inflight.late_opcode = 0;
+		late = true;
+	} else if (inflight.response_pending && inflight.conn == conn) {
+		inflight.response_pending = false;
+		/* Fails if the timeout already answered the command */
+		late = !cmd_take(inflight.seq, &cmd);
 	}
+	k_spin_unlock(&cp_lock, key);
 
-	/* Forward indication back to Zwift if connected */
-	if (peripheral_conn && ftms_cp_indicate_enabled) {
-		if (length > sizeof(ftms_cp_response)) {
-			log("[FTMS CP] Response too long (%u), truncating\n", length);
-			length = sizeof(ftms_cp_response);
+	if (late) {
+		log_info(CP, "[FTMS CP] Late response to a timed out command, dropped\n");
+	} else if (cmd.reply_to) {
+		uint8_t forward[CONSUMER_INDICATE_MAX_LEN];
+		uint16_t forward_len = MIN(length, sizeof(forward));
+
+		if (length > sizeof(forward)) {
+			log_info(CP, "[FTMS CP] Response too long (%u), truncating\n", length);
 		}
-		ftms_cp_response_len = length;
-		memcpy(ftms_cp_response, data, length);
-		
+		memcpy(forward, data, forward_len);
+
 		/* Convert response opcode from 0x04 back to 0x11 if needed */
-		if (last_cmd_was_converted && ftms_cp_response_len >= 3 && 
-		    ftms_cp_response[0] == FTMS_CP_RESPONSE_CODE && 
-		    ftms_cp_response[1] == FTMS_CP_SET_TARGET_RESISTANCE) {
-			ftms_cp_response[1] = FTMS_CP_SET_INDOOR_BIKE_SIM;
-			log("[FTMS CP] Converted response 0x04 -> 0x11 for Zwift\n");
-			last_cmd_was_converted = false;
+		if (cmd.converted && rc_cp_response_unconvert(forward, forward_len)) {
+			log_debug(CP, "[FTMS CP] Converted response 0x04 -> 0x11 for Zwift\n");
 		}
-		
-		k_work_submit(&ftms_cp_response_work);
-		log("[FTMS CP] Queued response for forwarding\n");
-	} else if (peripheral_conn && !ftms_cp_indicate_enabled) {
-		log("[FTMS CP] Cannot send indication - CCC not configured\n");
+
+		if (consumer_indicate(cmd.reply_to, &ftms_svc.attrs[FTMS_ATTR_CONTROL_POINT],
+				      forward, forward_len) == 0) {
+			log_debug(CP, "[FTMS CP] Queued response for forwarding\n");
+		}
+	} else {
+		log_debug(CP, "[FTMS CP] Setup response consumed by the relay\n");
 	}
 
+	trainer_send_next();
+
 	return BT_GATT_ITER_CONTINUE;
 }
 
+void ftms_cp_trainer_ready(void)
+{
+	trainer_controlled = false;
+	trainer_started = false;
+	control_refused = false;
+
+	/* Bring the new link in line with the session consumers see */
+	log_info(CP, "[FTMS CP] Trainer ready, replaying session (%s, target %s)\n",
+		 session == CP_SESSION_STARTED ? "started" :
+		 session == CP_SESSION_STOPPED ? "stopped" : "idle",
+		 last_target_len ? ftms_cp_opcode_str(last_target[0]) : "none");
+
+	trainer_ensure_control();
+	if (session == CP_SESSION_STARTED) {
+		trainer_queue_setup(FTMS_CP_START_RESUME);
+	}
+	if (last_target_len && trainer_queue(last_target, last_target_len, NULL)) {
+		log_info(CP, "[FTMS CP] No room to queue the last target\n");
+	}
+	trainer_send_next();
+}
+
+void ftms_cp_trainer_disconnected(void)
+{
+	struct cp_trainer_cmd failed[CP_QUEUE_DEPTH];
+	k_spinlock_key_t key = k_spin_lock(&cp_lock);
+	int n = 0;
+
+	/* Queued commands will never be answered by this link, and the stack
+	 * is done with the params */
+	while (cmd_take(cmd_queue[cmd_head].seq, &failed[n])) {
+		n++;
+	}
+	inflight.write_pending = false;
+	inflight.response_pending = false;
+	inflight.timed_out = false;
+	inflight.late_opcode = 0;
+	inflight.conn = NULL;
+	k_spin_unlock(&cp_lock, key);
+
+	k_work_cancel_delayable(&response_timeout_work);
+	for (int i = 0; i < n; i++) {
+		cmd_fail(&failed[i]);
+	}
+	trainer_controlled = false;
+	trainer_started = false;
+}
+
+void ftms_cp_consumer_disconnected(struct bt_conn *conn)
+{
+	k_spinlock_key_t key;
+
+	if (control_owner == conn) {
+		control_owner = NULL;
+		log_info(CP, "[FTMS CP] Control released by disconnect\n");
+	}
+
+	key = k_spin_lock(&cp_lock);
+	for (int i = 0; i < cmd_count; i++) {
+		struct cp_trainer_cmd *c = &cmd_queue[(cmd_head + i) % CP_QUEUE_DEPTH];
+
+		if (c->reply_to == conn) {
+			c->reply_to = NULL;
+		}
+	}
+	k_spin_unlock(&cp_lock, key);
+}
+
+void ftms_cp_print_stats(void)
+{
+	json_out("{\"type\":\"ftms_cp\",\"ts\":%u,\"session\":\"%s\",\"trainer_controlled\":%s,"
+		 "\"trainer_started\":%s,\"queued\":%u,\"local\":%u,\"forwarded\":%u,\"setup\":%u,"
+		 "\"coalesced\":%u,\"timeouts\":%u,\"failed\":%u}\n",
+		 k_uptime_get_32(),
+		 session == CP_SESSION_STARTED ? "started" :
+		 session == CP_SESSION_STOPPED ? "stopped" : "idle",
+		 trainer_controlled ? "true" : "false", trainer_started ? "true" : "false",
+		 cmd_count, cp_stats.local, cp_stats.forwarded, cp_stats.setup,
+		 cp_stats.coalesced, cp_stats.timeouts, cp_stats.failed);
+}
+
+void ftms_cp_reset_stats(void)
+{
+	memset(&cp_stats, 0, sizeof(cp_stats));
+}
+
 void ftms_control_point_init(void)
 {
-	k_work_init(&ftms_cp_response_work, ftms_cp_response_work_handler);
+	k_work_init_delayable(&response_timeout_work, response_timeout_handler);
 }
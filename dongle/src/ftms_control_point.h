@@ -19,15 +19,32 @@
 #define FTMS_CP_SET_INDOOR_BIKE_SIM       0x11
 #define FTMS_CP_RESPONSE_CODE             0x80
 
-/* Control Point state */
-extern bool ftms_cp_indicate_enabled;
-extern bool ftms_cp_indicating;
-extern struct k_work ftms_cp_response_work;
+/* FTMS Control Point Result Codes */
+#define FTMS_CP_RESULT_SUCCESS               0x01
+#define FTMS_CP_RESULT_NOT_SUPPORTED         0x02
+#define FTMS_CP_RESULT_INVALID_PARAMETER     0x03
+#define FTMS_CP_RESULT_FAILED                0x04
+#define FTMS_CP_RESULT_CONTROL_NOT_PERMITTED 0x05
 
 /* Functions */
 void ftms_control_point_init(void);
 const char *ftms_cp_opcode_str(uint8_t opcode);
 
+/* Release control ownership held by a disconnected consumer */
+void ftms_cp_consumer_disconnected(struct bt_conn *conn);
+
+/* Trainer Control Point subscribed: take control and replay the session
+ * (Start/Resume, last target) consumers set up */
+void ftms_cp_trainer_ready(void);
+
+/* Trainer link lost, commands waiting for it are answered as failed */
+void ftms_cp_trainer_disconnected(void);
+
+/* Emit session state and local/forwarded counters as JSON */
+void ftms_cp_print_stats(void);
+
+void ftms_cp_reset_stats(void);
+
 /* GATT callbacks */
 void ftms_cp_ccc_cfg_changed(const struct bt_gatt_attr *attr, uint16_t value);
 ssize_t ftms_control_point_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
@@ -0,0 +1,908 @@
+/* gatt_mirror.c - Trainer GATT services mirrored to consumers
+ *
+ * Once the main discovery of the trainer is done, its whole attribute table
+ * is walked (services, characteristics, CCCs). Every service the relay does
+ * not serve itself is registered in the dynamic GATT database with the same
+ * UUIDs and properties, and consumer traffic on it is proxied:
+ *
+ *   - reads return the last value read or notified, and refresh it from the
+ *     trainer in the background (GATT server reads cannot wait for the
+ *     trainer),
+ *   - writes are forwarded; a write request is answered before the trainer
+ *     acknowledges it, trainer errors are counted,
+ *   - the trainer characteristic is subscribed while any consumer is, and
+ *     its notifications and indications go out through consumer_manager.
+ *
+ * Characteristics of services the relay serves itself that only the trainer
+ * knows (FTMS Feature, Supported Resistance Level Range) are read once and
+ * served by gatt_services.c through gatt_mirror_read_cached().
+ *
+ * Handles translate in O(1) both ways: a local value attribute carries its
+ * mirror_value in user_data, and remote_map indexes mirror_values by trainer
+ * handle for the read, write and notification callbacks.
+ *
+ * The database stays registered while the trainer is away so consumers keep
+ * their handles and subscriptions. On reconnect it is rebound if the layout
+ * is unchanged, otherwise rebuilt.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <string.h>
+#include "common.h"
+#include "gatt_mirror.h"
+#include "consumer_manager.h"
+#include "att_capture.h"
+
+#define MIRROR_MAX_ATTRS CONFIG_ZRELAY_GATT_MIRROR_MAX_ATTRS
+#define MIRROR_MAX_HANDLE CONFIG_ZRELAY_GATT_MIRROR_MAX_HANDLE
+/* Trainer services seen in discovery, mirrored or not */
+#define MIRROR_MAX_SERVICES 12
+/* Characteristics mirrored or cached */
+#define MIRROR_MAX_VALUES 16
+/* Cached value size, fits the default ATT MTU */
+#define MIRROR_VALUE_MAX_LEN 20
+#define MIRROR_NO_VALUE 0xff
+
+/* Properties the mirror can proxy */
+#define MIRROR_PROPS (BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE_WITHOUT_RESP | \
+		      BT_GATT_CHRC_WRITE | BT_GATT_CHRC_NOTIFY | BT_GATT_CHRC_INDICATE)
+
+/* Services served by the relay or the stack, never mirrored */
+static const uint16_t own_services[] = {
+	0x1800, /* GAP */
+	0x1801, /* GATT */
+	0x180A, /* Device Information */
+	0x180D, /* Heart Rate */
+	0x180F, /* Battery */
+	0x1816, /* Cycling Speed and Cadence */
+	0x1818, /* Cycling Power */
+	0x1826, /* Fitness Machine */
+};
+
+/* Characteristics of own services read for gatt_mirror_read_cached() */
+static const uint16_t cached_chrcs[] = {
+	0x2ACC, /* Fitness Machine Feature */
+	0x2AD6, /* Supported Resistance Level Range */
+};
+
+/* Declaration UUIDs must outlive the attributes that point at them */
+static const struct bt_uuid_16 uuid_primary = BT_UUID_INIT_16(0x2800);
+static const struct bt_uuid_16 uuid_chrc = BT_UUID_INIT_16(0x2803);
+static const struct bt_uuid_16 uuid_ccc = BT_UUID_INIT_16(0x2902);
+
+union mirror_uuid {
+	struct bt_uuid uuid;
+	struct bt_uuid_16 u16;
+	struct bt_uuid_128 u128;
+};
+
+struct mirror_service {
+	union mirror_uuid uuid;
+	uint16_t start_handle;
+	uint16_t end_handle;
+	bool mirrored;
+};
+
+/* A trainer characteristic as discovered, compared on reconnect */
+struct mirror_chrc {
+	union mirror_uuid uuid;
+	uint16_t value_handle;
+	uint16_t end_handle;  /* Last handle before the next characteristic */
+	uint16_t ccc_handle;  /* 0 if none */
+	uint8_t props;
+	uint8_t svc;          /* Index into services */
+};
+
+struct mirror_value_stats {
+	uint32_t reads;        /* Consumer reads */
+	uint32_t writes;       /* Consumer writes and write commands */
+	uint32_t notifies;     /* Trainer notifications and indications */
+	uint32_t errors;       /* Failed trainer reads, writes, subscriptions */
+	uint32_t refreshes;    /* Completed trainer reads */
+	uint32_t read_ms_max;
+	uint32_t read_ms_total;
+	uint32_t acked;        /* Completed trainer write requests */
+	uint32_t write_ms_max;
+	uint32_t write_ms_total;
+};
+
+struct mirror_value {
+	struct mirror_chrc info;
+
+	/* Local declaration; decl is NULL for cached characteristics and
+	 * values of services that did not fit the attribute table */
+	struct bt_gatt_chrc chrc;
+	const struct bt_gatt_attr *decl;
+	struct bt_gatt_ccc_managed_user_data ccc;
+
+	uint8_t data[MIRROR_VALUE_MAX_LEN];
+	uint16_t len;
+
+	/* Trainer subscription, held while any consumer is subscribed */
+	struct bt_gatt_subscribe_params sub;
+	bool subscribed;
+	uint16_t consumer_ccc;
+
+	struct mirror_value_stats stats;
+};
+
+enum mirror_state {
+	MIRROR_IDLE,
+	MIRROR_DISCOVERING,
+	MIRROR_LINKED,
+};
+
+static const char *const state_names[] = { "idle", "discovering", "linked" };
+
+/* Live layout, referenced by the registered attributes */
+static struct mirror_service services[MIRROR_MAX_SERVICES];
+static struct mirror_value values[MIRROR_MAX_VALUES];
+static uint8_t service_count;
+static uint8_t value_count;
+
+static struct bt_gatt_attr attrs[MIRROR_MAX_ATTRS];
+static struct bt_gatt_service gatt_svcs[MIRROR_MAX_SERVICES];
+static uint8_t gatt_svc_count;
+static uint16_t attr_count;
+
+/* Trainer value handle to values[] index */
+static uint8_t remote_map[MIRROR_MAX_HANDLE + 1];
+
+/* Discovery results */
+static struct mirror_service found_services[MIRROR_MAX_SERVICES];
+static struct mirror_chrc found_chrcs[MIRROR_MAX_VALUES];
+static uint8_t found_service_count;
+static uint8_t found_chrc_count;
+static int last_found;
+static uint16_t skipped;
+
+static struct {
+	enum mirror_state state;
+	struct conn_slot *trainer;
+	bool built;  /* Live layout valid, possibly with nothing registered */
+	struct bt_gatt_discover_params disc;
+
+	/* One trainer read and one write request at a time */
+	struct bt_gatt_read_params read;
+	bool read_busy;
+	uint32_t read_at;
+	uint8_t initial_read;  /* Next value of the post-link read sweep */
+
+	struct bt_gatt_write_params write;
+	uint8_t write_buf[MIRROR_VALUE_MAX_LEN];
+	bool write_busy;
+	uint32_t write_at;
+
+	uint32_t links;
+	uint32_t rebuilds;
+} mirror;
+
+static void read_next_initial(void);
+
+static bool uuid16_in(const struct bt_uuid *uuid, const uint16_t *list, size_t count)
+{
+	if (uuid->type != BT_UUID_TYPE_16) {
+		return false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (BT_UUID_16(uuid)->val == list[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void copy_uuid(union mirror_uuid *dst, const struct bt_uuid *src)
+{
+	if (src->type == BT_UUID_TYPE_128) {
+		memcpy(&dst->u128, src, sizeof(dst->u128));
+	} else {
+		memcpy(&dst->u16, src, sizeof(dst->u16));
+	}
+}
+
+static struct mirror_value *value_for_remote(uint16_t handle)
+{
+	if (handle > MIRROR_MAX_HANDLE || remote_map[handle] == MIRROR_NO_VALUE) {
+		return NULL;
+	}
+	return &values[remote_map[handle]];
+}
+
+static bool trainer_linked(void)
+{
+	return mirror.state == MIRROR_LINKED && mirror.trainer && mirror.trainer->conn;
+}
+
+/* Trainer side */
+
+static uint8_t mirror_notify_func(struct bt_conn *conn, struct bt_gatt_subscribe_params *params,
+				  const void *data, uint16_t length)
+{
+	struct mirror_value *v = value_for_remote(params->value_handle);
+	bool notify = params->value == BT_GATT_CCC_NOTIFY;
+
+	if (!data) {
+		log_debug(DISC, "[Mirror] Unsubscribed from handle %u\n", params->value_handle);
+		if (v) {
+			v->subscribed = false;
+		}
+		return BT_GATT_ITER_STOP;
+	}
+
+	att_capture(conn, ATT_CAPTURE_RX, notify ? ATT_OP_NOTIFY : ATT_OP_INDICATE,
+		    params->value_handle, data, length);
+
+	if (!v) {
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	v->len = MIN(length, sizeof(v->data));
+	memcpy(v->data, data, v->len);
+	v->stats.notifies++;
+
+	if (v->decl) {
+		if (notify) {
+			consumer_notify(v->decl, v->data, v->len);
+		} else {
+			consumer_indicate_all(v->decl, v->data, v->len);
+		}
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+static void mirror_subscribe(struct mirror_value *v)
+{
+	int err;
+
+	if (v->subscribed || !v->info.ccc_handle || !trainer_linked()) {
+		return;
+	}
+
+	memset(&v->sub, 0, sizeof(v->sub));
+	v->sub.notify = mirror_notify_func;
+	v->sub.value = (v->info.props & BT_GATT_CHRC_NOTIFY) ?
+		       BT_GATT_CCC_NOTIFY : BT_GATT_CCC_INDICATE;
+	v->sub.value_handle = v->info.value_handle;
+	v->sub.ccc_handle = v->info.ccc_handle;
+	atomic_set_bit(v->sub.flags, BT_GATT_SUBSCRIBE_FLAG_VOLATILE);
+
+	err = bt_gatt_subscribe(mirror.trainer->conn, &v->sub);
+	if (err && err != -EALREADY) {
+		v->stats.errors++;
+		log_info(DISC, "[Mirror] Subscribe to handle %u failed (err %d)\n",
+			 v->info.value_handle, err);
+		return;
+	}
+	v->subscribed = true;
+}
+
+static void mirror_unsubscribe(struct mirror_value *v)
+{
+	if (!v->subscribed || !trainer_linked()) {
+		return;
+	}
+
+	if (bt_gatt_unsubscribe(mirror.trainer->conn, &v->sub) == 0) {
+		v->subscribed = false;
+	}
+}
+
+static uint8_t mirror_read_func(struct bt_conn *conn, uint8_t err,
+				struct bt_gatt_read_params *params,
+				const void *data, uint16_t length)
+{
+	struct mirror_value *v = value_for_remote(params->single.handle);
+	uint32_t latency = k_uptime_get_32() - mirror.read_at;
+
+	mirror.read_busy = false;
+
+	if (v) {
+		if (err) {
+			v->stats.errors++;
+			att_capture(conn, ATT_CAPTURE_RX, ATT_OP_ERROR_RSP, 0, NULL, 0);
+			log_debug(DISC, "[Mirror] Read of handle %u failed (err 0x%02x)\n",
+				  params->single.handle, err);
+		} else {
+			/* First chunk only, longer values are cut to the cache size */
+			v->len = data ? MIN(length, sizeof(v->data)) : 0;
+			if (v->len) {
+				memcpy(v->data, data, v->len);
+			}
+			att_capture(conn, ATT_CAPTURE_RX, ATT_OP_READ_RSP, 0, data, length);
+
+			v->stats.refreshes++;
+			v->stats.read_ms_total += latency;
+			v->stats.read_ms_max = MAX(v->stats.read_ms_max, latency);
+		}
+	}
+
+	read_next_initial();
+
+	return BT_GATT_ITER_STOP;
+}
+
+/* Start a trainer read of v unless one is already in flight */
+static bool mirror_refresh(struct mirror_value *v)
+{
+	int err;
+
+	if (mirror.read_busy || !trainer_linked() || !(v->info.props & BT_GATT_CHRC_READ)) {
+		return false;
+	}
+
+	memset(&mirror.read, 0, sizeof(mirror.read));
+	mirror.read.func = mirror_read_func;
+	mirror.read.handle_count = 1;
+	mirror.read.single.handle = v->info.value_handle;
+	mirror.read.single.offset = 0;
+
+	err = bt_gatt_read(mirror.trainer->conn, &mirror.read);
+	if (err) {
+		v->stats.errors++;
+		return false;
+	}
+
+	mirror.read_busy = true;
+	mirror.read_at = k_uptime_get_32();
+	att_capture(mirror.trainer->conn, ATT_CAPTURE_TX, ATT_OP_READ_REQ,
+		    v->info.value_handle, NULL, 0);
+	return true;
+}
+
+/* Fill the caches once after linking, one read at a time */
+static void read_next_initial(void)
+{
+	while (mirror.initial_read < value_count) {
+		struct mirror_value *v = &values[mirror.initial_read++];
+
+		if (mirror_refresh(v)) {
+			return;
+		}
+	}
+}
+
+static void mirror_write_func(struct bt_conn *conn, uint8_t err,
+			      struct bt_gatt_write_params *params)
+{
+	struct mirror_value *v = value_for_remote(params->handle);
+	uint32_t latency = k_uptime_get_32() - mirror.write_at;
+
+	mirror.write_busy = false;
+
+	att_capture(conn, ATT_CAPTURE_RX, err ? ATT_OP_ERROR_RSP : ATT_OP_WRITE_RSP, 0, NULL, 0);
+
+	if (!v) {
+		return;
+	}
+
+	if (err) {
+		v->stats.errors++;
+		log_info(DISC, "[Mirror] Trainer rejected write to handle %u (err 0x%02x)\n",
+			 params->handle, err);
+		return;
+	}
+
+	v->stats.acked++;
+	v->stats.write_ms_total += latency;
+	v->stats.write_ms_max = MAX(v->stats.write_ms_max, latency);
+}
+
+/* Consumer side */
+
+static ssize_t mirror_read(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			   void *buf, uint16_t len, uint16_t offset)
+{
+	struct mirror_value *v = attr->user_data;
+	uint16_t handle = bt_gatt_attr_get_handle(attr);
+
+	att_capture(conn, ATT_CAPTURE_RX, ATT_OP_READ_REQ, handle, NULL, 0);
+
+	if (offset == 0) {
+		v->stats.reads++;
+		/* Served from the cache, the refresh makes the next read current */
+		mirror_refresh(v);
+	}
+
+	att_capture(conn, ATT_CAPTURE_TX, ATT_OP_READ_RSP, 0, v->data, v->len);
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, v->data, v->len);
+}
+
+static ssize_t mirror_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			    const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+	struct mirror_value *v = attr->user_data;
+	bool cmd = flags & BT_GATT_WRITE_FLAG_CMD;
+	int err;
+
+	att_capture(conn, ATT_CAPTURE_RX, cmd ? ATT_OP_WRITE_CMD : ATT_OP_WRITE_REQ,
+		    bt_gatt_attr_get_handle(attr), buf, len);
+
+	if (offset) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (len > sizeof(mirror.write_buf)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	v->stats.writes++;
+
+	if (!trainer_linked()) {
+		v->stats.errors++;
+		return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+	}
+
+	if (cmd) {
+		err = bt_gatt_write_without_response(mirror.trainer->conn, v->info.value_handle,
+						     buf, len, false);
+		if (err) {
+			v->stats.errors++;
+		} else {
+			att_capture(mirror.trainer->conn, ATT_CAPTURE_TX, ATT_OP_WRITE_CMD,
+				    v->info.value_handle, buf, len);
+		}
+		return len;
+	}
+
+	if (mirror.write_busy) {
+		v->stats.errors++;
+		log_info(DISC, "[Mirror] Write to handle %u while another is pending\n",
+			 v->info.value_handle);
+		return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+	}
+
+	memcpy(mirror.write_buf, buf, len);
+	memset(&mirror.write, 0, sizeof(mirror.write));
+	mirror.write.func = mirror_write_func;
+	mirror.write.handle = v->info.value_handle;
+	mirror.write.data = mirror.write_buf;
+	mirror.write.length = len;
+
+	err = bt_gatt_write(mirror.trainer->conn, &mirror.write);
+	if (err) {
+		v->stats.errors++;
+		return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+	}
+
+	mirror.write_busy = true;
+	mirror.write_at = k_uptime_get_32();
+	att_capture(mirror.trainer->conn, ATT_CAPTURE_TX, ATT_OP_WRITE_REQ,
+		    v->info.value_handle, buf, len);
+	return len;
+}
+
+/* Aggregate CCC of all consumers changed */
+static void mirror_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
+{
+	struct mirror_value *v = CONTAINER_OF(attr->user_data, struct mirror_value, ccc);
+
+	v->consumer_ccc = value;
+	if (value) {
+		mirror_subscribe(v);
+	} else {
+		mirror_unsubscribe(v);
+	}
+}
+
+ssize_t gatt_mirror_read_cached(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+				void *buf, uint16_t len, uint16_t offset)
+{
+	for (int i = 0; i < value_count; i++) {
+		struct mirror_value *v = &values[i];
+
+		if (!v->decl && !bt_uuid_cmp(&v->info.uuid.uuid, attr->uuid)) {
+			return bt_gatt_attr_read(conn, attr, buf, len, offset, v->data, v->len);
+		}
+	}
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, NULL, 0);
+}
+
+/* Dynamic database */
+
+static void mirror_unregister(void)
+{
+	for (int i = 0; i < gatt_svc_count; i++) {
+		bt_gatt_service_unregister(&gatt_svcs[i]);
+	}
+	gatt_svc_count = 0;
+	attr_count = 0;
+}
+
+static void mirror_register(void)
+{
+	for (int i = 0; i < service_count; i++) {
+		struct bt_gatt_attr *first = &attrs[attr_count];
+		uint16_t need = 1;
+		uint16_t n = attr_count;
+		int err;
+
+		if (!services[i].mirrored || gatt_svc_count == MIRROR_MAX_SERVICES) {
+			continue;
+		}
+
+		for (int j = 0; j < value_count; j++) {
+			if (values[j].info.svc == i) {
+				need += values[j].info.ccc_handle ? 3 : 2;
+			}
+		}
+		if (attr_count + need > MIRROR_MAX_ATTRS) {
+			log_info(DISC, "[Mirror] Service at handle %u needs %u attributes, %u left\n",
+				 services[i].start_handle, need, MIRROR_MAX_ATTRS - attr_count);
+			continue;
+		}
+
+		attrs[n++] = (struct bt_gatt_attr)BT_GATT_ATTRIBUTE(&uuid_primary.uuid,
+				BT_GATT_PERM_READ, bt_gatt_attr_read_service, NULL,
+				&services[i].uuid.uuid);
+
+		for (int j = 0; j < value_count; j++) {
+			struct mirror_value *v = &values[j];
+			uint16_t perm = 0;
+
+			if (v->info.svc != i) {
+				continue;
+			}
+
+			v->chrc.uuid = &v->info.uuid.uuid;
+			v->chrc.value_handle = 0;
+			v->chrc.properties = v->info.props;
+			if (v->info.props & BT_GATT_CHRC_READ) {
+				perm |= BT_GATT_PERM_READ;
+			}
+			if (v->info.props & (BT_GATT_CHRC_WRITE | BT_GATT_CHRC_WRITE_WITHOUT_RESP)) {
+				perm |= BT_GATT_PERM_WRITE;
+			}
+
+			v->decl = &attrs[n];
+			attrs[n++] = (struct bt_gatt_attr)BT_GATT_ATTRIBUTE(&uuid_chrc.uuid,
+					BT_GATT_PERM_READ, bt_gatt_attr_read_chrc, NULL, &v->chrc);
+			attrs[n++] = (struct bt_gatt_attr)BT_GATT_ATTRIBUTE(&v->info.uuid.uuid,
+					perm, mirror_read, mirror_write, v);
+
+			if (v->info.ccc_handle) {
+				memset(&v->ccc, 0, sizeof(v->ccc));
+				v->ccc.cfg_changed = mirror_ccc_changed;
+				attrs[n++] = (struct bt_gatt_attr)BT_GATT_ATTRIBUTE(&uuid_ccc.uuid,
+						BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+						bt_gatt_attr_read_ccc, bt_gatt_attr_write_ccc, &v->ccc);
+			}
+		}
+
+		gatt_svcs[gatt_svc_count].attrs = first;
+		gatt_svcs[gatt_svc_count].attr_count = n - attr_count;
+
+		err = bt_gatt_service_register(&gatt_svcs[gatt_svc_count]);
+		if (err) {
+			log_info(DISC, "[Mirror] Service registration failed (err %d)\n", err);
+			for (int j = 0; j < value_count; j++) {
+				if (values[j].info.svc == i) {
+					values[j].decl = NULL;
+				}
+			}
+			continue;
+		}
+
+		gatt_svc_count++;
+		attr_count = n;
+	}
+
+	log_info(DISC, "[Mirror] %u services, %u attributes registered\n",
+		 gatt_svc_count, attr_count);
+}
+
+static bool layout_matches(void)
+{
+	if (found_service_count != service_count || found_chrc_count != value_count) {
+		return false;
+	}
+
+	for (int i = 0; i < service_count; i++) {
+		if (found_services[i].mirrored != services[i].mirrored ||
+		    bt_uuid_cmp(&found_services[i].uuid.uuid, &services[i].uuid.uuid)) {
+			return false;
+		}
+	}
+
+	for (int i = 0; i < value_count; i++) {
+		const struct mirror_chrc *f = &found_chrcs[i];
+		const struct mirror_chrc *l = &values[i].info;
+
+		if (f->props != l->props || f->svc != l->svc ||
+		    !f->ccc_handle != !l->ccc_handle || bt_uuid_cmp(&f->uuid.uuid, &l->uuid.uuid)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Discovery finished: rebind or rebuild, then read and resubscribe */
+static void mirror_link(void)
+{
+	if (mirror.built && layout_matches()) {
+		for (int i = 0; i < value_count; i++) {
+			values[i].info = found_chrcs[i];
+		}
+		log_info(DISC, "[Mirror] Trainer layout unchanged, rebinding\n");
+	} else {
+		mirror_unregister();
+
+		memcpy(services, found_services, sizeof(services));
+		service_count = found_service_count;
+		memset(values, 0, sizeof(values));
+		value_count = found_chrc_count;
+		for (int i = 0; i < value_count; i++) {
+			values[i].info = found_chrcs[i];
+		}
+
+		mirror_register();
+		mirror.built = true;
+		mirror.rebuilds++;
+	}
+
+	memset(remote_map, MIRROR_NO_VALUE, sizeof(remote_map));
+	for (int i = 0; i < value_count; i++) {
+		remote_map[values[i].info.value_handle] = i;
+	}
+
+	mirror.state = MIRROR_LINKED;
+	mirror.links++;
+
+	for (int i = 0; i < value_count; i++) {
+		values[i].subscribed = false;
+		if (values[i].consumer_ccc) {
+			mirror_subscribe(&values[i]);
+		}
+	}
+
+	mirror.initial_read = 0;
+	read_next_initial();
+}
+
+/* Discovery */
+
+static void found_service(const struct bt_gatt_attr *attr)
+{
+	const struct bt_gatt_service_val *sv = attr->user_data;
+	struct mirror_service *s;
+
+	if (found_service_count == MIRROR_MAX_SERVICES) {
+		skipped++;
+		return;
+	}
+
+	s = &found_services[found_service_count++];
+	copy_uuid(&s->uuid, sv->uuid);
+	s->start_handle = attr->handle;
+	s->end_handle = sv->end_handle;
+	s->mirrored = !uuid16_in(sv->uuid, own_services, ARRAY_SIZE(own_services));
+}
+
+static void found_chrc(const struct bt_gatt_attr *attr)
+{
+	const struct bt_gatt_chrc *chrc = attr->user_data;
+	struct mirror_chrc *c;
+	int svc = -1;
+
+	for (int i = 0; i < found_service_count; i++) {
+		if (attr->handle > found_services[i].start_handle &&
+		    attr->handle <= found_services[i].end_handle) {
+			svc = i;
+			break;
+		}
+	}
+
+	/* The previous characteristic ends before this declaration */
+	if (last_found >= 0) {
+		c = &found_chrcs[last_found];
+		c->end_handle = MIN(attr->handle - 1, found_services[c->svc].end_handle);
+		last_found = -1;
+	}
+
+	if (svc < 0 || !(found_services[svc].mirrored ||
+			 uuid16_in(chrc->uuid, cached_chrcs, ARRAY_SIZE(cached_chrcs)))) {
+		return;
+	}
+
+	if (found_chrc_count == MIRROR_MAX_VALUES || chrc->value_handle > MIRROR_MAX_HANDLE) {
+		log_info(DISC, "[Mirror] Not mirroring characteristic at handle %u\n",
+			 chrc->value_handle);
+		skipped++;
+		return;
+	}
+
+	c = &found_chrcs[found_chrc_count];
+	memset(c, 0, sizeof(*c));
+	copy_uuid(&c->uuid, chrc->uuid);
+	c->value_handle = chrc->value_handle;
+	c->props = chrc->properties & MIRROR_PROPS;
+	if (c->props & BT_GATT_CHRC_NOTIFY) {
+		/* Consumers are notified, never indicated, for such values */
+		c->props &= ~BT_GATT_CHRC_INDICATE;
+	}
+	c->svc = svc;
+	last_found = found_chrc_count++;
+}
+
+static void found_ccc(const struct bt_gatt_attr *attr)
+{
+	for (int i = 0; i < found_chrc_count; i++) {
+		struct mirror_chrc *c = &found_chrcs[i];
+
+		if (found_services[c->svc].mirrored && !c->ccc_handle &&
+		    (c->props & (BT_GATT_CHRC_NOTIFY | BT_GATT_CHRC_INDICATE)) &&
+		    attr->handle > c->value_handle && attr->handle <= c->end_handle) {
+			c->ccc_handle = attr->handle;
+			return;
+		}
+	}
+}
+
+static uint8_t mirror_discover_func(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+				    struct bt_gatt_discover_params *params);
+
+static void discover_next(struct bt_conn *conn, uint8_t type, uint16_t start, uint16_t end)
+{
+	int err;
+
+	memset(&mirror.disc, 0, sizeof(mirror.disc));
+	mirror.disc.func = mirror_discover_func;
+	mirror.disc.type = type;
+	mirror.disc.start_handle = start;
+	mirror.disc.end_handle = end;
+	mirror.disc.uuid = type == BT_GATT_DISCOVER_DESCRIPTOR ? &uuid_ccc.uuid : NULL;
+
+	err = bt_gatt_discover(conn, &mirror.disc);
+	if (err) {
+		log_info(DISC, "[Mirror] Discover failed (err %d)\n", err);
+		mirror.state = MIRROR_IDLE;
+	}
+}
+
+/* One pass over the whole table per attribute type */
+static void pass_complete(struct bt_conn *conn, uint8_t type)
+{
+	uint16_t start = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	uint16_t end = 0;
+
+	if (type == BT_GATT_DISCOVER_PRIMARY) {
+		discover_next(conn, BT_GATT_DISCOVER_CHARACTERISTIC,
+			      BT_ATT_FIRST_ATTRIBUTE_HANDLE, BT_ATT_LAST_ATTRIBUTE_HANDLE);
+		return;
+	}
+
+	if (type == BT_GATT_DISCOVER_CHARACTERISTIC) {
+		for (int i = 0; i < found_chrc_count; i++) {
+			struct mirror_chrc *c = &found_chrcs[i];
+
+			if (!c->end_handle) {
+				c->end_handle = found_services[c->svc].end_handle;
+			}
+			if (found_services[c->svc].mirrored &&
+			    (c->props & (BT_GATT_CHRC_NOTIFY | BT_GATT_CHRC_INDICATE))) {
+				start = MIN(start, c->value_handle + 1);
+				end = MAX(end, c->end_handle);
+			}
+		}
+		if (start <= end) {
+			discover_next(conn, BT_GATT_DISCOVER_DESCRIPTOR, start, end);
+			return;
+		}
+	}
+
+	log_info(DISC, "[Mirror] Trainer has %u services, %u characteristics mirrored or cached"
+		 " (%u skipped)\n", found_service_count, found_chrc_count, skipped);
+	mirror_link();
+}
+
+static uint8_t mirror_discover_func(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+				    struct bt_gatt_discover_params *params)
+{
+	if (mirror.state != MIRROR_DISCOVERING || !mirror.trainer ||
+	    mirror.trainer->conn != conn) {
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (!attr) {
+		pass_complete(conn, params->type);
+		return BT_GATT_ITER_STOP;
+	}
+
+	switch (params->type) {
+	case BT_GATT_DISCOVER_PRIMARY:
+		found_service(attr);
+		break;
+	case BT_GATT_DISCOVER_CHARACTERISTIC:
+		found_chrc(attr);
+		break;
+	default:
+		found_ccc(attr);
+		break;
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+void gatt_mirror_start(struct conn_slot *slot)
+{
+	if (!slot->conn || !slot->ftms_control_point_handle) {
+		return;
+	}
+	if (mirror.state != MIRROR_IDLE && mirror.trainer == slot) {
+		return;
+	}
+
+	mirror.trainer = slot;
+	mirror.state = MIRROR_DISCOVERING;
+	mirror.read_busy = false;
+	mirror.write_busy = false;
+	found_service_count = 0;
+	found_chrc_count = 0;
+	last_found = -1;
+	skipped = 0;
+
+	log_info(DISC, "[Mirror] Discovering trainer attributes (slot %d)\n",
+		 (int)(slot - connections));
+	discover_next(slot->conn, BT_GATT_DISCOVER_PRIMARY,
+		      BT_ATT_FIRST_ATTRIBUTE_HANDLE, BT_ATT_LAST_ATTRIBUTE_HANDLE);
+}
+
+void gatt_mirror_trainer_disconnected(struct conn_slot *slot)
+{
+	if (mirror.trainer != slot) {
+		return;
+	}
+
+	/* Keep the database; reads serve the last values, writes fail */
+	mirror.state = MIRROR_IDLE;
+	mirror.read_busy = false;
+	mirror.write_busy = false;
+	for (int i = 0; i < value_count; i++) {
+		values[i].subscribed = false;
+	}
+	log_info(DISC, "[Mirror] Trainer disconnected, %u services kept\n", gatt_svc_count);
+}
+
+void gatt_mirror_print_stats(void)
+{
+	char uuid[BT_UUID_STR_LEN];
+
+	json_out("{\"type\":\"mirror\",\"ts\":%u,\"state\":\"%s\",\"services\":%u,"
+		 "\"attrs\":%u,\"links\":%u,\"rebuilds\":%u,\"values\":[",
+		 k_uptime_get_32(), state_names[mirror.state], gatt_svc_count, attr_count,
+		 mirror.links, mirror.rebuilds);
+
+	for (int i = 0; i < value_count; i++) {
+		const struct mirror_value *v = &values[i];
+		const struct mirror_value_stats *s = &v->stats;
+
+		bt_uuid_to_str(&v->info.uuid.uuid, uuid, sizeof(uuid));
+		json_out("%s{\"uuid\":\"%s\",\"local\":%u,\"remote\":%u,\"props\":%u,"
+			 "\"subscribed\":%s,\"reads\":%u,\"writes\":%u,\"notifies\":%u,"
+			 "\"errors\":%u,\"read_ms_max\":%u,\"read_ms_avg\":%u,"
+			 "\"write_ms_max\":%u,\"write_ms_avg\":%u}",
+			 i ? "," : "", uuid,
+			 v->decl ? bt_gatt_attr_get_handle(v->decl + 1) : 0,
+			 v->info.value_handle, v->info.props, v->subscribed ? "true" : "false",
+			 s->reads, s->writes, s->notifies, s->errors,
+			 s->read_ms_max, s->refreshes ? s->read_ms_total / s->refreshes : 0,
+			 s->write_ms_max, s->acked ? s->write_ms_total / s->acked : 0);
+	}
+
+	json_out("]}\n");
+}
+
+void gatt_mirror_reset_stats(void)
+{
+	for (int i = 0; i < value_count; i++) {
+		memset(&values[i].stats, 0, sizeof(values[i].stats));
+	}
+	mirror.links = 0;
+	mirror.rebuilds = 0;
+}
@@ -0,0 +1,38 @@
+/* gatt_mirror.h - Trainer GATT services mirrored to consumers */
+
+#ifndef GATT_MIRROR_H_
+#define GATT_MIRROR_H_
+
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include "common.h"
+
+#if defined(CONFIG_ZRELAY_GATT_MIRROR)
+
+/* Main discovery of slot is complete; if it is the trainer, discover its
+ * remaining services and mirror them */
+void gatt_mirror_start(struct conn_slot *slot);
+
+/* Trainer link lost, the mirror stays registered until it reconnects */
+void gatt_mirror_trainer_disconnected(struct conn_slot *slot);
+
+/* Read handler body for static characteristics served from the trainer's
+ * value, e.g. FTMS Feature. Empty until the trainer was read. */
+ssize_t gatt_mirror_read_cached(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+				void *buf, uint16_t len, uint16_t offset);
+
+/* Emit per-attribute proxy counters and latencies as JSON */
+void gatt_mirror_print_stats(void);
+
+void gatt_mirror_reset_stats(void);
+
+#else
+
+static inline void gatt_mirror_start(struct conn_slot *slot) {}
+static inline void gatt_mirror_trainer_disconnected(struct conn_slot *slot) {}
+static inline void gatt_mirror_print_stats(void) {}
+static inline void gatt_mirror_reset_stats(void) {}
+
+#endif /* CONFIG_ZRELAY_GATT_MIRROR */
+
+#endif /* GATT_MIRROR_H_ */
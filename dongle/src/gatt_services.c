@@ -3,27 +3,29 @@
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/gatt.h>
 #include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/byteorder.h>
 #include "common.h"
 #include "gatt_services.h"
 #include "ftms_control_point.h"
+#include "gatt_mirror.h"
 
 /* Measurement buffers */
-uint8_t hr_measurement[20];
+uint8_t hr_measurement[RC_HR_RELAY_LEN];
 uint16_t hr_measurement_len;
 
-uint8_t csc_measurement[11];
+uint8_t csc_measurement[RC_CSC_MAX_LEN];
 uint16_t csc_measurement_len;
 
-uint8_t cp_measurement[34];
+uint8_t cp_measurement[RC_CP_RELAY_LEN];
 uint16_t cp_measurement_len;
 
-uint8_t ftms_measurement[64];
+uint8_t ftms_measurement[RC_IBD_RELAY_LEN];
 uint16_t ftms_measurement_len;
 
-uint8_t ftms_training_status[20];
+uint8_t ftms_training_status[RC_STATUS_RELAY_LEN];
 uint16_t ftms_training_status_len;
 
-uint8_t ftms_machine_status[20];
+uint8_t ftms_machine_status[RC_STATUS_RELAY_LEN];
 uint16_t ftms_machine_status_len;
 
 /* Heart Rate Service */
@@ -36,6 +38,18 @@ BT_GATT_SERVICE_DEFINE(hr_svc,
 	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
 );
 
+/* CSC Feature: wheel (synthesized from trainer speed) and crank revolution data */
+#define CSC_FEATURE_WHEEL_REV 0x0001
+#define CSC_FEATURE_CRANK_REV 0x0002
+
+static ssize_t csc_feature_read(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+				void *buf, uint16_t len, uint16_t offset)
+{
+	uint16_t feature = sys_cpu_to_le16(CSC_FEATURE_WHEEL_REV | CSC_FEATURE_CRANK_REV);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &feature, sizeof(feature));
+}
+
 /* Cycling Speed and Cadence Service */
 BT_GATT_SERVICE_DEFINE(csc_svc,
 	BT_GATT_PRIMARY_SERVICE(BT_UUID_DECLARE_16(0x1816)),
@@ -44,6 +58,10 @@ BT_GATT_SERVICE_DEFINE(csc_svc,
 			       BT_GATT_PERM_NONE,
 			       NULL, NULL, NULL),
 	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_16(0x2A5C), /* CSC Feature */
+			       BT_GATT_CHRC_READ,
+			       BT_GATT_PERM_READ,
+			       csc_feature_read, NULL, NULL),
 );
 
 /* Cycling Power Service */
@@ -56,6 +74,29 @@ BT_GATT_SERVICE_DEFINE(cp_svc,
 	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
 );
 
+#if defined(CONFIG_ZRELAY_GATT_MIRROR)
+/* Trainer-specific FTMS characteristics, served from values read by the
+ * mirror. Appended after the Control Point so attribute indices used by
+ * the relay do not move. */
+static ssize_t ftms_mirrored_read(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+				  void *buf, uint16_t len, uint16_t offset)
+{
+	return gatt_mirror_read_cached(conn, attr, buf, len, offset);
+}
+
+#define FTMS_MIRRORED_ATTRS \
+	BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_16(0x2ACC), /* Fitness Machine Feature */ \
+			       BT_GATT_CHRC_READ, \
+			       BT_GATT_PERM_READ, \
+			       ftms_mirrored_read, NULL, NULL), \
+	BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_16(0x2AD6), /* Supported Resistance Level Range */ \
+			       BT_GATT_CHRC_READ, \
+			       BT_GATT_PERM_READ, \
+			       ftms_mirrored_read, NULL, NULL),
+#else
+#define FTMS_MIRRORED_ATTRS
+#endif
+
 /* Fitness Machine Service */
 BT_GATT_SERVICE_DEFINE(ftms_svc,
 	BT_GATT_PRIMARY_SERVICE(BT_UUID_DECLARE_16(0x1826)),
@@ -79,4 +120,5 @@ BT_GATT_SERVICE_DEFINE(ftms_svc,
 			       BT_GATT_PERM_WRITE,
 			       NULL, ftms_control_point_write, NULL),
 	BT_GATT_CCC(ftms_cp_ccc_cfg_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	FTMS_MIRRORED_ATTRS
 );
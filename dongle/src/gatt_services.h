@@ -4,6 +4,7 @@
 #define GATT_SERVICES_H_
 
 #include <zephyr/bluetooth/gatt.h>
+#include "relay_codec.h"
 
 /* Service definitions */
 extern const struct bt_gatt_service_static hr_svc;
@@ -11,23 +12,29 @@ extern const struct bt_gatt_service_static csc_svc;
 extern const struct bt_gatt_service_static cp_svc;
 extern const struct bt_gatt_service_static ftms_svc;
 
+/* Characteristic declaration indices within ftms_svc.attrs */
+#define FTMS_ATTR_INDOOR_BIKE_DATA  1
+#define FTMS_ATTR_TRAINING_STATUS   4
+#define FTMS_ATTR_MACHINE_STATUS    7
+#define FTMS_ATTR_CONTROL_POINT     10
+
 /* Measurement buffers */
-extern uint8_t hr_measurement[20];
+extern uint8_t hr_measurement[RC_HR_RELAY_LEN];
 extern uint16_t hr_measurement_len;
 
-extern uint8_t csc_measurement[11];
+extern uint8_t csc_measurement[RC_CSC_MAX_LEN];
 extern uint16_t csc_measurement_len;
 
-extern uint8_t cp_measurement[34];
+extern uint8_t cp_measurement[RC_CP_RELAY_LEN];
 extern uint16_t cp_measurement_len;
 
-extern uint8_t ftms_measurement[64];
+extern uint8_t ftms_measurement[RC_IBD_RELAY_LEN];
 extern uint16_t ftms_measurement_len;
 
-extern uint8_t ftms_training_status[20];
+extern uint8_t ftms_training_status[RC_STATUS_RELAY_LEN];
 extern uint16_t ftms_training_status_len;
 
-extern uint8_t ftms_machine_status[20];
+extern uint8_t ftms_machine_status[RC_STATUS_RELAY_LEN];
 extern uint16_t ftms_machine_status_len;
 
 #endif /* GATT_SERVICES_H_ */
@@ -5,6 +5,7 @@
 #include "common.h"
 #include "led_feedback.h"
 #include "device_manager.h"
+#include "work_queues.h"
 
 /* LED configuration - use led0 alias from devicetree */
 #define LED0_NODE DT_ALIAS(led0)
@@ -129,7 +130,7 @@ static void led_work_handler(struct k_work *work)
 	}
 	
 	/* Schedule next LED update */
-	k_work_reschedule(&led_work, K_MSEC(next_delay_ms));
+	k_work_reschedule_for_queue(&housekeeping_work_q, &led_work, K_MSEC(next_delay_ms));
 }
 
 void led_feedback_update(void)
@@ -144,7 +145,7 @@ void led_feedback_update(void)
 	set_led(false);
 	
 	/* Reschedule immediately to pick up new state */
-	k_work_reschedule(&led_work, K_NO_WAIT);
+	k_work_reschedule_for_queue(&housekeeping_work_q, &led_work, K_NO_WAIT);
 }
 
 int led_feedback_init(void)
@@ -0,0 +1,313 @@
+/* link_monitor.c - Sensor link quality monitoring and adaptation */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/sys/byteorder.h>
+#include <string.h>
+#include "common.h"
+#include "link_monitor.h"
+#include "relay_config.h"
+#include "scan_scheduler.h"
+#include "work_queues.h"
+
+#define LINK_POLL_INTERVAL_MS 1000
+/* Telemetry every LINK_REPORT_POLLS polls */
+#define LINK_REPORT_POLLS 10
+
+/* Notification gap: longer than this many learned periods */
+#define LINK_GAP_PERIODS 3
+#define LINK_GAP_MIN_MS 250
+
+/* Minimum time between adaptations of one link */
+#define LINK_ADAPT_HOLDOFF_MS 10000
+/* Strong signal this long on Coded PHY returns the link to 1M */
+#define LINK_RECOVER_MS 60000
+
+/* Supervision timeout used once a link had a near miss (10 ms units).
+ * Only the timeout is raised; the connection interval is left to the
+ * sensor, and weak links are handled by switching PHY. */
+#define LINK_ROBUST_TIMEOUT 600
+
+struct link_quality {
+	int16_t rssi_avg;      /* EWMA, 1/4 weight per sample */
+	int8_t rssi;
+	int8_t rssi_min;
+	uint32_t last_rx;
+	uint32_t period_ms;    /* Learned notification period, EWMA 1/8 */
+	uint32_t rx_count;
+	uint32_t gaps;
+	uint32_t max_gap_ms;
+	uint32_t near_misses;
+	uint32_t eval_near_misses;  /* near_misses at last evaluation */
+	uint32_t last_adapt;
+	uint32_t good_since;
+	uint16_t adaptations;
+	bool rssi_valid;
+	bool degraded;         /* Reported to the scan scheduler */
+};
+
+static struct link_quality links[MAX_CONNECTIONS];
+static struct k_work_delayable poll_work;
+static uint32_t poll_count;
+
+static int read_conn_rssi(struct bt_conn *conn, int8_t *rssi)
+{
+	struct bt_hci_cp_read_rssi *cp;
+	struct bt_hci_rp_read_rssi *rp;
+	struct net_buf *buf, *rsp = NULL;
+	uint16_t handle;
+	int err;
+
+	err = bt_hci_get_conn_handle(conn, &handle);
+	if (err) {
+		return err;
+	}
+
+	buf = bt_hci_cmd_create(BT_HCI_OP_READ_RSSI, sizeof(*cp));
+	if (!buf) {
+		return -ENOBUFS;
+	}
+
+	cp = net_buf_add(buf, sizeof(*cp));
+	cp->handle = sys_cpu_to_le16(handle);
+
+	err = bt_hci_cmd_send_sync(BT_HCI_OP_READ_RSSI, buf, &rsp);
+	if (err) {
+		return err;
+	}
+
+	rp = (void *)rsp->data;
+	*rssi = rp->rssi;
+	net_buf_unref(rsp);
+
+	return 0;
+}
+
+static const char *phy_str(uint8_t phy)
+{
+	switch (phy) {
+	case BT_GAP_LE_PHY_1M:    return "1M";
+	case BT_GAP_LE_PHY_2M:    return "2M";
+	case BT_GAP_LE_PHY_CODED: return "coded";
+	default:                  return "unknown";
+	}
+}
+
+/* The last reading or the average is below the weak threshold */
+static bool link_weak(const struct link_quality *lq)
+{
+	return lq->rssi_valid &&
+	       MIN(lq->rssi, lq->rssi_avg) < relay_config_get(RELAY_CFG_RSSI_WEAK);
+}
+
+static void adapt_link(int idx, const struct bt_conn_info *info, uint32_t now)
+{
+	struct link_quality *lq = &links[idx];
+	struct bt_conn *conn = connections[idx].conn;
+	uint8_t phy = info->le.phy ? info->le.phy->rx_phy : BT_GAP_LE_PHY_1M;
+	bool near_miss = lq->near_misses != lq->eval_near_misses;
+	int err;
+
+	lq->eval_near_misses = lq->near_misses;
+
+	if (!lq->rssi_valid || lq->rssi_avg > relay_config_get(RELAY_CFG_RSSI_GOOD)) {
+		if (lq->good_since == 0) {
+			lq->good_since = now;
+		}
+	} else {
+		lq->good_since = 0;
+	}
+
+	/* Scanning competes with a struggling link for airtime; report it
+	 * once, until the signal is good again */
+	if ((near_miss || link_weak(lq)) && !lq->degraded) {
+		lq->degraded = true;
+		scan_scheduler_report_link_degraded();
+	} else if (lq->degraded && !near_miss && lq->good_since != 0) {
+		lq->degraded = false;
+	}
+
+	if (lq->last_adapt != 0 && now - lq->last_adapt < LINK_ADAPT_HOLDOFF_MS) {
+		return;
+	}
+
+	if (near_miss && info->le.timeout < LINK_ROBUST_TIMEOUT) {
+		/* The link nearly timed out, give it more slack at the same interval */
+		struct bt_le_conn_param param = {
+			.interval_min = info->le.interval,
+			.interval_max = info->le.interval,
+			.latency = info->le.latency,
+			.timeout = LINK_ROBUST_TIMEOUT,
+		};
+
+		err = bt_conn_le_param_update(conn, &param);
+		log("[Link] Slot %d near miss, supervision timeout %u -> %u ms (err %d)\n",
+		    idx, info->le.timeout * 10, LINK_ROBUST_TIMEOUT * 10, err);
+	} else if (lq->rssi_valid && lq->rssi_avg < relay_config_get(RELAY_CFG_RSSI_WEAK) && phy != BT_GAP_LE_PHY_CODED) {
+		/* Weak signal, trade airtime for range */
+		err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_CODED);
+		log("[Link] Slot %d weak signal (%d dBm), switching to Coded PHY (err %d)\n",
+		    idx, lq->rssi_avg, err);
+	} else if (phy == BT_GAP_LE_PHY_CODED && lq->good_since != 0 &&
+		   now - lq->good_since >= LINK_RECOVER_MS) {
+		err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_1M);
+		log("[Link] Slot %d signal recovered (%d dBm), switching to 1M PHY (err %d)\n",
+		    idx, lq->rssi_avg, err);
+	} else {
+		return;
+	}
+
+	lq->last_adapt = now;
+	lq->adaptations++;
+}
+
+static void poll_work_handler(struct k_work *work)
+{
+	uint32_t now = k_uptime_get_32();
+
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		struct link_quality *lq = &links[i];
+		struct bt_conn_info info;
+		int8_t rssi;
+
+		if (!connections[i].conn || bt_conn_get_info(connections[i].conn, &info) != 0 ||
+		    info.state != BT_CONN_STATE_CONNECTED) {
+			continue;
+		}
+
+		if (read_conn_rssi(connections[i].conn, &rssi) == 0 && rssi != 127) {
+			/* 127 means the controller has no measurement */
+			if (!lq->rssi_valid) {
+				lq->rssi_avg = rssi;
+				lq->rssi_min = rssi;
+				lq->rssi_valid = true;
+			} else {
+				lq->rssi_avg += (rssi - lq->rssi_avg) / 4;
+				lq->rssi_min = MIN(lq->rssi_min, rssi);
+			}
+			lq->rssi = rssi;
+			connections[i].rssi = rssi;
+		}
+
+		adapt_link(i, &info, now);
+	}
+
+	if (++poll_count % LINK_REPORT_POLLS == 0) {
+		link_monitor_print_stats();
+	}
+
+	k_work_reschedule_for_queue(&conn_work_q, &poll_work, K_MSEC(LINK_POLL_INTERVAL_MS));
+}
+
+void link_monitor_on_rx(int slot_idx)
+{
+	struct link_quality *lq = &links[slot_idx];
+	uint32_t now = k_uptime_get_32();
+	uint32_t delta = now - lq->last_rx;
+
+	lq->rx_count++;
+	if (lq->rx_count == 1) {
+		lq->last_rx = now;
+		return;
+	}
+	lq->last_rx = now;
+
+	/* Several characteristics can notify in the same event, ignore those */
+	if (delta == 0) {
+		return;
+	}
+
+	if (lq->period_ms == 0) {
+		lq->period_ms = delta;
+		return;
+	}
+
+	if (delta > LINK_GAP_PERIODS * lq->period_ms && delta > LINK_GAP_MIN_MS) {
+		struct bt_conn_info info;
+
+		lq->gaps++;
+		lq->max_gap_ms = MAX(lq->max_gap_ms, delta);
+
+		/* Silence alone is not evidence: a power meter stops notifying
+		 * when the cranks stop, a strap when it loses contact. Half the
+		 * supervision timeout without data on a weak link is a near miss. */
+		if (link_weak(lq) && connections[slot_idx].conn &&
+		    bt_conn_get_info(connections[slot_idx].conn, &info) == 0 &&
+		    delta * 2 >= info.le.timeout * 10U) {
+			lq->near_misses++;
+		}
+		return;
+	}
+
+	lq->period_ms += ((int32_t)delta - (int32_t)lq->period_ms) / 8;
+}
+
+void link_monitor_reset(int slot_idx)
+{
+	memset(&links[slot_idx], 0, sizeof(links[slot_idx]));
+}
+
+void link_monitor_print_stats(void)
+{
+	uint32_t now = k_uptime_get_32();
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		struct link_quality *lq = &links[i];
+		struct bt_conn_info info;
+
+		if (!connections[i].conn || bt_conn_get_info(connections[i].conn, &info) != 0) {
+			continue;
+		}
+
+		bt_addr_le_to_str(bt_conn_get_dst(connections[i].conn), addr, sizeof(addr));
+		json_out("{\"type\":\"link\",\"ts\":%u,\"slot\":%d,\"addr\":\"%s\",\"rssi\":%d,"
+			 "\"rssi_avg\":%d,\"rssi_min\":%d,\"phy\":\"%s\",\"interval_ms\":%u,"
+			 "\"timeout_ms\":%u,\"period_ms\":%u,\"gaps\":%u,\"max_gap_ms\":%u,"
+			 "\"near_misses\":%u,\"adaptations\":%u}\n",
+			 now, i, addr, lq->rssi, lq->rssi_avg, lq->rssi_min,
+			 phy_str(info.le.phy ? info.le.phy->rx_phy : 0),
+			 info.le.interval * 5 / 4, info.le.timeout * 10, lq->period_ms,
+			 lq->gaps, lq->max_gap_ms, lq->near_misses, lq->adaptations);
+	}
+}
+
+void link_monitor_reset_stats(void)
+{
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		struct link_quality *lq = &links[i];
+
+		lq->rssi_min = lq->rssi;
+		lq->gaps = 0;
+		lq->max_gap_ms = 0;
+		lq->near_misses = 0;
+		lq->eval_near_misses = 0;
+		lq->adaptations = 0;
+	}
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+			     uint16_t latency, uint16_t timeout)
+{
+	log("[Link] Parameters updated: interval %u ms, latency %u, timeout %u ms\n",
+	    interval * 5 / 4, latency, timeout * 10);
+}
+
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+	log("[Link] PHY updated: tx %s, rx %s\n",
+	    phy_str(param->tx_phy), phy_str(param->rx_phy));
+}
+
+BT_CONN_CB_DEFINE(link_monitor_callbacks) = {
+	.le_param_updated = le_param_updated,
+	.le_phy_updated = le_phy_updated,
+};
+
+void link_monitor_init(void)
+{
+	k_work_init_delayable(&poll_work, poll_work_handler);
+	k_work_reschedule_for_queue(&conn_work_q, &poll_work, K_MSEC(LINK_POLL_INTERVAL_MS));
+}
@@ -0,0 +1,23 @@
+/* link_monitor.h - Sensor link quality monitoring and adaptation */
+
+#ifndef LINK_MONITOR_H_
+#define LINK_MONITOR_H_
+
+#include <zephyr/bluetooth/conn.h>
+#include "common.h"
+
+void link_monitor_init(void);
+
+/* Start tracking a freshly connected sensor slot */
+void link_monitor_reset(int slot_idx);
+
+/* Record a notification received on a sensor slot */
+void link_monitor_on_rx(int slot_idx);
+
+/* Emit link quality for all connected sensors as JSON */
+void link_monitor_print_stats(void);
+
+/* Zero gap, near miss and adaptation counters, learned state is kept */
+void link_monitor_reset_stats(void);
+
+#endif /* LINK_MONITOR_H_ */
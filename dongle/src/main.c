@@ -21,9 +21,24 @@
 #include "ftms_control_point.h"
 #include "notification_handler.h"
 #include "device_manager.h"
+#include "device_table.h"
 #include "gatt_discovery.h"
 #include "nvs_storage.h"
 #include "led_feedback.h"
+#include "scan_scheduler.h"
+#include "conn_manager.h"
+#include "consumer_manager.h"
+#include "csc_output.h"
+#include "battery_monitor.h"
+#include "link_monitor.h"
+#include "flight_recorder.h"
+#include "boot_milestone.h"
+#include "command_channel.h"
+#include "att_capture.h"
+#include "work_queues.h"
+#include "resource_audit.h"
+#include "sysstats.h"
+#include "gatt_mirror.h"
 
 /* Button configuration */
 #define SW0_NODE DT_ALIAS(sw0)
@@ -34,12 +49,8 @@ static struct gpio_callback button_cb_data;
 static uint32_t button_press_time = 0;
 static struct k_work_delayable long_press_work;
 
-/* Serial output mutex for thread-safe logging and JSON output */
-K_MUTEX_DEFINE(serial_output_mutex);
-
 /* Global variables */
 struct conn_slot connections[MAX_CONNECTIONS];
-struct bt_conn *peripheral_conn = NULL;
 uint32_t last_cp_data_time = 0;
 uint64_t total_rx_count = 0;
 static char device_name_buffer[32] = DEVICE_NAME_PREFIX;  /* Store current device name for advertising callbacks */
@@ -51,15 +62,40 @@ const struct bt_uuid *discover_services[] = {
 	BT_UUID_HRS,
 	BT_UUID_CPS,
 	BT_UUID_FMS,
+	BT_UUID_BAS,
 };
 const int discover_service_count = ARRAY_SIZE(discover_services);
 
+static bool is_peripheral_link(struct bt_conn *conn)
+{
+	struct bt_conn_info info;
+
+	return bt_conn_get_info(conn, &info) == 0 && info.role == BT_CONN_ROLE_PERIPHERAL;
+}
+
 static void connected(struct bt_conn *conn, uint8_t conn_err)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
+	if (is_peripheral_link(conn)) {
+		if (conn_err) {
+			log("Consumer connection failed (%u)\n", conn_err);
+		} else {
+			log("Consumer connected: %s\n", addr);
+			boot_milestone(BOOT_FIRST_CONSUMER);
+			consumer_connected(conn);
+			flight_recorder_log(FR_CONSUMER, consumer_count(), 1, 0, 0, 0);
+		}
+
+		/* Advertising stops on connection, keep it going while consumer slots remain */
+		if (consumer_count() < MAX_PERIPHERAL_CONNECTIONS) {
+			start_advertising(device_name_buffer);
+		}
+		return;
+	}
+
 	/* Find the connection slot */
 	struct conn_slot *slot = NULL;
 	int slot_idx = -1;
@@ -78,9 +114,17 @@ static void connected(struct bt_conn *conn, uint8_t conn_err)
 
 	if (conn_err) {
 		log("Failed to connect to %s (%u)\n", addr, conn_err);
+		flight_recorder_log(FR_CONNECT, slot_idx, slot->role, conn_err, 0, 0);
 		
-		/* Cancel timeout if this was the pending connection */
-		cancel_connection_timeout(conn);
+		/* Cancel timeout and schedule backoff for this device */
+		conn_manager_on_connected(conn, conn_err);
+
+		device_table_lock();
+		struct device_info *dev_info = device_table_find(bt_conn_get_dst(conn));
+		if (dev_info) {
+			dev_info->conn_slot = -1;
+		}
+		device_table_unlock();
 		
 		bt_conn_unref(slot->conn);
 		slot->conn = NULL;
@@ -89,24 +133,27 @@ static void connected(struct bt_conn *conn, uint8_t conn_err)
 	}
 
 	log("Connected: %s\n", addr);
+	boot_milestone(BOOT_FIRST_SENSOR);
 	
 	/* Update LED feedback for new connection */
 	led_feedback_update();
 	
 	/* Copy RSSI from device_info (captured during scanning) */
 	slot->rssi = 0;  /* Default if not found */
-	struct device_info *dev_info;
-	SYS_SLIST_FOR_EACH_CONTAINER(&device_list, dev_info, node) {
-		if (!bt_addr_le_cmp(&dev_info->addr, bt_conn_get_dst(conn))) {
-			slot->rssi = dev_info->rssi;
-			log("RSSI at connection: %d dBm\n", slot->rssi);
-			break;
-		}
+	device_table_lock();
+	struct device_info *dev_info = device_table_find(bt_conn_get_dst(conn));
+	if (dev_info) {
+		dev_info->conn_slot = slot_idx;
+		slot->rssi = dev_info->rssi;
+		log("RSSI at connection: %d dBm\n", slot->rssi);
 	}
+	device_table_unlock();
+	link_monitor_reset(slot_idx);
 	print_device_list();
 
-	/* Cancel timeout if this was a pending connection */
-	cancel_connection_timeout(conn);
+	/* Cancel timeout and record time-to-connect */
+	conn_manager_on_connected(conn, 0);
+	flight_recorder_log(FR_CONNECT, slot_idx, slot->role, 0, 0, 0);
 	
 	/* Save device to NVS for future reconnection priority */
 	save_connected_device(conn);
@@ -124,16 +171,14 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 	log("Disconnected: %s, reason 0x%02x %s\n", addr, reason, bt_hci_err_to_str(reason));
 
 	/* Remove device from list so it can be cleanly re-discovered and re-connected */
-	struct device_info *dev_info, *tmp;
-	SYS_SLIST_FOR_EACH_CONTAINER_SAFE(&device_list, dev_info, tmp, node) {
-		if (!bt_addr_le_cmp(&dev_info->addr, bt_conn_get_dst(conn))) {
-			log("Removed device from list: %s\n", dev_info->name);
-			sys_slist_find_and_remove(&device_list, &dev_info->node);
-			k_free(dev_info);
-			print_device_list();
-			break;
-		}
+	device_table_lock();
+	struct device_info *dev_info = device_table_find(bt_conn_get_dst(conn));
+	if (dev_info) {
+		log("Removed device from list: %s\n", dev_info->name);
+		device_table_remove(dev_info);
+		print_device_list();
 	}
+	device_table_unlock();
 
 	/* Find and clear the connection slot */
 	bool found_slot = false;
@@ -141,6 +186,7 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 		if (connections[i].conn == conn) {
 			log("Freeing connection slot %d (%d subscriptions)\n", 
 			       i, connections[i].subscribe_count);
+			flight_recorder_log(FR_DISCONNECT, i, reason, 0, 0, 0);
 			
 			/* Note: Don't call bt_gatt_unsubscribe here - connection is already
 			 * disconnected so it fails with -ENOTCONN. The subscription params
@@ -148,6 +194,11 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 			
 			/* Clear subscription state so params can be reused */
 			connections[i].subscribe_count = 0;
+
+			if (connections[i].ftms_control_point_handle) {
+				ftms_cp_trainer_disconnected();
+				gatt_mirror_trainer_disconnected(&connections[i]);
+			}
 			
 			bt_conn_unref(connections[i].conn);
 			connections[i].conn = NULL;
@@ -160,22 +211,25 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 		}
 	}
 
-	/* Cancel timeout if this was a pending connection */
-	cancel_connection_timeout(conn);
+	/* Cancel timeout if this was a pending connection, track flapping */
+	conn_manager_on_disconnected(conn, reason);
 
 	if (found_slot) {
-		/* Sensor disconnected */
+		/* Sensor disconnected; a supervision timeout means the radio is
+		 * struggling, so reconnect scanning backs off. The link monitor
+		 * usually reported it earlier; this covers sudden drops. */
+		if (reason == BT_HCI_ERR_CONN_TIMEOUT) {
+			scan_scheduler_report_link_loss();
+		}
 		start_scan();
 	} else {
 		/* Peripheral disconnected */
 		log("Peripheral disconnected, restarting advertising\n");
-		
-		if (peripheral_conn == conn) {
-			bt_conn_unref(peripheral_conn);
-			peripheral_conn = NULL;
-			log("[FTMS CP] Cleared peripheral connection\n");
-		}
-		
+
+		ftms_cp_consumer_disconnected(conn);
+		consumer_disconnected(conn);
+		flight_recorder_log(FR_CONSUMER, consumer_count(), 0, reason, 0, 0);
+
 		start_advertising(device_name_buffer);
 	}
 }
@@ -189,6 +243,10 @@ static void print_table_work_handler(struct k_work *work)
 {
 	log("Printing device list\n");
 	print_device_list();
+	conn_manager_print_stats();
+	consumer_print_stats();
+	nvs_print_stats();
+	work_queues_print_stats();
 }
 
 K_WORK_DEFINE(print_table_work, print_table_work_handler);
@@ -230,16 +288,18 @@ static void button_pressed(const struct device *dev, struct gpio_callback *cb, u
 		log("Button pressed\n");
 		
 		/* Schedule long press check after 2 seconds */
-		k_work_reschedule_for_queue(&k_sys_work_q, &long_press_work, K_MSEC(2000));
+		k_work_reschedule_for_queue(&conn_work_q, &long_press_work, K_MSEC(2000));
 	} else {
 		/* Button released */
 		uint32_t press_duration = k_uptime_get_32() - button_press_time;
 		
 		if (press_duration < 2000) {
-			/* Short press - cancel long press work and print device list */
+			/* Short press - cancel long press work, print device list and
+			 * keep the flight recorder contents for later download */
 			k_work_cancel_delayable(&long_press_work);
 			log("Short button press (%u ms) - printing device list\n", press_duration);
-			k_work_submit(&print_table_work);
+			k_work_submit_to_queue(&housekeeping_work_q, &print_table_work);
+			flight_recorder_freeze(FR_TRIGGER_BUTTON);
 		}
 		/* If long press, the timeout work already handled it */
 	}
@@ -249,8 +309,11 @@ int main(void)
 {
 	int err;
 
-	/* Delay to allow serial terminal to connect before first logs */
-	k_sleep(K_SECONDS(5));
+	/* Everything below submits work to these queues */
+	work_queues_init();
+
+	/* Output is buffered until a terminal opens the port, no need to wait */
+	serial_output_init();
 
 	err = bt_enable(NULL);
 
@@ -258,6 +321,8 @@ int main(void)
 		log("Bluetooth init failed (err %d)\n", err);
 		return 0;
 	}
+	boot_milestone(BOOT_BT_READY);
+	timebase_init();
 
 	/* Initialize button */
 	if (!gpio_is_ready_dt(&button)) {
@@ -287,7 +352,16 @@ int main(void)
 	/* Initialize modules */
 	device_manager_init();
 	ftms_control_point_init();
+	consumer_manager_init();
+	csc_output_init();
+	link_monitor_init();
+	battery_monitor_init();
+	flight_recorder_init();
+	att_capture_init();
 	led_feedback_init();
+	command_channel_init();
+	resource_audit_init();
+	sysstats_init();
 
 	/* Print initial device list */
 	print_device_list();
@@ -310,5 +384,9 @@ int main(void)
 
 	start_advertising(device_name_buffer);
 	log("Device ready - press button for 2+ seconds to enable scanning (5 min window)\n");
+
+	if (CONFIG_ZRELAY_BOOT_SCAN_WINDOW > 0) {
+		start_scan_window(CONFIG_ZRELAY_BOOT_SCAN_WINDOW * 1000U);
+	}
 	return 0;
 }
@@ -2,30 +2,37 @@
 
 #include <zephyr/kernel.h>
 #include <zephyr/bluetooth/gatt.h>
-#include <zephyr/sys/byteorder.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include "common.h"
 #include "notification_handler.h"
 #include "gatt_services.h"
+#include "consumer_manager.h"
+#include "csc_output.h"
+#include "battery_monitor.h"
 #include "device_manager.h"
+#include "link_monitor.h"
+#include "flight_recorder.h"
+#include "att_capture.h"
 
 /* CP data cache for injection into FTMS */
 struct cp_cache cached_cp_data = {0};
 
-static int get_battery_level_for_conn(struct bt_conn *conn)
+/* Copy into a relay buffer; an oversized payload is dropped, not relayed */
+static bool relay_copy(uint8_t *buf, size_t size, uint16_t *buf_len,
+		       const void *data, uint16_t length, const char *what)
 {
-	const bt_addr_le_t *dst = bt_conn_get_dst(conn);
-	struct device_info *dev_info;
+	int len = rc_relay_copy(buf, size, data, length);
 
-	SYS_SLIST_FOR_EACH_CONTAINER(&device_list, dev_info, node) {
-		if (!bt_addr_le_cmp(&dev_info->addr, dst)) {
-			return dev_info->battery_level;
-		}
+	if (len < 0) {
+		log_debug(RELAY, "[DEBUG] %s too long to relay: %u > %u bytes\n",
+			  what, length, (unsigned int)size);
+		return false;
 	}
 
-	return -1;
+	*buf_len = len;
+	return true;
 }
 
 static void json_out_battery_field(int battery_level)
@@ -42,10 +49,12 @@ uint8_t notify_func(struct bt_conn *conn,
 		    const void *data, uint16_t length)
 {
 	if (!data) {
-		log("[DEBUG] Unsubscribed value_handle=%u\n", params->value_handle);
+		log_debug(RELAY, "[DEBUG] Unsubscribed value_handle=%u\n", params->value_handle);
 		return BT_GATT_ITER_STOP;
 	}
 
+	att_capture(conn, ATT_CAPTURE_RX, ATT_OP_NOTIFY, params->value_handle, data, length);
+
 	/* Find which connection slot this notification belongs to */
 	struct conn_slot *slot = NULL;
 	int sub_idx = -1;
@@ -65,292 +74,166 @@ uint8_t notify_func(struct bt_conn *conn,
 	}
 
 	if (!slot) {
-		log("[DEBUG] Notification from unknown subscription\n");
+		log_debug(RELAY, "[DEBUG] Notification from unknown subscription\n");
 		return BT_GATT_ITER_CONTINUE;
 	}
 
-	/* Get service type from the found index */
+	/* Set from the characteristic UUID at discovery */
 	int svc_type = slot->service_type[sub_idx];
 
-	if (svc_type == -1) {
-		log("[DEBUG] Service type not found (length=%u, handle=%u)\n", length, params->value_handle);
+	if (svc_type == SUB_UNKNOWN) {
+		log_debug(RELAY, "[DEBUG] Service type not found (length=%u, handle=%u)\n", length, params->value_handle);
 		return BT_GATT_ITER_CONTINUE;
 	}
 
-	/* Get RSSI - use a cached value since live RSSI requires async callback */
-	/* We'll update it periodically in main loop instead */
+	/* slot->rssi is refreshed by the link monitor */
+	link_monitor_on_rx(slot - connections);
 
-	if (svc_type == 0) {
+	if (svc_type == SUB_BATTERY) {
+		battery_monitor_update(slot, data, length);
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	if (svc_type == SUB_HR) {
 		/* HR service */
-		const uint8_t *hr_data = data;
-		int battery_level = get_battery_level_for_conn(conn);
-		uint8_t flags = hr_data[0];
-		uint8_t hr_format = flags & 0x01;
-		uint16_t heart_rate;
+		int battery_level = slot->battery_level;
+		struct rc_hr hr;
 
-		if (length < 2) {
-			log("[DEBUG] Invalid HR data length: %u\n", length);
+		if (rc_hr_decode(data, length, &hr)) {
+			log_debug(RELAY, "[DEBUG] Invalid HR data length: %u\n", length);
 			return BT_GATT_ITER_CONTINUE;
 		}
 
-		if (hr_format == 0) {
-			heart_rate = hr_data[1];
-		} else {
-			if (length < 3) {
-				log("[DEBUG] Invalid HR data length for UINT16: %u\n", length);
-				return BT_GATT_ITER_CONTINUE;
-			}
-			heart_rate = sys_le16_to_cpu(*(uint16_t *)&hr_data[1]);
+		if (relay_copy(hr_measurement, sizeof(hr_measurement), &hr_measurement_len,
+			       data, length, "HR")) {
+			consumer_notify(&hr_svc.attrs[1], hr_measurement, hr_measurement_len);
 		}
 
-		hr_measurement_len = length;
-		memcpy(hr_measurement, data, length);
-		bt_gatt_notify(NULL, &hr_svc.attrs[1], hr_measurement, hr_measurement_len);
+		flight_recorder_log(FR_HR, slot - connections, hr.bpm, 0, 0, 0);
 
-		json_out("{\"type\":\"hr\",\"ts\":%u,\"bpm\":%u,\"rssi\":%d", k_uptime_get_32(), heart_rate, slot->rssi);
+		json_out("{\"type\":\"hr\",\"ts\":%u,\"bpm\":%u,\"rssi\":%d", k_uptime_get_32(), hr.bpm, slot->rssi);
 		json_out_battery_field(battery_level);
 		json_out("}\n");
-	} else if (svc_type == 1) {
+	} else if (svc_type == SUB_CP) {
 		/* CP service - always relay to Zwift immediately */
-		int battery_level = get_battery_level_for_conn(conn);
-		cp_measurement_len = length;
-		memcpy(cp_measurement, data, length);
-		bt_gatt_notify(NULL, &cp_svc.attrs[1], cp_measurement, cp_measurement_len);
+		int battery_level = slot->battery_level;
+		struct rc_cp cp;
+
+		if (relay_copy(cp_measurement, sizeof(cp_measurement), &cp_measurement_len,
+			       data, length, "CP")) {
+			consumer_notify(&cp_svc.attrs[1], cp_measurement, cp_measurement_len);
+		}
 		
 		/* Now parse and cache for internal use */
 		last_cp_data_time = k_uptime_get_32();
-		const uint8_t *cp_data = data;
 		
-		if (length >= 4) {
-			uint16_t flags = sys_le16_to_cpu(*(uint16_t *)&cp_data[0]);
-			int16_t power = sys_le16_to_cpu(*(uint16_t *)&cp_data[2]);
-			int offset = 4;
-			
+		if (rc_cp_decode(data, length, &cp) == 0) {
 			/* Cache power */
-			cached_cp_data.power = power;
+			cached_cp_data.power = cp.power;
 			cached_cp_data.timestamp = last_cp_data_time;
 			
-			json_out("{\"type\":\"cp\",\"ts\":%u,\"power\":%d,\"flags\":%u,\"rssi\":%d", last_cp_data_time, power, flags, slot->rssi);
+			json_out("{\"type\":\"cp\",\"ts\":%u,\"power\":%d,\"flags\":%u,\"rssi\":%d", last_cp_data_time, cp.power, cp.flags, slot->rssi);
 			json_out_battery_field(battery_level);
 			
-			if (flags & 0x01) {
-				if (length > offset) {
-					uint8_t balance = cp_data[offset];
-				json_out(",\"balance\":%u", balance);
-					offset++;
-				}
+			if (cp.has_balance) {
+				json_out(",\"balance\":%u", cp.balance);
 			}
 			
-			if (flags & 0x20) {
-				if (length >= offset + 4) {
-					uint16_t crank_revs = sys_le16_to_cpu(*(uint16_t *)&cp_data[offset]);
-					uint16_t crank_time = sys_le16_to_cpu(*(uint16_t *)&cp_data[offset + 2]);
-					
-					/* Calculate cadence from crank revolution delta using sensor time */
-					if (cached_cp_data.valid) {
-						uint16_t rev_delta = (crank_revs >= cached_cp_data.last_crank_revs) ? 
-							(crank_revs - cached_cp_data.last_crank_revs) : 
-							(65536 + crank_revs - cached_cp_data.last_crank_revs);
-						
-						if (rev_delta > 0) {
-							/* Crank position changed - calculate cadence from sensor time */
-							uint16_t time_delta = (crank_time >= cached_cp_data.last_crank_time) ?
-								(crank_time - cached_cp_data.last_crank_time) :
-								(65536 + crank_time - cached_cp_data.last_crank_time);
-							
-							if (time_delta > 0) {
-								/* rpm = (rev_delta / (time_delta / 1024)) * 60 */
-								/* cadence (0.5 rpm) = rpm * 2 = (rev_delta * 122880) / time_delta */
-								uint32_t cadence_calc = (rev_delta * 122880UL) / time_delta;
-								cached_cp_data.cadence = (uint16_t)(cadence_calc > 65535 ? 65535 : cadence_calc);
-							}
-							cached_cp_data.last_crank_change_time = last_cp_data_time;
-						} else {
-							/* No change in crank position - check timeout */
-							uint32_t time_since_change = last_cp_data_time - cached_cp_data.last_crank_change_time;
-							if (time_since_change >= 4000) {
-								cached_cp_data.cadence = 0;
-							}
-							/* else: keep previous cadence value */
-						}
-					} else {
-						/* First time seeing crank data - initialize */
-						cached_cp_data.last_crank_change_time = last_cp_data_time;
-					}
-					json_out(",\"crank_revs\":%u,\"crank_time\":%u,\"cadence\":%u", crank_revs, crank_time, cached_cp_data.cadence / 2);
-					
-					cached_cp_data.last_crank_revs = crank_revs;
-					cached_cp_data.last_crank_time = crank_time;
-					cached_cp_data.valid = true;
-				}
+			if (cp.has_crank) {
+				/* Cadence from crank revolution delta using sensor time */
+				rc_cadence_update(&cached_cp_data.crank, cp.crank_revs, cp.crank_time,
+						  last_cp_data_time);
+				json_out(",\"crank_revs\":%u,\"crank_time\":%u,\"cadence\":%u",
+					 cp.crank_revs, cp.crank_time, cached_cp_data.crank.cadence / 2);
 			}
 			json_out("}\n");
+
+			flight_recorder_log(FR_CP, slot - connections, cp.power,
+					    cached_cp_data.crank.cadence / 2, 0, 0);
 		}
-		
-		/* Send CSC notification if we have crank data */
-		if (cached_cp_data.valid) {
-			csc_measurement[0] = 0x02; /* Crank Revolution Data Present */
-			*(uint16_t *)&csc_measurement[1] = sys_cpu_to_le16(cached_cp_data.last_crank_revs);
-			*(uint16_t *)&csc_measurement[3] = sys_cpu_to_le16(cached_cp_data.last_crank_time);
-			csc_measurement_len = 5;
-			bt_gatt_notify(NULL, &csc_svc.attrs[1], csc_measurement, csc_measurement_len);
-		}
-	} else if (svc_type == 2) {
+	} else if (svc_type == SUB_IBD) {
 		/* FTMS Indoor Bike Data */
-		const uint8_t *ftms_data = data;
-		int battery_level = get_battery_level_for_conn(conn);
-		uint16_t flags = 0;
+		int battery_level = slot->battery_level;
 		bool cp_active = false;
-		int cadence_offset = -1;
-		int power_offset = -1;
 		uint32_t now = k_uptime_get_32();
+		struct rc_ibd ibd;
+		bool decoded = rc_ibd_decode(data, length, &ibd) == 0;
 		
-		if (length >= 2) {
-			flags = sys_le16_to_cpu(*(uint16_t *)&ftms_data[0]);
-			int offset = 2;
-			
+		if (decoded) {
+			int16_t ftms_power = (ibd.present & RC_IBD_HAS_POWER) ? ibd.power : -1;
+
 			/* Check if power meter is active */
-			cp_active = (cached_cp_data.valid && (now - cached_cp_data.timestamp) < CP_TIMEOUT_MS);
+			cp_active = (cached_cp_data.crank.valid && (now - cached_cp_data.timestamp) < CP_TIMEOUT_MS);
 			
-			json_out("{\"type\":\"ftms\",\"ts\":%u,\"flags\":%u,\"rssi\":%d", now, flags, slot->rssi);
+			json_out("{\"type\":\"ftms\",\"ts\":%u,\"flags\":%u,\"rssi\":%d", now, ibd.flags, slot->rssi);
 			json_out_battery_field(battery_level);
 			
-			/* Instantaneous Speed */
-			if (length >= offset + 2) {
-				uint16_t speed = sys_le16_to_cpu(*(uint16_t *)&ftms_data[offset]);
-				json_out(",\"speed\":%u", speed);
+			if (ibd.present & RC_IBD_HAS_SPEED) {
+				json_out(",\"speed\":%u", ibd.speed);
+				csc_output_speed(ibd.speed, now);
 			}
-			offset += 2;
-			
-			if (flags & 0x0002) {
-				offset += 2;
-			}
-			
-			cadence_offset = -1;
-			power_offset = -1;
-			
-			if (flags & 0x0004) {
-				cadence_offset = offset;
-				if (length >= offset + 2) {
-					uint16_t ftms_cadence = sys_le16_to_cpu(*(uint16_t *)&ftms_data[offset]);
-					json_out(",\"cadence\":%u", ftms_cadence / 2);
-				}
-				offset += 2;
-			}
-			
-			if (flags & 0x0008) {
-				offset += 2;
-			}
-			
-			if (flags & 0x0010) {
-				offset += 3;
+			if (ibd.present & RC_IBD_HAS_CADENCE) {
+				json_out(",\"cadence\":%u", ibd.cadence / 2);
 			}
-			
-			if (flags & 0x0020) {
-				if (length >= offset + 2) {
-					int16_t resistance = sys_le16_to_cpu(*(uint16_t *)&ftms_data[offset]);
-					json_out(",\"resistance\":%d", resistance);
-				}
-				offset += 2;
+			if (ibd.present & RC_IBD_HAS_RESISTANCE) {
+				json_out(",\"resistance\":%d", ibd.resistance);
 			}
-			
-			/* Extract/inject power */
-			int16_t ftms_power = -1;
-			if (flags & 0x0040) {
-				power_offset = offset;
-				if (length >= offset + 2) {
-					ftms_power = sys_le16_to_cpu(*(uint16_t *)&ftms_data[offset]);
-					json_out(",\"power\":%d", ftms_power);
-				}
-				offset += 2;
+			if (ibd.present & RC_IBD_HAS_POWER) {
+				json_out(",\"power\":%d", ibd.power);
 			}
 
 			json_out("}\n");
+
+			flight_recorder_log(FR_FTMS, slot - connections, ftms_power, ibd.cadence / 2,
+					    ibd.resistance, ibd.speed);
 		}
 		/* Rebroadcast FTMS with CP power injection if active */
-		ftms_measurement_len = length;
-		memcpy(ftms_measurement, data, length);
-		
-		/* Inject power meter power if active AND power field already exists */
-		/* Only replace existing power to avoid creating invalid packet structure */
-		if (cp_active && cached_cp_data.power >= 0 && power_offset >= 0 && power_offset + 2 <= ftms_measurement_len) {
-			*(int16_t *)&ftms_measurement[power_offset] = sys_cpu_to_le16(cached_cp_data.power);
+		if (relay_copy(ftms_measurement, sizeof(ftms_measurement), &ftms_measurement_len,
+			       data, length, "Indoor Bike Data")) {
+			/* Inject power meter power if active AND power field already exists */
+			if (decoded && cp_active && cached_cp_data.power >= 0) {
+				rc_ibd_set_power(ftms_measurement, ftms_measurement_len, &ibd,
+						 cached_cp_data.power);
+			}
+
+			consumer_notify(&ftms_svc.attrs[FTMS_ATTR_INDOOR_BIKE_DATA], ftms_measurement,
+					ftms_measurement_len);
 		}
-		
-		bt_gatt_notify(NULL, &ftms_svc.attrs[1], ftms_measurement, ftms_measurement_len);
-	} else if (svc_type == 3) {
+	} else if (svc_type == SUB_TRAINING_STATUS) {
 		/* FTMS Training Status */
-		log("[DEBUG] FTMS Training Status [%u bytes]\n", length);
-		ftms_training_status_len = length;
-		memcpy(ftms_training_status, data, length);
-		bt_gatt_notify(NULL, &ftms_svc.attrs[3], ftms_training_status, ftms_training_status_len);
-	} else if (svc_type == 4) {
+		log_debug(RELAY, "[DEBUG] FTMS Training Status [%u bytes]\n", length);
+		if (relay_copy(ftms_training_status, sizeof(ftms_training_status),
+			       &ftms_training_status_len, data, length, "Training Status")) {
+			consumer_notify(&ftms_svc.attrs[FTMS_ATTR_TRAINING_STATUS], ftms_training_status,
+					ftms_training_status_len);
+		}
+	} else if (svc_type == SUB_MACHINE_STATUS) {
 		/* FTMS Machine Status */
-		const uint8_t *status_data = data;
-		uint32_t now = k_uptime_get_32();
+		struct rc_status st;
 		
-		if (length >= 1) {
-			uint8_t op_code = status_data[0];
-			
-			json_out("{\"type\":\"status\",\"ts\":%u,\"code\":%u", now, op_code);
+		if (rc_status_decode(data, length, &st) == 0) {
+			json_out("{\"type\":\"status\",\"ts\":%u,\"code\":%u", k_uptime_get_32(), st.op_code);
 			
-			switch (op_code) {
-			case 0x05:
-				if (length >= 3) {
-					uint16_t speed = sys_le16_to_cpu(*(uint16_t *)&status_data[1]);
-					json_out(",\"speed\":%u", speed);
-				}
-				break;
-			case 0x06:
-				if (length >= 3) {
-					int16_t incline = sys_le16_to_cpu(*(uint16_t *)&status_data[1]);
-					json_out(",\"incline\":%d", incline);
-				}
-				break;
-			case 0x07:
-				if (length >= 2) {
-					int8_t resistance = status_data[1];
-					json_out(",\"resistance\":%d", resistance);
-				}
-				break;
-			case 0x08:
-				if (length >= 3) {
-					int16_t power = sys_le16_to_cpu(*(uint16_t *)&status_data[1]);
-					json_out(",\"target_power\":%d", power);
-				}
-				break;
-			case 0x09:
-				if (length >= 2) {
-					uint8_t hr = status_data[1];
-					json_out(",\"target_hr\":%u", hr);
+			if (st.field == RC_STATUS_RAW) {
+				json_out(",\"data\":[");
+				for (size_t i = 0; i < st.raw_len; i++) {
+					json_out("%u%s", st.raw[i], (i < st.raw_len - 1) ? "," : "");
 				}
-				break;
-			case 0x83:
-			case 0x84:
-				if (length >= 2) {
-					uint8_t temp = status_data[1];
-					json_out(",\"temp\":%u", temp);
-				}
-				break;
-			default:
-				if (length > 1) {
-						json_out(",\"data\":[");
-					for (int i = 1; i < length; i++) {
-							json_out("%u%s", status_data[i], (i < length - 1) ? "," : "");
-					}
-						json_out("]");
-				}
-				break;
+				json_out("]");
+			} else if (st.field != RC_STATUS_NONE) {
+				json_out(",\"%s\":%d", rc_status_field_name(st.field), (int)st.value);
 			}
 			
 			json_out("}\n");
 		} else {
-			log("[DEBUG] FTMS Machine Status [%u bytes]\n", length);
+			log_debug(RELAY, "[DEBUG] FTMS Machine Status [%u bytes]\n", length);
 		}
 		
-		ftms_machine_status_len = length;
-		memcpy(ftms_machine_status, data, length);
-		bt_gatt_notify(NULL, &ftms_svc.attrs[5], ftms_machine_status, ftms_machine_status_len);
+		if (relay_copy(ftms_machine_status, sizeof(ftms_machine_status),
+			       &ftms_machine_status_len, data, length, "Machine Status")) {
+			consumer_notify(&ftms_svc.attrs[FTMS_ATTR_MACHINE_STATUS], ftms_machine_status,
+					ftms_machine_status_len);
+		}
 	}
 
 	total_rx_count++;
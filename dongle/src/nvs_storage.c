@@ -6,9 +6,11 @@
 #include <zephyr/storage/flash_map.h>
 #include <zephyr/fs/nvs.h>
 #include <zephyr/drivers/hwinfo.h>
+#include <zephyr/sys/crc.h>
 #include <string.h>
 #include "common.h"
 #include "nvs_storage.h"
+#include "work_queues.h"
 
 #define NVS_PARTITION		storage_partition
 #define NVS_PARTITION_DEVICE	FIXED_PARTITION_DEVICE(NVS_PARTITION)
@@ -17,53 +19,209 @@
 /* NVS IDs for saved devices (1-4) */
 #define NVS_DEVICE_BASE_ID	1
 
+/* Record format: header + payload. Version 1 was the bare payload. */
+#define NVS_RECORD_VERSION	2
+
+/* Dirty records are flushed together after this delay */
+#define NVS_FLUSH_DELAY_MS	2000
+
+/* Erase cycles the nRF52840 flash is rated for */
+#define NVS_FLASH_ENDURANCE	10000
+/* Allocation table entry written with every record */
+#define NVS_ATE_SIZE		8
+
+struct nvs_record_hdr {
+	uint8_t version;
+	uint8_t reserved;
+	uint16_t len;
+	uint32_t crc;  /* CRC-32 of the payload */
+};
+
+struct nvs_device_record {
+	struct nvs_record_hdr hdr;
+	struct saved_device dev;
+};
+
+struct nvs_counters {
+	uint32_t writes;
+	uint32_t deletes;
+	uint32_t unchanged;  /* Writes skipped because flash already matched */
+	uint32_t failures;
+	uint32_t flushes;
+	uint32_t bytes;
+	uint32_t crc_errors;
+	uint32_t migrated;
+};
+
 struct nvs_fs nvs;  /* Non-static for use by grade_limiter */
 static struct saved_device saved_devices[MAX_SAVED_DEVICES];
 static bool nvs_initialized = false;
 
+/* Bit i set: saved_devices[i] differs from flash */
+static uint32_t dirty_mask;
+static struct nvs_counters counters;
+
+/* Guards saved_devices[] and dirty_mask: lookups and updates from the
+ * BT RX thread and the command thread, and the flush */
+K_MUTEX_DEFINE(nvs_lock);
+
+/* Flash writes stall the CPU, they run on the housekeeping queue */
+static struct k_work_delayable flush_work;
+
+static void mark_dirty(int slot)
+{
+	dirty_mask |= BIT(slot);
+	/* Schedule, not reschedule: a stream of updates can't postpone the flush */
+	k_work_schedule_for_queue(&housekeeping_work_q, &flush_work, K_MSEC(NVS_FLUSH_DELAY_MS));
+}
+
+/* Slot holding addr, -1 if not saved. Caller holds nvs_lock. */
+static int find_slot(const bt_addr_le_t *addr)
+{
+	for (int i = 0; i < MAX_SAVED_DEVICES; i++) {
+		if (saved_devices[i].valid && !bt_addr_le_cmp(&saved_devices[i].addr, addr)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int flush_slot(int slot)
+{
+	struct nvs_device_record rec;
+	uint16_t id = NVS_DEVICE_BASE_ID + slot;
+	ssize_t ret;
+
+	k_mutex_lock(&nvs_lock, K_FOREVER);
+	rec.dev = saved_devices[slot];
+	dirty_mask &= ~BIT(slot);
+	k_mutex_unlock(&nvs_lock);
+
+	if (!rec.dev.valid) {
+		ret = nvs_delete(&nvs, id);
+		if (ret == 0) {
+			counters.deletes++;
+		}
+	} else {
+		rec.hdr.version = NVS_RECORD_VERSION;
+		rec.hdr.reserved = 0;
+		rec.hdr.len = sizeof(rec.dev);
+		rec.hdr.crc = crc32_ieee((const uint8_t *)&rec.dev, sizeof(rec.dev));
+
+		ret = nvs_write(&nvs, id, &rec, sizeof(rec));
+		if (ret == 0) {
+			counters.unchanged++;
+		} else if (ret > 0) {
+			counters.writes++;
+			counters.bytes += ROUND_UP(ret, 4) + NVS_ATE_SIZE;
+		}
+	}
+
+	if (ret < 0) {
+		log_info(NVS, "Failed to flush NVS record %u (err %d)\n", id, (int)ret);
+		counters.failures++;
+		return ret;
+	}
+
+	return 0;
+}
+
+static void flush_work_handler(struct k_work *work)
+{
+	uint32_t start = k_uptime_get_32();
+	uint32_t pending = dirty_mask;
+	bool failed = false;
+
+	for (int i = 0; i < MAX_SAVED_DEVICES; i++) {
+		if ((pending & BIT(i)) && flush_slot(i) != 0) {
+			k_mutex_lock(&nvs_lock, K_FOREVER);
+			dirty_mask |= BIT(i);
+			k_mutex_unlock(&nvs_lock);
+			failed = true;
+		}
+	}
+
+	counters.flushes++;
+	log_info(NVS, "NVS flush: records 0x%02x in %u ms\n", pending, k_uptime_get_32() - start);
+
+	if (failed) {
+		k_work_schedule_for_queue(&housekeeping_work_q, &flush_work, K_MSEC(NVS_FLUSH_DELAY_MS));
+	}
+}
+
+static void load_slot(int slot)
+{
+	struct nvs_device_record rec;
+	uint16_t id = NVS_DEVICE_BASE_ID + slot;
+	ssize_t ret = nvs_read(&nvs, id, &rec, sizeof(rec));
+
+	if (ret == sizeof(rec) && rec.hdr.version == NVS_RECORD_VERSION &&
+	    rec.hdr.len == sizeof(rec.dev)) {
+		if (rec.hdr.crc != crc32_ieee((const uint8_t *)&rec.dev, sizeof(rec.dev))) {
+			log_info(NVS, "Saved device %d failed CRC check, discarding\n", slot);
+			counters.crc_errors++;
+			mark_dirty(slot);
+			return;
+		}
+		saved_devices[slot] = rec.dev;
+	} else if (ret == sizeof(struct saved_device)) {
+		/* Version 1 record, rewrite with a header on the next flush */
+		nvs_read(&nvs, id, &saved_devices[slot], sizeof(struct saved_device));
+		counters.migrated++;
+		mark_dirty(slot);
+	} else if (ret > 0) {
+		log_info(NVS, "Saved device %d has unknown format (%d bytes), discarding\n", slot, (int)ret);
+		mark_dirty(slot);
+		return;
+	} else {
+		return;
+	}
+
+	if (saved_devices[slot].valid) {
+		char addr_str[BT_ADDR_LE_STR_LEN];
+		bt_addr_le_to_str(&saved_devices[slot].addr, addr_str, sizeof(addr_str));
+		log_info(NVS, "Loaded saved device %d: %s (%s)\n",
+		       slot, saved_devices[slot].name, addr_str);
+	}
+}
+
 int nvs_storage_init(void)
 {
 	int err;
 	struct flash_pages_info info;
 
+	k_work_init_delayable(&flush_work, flush_work_handler);
+
 	nvs.flash_device = NVS_PARTITION_DEVICE;
 	if (!device_is_ready(nvs.flash_device)) {
-		log("Flash device %s is not ready\n", nvs.flash_device->name);
+		log_info(NVS, "Flash device %s is not ready\n", nvs.flash_device->name);
 		return -ENODEV;
 	}
 
 	nvs.offset = NVS_PARTITION_OFFSET;
 	err = flash_get_page_info_by_offs(nvs.flash_device, nvs.offset, &info);
 	if (err) {
-		log("Unable to get page info (err %d)\n", err);
+		log_info(NVS, "Unable to get page info (err %d)\n", err);
 		return err;
 	}
 
 	nvs.sector_size = info.size;
-	nvs.sector_count = 3U;  /* Use 3 sectors for wear leveling */
+	nvs.sector_count = NVS_SECTOR_COUNT;
 
 	err = nvs_mount(&nvs);
 	if (err) {
-		log("Flash Init failed (err %d)\n", err);
+		log_info(NVS, "Flash Init failed (err %d)\n", err);
 		return err;
 	}
 
-	log("NVS initialized: offset=0x%lx, sector_size=%u, sector_count=%u\n",
+	log_info(NVS, "NVS initialized: offset=0x%lx, sector_size=%u, sector_count=%u\n",
 	       (unsigned long)nvs.offset, nvs.sector_size, nvs.sector_count);
 
 	/* Load saved devices into RAM */
 	memset(saved_devices, 0, sizeof(saved_devices));
 	for (int i = 0; i < MAX_SAVED_DEVICES; i++) {
-		ssize_t ret = nvs_read(&nvs, NVS_DEVICE_BASE_ID + i, 
-		                       &saved_devices[i], sizeof(struct saved_device));
-		if (ret == sizeof(struct saved_device)) {
-			if (saved_devices[i].valid) {
-				char addr_str[BT_ADDR_LE_STR_LEN];
-				bt_addr_le_to_str(&saved_devices[i].addr, addr_str, sizeof(addr_str));
-				log("Loaded saved device %d: %s (%s)\n", 
-				       i, saved_devices[i].name, addr_str);
-			}
-		}
+		load_slot(i);
 	}
 
 	nvs_initialized = true;
@@ -76,48 +234,46 @@ int nvs_save_device(const bt_addr_le_t *addr, const char *name, uint8_t svc_mask
 		return -EINVAL;
 	}
 
-	int slot = -1;
-	int empty_slot = -1;
+	struct saved_device updated = {0};
+	int slot;
 
-	/* Check if device already exists or find empty slot */
-	for (int i = 0; i < MAX_SAVED_DEVICES; i++) {
-		if (saved_devices[i].valid && !bt_addr_le_cmp(&saved_devices[i].addr, addr)) {
+	memcpy(&updated.addr, addr, sizeof(bt_addr_le_t));
+	strncpy(updated.name, name, sizeof(updated.name) - 1);
+	updated.svc_mask = svc_mask;
+	updated.valid = 1;
+
+	/* Lookup, compare and update under one lock, so two saves can't claim
+	 * the same empty slot and a clear can't be overwritten halfway */
+	k_mutex_lock(&nvs_lock, K_FOREVER);
+
+	/* Existing entry, or else the first empty slot */
+	slot = find_slot(addr);
+	for (int i = 0; slot == -1 && i < MAX_SAVED_DEVICES; i++) {
+		if (!saved_devices[i].valid) {
 			slot = i;
-			break;
-		}
-		if (!saved_devices[i].valid && empty_slot == -1) {
-			empty_slot = i;
 		}
 	}
 
-	/* Use existing slot or first empty slot */
-	if (slot == -1) {
-		slot = empty_slot;
-	}
-
 	if (slot == -1) {
-		log("No free slots to save device\n");
+		k_mutex_unlock(&nvs_lock);
+		log_info(NVS, "No free slots to save device\n");
 		return -ENOMEM;
 	}
 
-	/* Update in RAM */
-	memcpy(&saved_devices[slot].addr, addr, sizeof(bt_addr_le_t));
-	strncpy(saved_devices[slot].name, name, sizeof(saved_devices[slot].name) - 1);
-	saved_devices[slot].name[sizeof(saved_devices[slot].name) - 1] = '\0';
-	saved_devices[slot].svc_mask = svc_mask;
-	saved_devices[slot].valid = 1;
-
-	/* Write to NVS */
-	ssize_t ret = nvs_write(&nvs, NVS_DEVICE_BASE_ID + slot, 
-	                        &saved_devices[slot], sizeof(struct saved_device));
-	if (ret < 0) {
-		log("Failed to write device to NVS (err %d)\n", ret);
-		return ret;
+	/* Reconnecting a known device is the common case, don't touch flash */
+	if (!memcmp(&saved_devices[slot], &updated, sizeof(updated))) {
+		k_mutex_unlock(&nvs_lock);
+		return 0;
 	}
 
+	/* Update in RAM, flash follows on the next flush */
+	saved_devices[slot] = updated;
+	mark_dirty(slot);
+	k_mutex_unlock(&nvs_lock);
+
 	char addr_str[BT_ADDR_LE_STR_LEN];
 	bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
-	log("Saved device to slot %d: %s (%s)\n", slot, name, addr_str);
+	log_info(NVS, "Saved device to slot %d: %s (%s)\n", slot, name, addr_str);
 
 	return 0;
 }
@@ -129,59 +285,71 @@ int nvs_load_devices(struct saved_device *devices, int max_devices)
 	}
 
 	int count = 0;
+
+	k_mutex_lock(&nvs_lock, K_FOREVER);
 	for (int i = 0; i < MAX_SAVED_DEVICES && i < max_devices; i++) {
 		if (saved_devices[i].valid) {
 			memcpy(&devices[count], &saved_devices[i], sizeof(struct saved_device));
 			count++;
 		}
 	}
+	k_mutex_unlock(&nvs_lock);
 
 	return count;
 }
 
 bool nvs_is_device_saved(const bt_addr_le_t *addr)
 {
+	bool saved;
+
 	if (!nvs_initialized) {
 		return false;
 	}
 
-	for (int i = 0; i < MAX_SAVED_DEVICES; i++) {
-		if (saved_devices[i].valid && !bt_addr_le_cmp(&saved_devices[i].addr, addr)) {
-			return true;
-		}
-	}
+	k_mutex_lock(&nvs_lock, K_FOREVER);
+	saved = find_slot(addr) >= 0;
+	k_mutex_unlock(&nvs_lock);
 
-	return false;
+	return saved;
 }
 
 uint8_t nvs_get_saved_svc_mask(const bt_addr_le_t *addr)
 {
+	uint8_t svc_mask = 0;
+	int slot;
+
 	if (!nvs_initialized) {
 		return 0;
 	}
 
-	for (int i = 0; i < MAX_SAVED_DEVICES; i++) {
-		if (saved_devices[i].valid && !bt_addr_le_cmp(&saved_devices[i].addr, addr)) {
-			return saved_devices[i].svc_mask;
-		}
+	k_mutex_lock(&nvs_lock, K_FOREVER);
+	slot = find_slot(addr);
+	if (slot >= 0) {
+		svc_mask = saved_devices[slot].svc_mask;
 	}
+	k_mutex_unlock(&nvs_lock);
 
-	return 0;
+	return svc_mask;
 }
 
-const char *nvs_get_saved_name(const bt_addr_le_t *addr)
+bool nvs_get_saved_name(const bt_addr_le_t *addr, char *name, size_t len)
 {
-	if (!nvs_initialized) {
-		return NULL;
+	int slot;
+
+	if (!nvs_initialized || len == 0) {
+		return false;
 	}
 
-	for (int i = 0; i < MAX_SAVED_DEVICES; i++) {
-		if (saved_devices[i].valid && !bt_addr_le_cmp(&saved_devices[i].addr, addr)) {
-			return saved_devices[i].name;
-		}
+	/* Copied under the lock, a clear may zero the shadow right after */
+	k_mutex_lock(&nvs_lock, K_FOREVER);
+	slot = find_slot(addr);
+	if (slot >= 0) {
+		strncpy(name, saved_devices[slot].name, len - 1);
+		name[len - 1] = '\0';
 	}
+	k_mutex_unlock(&nvs_lock);
 
-	return NULL;
+	return slot >= 0;
 }
 
 int nvs_clear_all_devices(void)
@@ -190,16 +358,45 @@ int nvs_clear_all_devices(void)
 		return -EINVAL;
 	}
 
+	k_mutex_lock(&nvs_lock, K_FOREVER);
 	for (int i = 0; i < MAX_SAVED_DEVICES; i++) {
-		saved_devices[i].valid = 0;
-		nvs_write(&nvs, NVS_DEVICE_BASE_ID + i, 
-		          &saved_devices[i], sizeof(struct saved_device));
+		if (saved_devices[i].valid) {
+			memset(&saved_devices[i], 0, sizeof(saved_devices[i]));
+			mark_dirty(i);
+		}
 	}
+	k_mutex_unlock(&nvs_lock);
 
-	log("Cleared all saved devices\n");
+	log_info(NVS, "Cleared all saved devices\n");
 	return 0;
 }
 
+void nvs_print_stats(void)
+{
+	uint32_t uptime_s = k_uptime_get_32() / 1000;
+	uint32_t area = nvs.sector_size * nvs.sector_count;
+	uint32_t lifetime_days = 0;
+
+	/* NVS fills the sectors in turn, so every 'area' bytes written erase
+	 * each sector once. Extrapolate the write rate seen since boot. */
+	if (counters.bytes > 0 && uptime_s > 0 && area > 0) {
+		uint64_t total_bytes = (uint64_t)area * NVS_FLASH_ENDURANCE;
+		uint64_t secs = total_bytes * uptime_s / counters.bytes;
+
+		lifetime_days = (uint32_t)MIN(secs / 86400U, UINT32_MAX);
+	}
+
+	json_out("{\"type\":\"nvs\",\"ts\":%u,\"writes\":%u,\"deletes\":%u,\"unchanged\":%u,"
+		 "\"failures\":%u,\"flushes\":%u,\"bytes\":%u,\"erases_est\":%u,"
+		 "\"crc_errors\":%u,\"migrated\":%u,\"dirty\":%u,\"free\":%d,"
+		 "\"lifetime_days_est\":%u}\n",
+		 k_uptime_get_32(), counters.writes, counters.deletes, counters.unchanged,
+		 counters.failures, counters.flushes, counters.bytes,
+		 area ? counters.bytes / nvs.sector_size : 0,
+		 counters.crc_errors, counters.migrated, dirty_mask,
+		 nvs_initialized ? (int)nvs_calc_free_space(&nvs) : -1, lifetime_days);
+}
+
 int nvs_get_device_suffix(char *suffix, int max_len)
 {
 	if (!suffix || max_len < 5) {  /* Need room for "XXXX\0" (4 hex chars) */
@@ -211,7 +408,7 @@ int nvs_get_device_suffix(char *suffix, int max_len)
 	ssize_t id_len = hwinfo_get_device_id(device_id, sizeof(device_id));
 	
 	if (id_len <= 0) {
-		log("Failed to get device ID from hwinfo (err %d)\n", id_len);
+		log_info(NVS, "Failed to get device ID from hwinfo (err %d)\n", id_len);
 		return -ENODEV;
 	}
 
@@ -224,7 +421,7 @@ int nvs_get_device_suffix(char *suffix, int max_len)
 	/* Format as 4 hex characters */
 	snprintf(suffix, max_len, "%04X", hash);
 
-	log("Device suffix from hardware ID: %s\n", suffix);
+	log_info(NVS, "Device suffix from hardware ID: %s\n", suffix);
 	return 0;
 }
 
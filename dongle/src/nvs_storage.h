@@ -6,10 +6,14 @@
 #include <zephyr/bluetooth/bluetooth.h>
 #include "common.h"
 
+/* Sectors used by NVS at the start of the storage partition (wear leveling) */
+#define NVS_SECTOR_COUNT 3U
+
 /* NVS initialization */
 int nvs_storage_init(void);
 
-/* Save a device to NVS (replaces existing entry if addr matches) */
+/* Save a device (replaces existing entry if addr matches).
+ * Updates the RAM copy; flash is written later from a low priority work queue. */
 int nvs_save_device(const bt_addr_le_t *addr, const char *name, uint8_t svc_mask);
 
 /* Load all saved devices into memory */
@@ -21,12 +25,16 @@ bool nvs_is_device_saved(const bt_addr_le_t *addr);
 /* Get saved device info (returns svc_mask, or 0 if not found) */
 uint8_t nvs_get_saved_svc_mask(const bt_addr_le_t *addr);
 
-/* Get saved device name (returns NULL if not found) */
-const char *nvs_get_saved_name(const bt_addr_le_t *addr);
+/* Copy the saved device name into name (len bytes, NUL terminated).
+ * Returns false if the device is not saved. */
+bool nvs_get_saved_name(const bt_addr_le_t *addr, char *name, size_t len);
 
 /* Clear all saved devices */
 int nvs_clear_all_devices(void);
 
+/* Emit write/erase counters and estimated flash lifetime as JSON */
+void nvs_print_stats(void);
+
 /* Get device suffix from unique hardware ID (computed each time, not persisted) */
 int nvs_get_device_suffix(char *suffix, int max_len);
 
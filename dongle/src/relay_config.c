@@ -0,0 +1,76 @@
+/* relay_config.c - Runtime tunable relay parameters */
+
+#include <zephyr/kernel.h>
+#include "common.h"
+#include "relay_config.h"
+
+struct relay_config_entry {
+	const char *name;
+	int32_t min;
+	int32_t max;
+	int32_t value;  /* Word sized, read from any context without a lock */
+};
+
+#if defined(CONFIG_ZRELAY_FLIGHT_RECORDER)
+#define FR_SAMPLE_MS_DEFAULT CONFIG_ZRELAY_FLIGHT_RECORDER_SAMPLE_MS
+#else
+#define FR_SAMPLE_MS_DEFAULT 1000
+#endif
+
+#define CFG_ENTRY(_name, _def, _min, _max) \
+	{ .name = _name, .min = _min, .max = _max, .value = _def }
+
+/* Defaults match the behaviour before the values were tunable:
+ * grade -100 -> resistance 0, grade 1900 -> resistance 100 */
+static struct relay_config_entry entries[RELAY_CFG_COUNT] = {
+	[RELAY_CFG_GRADE_OFFSET]   = CFG_ENTRY("grade_offset", 120, -2000, 2000),
+	[RELAY_CFG_GRADE_DIVISOR]  = CFG_ENTRY("grade_divisor", 20, 1, 1000),
+	[RELAY_CFG_RESISTANCE_MAX] = CFG_ENTRY("resistance_max", 100, 0, 100),
+	[RELAY_CFG_FR_SAMPLE_MS]   = CFG_ENTRY("fr_sample_ms", FR_SAMPLE_MS_DEFAULT, 0, 60000),
+	[RELAY_CFG_FR_DROP_POWER]  = CFG_ENTRY("fr_drop_power", 100, 0, 2000),
+	[RELAY_CFG_RSSI_WEAK]      = CFG_ENTRY("rssi_weak", -85, -127, 0),
+	[RELAY_CFG_RSSI_GOOD]      = CFG_ENTRY("rssi_good", -70, -127, 0),
+	[RELAY_CFG_WHEEL_MM]       = CFG_ENTRY("wheel_mm", CONFIG_ZRELAY_CSC_WHEEL_MM, 500, 4000),
+};
+
+int32_t relay_config_get(enum relay_config_key key)
+{
+	if ((unsigned int)key >= RELAY_CFG_COUNT) {
+		return 0;
+	}
+
+	return entries[key].value;
+}
+
+int relay_config_set(enum relay_config_key key, int32_t value)
+{
+	if ((unsigned int)key >= RELAY_CFG_COUNT) {
+		return -EINVAL;
+	}
+
+	if (value < entries[key].min || value > entries[key].max) {
+		return -EINVAL;
+	}
+
+	entries[key].value = value;
+	log("[Config] %s = %d\n", entries[key].name, value);
+	return 0;
+}
+
+const char *relay_config_name(enum relay_config_key key)
+{
+	if ((unsigned int)key >= RELAY_CFG_COUNT) {
+		return NULL;
+	}
+
+	return entries[key].name;
+}
+
+void relay_config_print(void)
+{
+	json_out("{\"type\":\"config\",\"ts\":%u", k_uptime_get_32());
+	for (int i = 0; i < RELAY_CFG_COUNT; i++) {
+		json_out(",\"%s\":%d", entries[i].name, relay_config_get(i));
+	}
+	json_out("}\n");
+}
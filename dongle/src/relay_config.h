@@ -0,0 +1,34 @@
+/* relay_config.h - Runtime tunable relay parameters */
+
+#ifndef RELAY_CONFIG_H_
+#define RELAY_CONFIG_H_
+
+#include <zephyr/kernel.h>
+
+/* Keys are part of the host command protocol, append only */
+enum relay_config_key {
+	RELAY_CFG_GRADE_OFFSET = 0,   /* Added to grade (0.01 %) before scaling */
+	RELAY_CFG_GRADE_DIVISOR = 1,  /* Grade units per resistance step */
+	RELAY_CFG_RESISTANCE_MAX = 2, /* Upper resistance limit (0-100) */
+	RELAY_CFG_FR_SAMPLE_MS = 3,   /* Flight recorder sample interval per sensor type */
+	RELAY_CFG_FR_DROP_POWER = 4,  /* Power (W) above which a sudden drop triggers a dump */
+	RELAY_CFG_RSSI_WEAK = 5,      /* Average RSSI (dBm) that moves a link to Coded PHY */
+	RELAY_CFG_RSSI_GOOD = 6,      /* Average RSSI (dBm) that lets a link return to 1M */
+	RELAY_CFG_WHEEL_MM = 7,       /* Wheel circumference for synthesized CSC wheel data */
+	RELAY_CFG_COUNT,
+};
+
+/* Current value; keys out of range return 0 */
+int32_t relay_config_get(enum relay_config_key key);
+
+/* Set a value in RAM, -EINVAL for unknown keys or values out of range.
+ * Values return to their defaults on reboot. */
+int relay_config_set(enum relay_config_key key, int32_t value);
+
+/* Name used in JSON output, NULL for unknown keys */
+const char *relay_config_name(enum relay_config_key key);
+
+/* Emit all values as one JSON record */
+void relay_config_print(void);
+
+#endif /* RELAY_CONFIG_H_ */
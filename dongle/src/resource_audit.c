@@ -0,0 +1,184 @@
+/* resource_audit.c - Periodic connection, slot and heap invariant checks */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/sys/sys_heap.h>
+#include <string.h>
+#include "common.h"
+#include "consumer_manager.h"
+#include "device_table.h"
+#include "resource_audit.h"
+#include "work_queues.h"
+
+/* Connection objects alive in the stack but held by no slot or consumer.
+ * One audit of slack covers a disconnect still being processed. */
+#define AUDIT_LEAK_AUDITS 2
+
+struct audit_stats {
+	uint32_t audits;
+	uint32_t violations;    /* Failed slot and device table checks */
+	uint32_t conn_leaks;    /* Audits that found leaked connection objects */
+	uint32_t stale_slots;   /* Slots still holding a disconnected link */
+};
+
+static struct audit_stats stats;
+static int leak_streak;
+static uint8_t stale_mask;  /* Slots found disconnected at the previous audit */
+static struct k_work_delayable audit_work;
+
+static void count_conn(struct bt_conn *conn, void *data)
+{
+	int *count = data;
+
+	(*count)++;
+}
+
+/* First violation of the current audit, logged once the checks are done */
+static const char *violation_what;
+static int violation_slot;
+
+static void violation(const char *what, int slot)
+{
+	stats.violations++;
+	if (!violation_what) {
+		violation_what = what;
+		violation_slot = slot;
+	}
+}
+
+/* Every connected slot has a device entry pointing back at it, and every
+ * device entry that claims a slot matches that slot's peer */
+static int check_slots(void)
+{
+	struct device_info *dev_info;
+	uint8_t stale = 0;
+	int held = 0;
+
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		struct conn_slot *slot = &connections[i];
+		struct bt_conn_info info;
+
+		if (slot->subscribe_count < 0 || slot->subscribe_count > MAX_SUBSCRIPTIONS_PER_CONN) {
+			violation("Subscription count out of range", i);
+		}
+
+		if (!slot->conn) {
+			if (slot->subscribe_count != 0) {
+				violation("Subscriptions on a free slot", i);
+			}
+			continue;
+		}
+		held++;
+
+		dev_info = device_table_find(bt_conn_get_dst(slot->conn));
+		if (!dev_info || dev_info->conn_slot != i) {
+			violation("Slot not referenced by its device", i);
+		}
+
+		if (bt_conn_get_info(slot->conn, &info) == 0 &&
+		    info.state == BT_CONN_STATE_DISCONNECTED) {
+			if (stale_mask & BIT(i)) {
+				stats.stale_slots++;
+				violation("Slot holds a disconnected link", i);
+			}
+			stale |= BIT(i);
+		}
+	}
+	stale_mask = stale;
+
+	DEVICE_TABLE_FOREACH(dev_info) {
+		if (dev_info->conn_slot < 0) {
+			continue;
+		}
+		if (dev_info->conn_slot >= MAX_CONNECTIONS) {
+			violation("Device slot index out of range", dev_info->conn_slot);
+			continue;
+		}
+
+		struct bt_conn *conn = connections[dev_info->conn_slot].conn;
+
+		if (!conn || !bt_addr_le_eq(bt_conn_get_dst(conn), &dev_info->addr)) {
+			violation("Device points at another slot's link", dev_info->conn_slot);
+		}
+	}
+
+	return held;
+}
+
+void resource_audit_run(void)
+{
+	int sensors, consumers;
+	int stack_conns = 0;
+	uint32_t heap_used = 0;
+	uint32_t heap_max = 0;
+
+	stats.audits++;
+	violation_what = NULL;
+
+	/* Connection callbacks run on the cooperative BT threads; with the
+	 * scheduler locked the checks see slots between two callbacks. The
+	 * table lock is a mutex, so take it before locking the scheduler */
+	device_table_lock();
+	k_sched_lock();
+	sensors = check_slots();
+	consumers = consumer_count();
+
+	/* A pending connection shares its slot's object, so objects held by
+	 * slots and consumers must account for every one the stack has */
+	bt_conn_foreach(BT_CONN_TYPE_LE, count_conn, &stack_conns);
+	k_sched_unlock();
+	device_table_unlock();
+
+	if (violation_what) {
+		log("[Audit] %s (slot %d)\n", violation_what, violation_slot);
+	}
+	if (stack_conns > sensors + consumers) {
+		if (++leak_streak == AUDIT_LEAK_AUDITS) {
+			stats.conn_leaks++;
+			log("[Audit] %d connection objects, %d held\n",
+			    stack_conns, sensors + consumers);
+		}
+	} else {
+		leak_streak = 0;
+	}
+
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS) && CONFIG_HEAP_MEM_POOL_SIZE > 0
+	extern struct k_heap _system_heap;
+	struct sys_memory_stats heap;
+
+	if (sys_heap_runtime_stats_get(&_system_heap.heap, &heap) == 0) {
+		heap_used = heap.allocated_bytes;
+		heap_max = heap.max_allocated_bytes;
+	}
+#endif
+
+	json_out("{\"type\":\"audit\",\"ts\":%u,\"audits\":%u,\"violations\":%u,"
+		 "\"conn_leaks\":%u,\"stale_slots\":%u,\"bt_conns\":%d,\"sensors\":%d,"
+		 "\"consumers\":%d,\"devices\":%d,\"heap_used\":%u,\"heap_max\":%u}\n",
+		 k_uptime_get_32(), stats.audits, stats.violations, stats.conn_leaks,
+		 stats.stale_slots, stack_conns, sensors, consumers, device_table_count(),
+		 heap_used, heap_max);
+}
+
+static void audit_work_handler(struct k_work *work)
+{
+	resource_audit_run();
+	k_work_reschedule_for_queue(&housekeeping_work_q, &audit_work,
+				    K_SECONDS(CONFIG_ZRELAY_AUDIT_INTERVAL));
+}
+
+void resource_audit_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	leak_streak = 0;
+}
+
+void resource_audit_init(void)
+{
+	k_work_init_delayable(&audit_work, audit_work_handler);
+	if (CONFIG_ZRELAY_AUDIT_INTERVAL > 0) {
+		k_work_reschedule_for_queue(&housekeeping_work_q, &audit_work,
+					    K_SECONDS(CONFIG_ZRELAY_AUDIT_INTERVAL));
+	}
+}
@@ -0,0 +1,14 @@
+/* resource_audit.h - Periodic connection, slot and heap invariant checks */
+
+#ifndef RESOURCE_AUDIT_H_
+#define RESOURCE_AUDIT_H_
+
+/* Start auditing every CONFIG_ZRELAY_AUDIT_INTERVAL seconds (0 disables) */
+void resource_audit_init(void);
+
+/* Run the checks now and emit an audit record as JSON */
+void resource_audit_run(void);
+
+void resource_audit_reset_stats(void);
+
+#endif /* RESOURCE_AUDIT_H_ */
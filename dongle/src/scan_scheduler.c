@@ -0,0 +1,239 @@
+/* scan_scheduler.c - Scan duty-cycle scheduling */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gap.h>
+#include "common.h"
+#include "scan_scheduler.h"
+#include "device_manager.h"
+#include "conn_manager.h"
+#include "device_table.h"
+#include "nvs_storage.h"
+#include "work_queues.h"
+
+/* Each supervision timeout raises the backoff level; it decays one level
+ * per quiet period so reconnect scanning recovers once links are stable. */
+#define SCAN_BACKOFF_MAX_LEVEL 2
+#define SCAN_BACKOFF_DECAY_MS 60000
+
+static bt_le_scan_cb_t *scan_cb;
+static enum scan_mode current_mode = SCAN_MODE_OFF;
+static int applied_backoff = -1;
+static bool scanning = false;
+static int backoff_level = 0;
+static struct k_work_delayable backoff_decay_work;
+static struct k_work update_work;
+static struct k_work link_loss_work;
+
+/* Updates and the backoff run on conn_work_q only. The lock covers a
+ * suspend from another thread, before advertising starts. */
+K_MUTEX_DEFINE(scan_lock);
+
+const char *scan_mode_str(enum scan_mode mode)
+{
+	switch (mode) {
+	case SCAN_MODE_OFF:       return "off";
+	case SCAN_MODE_RECONNECT: return "reconnect";
+	case SCAN_MODE_PAIRING:   return "pairing";
+	default:                  return "unknown";
+	}
+}
+
+static bool has_free_slot(void)
+{
+	for (int i = 0; i < MAX_CONNECTIONS; i++) {
+		if (!connections[i].conn) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int missing_saved_devices(void)
+{
+	struct saved_device saved[MAX_SAVED_DEVICES];
+	int count = nvs_load_devices(saved, MAX_SAVED_DEVICES);
+	int missing = 0;
+
+	device_table_lock();
+	for (int i = 0; i < count; i++) {
+		struct device_info *dev_info = device_table_find(&saved[i].addr);
+
+		if (!dev_info || dev_info->conn_slot < 0) {
+			missing++;
+		}
+	}
+	device_table_unlock();
+
+	return missing;
+}
+
+static enum scan_mode desired_mode(void)
+{
+	if (conn_manager_is_pending() || !has_free_slot()) {
+		return SCAN_MODE_OFF;
+	}
+
+	if (is_scan_window_active()) {
+		return SCAN_MODE_PAIRING;
+	}
+
+	if (missing_saved_devices() > 0) {
+		return SCAN_MODE_RECONNECT;
+	}
+
+	return SCAN_MODE_OFF;
+}
+
+static void stop_scanning(void)
+{
+	if (!scanning) {
+		return;
+	}
+
+	int err = bt_le_scan_stop();
+	if (err && err != -EALREADY) {
+		log_info(SCAN, "Stop LE scan failed (err %d)\n", err);
+	}
+	scanning = false;
+}
+
+static int start_scanning(enum scan_mode mode)
+{
+	struct bt_le_scan_param scan_param;
+	int err;
+
+	if (mode == SCAN_MODE_PAIRING) {
+		/* Active scan to collect names, Coded PHY for range */
+		scan_param = (struct bt_le_scan_param) {
+			.type     = BT_LE_SCAN_TYPE_ACTIVE,
+			.options  = BT_LE_SCAN_OPT_CODED,
+			.interval = BT_GAP_SCAN_FAST_INTERVAL,
+			.window   = BT_GAP_SCAN_FAST_WINDOW,
+		};
+	} else {
+		/* Saved devices are known by address; names come from NVS */
+		scan_param = (struct bt_le_scan_param) {
+			.type     = BT_LE_SCAN_TYPE_PASSIVE,
+			.options  = BT_LE_SCAN_OPT_NONE,
+			.interval = backoff_level > 0 ? BT_GAP_SCAN_SLOW_INTERVAL_2 :
+							BT_GAP_SCAN_SLOW_INTERVAL_1,
+			.window   = BT_GAP_SCAN_SLOW_WINDOW_1,
+		};
+	}
+
+	err = bt_le_scan_start(&scan_param, scan_cb);
+	if (err && err != -EALREADY && (scan_param.options & BT_LE_SCAN_OPT_CODED)) {
+		log_info(SCAN, "Scanning with Coded PHY support failed (err %d)\n", err);
+
+		log_info(SCAN, "Scanning without Coded PHY\n");
+		scan_param.options &= ~BT_LE_SCAN_OPT_CODED;
+		err = bt_le_scan_start(&scan_param, scan_cb);
+	}
+
+	if (err && err != -EALREADY) {
+		log_info(SCAN, "Scanning failed to start (err %d)\n", err);
+		return err;
+	}
+
+	scanning = true;
+	return 0;
+}
+
+void scan_scheduler_update(void)
+{
+	enum scan_mode mode = desired_mode();
+	int backoff = (mode == SCAN_MODE_RECONNECT) ? backoff_level : 0;
+
+	k_mutex_lock(&scan_lock, K_FOREVER);
+	if (mode == current_mode && scanning == (mode != SCAN_MODE_OFF) &&
+	    backoff == applied_backoff) {
+		k_mutex_unlock(&scan_lock);
+		return;
+	}
+
+	stop_scanning();
+
+	if (mode != SCAN_MODE_OFF && start_scanning(mode) != 0) {
+		mode = SCAN_MODE_OFF;
+	}
+
+	if (mode != current_mode || backoff != applied_backoff) {
+		log_info(SCAN, "Scan mode: %s -> %s (backoff %d)\n",
+		       scan_mode_str(current_mode), scan_mode_str(mode), backoff);
+	}
+
+	current_mode = mode;
+	applied_backoff = backoff;
+	k_mutex_unlock(&scan_lock);
+}
+
+static void update_work_handler(struct k_work *work)
+{
+	scan_scheduler_update();
+}
+
+void scan_scheduler_request_update(void)
+{
+	k_work_submit_to_queue(&conn_work_q, &update_work);
+}
+
+void scan_scheduler_suspend(void)
+{
+	k_mutex_lock(&scan_lock, K_FOREVER);
+	stop_scanning();
+	current_mode = SCAN_MODE_OFF;
+	k_mutex_unlock(&scan_lock);
+}
+
+static void backoff_decay_handler(struct k_work *work)
+{
+	if (backoff_level > 0) {
+		backoff_level--;
+		if (backoff_level > 0) {
+			k_work_reschedule_for_queue(&conn_work_q, &backoff_decay_work, K_MSEC(SCAN_BACKOFF_DECAY_MS));
+		}
+	}
+
+	scan_scheduler_update();
+}
+
+static void raise_backoff(const char *why)
+{
+	if (backoff_level < SCAN_BACKOFF_MAX_LEVEL) {
+		backoff_level++;
+	}
+	log_info(SCAN, "%s reported, scan backoff level %d\n", why, backoff_level);
+
+	k_work_reschedule_for_queue(&conn_work_q, &backoff_decay_work, K_MSEC(SCAN_BACKOFF_DECAY_MS));
+}
+
+void scan_scheduler_report_link_degraded(void)
+{
+	raise_backoff("Link degradation");
+	/* The link is still up, so nothing else restarts the scan */
+	scan_scheduler_update();
+}
+
+static void link_loss_work_handler(struct k_work *work)
+{
+	raise_backoff("Link loss");
+}
+
+void scan_scheduler_report_link_loss(void)
+{
+	k_work_submit_to_queue(&conn_work_q, &link_loss_work);
+}
+
+enum scan_mode scan_scheduler_mode(void)
+{
+	return current_mode;
+}
+
+void scan_scheduler_init(bt_le_scan_cb_t *cb)
+{
+	scan_cb = cb;
+	k_work_init_delayable(&backoff_decay_work, backoff_decay_handler);
+	k_work_init(&update_work, update_work_handler);
+	k_work_init(&link_loss_work, link_loss_work_handler);
+}
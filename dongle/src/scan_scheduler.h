@@ -0,0 +1,37 @@
+/* scan_scheduler.h - Scan duty-cycle scheduling */
+
+#ifndef SCAN_SCHEDULER_H_
+#define SCAN_SCHEDULER_H_
+
+#include <zephyr/bluetooth/bluetooth.h>
+
+enum scan_mode {
+	SCAN_MODE_OFF,        /* Nothing missing, radio left to connections */
+	SCAN_MODE_RECONNECT,  /* Low duty passive scan for missing saved devices */
+	SCAN_MODE_PAIRING,    /* Aggressive active scan during the pairing window */
+};
+
+void scan_scheduler_init(bt_le_scan_cb_t *cb);
+
+/* Re-evaluate the desired scan mode and (re)start or stop scanning.
+ * Call on conn_work_q only; other threads use scan_scheduler_request_update. */
+void scan_scheduler_update(void);
+
+/* Run scan_scheduler_update on conn_work_q */
+void scan_scheduler_request_update(void);
+
+/* Stop scanning until the next update, e.g. before creating a connection */
+void scan_scheduler_suspend(void);
+
+/* Report a sensor link that started missing events or went weak; reconnect
+ * scanning backs off right away. Called from the link monitor. */
+void scan_scheduler_report_link_degraded(void);
+
+/* Report a link lost to supervision timeout, for links that dropped
+ * before the link monitor saw them degrade */
+void scan_scheduler_report_link_loss(void);
+
+enum scan_mode scan_scheduler_mode(void);
+const char *scan_mode_str(enum scan_mode mode);
+
+#endif /* SCAN_SCHEDULER_H_ */
@@ -0,0 +1,424 @@
+/* serial_output.c - Console and telemetry output with early-boot buffering */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "serial_output.h"
+#include "boot_milestone.h"
+#include "command_channel.h"
+#include "timebase.h"
+#include "work_queues.h"
+
+#define EARLY_BUFFER_SIZE CONFIG_ZRELAY_EARLY_OUTPUT_BUFFER
+#define LINE_STATE_POLL_MS 100
+#define FORMAT_BUFFER_SIZE 256
+
+#define TELEMETRY_TX_CHUNK 64
+/* Fits the longest record, a flight recorder fr_data line */
+#define TELEMETRY_FORMAT_SIZE 512
+
+static const struct device *const console_dev = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
+
+/* Serial output mutex for thread-safe logging and JSON output */
+K_MUTEX_DEFINE(serial_output_mutex);
+
+/* Everything enabled, the Kconfig floors decide what is compiled in */
+uint32_t serial_log_mask = BIT(LOG_CAT_COUNT * 2) - 1;
+
+RING_BUF_DECLARE(early_output, EARLY_BUFFER_SIZE);
+static char format_buf[FORMAT_BUFFER_SIZE];
+static uint32_t early_dropped;
+
+/* Cost of console logging, to compare log level settings and builds */
+static uint32_t log_lines;
+static uint64_t log_cycles;
+
+/* Output goes straight to the console once a host holds the port open */
+static bool host_attached;
+static struct k_work_delayable line_state_work;
+
+#if defined(CONFIG_ZRELAY_TELEMETRY_UART)
+/* JSON records go to their own CDC ACM interface, sent from the TX interrupt
+ * so they never wait behind log lines. The ring also holds records written
+ * before the host opens the port. */
+static const struct device *const telemetry_dev =
+	DEVICE_DT_GET(DT_CHOSEN(zrelay_telemetry_uart));
+
+K_MUTEX_DEFINE(telemetry_mutex);
+RING_BUF_DECLARE(telemetry_tx, CONFIG_ZRELAY_TELEMETRY_BUFFER);
+/* The ring is shared with the TX interrupt */
+static struct k_spinlock telemetry_lock;
+static char telemetry_format_buf[TELEMETRY_FORMAT_SIZE];
+static bool telemetry_attached;
+static bool telemetry_discarding;  /* Dropping the rest of a partly dropped record */
+static uint32_t telemetry_open;    /* Claimed bytes of the record being written */
+static bool telemetry_in_record;   /* telemetry_mutex held until the record ends */
+static uint32_t telemetry_bytes;
+static uint32_t telemetry_dropped;
+#endif
+
+void serial_log_set(uint8_t level, uint32_t categories)
+{
+	uint32_t mask = serial_log_mask;
+
+	for (int cat = 0; cat < LOG_CAT_COUNT; cat++) {
+		if (!(categories & BIT(cat))) {
+			continue;
+		}
+
+		mask &= ~(SERIAL_LOG_BIT(cat, SERIAL_LOG_INFO) | SERIAL_LOG_BIT(cat, SERIAL_LOG_DEBUG));
+		for (uint8_t l = SERIAL_LOG_INFO; l <= level; l++) {
+			mask |= SERIAL_LOG_BIT(cat, l);
+		}
+	}
+
+	/* Single store, readers never see a half-updated mask */
+	serial_log_mask = mask;
+}
+
+uint8_t serial_log_get(enum log_category cat)
+{
+	if (serial_log_mask & SERIAL_LOG_BIT(cat, SERIAL_LOG_DEBUG)) {
+		return SERIAL_LOG_DEBUG;
+	}
+	return (serial_log_mask & SERIAL_LOG_BIT(cat, SERIAL_LOG_INFO)) ? SERIAL_LOG_INFO : SERIAL_LOG_OFF;
+}
+
+static void early_put(const char *data, uint32_t len)
+{
+	uint32_t space = ring_buf_space_get(&early_output);
+
+	if (len > space) {
+		/* Keep the newest output, the oldest lines are least useful */
+		uint32_t drop = MIN(len - space, ring_buf_size_get(&early_output));
+
+		ring_buf_get(&early_output, NULL, drop);
+		early_dropped += drop;
+	}
+
+	ring_buf_put(&early_output, (const uint8_t *)data, len);
+}
+
+static void early_flush(void)
+{
+	uint8_t *data;
+	uint32_t len;
+	bool skip_partial = early_dropped > 0;
+
+	if (early_dropped) {
+		printf("{\"type\":\"early_output\",\"ts\":%u,\"dropped\":%u}\n",
+		       k_uptime_get_32(), early_dropped);
+		early_dropped = 0;
+	}
+
+	while ((len = ring_buf_get_claim(&early_output, &data, EARLY_BUFFER_SIZE)) > 0) {
+		uint32_t start = 0;
+
+		/* The oldest line may have lost its beginning */
+		if (skip_partial) {
+			uint8_t *nl = memchr(data, '\n', len);
+
+			start = nl ? (nl - data) + 1 : len;
+			skip_partial = (nl == NULL);
+		}
+
+		printf("%.*s", (int)(len - start), (const char *)data + start);
+		ring_buf_get_finish(&early_output, len);
+	}
+}
+
+static void serial_vout(const char *fmt, va_list ap)
+{
+	uint32_t start = k_cycle_get_32();
+
+	k_mutex_lock(&serial_output_mutex, K_FOREVER);
+
+	if (host_attached) {
+		vprintf(fmt, ap);
+	} else {
+		int len = vsnprintf(format_buf, sizeof(format_buf), fmt, ap);
+
+		if (len > 0) {
+			early_put(format_buf, MIN(len, sizeof(format_buf) - 1));
+		}
+	}
+
+	log_lines++;
+	log_cycles += k_cycle_get_32() - start;
+	k_mutex_unlock(&serial_output_mutex);
+}
+
+void serial_out(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	serial_vout(fmt, ap);
+	va_end(ap);
+}
+
+/* Records start with {"type":"name". Returns the end of that prefix so the
+ * 64-bit microsecond timestamp can follow the type, NULL for fragments. */
+#define RECORD_PREFIX "{\"type\":\""
+
+static const char *record_prefix_end(const char *fmt)
+{
+	const char *quote;
+
+	if (strncmp(fmt, RECORD_PREFIX, sizeof(RECORD_PREFIX) - 1) != 0) {
+		return NULL;
+	}
+
+	quote = strchr(fmt + sizeof(RECORD_PREFIX) - 1, '"');
+	return quote ? quote + 1 : NULL;
+}
+
+#if defined(CONFIG_ZRELAY_TELEMETRY_UART)
+
+/* Whole records are dropped when the ring is full, the host reads lines.
+ * Records built from several calls stay claimed, invisible to the TX
+ * interrupt, until their newline; a fragment that does not fit rolls the
+ * ring back to the start of its record. Nothing else may put into the ring.
+ */
+static void telemetry_put(const char *data, uint32_t len)
+{
+	k_spinlock_key_t key = k_spin_lock(&telemetry_lock);
+	bool line_end = data[len - 1] == '\n';
+
+	if (telemetry_discarding) {
+		telemetry_discarding = !line_end;
+	} else if (ring_buf_space_get(&telemetry_tx) < len) {
+		ring_buf_put_finish(&telemetry_tx, 0);
+		telemetry_open = 0;
+		telemetry_dropped++;
+		telemetry_discarding = !line_end;
+	} else {
+		/* At most two claims, the free space may wrap */
+		while (len) {
+			uint8_t *dst;
+			uint32_t n = ring_buf_put_claim(&telemetry_tx, &dst, len);
+
+			memcpy(dst, data, n);
+			data += n;
+			len -= n;
+			telemetry_open += n;
+		}
+		if (line_end) {
+			ring_buf_put_finish(&telemetry_tx, telemetry_open);
+			telemetry_open = 0;
+		}
+	}
+
+	k_spin_unlock(&telemetry_lock, key);
+
+	if (telemetry_attached && line_end) {
+		uart_irq_tx_enable(telemetry_dev);
+	}
+}
+
+void telemetry_out(const char *fmt, ...)
+{
+	const char *rest = record_prefix_end(fmt);
+	char us[TIMEBASE_US_STR_LEN];
+	va_list ap;
+	int len = 0;
+
+	k_mutex_lock(&telemetry_mutex, K_FOREVER);
+
+	if (rest) {
+		len = snprintf(telemetry_format_buf, sizeof(telemetry_format_buf),
+			       "%.*s,\"us\":%s", (int)(rest - fmt), fmt,
+			       timebase_us_str(timebase_now_us(), us));
+		fmt = rest;
+	}
+
+	va_start(ap, fmt);
+	len += vsnprintf(telemetry_format_buf + len, sizeof(telemetry_format_buf) - len, fmt, ap);
+	va_end(ap);
+
+	if (len >= (int)sizeof(telemetry_format_buf)) {
+		/* Truncated; keep the record end so the next record starts a line */
+		len = sizeof(telemetry_format_buf) - 1;
+		if (fmt[strlen(fmt) - 1] == '\n') {
+			telemetry_format_buf[len - 1] = '\n';
+		}
+	}
+	if (len <= 0) {
+		k_mutex_unlock(&telemetry_mutex);
+		return;
+	}
+
+	telemetry_put(telemetry_format_buf, len);
+
+	/* A record built from several calls keeps the mutex until its
+	 * newline, so records of other threads cannot land inside it */
+	if (telemetry_format_buf[len - 1] != '\n') {
+		if (!telemetry_in_record) {
+			telemetry_in_record = true;
+			return;
+		}
+	} else if (telemetry_in_record) {
+		telemetry_in_record = false;
+		k_mutex_unlock(&telemetry_mutex);
+	}
+	k_mutex_unlock(&telemetry_mutex);
+}
+
+static void telemetry_isr(const struct device *dev, void *user_data)
+{
+	while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
+		if (uart_irq_rx_ready(dev)) {
+			uint8_t rx[32];
+			int n = uart_fifo_read(dev, rx, sizeof(rx));
+
+			if (n > 0) {
+				command_channel_rx(rx, n);
+			}
+		}
+
+		if (uart_irq_tx_ready(dev)) {
+			k_spinlock_key_t key = k_spin_lock(&telemetry_lock);
+			uint8_t *data;
+			uint32_t len = 0;
+
+			if (telemetry_attached) {
+				len = ring_buf_get_claim(&telemetry_tx, &data, TELEMETRY_TX_CHUNK);
+			}
+
+			if (len == 0) {
+				uart_irq_tx_disable(dev);
+			} else {
+				int sent = uart_fifo_fill(dev, data, len);
+
+				sent = MAX(sent, 0);
+				ring_buf_get_finish(&telemetry_tx, sent);
+				telemetry_bytes += sent;
+			}
+
+			k_spin_unlock(&telemetry_lock, key);
+		}
+	}
+}
+
+static bool telemetry_line_state_update(void)
+{
+	uint32_t dtr = 1;
+
+	if (!device_is_ready(telemetry_dev)) {
+		return false;
+	}
+
+	/* Without line state the host is assumed to be there */
+	(void)uart_line_ctrl_get(telemetry_dev, UART_LINE_CTRL_DTR, &dtr);
+
+	if (dtr && !telemetry_attached) {
+		telemetry_attached = true;
+		uart_irq_tx_enable(telemetry_dev);
+	} else if (!dtr && telemetry_attached) {
+		/* Keep unsent records until the host comes back */
+		telemetry_attached = false;
+	}
+
+	return telemetry_attached;
+}
+
+#else
+
+/* Single console, records are interleaved with log lines */
+void telemetry_out(const char *fmt, ...)
+{
+	const char *rest = record_prefix_end(fmt);
+	char us[TIMEBASE_US_STR_LEN];
+	va_list ap;
+
+	/* Recursive, keeps the record in one piece */
+	k_mutex_lock(&serial_output_mutex, K_FOREVER);
+
+	if (rest) {
+		serial_out("%.*s,\"us\":%s", (int)(rest - fmt), fmt,
+			   timebase_us_str(timebase_now_us(), us));
+		fmt = rest;
+	}
+
+	va_start(ap, fmt);
+	serial_vout(fmt, ap);
+	va_end(ap);
+
+	k_mutex_unlock(&serial_output_mutex);
+}
+
+#endif /* CONFIG_ZRELAY_TELEMETRY_UART */
+
+void serial_output_print_stats(void)
+{
+	/* Includes time spent waiting for the mutex */
+	uint32_t log_us = (uint32_t)(log_cycles * 1000000U / sys_clock_hw_cycles_per_sec());
+
+	json_out("{\"type\":\"serial\",\"ts\":%u,\"log_mask\":%u,\"log_lines\":%u,"
+		 "\"log_us\":%u", k_uptime_get_32(), serial_log_mask, log_lines, log_us);
+#if defined(CONFIG_ZRELAY_TELEMETRY_UART)
+	json_out(",\"telemetry_bytes\":%u,\"telemetry_dropped\":%u,\"telemetry_queued\":%u",
+		 telemetry_bytes, telemetry_dropped, ring_buf_size_get(&telemetry_tx));
+#endif
+	json_out("}\n");
+}
+
+static void line_state_work_handler(struct k_work *work)
+{
+	uint32_t dtr = 0;
+	int err = uart_line_ctrl_get(console_dev, UART_LINE_CTRL_DTR, &dtr);
+	bool attached;
+
+	k_mutex_lock(&serial_output_mutex, K_FOREVER);
+
+	if (err) {
+		/* No line state (plain UART, simulator): nobody to wait for */
+		dtr = 1;
+	}
+
+	if (dtr && !host_attached) {
+		early_flush();
+		host_attached = true;
+	} else if (!dtr && host_attached) {
+		/* Host closed the port, buffer until it comes back */
+		host_attached = false;
+	}
+
+	attached = host_attached;
+	k_mutex_unlock(&serial_output_mutex);
+
+#if defined(CONFIG_ZRELAY_TELEMETRY_UART)
+	/* The server reads telemetry, that is the host that matters */
+	attached = telemetry_line_state_update();
+#endif
+
+	if (attached) {
+		boot_milestone(BOOT_HOST_ATTACHED);
+	}
+
+	k_work_reschedule_for_queue(&housekeeping_work_q, &line_state_work, K_MSEC(LINE_STATE_POLL_MS));
+}
+
+void serial_output_init(void)
+{
+	k_work_init_delayable(&line_state_work, line_state_work_handler);
+
+#if defined(CONFIG_ZRELAY_TELEMETRY_UART)
+	if (device_is_ready(telemetry_dev)) {
+		uart_irq_callback_user_data_set(telemetry_dev, telemetry_isr, NULL);
+		uart_irq_rx_enable(telemetry_dev);
+	}
+#endif
+
+	if (!device_is_ready(console_dev) && !IS_ENABLED(CONFIG_ZRELAY_TELEMETRY_UART)) {
+		/* Keep buffering; nothing could be printed anyway */
+		return;
+	}
+
+	k_work_reschedule_for_queue(&housekeeping_work_q, &line_state_work, K_NO_WAIT);
+}
@@ -0,0 +1,53 @@
+/* serial_output.h - Console and telemetry output with early-boot buffering */
+
+#ifndef SERIAL_OUTPUT_H_
+#define SERIAL_OUTPUT_H_
+
+#include <zephyr/types.h>
+
+/* Console log verbosity, set by the host. JSON telemetry is always emitted. */
+enum serial_log_level {
+	SERIAL_LOG_OFF = 0,
+	SERIAL_LOG_INFO = 1,
+	SERIAL_LOG_DEBUG = 2,
+};
+
+/* Log categories. Each has a compile-time floor, CONFIG_ZRELAY_LOG_LEVEL_<name>,
+ * and a runtime level set by the host. */
+enum log_category {
+	LOG_CAT_GENERAL = 0,
+	LOG_CAT_SCAN = 1,
+	LOG_CAT_DISC = 2,
+	LOG_CAT_CP = 3,
+	LOG_CAT_RELAY = 4,
+	LOG_CAT_NVS = 5,
+	LOG_CAT_COUNT
+};
+
+#define LOG_CAT_ALL (BIT(LOG_CAT_COUNT) - 1)
+
+/* One enable bit per category and level, so a log check is a single load */
+#define SERIAL_LOG_BIT(cat, level) BIT((cat) * 2 + (level) - 1)
+
+extern uint32_t serial_log_mask;
+
+/* Set the runtime level of the categories in the LOG_CAT bitmask */
+void serial_log_set(uint8_t level, uint32_t categories);
+
+/* Runtime level of one category */
+uint8_t serial_log_get(enum log_category cat);
+
+/* Start watching the console line state (DTR) */
+void serial_output_init(void);
+
+/* printf-style log output, thread-safe. Buffered in RAM until a host opens the port. */
+void serial_out(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* printf-style JSON record output, thread-safe. With CONFIG_ZRELAY_TELEMETRY_UART
+ * records go to the telemetry interface, otherwise they share the console. */
+void telemetry_out(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* Emit log cost and telemetry interface counters as JSON */
+void serial_output_print_stats(void);
+
+#endif /* SERIAL_OUTPUT_H_ */
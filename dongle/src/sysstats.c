@@ -0,0 +1,115 @@
+/* sysstats.c - Per-thread stack high-water marks and CPU load */
+
+#include <zephyr/kernel.h>
+#include <string.h>
+#include "common.h"
+#include "sysstats.h"
+#include "work_queues.h"
+
+/* Threads tracked between samples; the relay runs about a dozen */
+#define SYSSTATS_MAX_THREADS 20
+
+struct thread_sample {
+	const struct k_thread *thread;
+	const char *name;
+	int prio;
+	size_t stack_size;
+	size_t stack_unused;
+	uint64_t cycles;       /* Execution cycles, cumulative */
+	uint64_t prev_cycles;  /* At the previous sample */
+};
+
+static struct thread_sample samples[SYSSTATS_MAX_THREADS];
+static int sample_count;
+static uint64_t prev_total_cycles;
+static struct k_work_delayable sysstats_work;
+
+static struct thread_sample *find_sample(const struct k_thread *thread)
+{
+	for (int i = 0; i < sample_count; i++) {
+		if (samples[i].thread == thread) {
+			return &samples[i];
+		}
+	}
+
+	if (sample_count == SYSSTATS_MAX_THREADS) {
+		return NULL;
+	}
+
+	/* Threads are static in this firmware, slots are never recycled */
+	memset(&samples[sample_count], 0, sizeof(samples[0]));
+	samples[sample_count].thread = thread;
+	return &samples[sample_count++];
+}
+
+/* Record only; printing happens after the walk */
+static void sample_thread(const struct k_thread *cthread, void *user_data)
+{
+	struct k_thread *thread = (struct k_thread *)cthread;
+	struct thread_sample *s = find_sample(thread);
+	k_thread_runtime_stats_t rt;
+	const char *name;
+
+	if (!s) {
+		return;
+	}
+
+	name = k_thread_name_get(thread);
+	s->name = name && name[0] ? name : "?";
+	s->prio = k_thread_priority_get(thread);
+	s->stack_size = thread->stack_info.size;
+	if (k_thread_stack_space_get(thread, &s->stack_unused) != 0) {
+		s->stack_unused = 0;
+	}
+	if (k_thread_runtime_stats_get(thread, &rt) == 0) {
+		s->cycles = rt.execution_cycles;
+	}
+}
+
+void sysstats_print(void)
+{
+	k_thread_runtime_stats_t all;
+	uint64_t window;
+	uint32_t now = k_uptime_get_32();
+
+	/* Stack scans walk each stack from the bottom. The unlocked walk keeps
+	 * interrupts enabled meanwhile; no thread in this firmware exits. */
+	k_thread_foreach_unlocked(sample_thread, NULL);
+
+	if (k_thread_runtime_stats_all_get(&all) != 0) {
+		return;
+	}
+	window = all.execution_cycles - prev_total_cycles;
+	prev_total_cycles = all.execution_cycles;
+
+	for (int i = 0; i < sample_count; i++) {
+		struct thread_sample *s = &samples[i];
+		uint64_t delta = s->cycles - s->prev_cycles;
+		size_t used = s->stack_size - s->stack_unused;
+
+		s->prev_cycles = s->cycles;
+
+		/* CPU share in 0.1 % of the window since the previous sample */
+		json_out("{\"type\":\"sysstats\",\"ts\":%u,\"thread\":\"%s\",\"prio\":%d,"
+			 "\"stack_size\":%u,\"stack_used\":%u,\"stack_pct\":%u,\"cpu_permille\":%u}\n",
+			 now, s->name, s->prio, (uint32_t)s->stack_size, (uint32_t)used,
+			 s->stack_size ? (uint32_t)(used * 100 / s->stack_size) : 0,
+			 window ? (uint32_t)(delta * 1000 / window) : 0);
+	}
+}
+
+static void sysstats_work_handler(struct k_work *work)
+{
+	sysstats_print();
+	k_work_reschedule_for_queue(&housekeeping_work_q, &sysstats_work,
+				    K_SECONDS(CONFIG_ZRELAY_SYSSTATS_INTERVAL));
+}
+
+void sysstats_init(void)
+{
+	k_work_init_delayable(&sysstats_work, sysstats_work_handler);
+	if (CONFIG_ZRELAY_SYSSTATS_INTERVAL > 0) {
+		k_work_reschedule_for_queue(&housekeeping_work_q, &sysstats_work,
+					    K_SECONDS(CONFIG_ZRELAY_SYSSTATS_INTERVAL));
+	}
+}
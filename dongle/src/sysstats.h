@@ -0,0 +1,21 @@
+/* sysstats.h - Per-thread stack high-water marks and CPU load */
+
+#ifndef SYSSTATS_H_
+#define SYSSTATS_H_
+
+#if defined(CONFIG_ZRELAY_SYSSTATS)
+
+/* Sample every CONFIG_ZRELAY_SYSSTATS_INTERVAL seconds (0: on request only) */
+void sysstats_init(void);
+
+/* Emit one sysstats record per thread, CPU load since the previous sample */
+void sysstats_print(void);
+
+#else
+
+static inline void sysstats_init(void) {}
+static inline void sysstats_print(void) {}
+
+#endif /* CONFIG_ZRELAY_SYSSTATS */
+
+#endif /* SYSSTATS_H_ */
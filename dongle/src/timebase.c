@@ -0,0 +1,54 @@
+/* timebase.c - 64-bit microsecond timestamps and boot identification */
+
+#include <zephyr/kernel.h>
+#include <zephyr/random/random.h>
+#include "common.h"
+#include "timebase.h"
+#include "work_queues.h"
+
+/* The host resynchronises on every clock record and sees reboots quickly */
+#define CLOCK_RECORD_INTERVAL_MS 10000
+
+static uint32_t boot_id;
+static struct k_work_delayable clock_work;
+
+char *timebase_us_str(uint64_t us, char buf[TIMEBASE_US_STR_LEN])
+{
+	char *p = &buf[TIMEBASE_US_STR_LEN - 1];
+
+	*p = '\0';
+	do {
+		*--p = '0' + (us % 10);
+		us /= 10;
+	} while (us > 0);
+
+	return p;
+}
+
+uint32_t timebase_boot_id(void)
+{
+	return boot_id;
+}
+
+void timebase_print(void)
+{
+	json_out("{\"type\":\"clock\",\"ts\":%u,\"boot\":\"%08x\",\"ticks_per_sec\":%u}\n",
+		 k_uptime_get_32(), boot_id, CONFIG_SYS_CLOCK_TICKS_PER_SEC);
+}
+
+static void clock_work_handler(struct k_work *work)
+{
+	timebase_print();
+	k_work_reschedule_for_queue(&housekeeping_work_q, &clock_work, K_MSEC(CLOCK_RECORD_INTERVAL_MS));
+}
+
+void timebase_init(void)
+{
+	/* Needs the entropy source, so called after bt_enable() */
+	do {
+		boot_id = sys_rand32_get();
+	} while (boot_id == 0);
+
+	k_work_init_delayable(&clock_work, clock_work_handler);
+	k_work_reschedule_for_queue(&housekeeping_work_q, &clock_work, K_NO_WAIT);
+}
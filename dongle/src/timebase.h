@@ -0,0 +1,29 @@
+/* timebase.h - 64-bit microsecond timestamps and boot identification */
+
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include <zephyr/kernel.h>
+
+/* Decimal digits of a uint64_t plus terminator */
+#define TIMEBASE_US_STR_LEN 21
+
+/* Microseconds since boot, never wraps. Resolution is one kernel tick. */
+static inline uint64_t timebase_now_us(void)
+{
+	return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+/* Format us as a decimal string; libc printf may lack 64-bit support */
+char *timebase_us_str(uint64_t us, char buf[TIMEBASE_US_STR_LEN]);
+
+/* Random identifier chosen at boot, lets the host detect reboots */
+uint32_t timebase_boot_id(void);
+
+/* Choose the boot ID and start the periodic clock record */
+void timebase_init(void);
+
+/* Emit a clock record: boot ID, uptime and tick rate */
+void timebase_print(void);
+
+#endif /* TIMEBASE_H_ */
@@ -0,0 +1,123 @@
+/* work_queues.c - Prioritized work queues for relay, connection and housekeeping work */
+
+#include <zephyr/kernel.h>
+#include "common.h"
+#include "work_queues.h"
+
+/* Relay work sends notifications and indications only */
+#define RELAY_WORK_Q_STACK_SIZE 1536
+/* Connection work issues synchronous HCI commands */
+#define CONN_WORK_Q_STACK_SIZE 1536
+/* Housekeeping prints the device list and writes flash */
+#define HOUSEKEEPING_WORK_Q_STACK_SIZE 2048
+
+/* Cooperative, one above the system work queue so stack and driver work
+ * queued there cannot hold back a response to the consumer */
+#define RELAY_WORK_Q_PRIO (CONFIG_SYSTEM_WORKQUEUE_PRIORITY - 1)
+#define CONN_WORK_Q_PRIO K_PRIO_PREEMPT(1)
+#define HOUSEKEEPING_WORK_Q_PRIO K_LOWEST_APPLICATION_THREAD_PRIO
+
+/* How often each queue is probed for submit-to-run latency */
+#define PROBE_INTERVAL_MS 250
+
+K_THREAD_STACK_DEFINE(relay_work_q_stack, RELAY_WORK_Q_STACK_SIZE);
+K_THREAD_STACK_DEFINE(conn_work_q_stack, CONN_WORK_Q_STACK_SIZE);
+K_THREAD_STACK_DEFINE(housekeeping_work_q_stack, HOUSEKEEPING_WORK_Q_STACK_SIZE);
+
+struct k_work_q relay_work_q;
+struct k_work_q conn_work_q;
+struct k_work_q housekeeping_work_q;
+
+/* A probe is an empty work item submitted from a timer. The time until it
+ * runs is what any newly submitted item on that queue would have waited. */
+struct wq_probe {
+	struct k_work work;
+	struct k_work_q *queue;
+	const char *name;
+	uint32_t submit_cyc;
+	uint32_t count;
+	uint32_t missed;     /* Previous probe still queued a whole interval later */
+	uint32_t max_us;
+	uint64_t total_us;
+};
+
+static struct wq_probe probes[] = {
+	{ .queue = &relay_work_q, .name = "relay" },
+	{ .queue = &conn_work_q, .name = "conn" },
+	{ .queue = &housekeeping_work_q, .name = "housekeeping" },
+};
+
+static void probe_handler(struct k_work *work)
+{
+	struct wq_probe *p = CONTAINER_OF(work, struct wq_probe, work);
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - p->submit_cyc);
+
+	p->count++;
+	p->total_us += us;
+	p->max_us = MAX(p->max_us, us);
+}
+
+static void probe_timer_handler(struct k_timer *timer)
+{
+	for (int i = 0; i < ARRAY_SIZE(probes); i++) {
+		struct wq_probe *p = &probes[i];
+		uint32_t now = k_cycle_get_32();
+
+		if (k_work_submit_to_queue(p->queue, &p->work) == 1) {
+			p->submit_cyc = now;
+		} else {
+			p->missed++;
+		}
+	}
+}
+
+K_TIMER_DEFINE(probe_timer, probe_timer_handler, NULL);
+
+static void start_queue(struct k_work_q *queue, k_thread_stack_t *stack, size_t size,
+			int prio, const char *name)
+{
+	struct k_work_queue_config cfg = { .name = name };
+
+	k_work_queue_start(queue, stack, size, prio, &cfg);
+}
+
+void work_queues_init(void)
+{
+	start_queue(&relay_work_q, relay_work_q_stack,
+		    K_THREAD_STACK_SIZEOF(relay_work_q_stack), RELAY_WORK_Q_PRIO, "relay_wq");
+	start_queue(&conn_work_q, conn_work_q_stack,
+		    K_THREAD_STACK_SIZEOF(conn_work_q_stack), CONN_WORK_Q_PRIO, "conn_wq");
+	start_queue(&housekeeping_work_q, housekeeping_work_q_stack,
+		    K_THREAD_STACK_SIZEOF(housekeeping_work_q_stack), HOUSEKEEPING_WORK_Q_PRIO,
+		    "housekeeping_wq");
+
+	for (int i = 0; i < ARRAY_SIZE(probes); i++) {
+		k_work_init(&probes[i].work, probe_handler);
+	}
+	k_timer_start(&probe_timer, K_MSEC(PROBE_INTERVAL_MS), K_MSEC(PROBE_INTERVAL_MS));
+}
+
+void work_queues_print_stats(void)
+{
+	uint32_t now = k_uptime_get_32();
+
+	for (int i = 0; i < ARRAY_SIZE(probes); i++) {
+		struct wq_probe *p = &probes[i];
+
+		json_out("{\"type\":\"wq\",\"ts\":%u,\"queue\":\"%s\",\"probes\":%u,"
+			 "\"avg_us\":%u,\"max_us\":%u,\"missed\":%u}\n",
+			 now, p->name, p->count,
+			 p->count ? (uint32_t)(p->total_us / p->count) : 0,
+			 p->max_us, p->missed);
+	}
+}
+
+void work_queues_reset_stats(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(probes); i++) {
+		probes[i].count = 0;
+		probes[i].missed = 0;
+		probes[i].max_us = 0;
+		probes[i].total_us = 0;
+	}
+}
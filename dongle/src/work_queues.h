@@ -0,0 +1,25 @@
+/* work_queues.h - Prioritized work queues for relay, connection and housekeeping work */
+
+#ifndef WORK_QUEUES_H_
+#define WORK_QUEUES_H_
+
+#include <zephyr/kernel.h>
+
+/* Control point and indication traffic to consumers, highest priority */
+extern struct k_work_q relay_work_q;
+
+/* Connection management: connect timeouts, scan windows, link polling */
+extern struct k_work_q conn_work_q;
+
+/* LED patterns, printing, flash writes and capture streaming, lowest priority */
+extern struct k_work_q housekeeping_work_q;
+
+/* Start the queues and their latency probes, before any work is submitted */
+void work_queues_init(void);
+
+/* Emit per-queue latency stats as JSON */
+void work_queues_print_stats(void);
+
+void work_queues_reset_stats(void);
+
+#endif /* WORK_QUEUES_H_ */
@@ -13,6 +13,7 @@ import tomllib
 from flask import Flask, jsonify, render_template, request
 
 from .data_buffer import DataBuffer
+from .dongle_client import CommandError
 from .serial_reader import SerialReader
 
 
@@ -222,7 +223,7 @@ def get_metrics_config():
 def get_status():
     """Get server and connection status."""
     # Get the latest timestamp from data buffer to use as "current time"
-    # This is relative to dongle time, so we can compare with device timestamps
+    # Device timestamps are host time mapped from the dongle clock
     if data_buffer:
         current_time_ms = data_buffer.latest_timestamp_ms
     else:
@@ -247,10 +248,34 @@ def get_status():
         'connected': serial_reader.connected if serial_reader else False,
         'running': serial_reader.running if serial_reader else False,
         'port': serial_reader.port if serial_reader else None,
+        'clock': serial_reader.time_sync.status() if serial_reader else None,
         'devices': devices
     }
     return jsonify(status)
 
 
+@app.route('/api/command', methods=['POST'])
+def post_command():
+    """
+    Send a command to the dongle.
+    
+    JSON body: {"command": "stats", "args": []}, see dongle_client.COMMANDS.
+    Telemetry produced by the command arrives on the normal serial stream.
+    """
+    if serial_reader is None:
+        return jsonify({'error': 'Serial reader not initialized'}), 500
+    
+    body = request.get_json(silent=True) or {}
+    command = body.get('command', '')
+    args = [str(a) for a in body.get('args', [])]
+    try:
+        response = serial_reader.commands.run(command, args)
+    except (CommandError, KeyError, IndexError, ValueError) as e:
+        return jsonify({'error': str(e)}), 400
+    except Exception as e:
+        return jsonify({'error': str(e)}), 503
+    return jsonify(response)
+
+
 # Initialize app on import
 init_app()
@@ -2,7 +2,7 @@
 Data buffer for storing and retrieving time-windowed sensor data.
 """
 import threading
-from datetime import datetime, timedelta
+from datetime import datetime
 from typing import Dict, List, Optional, Tuple
 
 
@@ -24,7 +24,8 @@ class DataBuffer:
         self.latest_timestamp_ms: int = 0
         
         # Store data points as (timestamp_ms, value) tuples for each metric
-        # Timestamps are in milliseconds (relative to dongle start)
+        # Timestamps are host time in milliseconds since the Unix epoch,
+        # mapped from dongle time by TimeSync
         self.buffers: Dict[str, List[Tuple[int, float]]] = {
             'heart_rate': [],
             'power_meter_power': [],
@@ -43,7 +44,7 @@ class DataBuffer:
         
         Args:
             metric: Metric name (e.g., 'heart_rate', 'power_meter_power')
-            timestamp_ms: Timestamp in milliseconds (relative to dongle start)
+            timestamp_ms: Host time in milliseconds since the Unix epoch
             value: Value of the metric
         """
         if metric not in self.buffers:
@@ -97,19 +98,15 @@ class DataBuffer:
     
     def _ms_to_datetime(self, timestamp_ms: int) -> datetime:
         """
-        Convert relative timestamp (ms) to datetime for frontend.
-        Uses a base datetime and adds the relative time.
+        Convert a host timestamp (ms since the Unix epoch) to local datetime for frontend.
         
         Args:
-            timestamp_ms: Timestamp in milliseconds (relative)
+            timestamp_ms: Timestamp in milliseconds since the Unix epoch
             
         Returns:
             datetime object (for frontend compatibility)
         """
-        # Use a fixed base datetime (e.g., epoch start) and add relative time
-        # This is just for display purposes - the actual time doesn't matter
-        base_datetime = datetime(2024, 1, 1, 0, 0, 0)
-        return base_datetime + timedelta(milliseconds=timestamp_ms)
+        return datetime.fromtimestamp(timestamp_ms / 1000)
     
     def get_metrics_list(self) -> List[str]:
         """Get list of available metric names."""
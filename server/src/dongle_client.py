@@ -0,0 +1,252 @@
+"""
+Host side of the dongle command channel.
+
+Requests are binary frames written to the dongle's serial port:
+
+    0xA5 | seq | opcode | len | payload[len] | crc16 (little endian)
+
+crc16 is CRC-16/CCITT-FALSE over seq..payload. The dongle answers every
+request with a JSON line of type "cmd_rsp" carrying the same seq; see
+dongle/src/command_channel.h.
+
+Usage without the server running:
+    python -m src.dongle_client --port /dev/ttyACM1 stats
+    python -m src.dongle_client config-set grade_divisor 25
+"""
+import argparse
+import json
+import struct
+import sys
+import threading
+import time
+from typing import Callable, Dict, List, Optional
+
+FRAME_SYNC = 0xA5
+MAX_PAYLOAD = 16
+
+# Opcodes, must match enum cmd_opcode in dongle/src/command_channel.h
+CMD_PING = 0x01
+CMD_STATS = 0x02
+CMD_LOG_LEVEL = 0x03
+CMD_SCAN_START = 0x04
+CMD_SCAN_STOP = 0x05
+CMD_CONFIG_GET = 0x06
+CMD_CONFIG_SET = 0x07
+CMD_FR_DOWNLOAD = 0x08
+CMD_FR_SAVE = 0x09
+CMD_RESET_COUNTERS = 0x0A
+CMD_ATT_CAPTURE = 0x0B
+CMD_TIME_SYNC = 0x0C
+
+# Keys, must match enum relay_config_key in dongle/src/relay_config.h
+CONFIG_KEYS = {
+    'grade_offset': 0,
+    'grade_divisor': 1,
+    'resistance_max': 2,
+    'fr_sample_ms': 3,
+    'fr_drop_power': 4,
+    'rssi_weak': 5,
+    'rssi_good': 6,
+    'wheel_mm': 7,
+}
+CONFIG_ALL = 0xFF
+
+LOG_LEVELS = {'off': 0, 'info': 1, 'debug': 2}
+# Bit numbers of enum log_category
+LOG_CATEGORIES = {'general': 0, 'scan': 1, 'disc': 2, 'cp': 3, 'relay': 4, 'nvs': 5}
+
+
+def crc16_ccitt_false(data: bytes) -> int:
+    """CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), same as Zephyr crc16_itu_t."""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def encode_frame(seq: int, opcode: int, payload: bytes = b'') -> bytes:
+    """Build one request frame."""
+    if len(payload) > MAX_PAYLOAD:
+        raise ValueError(f"payload too long ({len(payload)} > {MAX_PAYLOAD})")
+    body = bytes([seq & 0xFF, opcode, len(payload)]) + payload
+    return bytes([FRAME_SYNC]) + body + struct.pack('<H', crc16_ccitt_false(body))
+
+
+class CommandError(Exception):
+    """The dongle rejected a command or did not answer."""
+
+
+class CommandClient:
+    """
+    Sends commands and matches "cmd_rsp" records to them.
+
+    write: callable that sends raw bytes to the dongle.
+    Feed every JSON record received from the dongle to handle_record().
+    """
+
+    def __init__(self, write: Callable[[bytes], None]):
+        self._write = write
+        self._seq = 0
+        self._lock = threading.Lock()
+        self._pending: Dict[int, dict] = {}
+        self._cond = threading.Condition()
+
+    def handle_record(self, data: dict) -> bool:
+        """Consume a cmd_rsp record, returns True if it answered a pending request."""
+        if data.get('type') != 'cmd_rsp':
+            return False
+        seq = data.get('seq')
+        with self._cond:
+            if seq in self._pending and self._pending[seq] is None:
+                self._pending[seq] = data
+                self._cond.notify_all()
+                return True
+        return False
+
+    def request(self, opcode: int, payload: bytes = b'', timeout: float = 2.0) -> dict:
+        """Send a command and wait for its response record."""
+        with self._lock:
+            self._seq = (self._seq + 1) & 0xFF
+            seq = self._seq
+        with self._cond:
+            self._pending[seq] = None
+        try:
+            self._write(encode_frame(seq, opcode, payload))
+            with self._cond:
+                if not self._cond.wait_for(lambda: self._pending[seq] is not None, timeout):
+                    raise CommandError(f"no response to opcode 0x{opcode:02x}")
+                rsp = self._pending[seq]
+        finally:
+            with self._cond:
+                self._pending.pop(seq, None)
+        if rsp.get('status', 0) != 0:
+            raise CommandError(f"opcode 0x{opcode:02x} failed with status {rsp['status']}")
+        return rsp
+
+    def ping(self) -> dict:
+        return self.request(CMD_PING)
+
+    def stats(self) -> dict:
+        return self.request(CMD_STATS)
+
+    def set_log_level(self, level: str, categories: Optional[List[str]] = None) -> dict:
+        """Set the console log level of some categories, all of them by default."""
+        payload = bytes([LOG_LEVELS[level]])
+        if categories:
+            mask = 0
+            for name in categories:
+                mask |= 1 << LOG_CATEGORIES[name]
+            payload += bytes([mask])
+        return self.request(CMD_LOG_LEVEL, payload)
+
+    def scan_start(self, seconds: int = 0) -> dict:
+        return self.request(CMD_SCAN_START, struct.pack('<H', seconds))
+
+    def scan_stop(self) -> dict:
+        return self.request(CMD_SCAN_STOP)
+
+    def config_get(self, key: Optional[str] = None) -> dict:
+        return self.request(CMD_CONFIG_GET, bytes([CONFIG_KEYS[key] if key else CONFIG_ALL]))
+
+    def config_set(self, key: str, value: int) -> dict:
+        return self.request(CMD_CONFIG_SET, struct.pack('<Bi', CONFIG_KEYS[key], value))
+
+    def fr_download(self, from_flash: bool = False, timeout: float = 10.0) -> dict:
+        return self.request(CMD_FR_DOWNLOAD, bytes([1 if from_flash else 0]), timeout)
+
+    def fr_save(self) -> dict:
+        return self.request(CMD_FR_SAVE)
+
+    def reset_counters(self) -> dict:
+        return self.request(CMD_RESET_COUNTERS)
+
+    def att_capture(self, enable: bool) -> dict:
+        return self.request(CMD_ATT_CAPTURE, bytes([1 if enable else 0]))
+
+    def time_sync(self, host_us: int) -> dict:
+        """Send host time, the response carries the dongle's receive time (rx_us) and boot ID."""
+        return self.request(CMD_TIME_SYNC, struct.pack('<Q', host_us))
+
+    def run(self, command: str, args: List[str]) -> dict:
+        """Run a command by CLI/API name."""
+        if command == 'ping':
+            return self.ping()
+        if command == 'stats':
+            return self.stats()
+        if command == 'log-level':
+            return self.set_log_level(args[0], args[1].split(',') if len(args) > 1 else None)
+        if command == 'scan-start':
+            return self.scan_start(int(args[0]) if args else 0)
+        if command == 'scan-stop':
+            return self.scan_stop()
+        if command == 'config-get':
+            return self.config_get(args[0] if args else None)
+        if command == 'config-set':
+            return self.config_set(args[0], int(args[1]))
+        if command == 'fr-download':
+            return self.fr_download(bool(args) and args[0] == 'flash')
+        if command == 'fr-save':
+            return self.fr_save()
+        if command == 'reset-counters':
+            return self.reset_counters()
+        if command == 'att-capture':
+            return self.att_capture(args[0] == 'on')
+        if command == 'time-sync':
+            return self.time_sync(time.time_ns() // 1000)
+        raise CommandError(f"unknown command '{command}'")
+
+
+COMMANDS = ['ping', 'stats', 'log-level', 'scan-start', 'scan-stop', 'config-get',
+            'config-set', 'fr-download', 'fr-save', 'reset-counters', 'att-capture',
+            'time-sync']
+
+
+def main() -> int:
+    import serial
+
+    parser = argparse.ArgumentParser(description="Send a command to the Z-Relay dongle")
+    parser.add_argument('--port', default='/dev/ttyACM1')
+    parser.add_argument('--timeout', type=float, default=10.0)
+    parser.add_argument('command', choices=COMMANDS)
+    parser.add_argument('args', nargs='*')
+    opts = parser.parse_args()
+
+    conn = serial.Serial(opts.port, 115200, timeout=0.2)
+    client = CommandClient(conn.write)
+    done = threading.Event()
+
+    # Print everything the dongle emits until our response arrives
+    def reader():
+        while not done.is_set():
+            line = conn.readline().decode('utf-8', errors='replace').strip()
+            if not line:
+                continue
+            print(line)
+            start, end = line.find('{'), line.rfind('}')
+            if start != -1 and end > start:
+                try:
+                    client.handle_record(json.loads(line[start:end + 1]))
+                except json.JSONDecodeError:
+                    pass
+
+    thread = threading.Thread(target=reader, daemon=True)
+    thread.start()
+    try:
+        client.run(opts.command, opts.args)
+        status = 0
+    except (CommandError, KeyError, IndexError, ValueError) as e:
+        print(f"error: {e}", file=sys.stderr)
+        status = 1
+    finally:
+        time.sleep(0.2)
+        done.set()
+        thread.join(timeout=1)
+        conn.close()
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main())
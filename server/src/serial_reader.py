@@ -11,9 +11,16 @@ from typing import Optional
 
 import serial
 
+from .dongle_client import CommandClient, CommandError
+from .time_sync import TimeSync, host_now_us
+
 
 logger = logging.getLogger(__name__)
 
+# Clock exchanges with the dongle, the first soon after connecting
+SYNC_INTERVAL_S = 10
+SYNC_FIRST_S = 1
+
 
 def rotate_log_file(log_file_path: str, max_backups: int = 5):
     """Rotate log file by renaming existing files."""
@@ -57,12 +64,24 @@ class SerialReader:
         self.thread: Optional[threading.Thread] = None
         self.log_file = log_file
         self.log_file_handle = None
+        self.commands = CommandClient(self._write)
+        self._rx_buffer = b''
+        self.time_sync = TimeSync()
+        self.sync_thread: Optional[threading.Thread] = None
+
     
     @property
     def connected(self) -> bool:
         """Check if serial port is connected and open."""
         return self.serial_conn is not None and self.serial_conn.is_open
     
+    def _write(self, data: bytes):
+        """Send raw bytes (command frames) to the dongle."""
+        conn = self.serial_conn
+        if conn is None or not conn.is_open:
+            raise serial.SerialException("serial port not connected")
+        conn.write(data)
+    
     def _close_port(self):
         """Fully close and release the serial port."""
         if self.serial_conn is not None:
@@ -100,6 +119,8 @@ class SerialReader:
         self.running = True
         self.thread = threading.Thread(target=self._read_loop, daemon=True)
         self.thread.start()
+        self.sync_thread = threading.Thread(target=self._sync_loop, daemon=True)
+        self.sync_thread.start()
     
     def stop(self):
         """Stop reading."""
@@ -117,9 +138,10 @@ class SerialReader:
         while self.running:
             try:
                 if self.serial_conn and self.serial_conn.is_open:
-                    line = self.serial_conn.readline()
-                    if line:
-                        self._process_line(line)
+                    # Read whatever has arrived in one go, then split lines
+                    chunk = self.serial_conn.read(max(1, self.serial_conn.in_waiting))
+                    if chunk:
+                        self._process_chunk(chunk)
                 else:
                     # Ensure port is fully released before reconnecting
                     self._close_port()
@@ -135,6 +157,7 @@ class SerialReader:
                             dsrdtr=False
                         )
                         self.serial_conn.reset_input_buffer()
+                        self._rx_buffer = b''
                         logger.info(f"Connected to {self.port}")
                     except serial.SerialException as e:
                         logger.warning(f"Could not connect: {e}. Retrying in 2 seconds.")
@@ -146,6 +169,34 @@ class SerialReader:
                 logger.exception(f"Error in read loop: {e}")
                 time.sleep(1)
     
+    def _sync_loop(self):
+        """Periodically exchange timestamps with the dongle."""
+        delay = SYNC_FIRST_S
+        while self.running:
+            time.sleep(delay)
+            if not self.connected:
+                delay = SYNC_FIRST_S
+                continue
+            delay = SYNC_INTERVAL_S
+            try:
+                host_send = host_now_us()
+                rsp = self.commands.time_sync(host_send)
+                host_recv = host_now_us()
+                self.time_sync.add_exchange(rsp['boot'], host_send, int(rsp['rx_us']), host_recv)
+            except (CommandError, KeyError, ValueError, serial.SerialException) as e:
+                # Older firmware has no time sync, the coarse offset still applies
+                logger.debug(f"Time sync failed: {e}")
+    
+    def _process_chunk(self, chunk: bytes):
+        """Split received bytes into lines, keeping a trailing partial line."""
+        self._rx_buffer += chunk
+        *lines, self._rx_buffer = self._rx_buffer.split(b'\n')
+        for line in lines:
+            self._process_line(line)
+        # A line without newline this long is garbage, do not grow forever
+        if len(self._rx_buffer) > 4096:
+            self._rx_buffer = b''
+    
     def _process_line(self, line_bytes: bytes):
         """Process a line from the serial port."""
         try:
@@ -178,7 +229,18 @@ class SerialReader:
             return
         
         msg_type = data.get('type')
-        ts = data.get('ts', 0)
+        
+        # Place the record on the host timeline (ms since the Unix epoch).
+        # Firmware without "us" only has the 32-bit millisecond "ts".
+        dongle_us = data.get('us')
+        if dongle_us is None:
+            dongle_us = data.get('ts', 0) * 1000
+        self.time_sync.observe(dongle_us, data.get('boot') if msg_type == 'clock' else None)
+        ts = self.time_sync.to_host_us(dongle_us) // 1000
+        
+        if msg_type == 'cmd_rsp':
+            self.commands.handle_record(data)
+            return
         
         if msg_type == 'hr':
             bpm = data.get('bpm')
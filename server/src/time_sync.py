@@ -0,0 +1,106 @@
+"""
+Maps dongle timestamps onto host (Unix) time.
+
+Every dongle record carries "us", microseconds since the dongle booted.
+A time-sync exchange gives (host send, dongle receive, host receive)
+triples. The midpoint of the host times estimates when the dongle
+received the request. Offset and drift come from a least-squares fit
+over the exchanges with the lowest round trip. Until the first exchange,
+the arrival time of the first record gives a coarse offset.
+
+The "clock" record's boot ID changes on reboot. A timestamp that jumps
+backwards also counts as a reboot. Either one resets the estimate.
+"""
+import threading
+import time
+from typing import List, Optional, Tuple
+
+MAX_SAMPLES = 32
+# A timestamp this far behind the previous one means the dongle rebooted
+REBOOT_BACKSTEP_US = 1_000_000
+# Exchanges slower than this multiple of the best round trip are ignored
+RTT_FILTER_FACTOR = 2.0
+RTT_FILTER_SLACK_US = 2000
+
+
+def host_now_us() -> int:
+    return time.time_ns() // 1000
+
+
+class TimeSync:
+    """Thread-safe dongle-to-host clock estimate."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self._reset(None)
+
+    def _reset(self, boot: Optional[str]):
+        self.boot = boot
+        # (dongle_us, host_minus_dongle_us, rtt_us)
+        self.samples: List[Tuple[int, float, int]] = []
+        self.offset_us: Optional[float] = None
+        self.drift = 0.0
+        self.ref_us = 0
+        self.last_us: Optional[int] = None
+        self.synced = False
+
+    def _check_reboot(self, dongle_us: int, boot: Optional[str]):
+        if boot is not None and boot != self.boot:
+            self._reset(boot)
+        elif self.last_us is not None and dongle_us + REBOOT_BACKSTEP_US < self.last_us:
+            self._reset(None)
+        self.last_us = dongle_us
+
+    def observe(self, dongle_us: int, boot: Optional[str] = None):
+        """Note a received record; seeds a coarse offset before the first exchange."""
+        with self.lock:
+            self._check_reboot(dongle_us, boot)
+            if self.offset_us is None:
+                self.offset_us = float(host_now_us() - dongle_us)
+                self.ref_us = dongle_us
+
+    def add_exchange(self, boot: str, host_send_us: int, dongle_rx_us: int, host_recv_us: int):
+        """Add one time-sync round trip and refit offset and drift."""
+        with self.lock:
+            self._check_reboot(dongle_rx_us, boot)
+            rtt = host_recv_us - host_send_us
+            midpoint = (host_send_us + host_recv_us) / 2
+            self.samples.append((dongle_rx_us, midpoint - dongle_rx_us, rtt))
+            del self.samples[:-MAX_SAMPLES]
+            self._fit()
+
+    def _fit(self):
+        best = min(s[2] for s in self.samples)
+        used = [s for s in self.samples if s[2] <= best * RTT_FILTER_FACTOR + RTT_FILTER_SLACK_US]
+
+        n = len(used)
+        mean_x = sum(s[0] for s in used) / n
+        mean_y = sum(s[1] for s in used) / n
+        var_x = sum((s[0] - mean_x) ** 2 for s in used)
+
+        self.ref_us = int(mean_x)
+        self.offset_us = mean_y
+        # Drift needs a spread of samples, a few seconds is not enough
+        if n >= 2 and var_x > 0 and used[-1][0] - used[0][0] > 30_000_000:
+            self.drift = sum((s[0] - mean_x) * (s[1] - mean_y) for s in used) / var_x
+        else:
+            self.drift = 0.0
+        self.synced = True
+
+    def to_host_us(self, dongle_us: int) -> int:
+        """Host Unix time in microseconds for a dongle timestamp."""
+        with self.lock:
+            if self.offset_us is None:
+                return host_now_us()
+            return int(dongle_us + self.offset_us + self.drift * (dongle_us - self.ref_us))
+
+    def status(self) -> dict:
+        with self.lock:
+            return {
+                'boot': self.boot,
+                'synced': self.synced,
+                'offset_us': self.offset_us,
+                'drift_ppm': self.drift * 1e6,
+                'samples': len(self.samples),
+                'best_rtt_us': min((s[2] for s in self.samples), default=None),
+            }